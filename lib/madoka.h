@@ -28,6 +28,11 @@
 #define MADOKA_H
 
 #include "madoka/croquis.h"
+#include "madoka/sharded-sketch.h"
 #include "madoka/sketch.h"
+#include "madoka/sketch-group.h"
+#include "madoka/sketch-merge.h"
+#include "madoka/update-buffer.h"
+#include "madoka/windowed-sketch.h"
 
 #endif  // MADOKA_H
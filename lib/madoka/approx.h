@@ -25,6 +25,11 @@
 #ifndef MADOKA_APPROX_H
 #define MADOKA_APPROX_H
 
+#ifdef __cplusplus
+ #include <cmath>
+#endif  // __cplusplus
+
+#include "kernel.h"
 #include "random.h"
 
 #ifdef __cplusplus
@@ -71,6 +76,8 @@ class Approx {
         ((value >> get_shift(exponent)) & APPROX_SIGNIFICAND_MASK);
   }
 
+  // decode() without a generator returns the lower bound of the values that
+  // `approx' stands for, and decode_midpoint() returns their midpoint.
   static UInt64 decode(UInt64 approx) noexcept {
     const UInt64 exponent =
         (approx >> APPROX_EXPONENT_SHIFT) & APPROX_EXPONENT_MASK;
@@ -91,7 +98,38 @@ class Approx {
 #endif  // MADOKA_NOT_PREFER_BRANCH
   }
 
-  static UInt64 decode(UInt64 approx, Random *random) noexcept {
+  static UInt64 decode_midpoint(UInt64 approx) noexcept {
+    const UInt64 exponent =
+        (approx >> APPROX_EXPONENT_SHIFT) & APPROX_EXPONENT_MASK;
+
+#ifndef MADOKA_NOT_PREFER_BRANCH
+    if (exponent <= 1) {
+      return approx;
+    }
+#endif  // MADOKA_NOT_PREFER_BRANCH
+
+    const UInt64 significand =
+        (approx >> APPROX_SIGNIFICAND_SHIFT) & APPROX_SIGNIFICAND_MASK;
+    return get_offset(exponent) | (significand << get_shift(exponent)) |
+        (get_mask(exponent) >> 1);
+  }
+
+  // encode_n() and decode_n() are the array versions of encode() and
+  // decode(). They use SIMD instructions if available.
+  static void encode_n(const UInt64 *values, std::size_t num_values,
+                       UInt64 *approxes) noexcept {
+    kernel().approx_encode(values, num_values, approxes);
+  }
+
+  static void decode_n(const UInt64 *approxes, std::size_t num_approxes,
+                       UInt64 *values) noexcept {
+    kernel().approx_decode(approxes, num_approxes, 0, values, NULL);
+  }
+
+  // decode() and inc() accept any generator that has UInt32 operator()(),
+  // such as Random and CounterRandom.
+  template <typename T>
+  static UInt64 decode(UInt64 approx, T *random) noexcept {
     const UInt64 exponent =
         (approx >> APPROX_EXPONENT_SHIFT) & APPROX_EXPONENT_MASK;
 
@@ -113,7 +151,8 @@ class Approx {
 #endif  // MADOKA_NOT_PREFER_BRANCH
   }
 
-  static UInt64 inc(UInt64 approx, Random *random) noexcept {
+  template <typename T>
+  static UInt64 inc(UInt64 approx, T *random) noexcept {
     const UInt64 exponent =
         (approx >> APPROX_EXPONENT_SHIFT) & APPROX_EXPONENT_MASK;
 
@@ -125,7 +164,47 @@ class Approx {
     return approx;
   }
 
+  // add() returns `approx' after `count' calls of inc(), and its result has
+  // the same distribution up to the resolution of get_skip(). Instead of
+  // drawing a random number per call, it draws the number of calls until
+  // the next bump from a geometric distribution, so that a bump costs one
+  // draw. A bump moves to the next code, so an add() makes at most as many
+  // draws as there are codes, 2^APPROX_SIZE.
+  template <typename T>
+  static UInt64 add(UInt64 approx, UInt64 count, T *random) noexcept {
+    while ((count != 0) && (approx != APPROX_MASK)) {
+      const UInt64 exponent =
+          (approx >> APPROX_EXPONENT_SHIFT) & APPROX_EXPONENT_MASK;
+      if (exponent <= 1) {
+        // inc() always bumps an approximate value with exponent 0 or 1.
+        const UInt64 gap = (2ULL << APPROX_EXPONENT_SHIFT) - approx;
+        const UInt64 num_bumps = (count < gap) ? count : gap;
+        approx += num_bumps;
+        count -= num_bumps;
+        continue;
+      }
+
+      const UInt64 skip = get_skip(exponent, random);
+      if (skip > count) {
+        break;
+      }
+      ++approx;
+      count -= skip;
+    }
+    return approx;
+  }
+
  private:
+  // get_skip() returns the number of calls of inc() until the next bump,
+  // which follows a geometric distribution with success probability
+  // 2^-(`exponent' - 1), up to the resolution of a 32-bit draw.
+  template <typename T>
+  static UInt64 get_skip(UInt64 exponent, T *random) noexcept {
+    const double u = (static_cast<double>((*random)()) + 0.5) / 4294967296.0;
+    const double p = 1.0 / static_cast<double>(1ULL << get_shift(exponent));
+    return static_cast<UInt64>(std::log(u) / std::log1p(-p)) + 1;
+  }
+
   static UInt64 get_offset(UInt64 exponent) {
 #ifndef MADOKA_NOT_PREFER_BRANCH
     return 1ULL << (exponent + (APPROX_SIGNIFICAND_SIZE - 1));
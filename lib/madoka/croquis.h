@@ -26,6 +26,7 @@
 #define MADOKA_CROQUIS_H
 
 #ifdef __cplusplus
+ #include <cmath>
  #include <cstring>
  #include <limits>
 #endif  // __cplusplus
@@ -33,6 +34,7 @@
 #include "file.h"
 #include "hash.h"
 #include "header.h"
+#include "range.h"
 
 #ifdef __cplusplus
 namespace madoka {
@@ -51,10 +53,41 @@ const UInt64 CROQUIS_MIN_DEPTH     = 1;
 const UInt64 CROQUIS_MAX_DEPTH     = 16;
 const UInt64 CROQUIS_DEFAULT_DEPTH = CROQUIS_HASH_SIZE;
 
+// A decayed croquis renormalizes its table when the scale of increments
+// exceeds CROQUIS_MAX_DECAY_SCALE.
+const double CROQUIS_MAX_DECAY_SCALE = 4294967296.0;
+
+// CROQUIS_FAST_RANGE maps hash IDs to cells with a multiplication instead
+// of a modulo operation. See also SKETCH_FAST_RANGE.
+//
+// CROQUIS_DECAYED adds an exponential time decay, which is saved between
+// the header and the table. See add() and get() with a time.
+enum CroquisFlag {
+  CROQUIS_FAST_RANGE = 1 << 17,
+  CROQUIS_DECAYED    = 1 << 24
+};
+
+// Flags in CROQUIS_HEADER_FLAGS are saved in the header of a croquis.
+const int CROQUIS_HEADER_FLAGS = CROQUIS_FAST_RANGE | CROQUIS_DECAYED;
+
+// CroquisDecay is the state of a decayed croquis. A value added at time t
+// is stored multiplied by `scale' = e^(rate * (t - landmark)), so that a
+// stored value divided by the scale at any later time is the value decayed
+// to that time. Decay costs O(1) per update instead of a sweep over the
+// table per tick, and the table is renormalized to a new landmark only when
+// the scale exceeds CROQUIS_MAX_DECAY_SCALE.
+struct CroquisDecay {
+  double rate;
+  double landmark;
+  double time;
+  double scale;
+};
+
 template <typename T>
 class Croquis {
  public:
-  Croquis() noexcept : file_(), header_(NULL), table_(NULL) {}
+  Croquis() noexcept
+    : file_(), header_(NULL), decay_(NULL), table_(NULL), range_() {}
   ~Croquis() noexcept {}
 
   void create(UInt64 width = 0, UInt64 depth = 0, const char *path = NULL,
@@ -121,7 +154,8 @@ class Croquis {
     return header().file_size();
   }
   int flags() const noexcept {
-    return file_.flags();
+    return file_.flags() |
+        ((header_ != NULL) ? static_cast<int>(header().flags()) : 0);
   }
 
   T get(const void *key_addr, std::size_t key_size) const noexcept {
@@ -147,6 +181,20 @@ class Croquis {
     return min_value;
   }
 
+  // get() with a time returns the value decayed to `time', which must not
+  // be earlier than the landmark. It is available if T is a floating point
+  // type and CROQUIS_DECAYED is set.
+  T get(const void *key_addr, std::size_t key_size,
+        double time) const noexcept {
+    static_assert(!std::numeric_limits<T>::is_integer,
+                  "decay requires a floating point type");
+    if (decay_ == NULL) {
+      return get(key_addr, key_size);
+    }
+    return static_cast<T>(get(key_addr, key_size) *
+        std::exp(-decay_->rate * (time - decay_->landmark)));
+  }
+
   void set(const void *key_addr, std::size_t key_size, T value) noexcept {
     UInt64 cell_ids[CROQUIS_MAX_DEPTH + CROQUIS_HASH_SIZE - 1];
     hash(key_addr, key_size, cell_ids);
@@ -189,20 +237,81 @@ class Croquis {
     return new_value;
   }
 
+  // add() with a time advances the decay to `time' and adds `value' scaled
+  // to the landmark. A time earlier than the latest one is treated as the
+  // latest one. It returns the new value decayed to the latest time.
+  T add(const void *key_addr, std::size_t key_size, T value,
+        double time) noexcept {
+    static_assert(!std::numeric_limits<T>::is_integer,
+                  "decay requires a floating point type");
+    if (decay_ == NULL) {
+      return add(key_addr, key_size, value);
+    }
+    advance(time);
+    return add(key_addr, key_size, value * static_cast<T>(decay_->scale)) /
+        static_cast<T>(decay_->scale);
+  }
+
+  // decay_rate() returns the decay rate per unit of time, and 0 means no
+  // decay. set_decay_rate() renormalizes the table to the latest time
+  // before it changes the rate, and throws if CROQUIS_DECAYED is not set.
+  double decay_rate() const noexcept {
+    return (decay_ != NULL) ? decay_->rate : 0.0;
+  }
+  void set_decay_rate(double rate) {
+    static_assert(!std::numeric_limits<T>::is_integer,
+                  "decay requires a floating point type");
+    MADOKA_THROW_IF(decay_ == NULL);
+    MADOKA_THROW_IF(!(rate >= 0.0));
+    renormalize_();
+    decay_->rate = rate;
+  }
+  // decay_time() returns the latest time, and decay_landmark() returns the
+  // time to which the stored values are scaled.
+  double decay_time() const noexcept {
+    return (decay_ != NULL) ? decay_->time : 0.0;
+  }
+  double decay_landmark() const noexcept {
+    return (decay_ != NULL) ? decay_->landmark : 0.0;
+  }
+
+  // advance() moves the latest time forward to `time' and renormalizes the
+  // table if the scale exceeds CROQUIS_MAX_DECAY_SCALE.
+  void advance(double time) noexcept {
+    static_assert(!std::numeric_limits<T>::is_integer,
+                  "decay requires a floating point type");
+    if ((decay_ == NULL) || !(time > decay_->time)) {
+      return;
+    }
+    decay_->time = time;
+    decay_->scale = std::exp(decay_->rate * (time - decay_->landmark));
+    if (decay_->scale > CROQUIS_MAX_DECAY_SCALE) {
+      renormalize_();
+    }
+  }
+
   void clear() noexcept {
     std::memset(table_, 0, table_size());
+    if (decay_ != NULL) {
+      decay_->landmark = decay_->time;
+      decay_->scale = 1.0;
+    }
   }
 
   void swap(Croquis *sketch) noexcept {
     file_.swap(&sketch->file_);
     util::swap(header_, sketch->header_);
+    util::swap(decay_, sketch->decay_);
     util::swap(table_, sketch->table_);
+    util::swap(range_, sketch->range_);
   }
 
  private:
   File file_;
   Header *header_;
+  CroquisDecay *decay_;
   T *table_;
+  Range range_;
 
   const Header &header() const noexcept {
     return *header_;
@@ -225,47 +334,57 @@ class Croquis {
     MADOKA_THROW_IF(width > CROQUIS_MAX_WIDTH);
     MADOKA_THROW_IF(depth < CROQUIS_MIN_DEPTH);
     MADOKA_THROW_IF(depth > CROQUIS_MAX_DEPTH);
+    MADOKA_THROW_IF(((flags & CROQUIS_DECAYED) != 0) &&
+                    std::numeric_limits<T>::is_integer);
 
     const UInt64 table_size = sizeof(T) * width * depth;
-    const UInt64 file_size = sizeof(Header) + table_size;
+    const UInt64 file_size = get_table_offset(flags) + table_size;
     MADOKA_THROW_IF(file_size > std::numeric_limits<std::size_t>::max());
 
-    file_.create(path, static_cast<std::size_t>(file_size), flags);
+    file_.create(path, static_cast<std::size_t>(file_size),
+                 flags & ~CROQUIS_HEADER_FLAGS);
     header_ = static_cast<Header *>(file_.addr());
-    table_ = reinterpret_cast<T *>(header_ + 1);
 
     header().set_width(width);
     header().set_depth(depth);
+    header().set_flags(flags & CROQUIS_HEADER_FLAGS);
     header().set_max_value(0);
     header().set_value_size(sizeof(T) * 8);
     header().set_seed(seed);
     header().set_table_size(table_size);
     header().set_file_size(file_size);
     check_header();
+    init_();
 
+    if (decay_ != NULL) {
+      decay_->rate = 0.0;
+      decay_->landmark = 0.0;
+      decay_->time = 0.0;
+      decay_->scale = 1.0;
+    }
     clear();
   }
 
   void open_(const char *path, int flags) {
     file_.open(path, flags);
     header_ = static_cast<Header *>(file_.addr());
-    table_ = reinterpret_cast<T *>(header_ + 1);
     check_header();
+    init_();
   }
 
   void load_(const char *path, int flags) {
     file_.load(path, flags);
     header_ = static_cast<Header *>(file_.addr());
-    table_ = reinterpret_cast<T *>(header_ + 1);
     check_header();
+    init_();
   }
 
   void deserialize_(const void *buf, UInt64 size, int flags) {
     file_.create(NULL, size, flags);
     std::memcpy(file_.addr(), buf, size);
     header_ = static_cast<Header *>(file_.addr());
-    table_ = reinterpret_cast<T *>(header_ + 1);
     check_header();
+    init_();
   }
 
   void check_header() const {
@@ -277,9 +396,42 @@ class Croquis {
     MADOKA_THROW_IF(header().max_value() != 0);
     MADOKA_THROW_IF(value_size() != (sizeof(T) * 8));
     MADOKA_THROW_IF(table_size() != (sizeof(T) * width() * depth()));
+    MADOKA_THROW_IF((header().flags() & ~CROQUIS_HEADER_FLAGS) != 0);
+    MADOKA_THROW_IF(file_size() !=
+        (get_table_offset(static_cast<int>(header().flags())) +
+         table_size()));
     MADOKA_THROW_IF(file_size() != file_.size());
   }
 
+  static UInt64 get_table_offset(int flags) noexcept {
+    return sizeof(Header) +
+        (((flags & CROQUIS_DECAYED) != 0) ? sizeof(CroquisDecay) : 0);
+  }
+
+  void init_() noexcept {
+    const int flags = static_cast<int>(header().flags());
+    decay_ = ((flags & CROQUIS_DECAYED) != 0) ?
+        reinterpret_cast<CroquisDecay *>(header_ + 1) : NULL;
+    table_ = reinterpret_cast<T *>(
+        static_cast<UInt8 *>(file_.addr()) + get_table_offset(flags));
+    range_.reset(width(), CROQUIS_ID_SIZE,
+                 (flags & CROQUIS_FAST_RANGE) != 0);
+  }
+
+  // renormalize_() scales the stored values to the latest time and makes
+  // it the new landmark.
+  void renormalize_() noexcept {
+    if (decay_->scale != 1.0) {
+      const T factor = static_cast<T>(1.0 / decay_->scale);
+      const UInt64 num_cells = width() * depth();
+      for (UInt64 i = 0; i < num_cells; ++i) {
+        table_[i] *= factor;
+      }
+    }
+    decay_->landmark = decay_->time;
+    decay_->scale = 1.0;
+  }
+
   void hash(const void *key_addr, std::size_t key_size,
              UInt64 *cell_ids) const noexcept {
     for (UInt64 i = 0; i < depth(); i += CROQUIS_HASH_SIZE) {
@@ -298,15 +450,9 @@ class Croquis {
         (hash_values[1] << (64 - CROQUIS_ID_SIZE))) & CROQUIS_ID_MASK;
     cell_ids[2] = hash_values[1] >> (64 - CROQUIS_ID_SIZE);
 
-    if (width_mask() != 0) {
-      cell_ids[0] &= width_mask();
-      cell_ids[1] &= width_mask();
-      cell_ids[2] &= width_mask();
-    } else {
-      cell_ids[0] %= width();
-      cell_ids[1] %= width();
-      cell_ids[2] %= width();
-    }
+    cell_ids[0] = range_(cell_ids[0]);
+    cell_ids[1] = range_(cell_ids[1]);
+    cell_ids[2] = range_(cell_ids[2]);
   }
 
   // Disallows copy and assignment.
@@ -300,7 +300,7 @@ void FileImpl::open_(const char *path, int flags) {
   MADOKA_THROW_IF(path == NULL);
 
   const int VALID_FLAGS = FILE_READONLY | FILE_PRIVATE |
-                          FILE_HUGETLB | FILE_PRELOAD;
+                          FILE_HUGETLB | FILE_PRELOAD | FILE_SEQUENTIAL;
   MADOKA_THROW_IF(flags & ~VALID_FLAGS);
 
   if (~flags & FILE_READONLY) {
@@ -309,7 +309,7 @@ void FileImpl::open_(const char *path, int flags) {
   if (~flags & FILE_PRIVATE) {
     flags |= FILE_SHARED;
   }
-  flags &= ~FILE_HUGETLB;
+  flags &= ~(FILE_HUGETLB | FILE_SEQUENTIAL);
 
   struct __stat64 stat;
   MADOKA_THROW_IF(::_stat64(path, &stat) == -1);
@@ -446,7 +446,7 @@ void FileImpl::open_(const char *path, int flags) {
   MADOKA_THROW_IF(path == NULL);
 
   const int VALID_FLAGS = FILE_READONLY | FILE_PRIVATE |
-                          FILE_HUGETLB | FILE_PRELOAD;
+                          FILE_HUGETLB | FILE_PRELOAD | FILE_SEQUENTIAL;
   MADOKA_THROW_IF(flags & ~VALID_FLAGS);
 
   if (~flags & FILE_READONLY) {
@@ -481,6 +481,12 @@ void FileImpl::open_(const char *path, int flags) {
 #endif  // MAP_HUGETLB
     MADOKA_THROW_IF(map_addr_ == MAP_FAILED);
     addr_ = map_addr_;
+#ifdef MADV_SEQUENTIAL
+    // The hint is only advisory, so its failure is ignored.
+    if (flags & FILE_SEQUENTIAL) {
+      ::madvise(map_addr_, size, MADV_SEQUENTIAL);
+    }
+#endif  // MADV_SEQUENTIAL
   }
   size_ = size;
   flags_ = flags;
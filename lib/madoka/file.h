@@ -32,15 +32,16 @@ extern "C" {
 #endif  // __cplusplus
 
 typedef enum {
-  MADOKA_FILE_CREATE    = 1 << 0,
-  MADOKA_FILE_TRUNCATE  = 1 << 1,
-  MADOKA_FILE_READONLY  = 1 << 2,
-  MADOKA_FILE_WRITABLE  = 1 << 3,
-  MADOKA_FILE_SHARED    = 1 << 4,
-  MADOKA_FILE_PRIVATE   = 1 << 5,
-  MADOKA_FILE_ANONYMOUS = 1 << 6,
-  MADOKA_FILE_HUGETLB   = 1 << 7,
-  MADOKA_FILE_PRELOAD   = 1 << 8
+  MADOKA_FILE_CREATE     = 1 << 0,
+  MADOKA_FILE_TRUNCATE   = 1 << 1,
+  MADOKA_FILE_READONLY   = 1 << 2,
+  MADOKA_FILE_WRITABLE   = 1 << 3,
+  MADOKA_FILE_SHARED     = 1 << 4,
+  MADOKA_FILE_PRIVATE    = 1 << 5,
+  MADOKA_FILE_ANONYMOUS  = 1 << 6,
+  MADOKA_FILE_HUGETLB    = 1 << 7,
+  MADOKA_FILE_PRELOAD    = 1 << 8,
+  MADOKA_FILE_SEQUENTIAL = 1 << 9
 } madoka_file_flag;
 
 #ifdef __cplusplus
@@ -52,16 +53,19 @@ typedef enum {
 
 namespace madoka {
 
+// FILE_SEQUENTIAL hints that the mapping of an opened file is read from the
+// beginning to the end, so that the OS can read ahead.
 enum FileFlag {
-  FILE_CREATE    = MADOKA_FILE_CREATE,
-  FILE_TRUNCATE  = MADOKA_FILE_TRUNCATE,
-  FILE_READONLY  = MADOKA_FILE_READONLY,
-  FILE_WRITABLE  = MADOKA_FILE_WRITABLE,
-  FILE_SHARED    = MADOKA_FILE_SHARED,
-  FILE_PRIVATE   = MADOKA_FILE_PRIVATE,
-  FILE_ANONYMOUS = MADOKA_FILE_ANONYMOUS,
-  FILE_HUGETLB   = MADOKA_FILE_HUGETLB,
-  FILE_PRELOAD   = MADOKA_FILE_PRELOAD
+  FILE_CREATE     = MADOKA_FILE_CREATE,
+  FILE_TRUNCATE   = MADOKA_FILE_TRUNCATE,
+  FILE_READONLY   = MADOKA_FILE_READONLY,
+  FILE_WRITABLE   = MADOKA_FILE_WRITABLE,
+  FILE_SHARED     = MADOKA_FILE_SHARED,
+  FILE_PRIVATE    = MADOKA_FILE_PRIVATE,
+  FILE_ANONYMOUS  = MADOKA_FILE_ANONYMOUS,
+  FILE_HUGETLB    = MADOKA_FILE_HUGETLB,
+  FILE_PRELOAD    = MADOKA_FILE_PRELOAD,
+  FILE_SEQUENTIAL = MADOKA_FILE_SEQUENTIAL
 };
 
 class FileImpl;
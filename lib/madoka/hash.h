@@ -25,13 +25,27 @@
 #ifndef MADOKA_HASH_H
 #define MADOKA_HASH_H
 
-#include "util.h"
+#include "kernel.h"
 
 #ifdef __cplusplus
 namespace madoka {
 
+const UInt64 HASH_C1     = 0x87C37B91114253D5ULL;
+const UInt64 HASH_C2     = 0x4CF5AD432745937FULL;
+const UInt64 HASH_MIX_C1 = 0xFF51AFD7ED558CCDULL;
+const UInt64 HASH_MIX_C2 = 0xC4CEB9FE1A85EC53ULL;
+
 class Hash {
  public:
+  // This operator() computes hash values of `num_keys' keys at once. If
+  // available, it uses a SIMD kernel that hashes 4 (AVX2) or 8 (AVX-512)
+  // keys in parallel. The results are the same as those of the other one.
+  void operator()(const void * const *key_addrs, const std::size_t *key_sizes,
+                  std::size_t num_keys, UInt64 seed,
+                  UInt64 (*hash_values)[2]) const noexcept {
+    kernel().hash(key_addrs, key_sizes, num_keys, seed, hash_values);
+  }
+
   void operator()(const void *key_addr, std::size_t key_size,
                   UInt64 seed, UInt64 hash_values[2]) const noexcept {
     const UInt8 * const bytes = static_cast<const UInt8 *>(key_addr);
@@ -46,18 +60,18 @@ class Hash {
       UInt64 k1 = blocks[i * 2];
       UInt64 k2 = blocks[(i * 2) + 1];
 
-      k1 *= C1;
+      k1 *= HASH_C1;
       k1 = rotate(k1, 31);
-      k1 *= C2;
+      k1 *= HASH_C2;
       h1 ^= k1;
 
       h1 = rotate(h1, 27);
       h1 += h2;
       h1 = (h1 * 5) + 0x52DCE729;
 
-      k2 *= C2;
+      k2 *= HASH_C2;
       k2 = rotate(k2, 33);
-      k2 *= C1;
+      k2 *= HASH_C1;
       h2 ^= k2;
 
       h2 = rotate(h2, 31);
@@ -98,9 +112,9 @@ class Hash {
       /* FALLTHRU */
       case 9: {
         k2 ^= static_cast<UInt64>(tail[8]) << 0;
-        k2 *= C2;
+        k2 *= HASH_C2;
         k2 = rotate(k2, 33);
-        k2 *= C1;
+        k2 *= HASH_C1;
         h2 ^= k2;
       }
       /* FALLTHRU */
@@ -134,9 +148,9 @@ class Hash {
       /* FALLTHRU */
       case 1: {
         k1 ^= static_cast<UInt64>(tail[0]) << 0;
-        k1 *= C1;
+        k1 *= HASH_C1;
         k1 = rotate(k1, 31);
-        k1 *= C2;
+        k1 *= HASH_C2;
         h1 ^= k1;
       }
     };
@@ -158,23 +172,48 @@ class Hash {
   }
 
  private:
-  static const UInt64 C1 = 0x87C37B91114253D5ULL;
-  static const UInt64 C2 = 0x4CF5AD432745937FULL;
-
   static UInt64 rotate(UInt64 x, UInt64 y) noexcept {
     return (x << y) | (x >> (64 - y));
   }
 
   static UInt64 mix(UInt64 x) noexcept {
     x ^= x >> 33;
-    x *= 0xFF51AFD7ED558CCDULL;
+    x *= HASH_MIX_C1;
     x ^= x >> 33;
-    x *= 0xC4CEB9FE1A85EC53ULL;
+    x *= HASH_MIX_C2;
     x ^= x >> 33;
     return x;
   }
 };
 
+// KeyHash is the hash value of a key for a seed. Sketches with the same seed
+// accept the same KeyHash, so a key that updates many sketches needs to be
+// hashed only once.
+class KeyHash {
+ public:
+  KeyHash() noexcept : seed_(0), values_() {}
+  KeyHash(const void *key_addr, std::size_t key_size,
+          UInt64 seed = 0) noexcept : seed_(seed), values_() {
+    Hash()(key_addr, key_size, seed, values_);
+  }
+  KeyHash(UInt64 seed, const UInt64 values[2]) noexcept
+    : seed_(seed), values_() {
+    values_[0] = values[0];
+    values_[1] = values[1];
+  }
+
+  UInt64 seed() const noexcept {
+    return seed_;
+  }
+  const UInt64 *values() const noexcept {
+    return values_;
+  }
+
+ private:
+  UInt64 seed_;
+  UInt64 values_[2];
+};
+
 }  // namespace madoka
 #endif  // __cplusplus
 
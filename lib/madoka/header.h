@@ -30,11 +30,17 @@
 #ifdef __cplusplus
 namespace madoka {
 
+// A header with HEADER_MAGIC has a format version. A header without it is
+// of format version 0, which was written before magic numbers were
+// introduced.
+const UInt32 HEADER_MAGIC = 0x414B444DU;  // "MDKA" in little endian.
+
 class Header {
  public:
   Header() noexcept
-    : width_(0), width_mask_(0), depth_(0), max_value_(0), value_size_(0),
-      seed_(0), table_size_(0), file_size_(0) {}
+    : width_(0), width_mask_(0), depth_(0), version_(0), flags_(0),
+      max_value_(0), value_size_(0), magic_(0), seed_(0), table_size_(0),
+      file_size_(0) {}
   ~Header() noexcept {}
 
   UInt64 width() const noexcept {
@@ -46,12 +52,21 @@ class Header {
   UInt64 depth() const noexcept {
     return depth_;
   }
+  UInt64 version() const noexcept {
+    return version_;
+  }
+  UInt64 flags() const noexcept {
+    return flags_;
+  }
   UInt64 max_value() const noexcept {
     return max_value_;
   }
   UInt64 value_size() const noexcept {
     return value_size_;
   }
+  UInt64 magic() const noexcept {
+    return magic_;
+  }
   UInt64 seed() const noexcept {
     return seed_;
   }
@@ -67,13 +82,22 @@ class Header {
     width_mask_ = ((width & (width - 1)) == 0) ? (width - 1) : 0;
   }
   void set_depth(UInt64 depth) noexcept {
-    depth_ = depth;
+    depth_ = static_cast<UInt16>(depth);
+  }
+  void set_version(UInt64 version) noexcept {
+    version_ = static_cast<UInt16>(version);
+  }
+  void set_flags(UInt64 flags) noexcept {
+    flags_ = static_cast<UInt32>(flags);
   }
   void set_max_value(UInt64 max_value) noexcept {
     max_value_ = max_value;
   }
   void set_value_size(UInt64 value_size) noexcept {
-    value_size_ = value_size;
+    value_size_ = static_cast<UInt32>(value_size);
+  }
+  void set_magic(UInt64 magic) noexcept {
+    magic_ = static_cast<UInt32>(magic);
   }
   void set_seed(UInt64 seed) noexcept {
     seed_ = seed;
@@ -88,9 +112,16 @@ class Header {
  private:
   UInt64 width_;
   UInt64 width_mask_;
-  UInt64 depth_;
+  // `depth_', `version_' and `flags_' share the 64-bit field that was used
+  // for `depth_' only, and `value_size_' and `magic_' share the field that
+  // was used for `value_size_' only. So, old headers are read as
+  // `version_' == 0, `flags_' == 0 and `magic_' == 0.
+  UInt16 depth_;
+  UInt16 version_;
+  UInt32 flags_;
   UInt64 max_value_;
-  UInt64 value_size_;
+  UInt32 value_size_;
+  UInt32 magic_;
   UInt64 seed_;
   UInt64 table_size_;
   UInt64 file_size_;
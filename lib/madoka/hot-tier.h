@@ -0,0 +1,194 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MADOKA_HOT_TIER_H
+#define MADOKA_HOT_TIER_H
+
+#include "util.h"
+
+#if defined(__cplusplus) && defined(__SSE2__)
+ #include <emmintrin.h>
+#endif  // defined(__cplusplus) && defined(__SSE2__)
+
+#ifdef __cplusplus
+namespace madoka {
+
+const UInt64 HOT_TIER_SIZE         = 32;
+const UInt64 HOT_TIER_MARGIN_SHIFT = 3;
+
+// HotTier is a small table of hot keys that a sketch with SKETCH_HOT_TIER
+// keeps in its file, between the header and the cells. A key is identified
+// by its cell IDs, so keys that share all their cells share an entry as
+// they would share an estimate in the cells.
+//
+// `count' of an entry is the value of the key. `base' is the estimate that
+// the cells gave when the key was promoted, so `count' - `base' is the
+// amount that the cells have not seen yet.
+//
+// Every update looks up the table, so find() must be cheap for both hits
+// and misses. Each entry has a 16-bit tag of its cell IDs and find()
+// compares all the tags at once with SSE2, so that only the entries whose
+// tags match are compared by cell IDs. The entry with the smallest count is
+// kept at hand: counts only grow, so it changes only when that entry is
+// raised or replaced, and then the entries are scanned. The tags are kept
+// in the file with the entries and are all zeros for an empty table.
+class HotTier {
+ public:
+  struct Entry {
+    UInt64 cell_ids[3];
+    UInt64 count;
+    UInt64 base;
+  };
+
+  HotTier() noexcept : size_(0), min_id_(0), entries_(), tags_() {}
+  ~HotTier() noexcept {}
+
+  UInt64 size() const noexcept {
+    return size_;
+  }
+  bool full() const noexcept {
+    return size_ == HOT_TIER_SIZE;
+  }
+
+  const Entry &operator[](UInt64 i) const noexcept {
+    return entries_[i];
+  }
+
+  // find() returns the index of the entry of a key or size() if the key is
+  // not in the table.
+  UInt64 find(const UInt64 cell_ids[3]) const noexcept {
+    const UInt16 key_tag = get_tag(cell_ids);
+#ifdef __SSE2__
+    const __m128i pattern = ::_mm_set1_epi16(static_cast<short>(key_tag));
+    const __m128i *tags = reinterpret_cast<const __m128i *>(tags_);
+    const __m128i lower = ::_mm_packs_epi16(
+        ::_mm_cmpeq_epi16(::_mm_loadu_si128(tags), pattern),
+        ::_mm_cmpeq_epi16(::_mm_loadu_si128(tags + 1), pattern));
+    const __m128i upper = ::_mm_packs_epi16(
+        ::_mm_cmpeq_epi16(::_mm_loadu_si128(tags + 2), pattern),
+        ::_mm_cmpeq_epi16(::_mm_loadu_si128(tags + 3), pattern));
+    UInt64 mask = static_cast<UInt32>(::_mm_movemask_epi8(lower)) |
+        (static_cast<UInt64>(::_mm_movemask_epi8(upper)) << 16);
+    while (mask != 0) {
+      const UInt64 i = util::bit_scan_forward(mask);
+      if (matches(i, cell_ids)) {
+        return i;
+      }
+      mask &= mask - 1;
+    }
+#else  // __SSE2__
+    for (UInt64 i = 0; i < size_; ++i) {
+      if ((tags_[i] == key_tag) && matches(i, cell_ids)) {
+        return i;
+      }
+    }
+#endif  // __SSE2__
+    return size_;
+  }
+  // find_min() returns the index of the entry with the smallest count. The
+  // table must not be empty.
+  UInt64 find_min() const noexcept {
+    return min_id_;
+  }
+
+  void insert(const UInt64 cell_ids[3], UInt64 count, UInt64 base) noexcept {
+    const UInt64 i = size_++;
+    set_entry(i, cell_ids, count, base);
+    if ((i == 0) || (count < entries_[min_id_].count)) {
+      min_id_ = i;
+    }
+  }
+  // reset() replaces the key of the i-th entry.
+  void reset(UInt64 i, const UInt64 cell_ids[3], UInt64 count,
+             UInt64 base) noexcept {
+    set_entry(i, cell_ids, count, base);
+    if (i == min_id_) {
+      update_min();
+    } else if (count < entries_[min_id_].count) {
+      min_id_ = i;
+    }
+  }
+  // raise() replaces the count of the i-th entry with a larger count.
+  void raise(UInt64 i, UInt64 count) noexcept {
+    entries_[i].count = count;
+    if (i == min_id_) {
+      update_min();
+    }
+  }
+  void clear() noexcept {
+    size_ = 0;
+    min_id_ = 0;
+    for (UInt64 i = 0; i < HOT_TIER_SIZE; ++i) {
+      tags_[i] = 0;
+    }
+  }
+
+ private:
+  UInt64 size_;
+  UInt64 min_id_;
+  Entry entries_[HOT_TIER_SIZE];
+  // tags_[i] is the tag of the i-th entry, and 0 for an empty entry.
+  UInt16 tags_[HOT_TIER_SIZE];
+
+  // get_tag() returns the upper 16 bits of the mixed cell IDs. The lowest
+  // bit is set so that a tag is never 0.
+  static UInt16 get_tag(const UInt64 cell_ids[3]) noexcept {
+    return static_cast<UInt16>((((cell_ids[0] ^ (cell_ids[1] << 21) ^
+        (cell_ids[2] << 42)) * 0x9E3779B97F4A7C15ULL) >> 48) | 1);
+  }
+
+  bool matches(UInt64 i, const UInt64 cell_ids[3]) const noexcept {
+    return (entries_[i].cell_ids[0] == cell_ids[0]) &&
+           (entries_[i].cell_ids[1] == cell_ids[1]) &&
+           (entries_[i].cell_ids[2] == cell_ids[2]);
+  }
+
+  void set_entry(UInt64 i, const UInt64 cell_ids[3], UInt64 count,
+                 UInt64 base) noexcept {
+    Entry &entry = entries_[i];
+    entry.cell_ids[0] = cell_ids[0];
+    entry.cell_ids[1] = cell_ids[1];
+    entry.cell_ids[2] = cell_ids[2];
+    entry.count = count;
+    entry.base = base;
+    tags_[i] = get_tag(cell_ids);
+  }
+
+  void update_min() noexcept {
+    UInt64 min_id = 0;
+    for (UInt64 i = 1; i < size_; ++i) {
+      min_id = (entries_[i].count < entries_[min_id].count) ? i : min_id;
+    }
+    min_id_ = min_id;
+  }
+
+  // Disallows copy and assignment.
+  HotTier(const HotTier &);
+  HotTier &operator=(const HotTier &);
+};
+
+}  // namespace madoka
+#endif  // __cplusplus
+
+#endif  // MADOKA_HOT_TIER_H
@@ -0,0 +1,600 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "kernel-impl.h"
+
+#ifdef MADOKA_KERNEL_X86
+
+#include <immintrin.h>
+
+#include "approx.h"
+#include "hash.h"
+
+namespace madoka {
+namespace kernels {
+namespace {
+
+// AVX2 has no 64-bit multiplication, so mul_avx2() combines three 32-bit
+// multiplications.
+MADOKA_TARGET("avx2")
+inline __m256i mul_avx2(__m256i x, UInt64 y) {
+  const __m256i y_lo = _mm256_set1_epi64x(
+      static_cast<long long>(y & 0xFFFFFFFFULL));
+  const __m256i y_hi = _mm256_set1_epi64x(static_cast<long long>(y >> 32));
+  const __m256i cross = _mm256_add_epi64(
+      _mm256_mul_epu32(_mm256_srli_epi64(x, 32), y_lo),
+      _mm256_mul_epu32(x, y_hi));
+  return _mm256_add_epi64(_mm256_mul_epu32(x, y_lo),
+                          _mm256_slli_epi64(cross, 32));
+}
+
+template <int Y>
+MADOKA_TARGET("avx2")
+inline __m256i rotate_avx2(__m256i x) {
+  return _mm256_or_si256(_mm256_slli_epi64(x, Y),
+                         _mm256_srli_epi64(x, 64 - Y));
+}
+
+MADOKA_TARGET("avx2")
+inline __m256i mix_avx2(__m256i x) {
+  x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 33));
+  x = mul_avx2(x, HASH_MIX_C1);
+  x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 33));
+  x = mul_avx2(x, HASH_MIX_C2);
+  return _mm256_xor_si256(x, _mm256_srli_epi64(x, 33));
+}
+
+// hash_lanes_avx2() hashes 4 keys. Blocks of each key are mixed while that
+// key has blocks and the other lanes are kept as is.
+MADOKA_TARGET("avx2")
+void hash_lanes_avx2(const void * const *key_addrs,
+                     const std::size_t *key_sizes, UInt64 seed,
+                     UInt64 (*hash_values)[2]) {
+  const std::size_t NUM_LANES = 4;
+
+  UInt64 k1s[NUM_LANES];
+  UInt64 k2s[NUM_LANES];
+  UInt64 nums_blocks[NUM_LANES];
+  UInt64 max_num_blocks = 0;
+  for (std::size_t i = 0; i < NUM_LANES; ++i) {
+    nums_blocks[i] = key_sizes[i] / 16;
+    if (nums_blocks[i] > max_num_blocks) {
+      max_num_blocks = nums_blocks[i];
+    }
+  }
+
+  const __m256i num_blocks =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(nums_blocks));
+  __m256i h1 = _mm256_set1_epi64x(static_cast<long long>(seed));
+  __m256i h2 = h1;
+
+  for (UInt64 block_id = 0; block_id < max_num_blocks; ++block_id) {
+    for (std::size_t i = 0; i < NUM_LANES; ++i) {
+      if (block_id < nums_blocks[i]) {
+        load_block(key_addrs[i], block_id, &k1s[i], &k2s[i]);
+      } else {
+        k1s[i] = k2s[i] = 0;
+      }
+    }
+    __m256i k1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(k1s));
+    __m256i k2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(k2s));
+
+    k1 = mul_avx2(k1, HASH_C1);
+    k1 = rotate_avx2<31>(k1);
+    k1 = mul_avx2(k1, HASH_C2);
+    __m256i new_h1 = _mm256_xor_si256(h1, k1);
+
+    new_h1 = rotate_avx2<27>(new_h1);
+    new_h1 = _mm256_add_epi64(new_h1, h2);
+    new_h1 = _mm256_add_epi64(
+        _mm256_add_epi64(_mm256_slli_epi64(new_h1, 2), new_h1),
+        _mm256_set1_epi64x(0x52DCE729));
+
+    k2 = mul_avx2(k2, HASH_C2);
+    k2 = rotate_avx2<33>(k2);
+    k2 = mul_avx2(k2, HASH_C1);
+    __m256i new_h2 = _mm256_xor_si256(h2, k2);
+
+    new_h2 = rotate_avx2<31>(new_h2);
+    new_h2 = _mm256_add_epi64(new_h2, new_h1);
+    new_h2 = _mm256_add_epi64(
+        _mm256_add_epi64(_mm256_slli_epi64(new_h2, 2), new_h2),
+        _mm256_set1_epi64x(0x38495AB5));
+
+    const __m256i is_active = _mm256_cmpgt_epi64(
+        num_blocks, _mm256_set1_epi64x(static_cast<long long>(block_id)));
+    h1 = _mm256_blendv_epi8(h1, new_h1, is_active);
+    h2 = _mm256_blendv_epi8(h2, new_h2, is_active);
+  }
+
+  for (std::size_t i = 0; i < NUM_LANES; ++i) {
+    load_tail(key_addrs[i], key_sizes[i], &k1s[i], &k2s[i]);
+  }
+  __m256i k1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(k1s));
+  __m256i k2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(k2s));
+
+  k2 = mul_avx2(k2, HASH_C2);
+  k2 = rotate_avx2<33>(k2);
+  k2 = mul_avx2(k2, HASH_C1);
+  h2 = _mm256_xor_si256(h2, k2);
+
+  k1 = mul_avx2(k1, HASH_C1);
+  k1 = rotate_avx2<31>(k1);
+  k1 = mul_avx2(k1, HASH_C2);
+  h1 = _mm256_xor_si256(h1, k1);
+
+  UInt64 sizes[NUM_LANES];
+  for (std::size_t i = 0; i < NUM_LANES; ++i) {
+    sizes[i] = key_sizes[i];
+  }
+  const __m256i size =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(sizes));
+  h1 = _mm256_xor_si256(h1, size);
+  h2 = _mm256_xor_si256(h2, size);
+
+  h1 = _mm256_add_epi64(h1, h2);
+  h2 = _mm256_add_epi64(h2, h1);
+
+  h1 = mix_avx2(h1);
+  h2 = mix_avx2(h2);
+
+  h1 = _mm256_add_epi64(h1, h2);
+  h2 = _mm256_add_epi64(h2, h1);
+
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(k1s), h1);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(k2s), h2);
+  for (std::size_t i = 0; i < NUM_LANES; ++i) {
+    hash_values[i][0] = k1s[i];
+    hash_values[i][1] = k2s[i];
+  }
+}
+
+// to_double_avx2() converts values less than 2^52 to doubles.
+MADOKA_TARGET("avx2")
+inline __m256d to_double_avx2(__m256i x) {
+  const __m256i magic = _mm256_set1_epi64x(0x4330000000000000LL);
+  return _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(x, magic)),
+                       _mm256_castsi256_pd(magic));
+}
+
+MADOKA_TARGET("avx2")
+inline double sum_avx2(__m256d x) {
+  double values[4];
+  _mm256_storeu_pd(values, x);
+  return (values[0] + values[1]) + (values[2] + values[3]);
+}
+
+MADOKA_TARGET("avx2")
+inline UInt64 sum_epi64_avx2(__m256i x) {
+  UInt64 values[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(values), x);
+  return (values[0] + values[1]) + (values[2] + values[3]);
+}
+
+// pop_count_avx2() counts the 1 bits of each 64-bit lane with a table of the
+// counts of 4-bit values.
+MADOKA_TARGET("avx2")
+inline __m256i pop_count_avx2(__m256i x) {
+  const __m256i table = _mm256_setr_epi8(
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0F);
+  const __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(x, low_mask));
+  const __m256i hi = _mm256_shuffle_epi8(
+      table, _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask));
+  return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+// lane_inner_product_avx2() returns the partial sums of the inner product of
+// the `VALUE_SIZE'-bit values of `x' and `y' in 64-bit lanes. 1 and 2-bit
+// values are multiplied as bit planes, 4-bit values are split into bytes,
+// bytes are multiplied in 16-bit lanes, and 16-bit values are multiplied
+// in 64-bit lanes.
+template <UInt64 VALUE_SIZE>
+MADOKA_TARGET("avx2")
+inline __m256i lane_inner_product_avx2(__m256i x, __m256i y) {
+  if (VALUE_SIZE == 1) {
+    return pop_count_avx2(_mm256_and_si256(x, y));
+  } else if (VALUE_SIZE == 2) {
+    const __m256i mask = _mm256_set1_epi8(0x55);
+    const __m256i x0 = _mm256_and_si256(x, mask);
+    const __m256i x1 = _mm256_and_si256(_mm256_srli_epi64(x, 1), mask);
+    const __m256i y0 = _mm256_and_si256(y, mask);
+    const __m256i y1 = _mm256_and_si256(_mm256_srli_epi64(y, 1), mask);
+    const __m256i cross = _mm256_add_epi64(
+        pop_count_avx2(_mm256_and_si256(x0, y1)),
+        pop_count_avx2(_mm256_and_si256(x1, y0)));
+    return _mm256_add_epi64(
+        _mm256_add_epi64(pop_count_avx2(_mm256_and_si256(x0, y0)),
+                         _mm256_slli_epi64(cross, 1)),
+        _mm256_slli_epi64(pop_count_avx2(_mm256_and_si256(x1, y1)), 2));
+  } else if (VALUE_SIZE == 4) {
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    return _mm256_add_epi64(
+        lane_inner_product_avx2<8>(_mm256_and_si256(x, mask),
+                                   _mm256_and_si256(y, mask)),
+        lane_inner_product_avx2<8>(
+            _mm256_and_si256(_mm256_srli_epi64(x, 4), mask),
+            _mm256_and_si256(_mm256_srli_epi64(y, 4), mask)));
+  } else if (VALUE_SIZE == 8) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i products = _mm256_add_epi32(
+        _mm256_madd_epi16(_mm256_unpacklo_epi8(x, zero),
+                          _mm256_unpacklo_epi8(y, zero)),
+        _mm256_madd_epi16(_mm256_unpackhi_epi8(x, zero),
+                          _mm256_unpackhi_epi8(y, zero)));
+    return _mm256_add_epi64(
+        _mm256_and_si256(products, _mm256_set1_epi64x(0xFFFFFFFFLL)),
+        _mm256_srli_epi64(products, 32));
+  }
+  const __m256i mask = _mm256_set1_epi64x(0xFFFF);
+  return _mm256_add_epi64(
+      _mm256_add_epi64(
+          _mm256_mul_epu32(_mm256_and_si256(x, mask),
+                           _mm256_and_si256(y, mask)),
+          _mm256_mul_epu32(_mm256_and_si256(_mm256_srli_epi64(x, 16), mask),
+                           _mm256_and_si256(_mm256_srli_epi64(y, 16), mask))),
+      _mm256_add_epi64(
+          _mm256_mul_epu32(_mm256_and_si256(_mm256_srli_epi64(x, 32), mask),
+                           _mm256_and_si256(_mm256_srli_epi64(y, 32), mask)),
+          _mm256_mul_epu32(_mm256_srli_epi64(x, 48),
+                           _mm256_srli_epi64(y, 48))));
+}
+
+template <UInt64 VALUE_SIZE>
+MADOKA_TARGET("avx2")
+void exact_inner_product_avx2_(const UInt64 *lhs, const UInt64 *rhs,
+                               UInt64 num_units, UInt64 sums[3]) {
+  __m256i inner_product = _mm256_setzero_si256();
+  __m256i lhs_square_length = _mm256_setzero_si256();
+  __m256i rhs_square_length = _mm256_setzero_si256();
+
+  UInt64 i = 0;
+  for ( ; (i + 4) <= num_units; i += 4) {
+    const __m256i x =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lhs + i));
+    const __m256i y =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rhs + i));
+    inner_product = _mm256_add_epi64(
+        inner_product, lane_inner_product_avx2<VALUE_SIZE>(x, y));
+    lhs_square_length = _mm256_add_epi64(
+        lhs_square_length, lane_inner_product_avx2<VALUE_SIZE>(x, x));
+    rhs_square_length = _mm256_add_epi64(
+        rhs_square_length, lane_inner_product_avx2<VALUE_SIZE>(y, y));
+  }
+  sums[0] += sum_epi64_avx2(inner_product);
+  sums[1] += sum_epi64_avx2(lhs_square_length);
+  sums[2] += sum_epi64_avx2(rhs_square_length);
+  exact_inner_product_scalar(lhs + i, rhs + i, num_units - i, VALUE_SIZE,
+                             sums);
+}
+
+}  // namespace
+
+MADOKA_TARGET("avx2")
+void hash_avx2(const void * const *key_addrs, const std::size_t *key_sizes,
+               std::size_t num_keys, UInt64 seed, UInt64 (*hash_values)[2]) {
+  std::size_t i = 0;
+  for ( ; (i + 4) <= num_keys; i += 4) {
+    hash_lanes_avx2(key_addrs + i, key_sizes + i, seed, hash_values + i);
+  }
+  hash_scalar(key_addrs + i, key_sizes + i, num_keys - i, seed,
+             hash_values + i);
+}
+
+MADOKA_TARGET("avx2")
+void saturated_add_avx2(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                        UInt64 value_size) {
+  if ((value_size != 8) && (value_size != 16)) {
+    saturated_add_scalar(lhs, rhs, num_units, value_size);
+    return;
+  }
+
+  UInt64 i = 0;
+  for ( ; (i + 4) <= num_units; i += 4) {
+    __m256i * const lhs_units = reinterpret_cast<__m256i *>(lhs + i);
+    const __m256i x = _mm256_loadu_si256(lhs_units);
+    const __m256i y =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rhs + i));
+    _mm256_storeu_si256(lhs_units, (value_size == 8) ?
+        _mm256_adds_epu8(x, y) : _mm256_adds_epu16(x, y));
+  }
+  saturated_add_scalar(lhs + i, rhs + i, num_units - i, value_size);
+}
+
+namespace {
+
+// select_merge_avx2() works as select_merge() in kernel.cc does, on 4 units
+// at once. 8-bit and 16-bit values are compared directly.
+template <bool IS_MAX>
+MADOKA_TARGET("avx2")
+inline void select_merge_avx2(UInt64 *lhs, const UInt64 *rhs,
+                              UInt64 num_units, UInt64 value_size) {
+  const MergeLanes lanes(value_size);
+  const __m256i value_bits =
+      _mm256_set1_epi64x(static_cast<long long>(lanes.value_bits));
+  const __m256i highest_bits =
+      _mm256_set1_epi64x(static_cast<long long>(lanes.highest_bits));
+  const __m128i lowest_shift =
+      _mm_cvtsi64_si128(static_cast<long long>(value_size - 1));
+  const __m256i owner_bits[3] = {
+    _mm256_set1_epi64x(1LL << (APPROX_SIZE - 1)),
+    _mm256_set1_epi64x(1LL << ((APPROX_SIZE * 2) - 1)),
+    _mm256_set1_epi64x(1LL << ((APPROX_SIZE * 3) - 1))
+  };
+
+  UInt64 i = 0;
+  for ( ; (i + 4) <= num_units; i += 4) {
+    __m256i * const lhs_units = reinterpret_cast<__m256i *>(lhs + i);
+    const __m256i lhs_unit = _mm256_loadu_si256(lhs_units);
+    const __m256i rhs_unit =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rhs + i));
+    if (value_size == 8) {
+      _mm256_storeu_si256(lhs_units, IS_MAX ?
+          _mm256_max_epu8(lhs_unit, rhs_unit) :
+          _mm256_min_epu8(lhs_unit, rhs_unit));
+      continue;
+    } else if (value_size == 16) {
+      _mm256_storeu_si256(lhs_units, IS_MAX ?
+          _mm256_max_epu16(lhs_unit, rhs_unit) :
+          _mm256_min_epu16(lhs_unit, rhs_unit));
+      continue;
+    }
+
+    const __m256i x = _mm256_and_si256(lhs_unit, value_bits);
+    const __m256i y = _mm256_and_si256(rhs_unit, value_bits);
+    const __m256i a = IS_MAX ? x : y;
+    const __m256i b = IS_MAX ? y : x;
+    const __m256i same_bits =
+        _mm256_xor_si256(_mm256_xor_si256(a, b), _mm256_set1_epi64x(-1));
+    const __m256i diff = _mm256_xor_si256(
+        _mm256_sub_epi64(_mm256_or_si256(a, highest_bits),
+                         _mm256_andnot_si256(highest_bits, b)),
+        _mm256_and_si256(same_bits, highest_bits));
+    const __m256i selected = _mm256_and_si256(_mm256_or_si256(
+        _mm256_andnot_si256(a, b), _mm256_and_si256(same_bits, diff)),
+        highest_bits);
+    __m256i mask = _mm256_sub_epi64(_mm256_slli_epi64(selected, 1),
+                                    _mm256_srl_epi64(selected, lowest_shift));
+    if (lanes.is_approx) {
+      const __m256i owner_mask = _mm256_or_si256(_mm256_or_si256(
+          _mm256_slli_epi64(_mm256_and_si256(selected, owner_bits[0]),
+                            approx_owner_shift(0)),
+          _mm256_slli_epi64(_mm256_and_si256(selected, owner_bits[1]),
+                            approx_owner_shift(1))),
+          _mm256_slli_epi64(_mm256_and_si256(selected, owner_bits[2]),
+                            approx_owner_shift(2)));
+      mask = _mm256_or_si256(mask, _mm256_or_si256(
+          owner_mask, _mm256_slli_epi64(owner_mask, 1)));
+    }
+    _mm256_storeu_si256(lhs_units, _mm256_or_si256(
+        _mm256_andnot_si256(mask, lhs_unit), _mm256_and_si256(rhs_unit, mask)));
+  }
+  if (IS_MAX) {
+    max_merge_scalar(lhs + i, rhs + i, num_units - i, value_size);
+  } else {
+    min_merge_scalar(lhs + i, rhs + i, num_units - i, value_size);
+  }
+}
+
+// filter_epi32() filters 8 values in 32-bit lanes. See filter_sse42().
+MADOKA_TARGET("avx2")
+inline __m256i filter_epi32(__m256i values, __m256i threshold,
+                            __m256i multiplier, __m128i shift,
+                            __m256i max_value) {
+  const __m256i is_small = _mm256_cmpgt_epi32(threshold, values);
+  const __m256i results = _mm256_min_epu32(_mm256_srl_epi32(
+      _mm256_mullo_epi32(values, multiplier), shift), max_value);
+  return _mm256_andnot_si256(is_small, results);
+}
+
+}  // namespace
+
+void max_merge_avx2(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                    UInt64 value_size) {
+  select_merge_avx2<true>(lhs, rhs, num_units, value_size);
+}
+
+void min_merge_avx2(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                    UInt64 value_size) {
+  select_merge_avx2<false>(lhs, rhs, num_units, value_size);
+}
+
+// filter_avx2() works as filter_sse42() does. Unpacking and packing work
+// in each 128-bit lane, so they keep the order of values.
+MADOKA_TARGET("avx2")
+void filter_avx2(UInt64 *units, UInt64 num_units, UInt64 value_size,
+                 UInt64 threshold, UInt64 multiplier, UInt64 shift,
+                 UInt64 max_value) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i threshold_lanes =
+      _mm256_set1_epi32(static_cast<int>(threshold));
+  const __m256i multiplier_lanes =
+      _mm256_set1_epi32(static_cast<int>(multiplier));
+  const __m128i shift_count = _mm_cvtsi64_si128(static_cast<long long>(shift));
+  const __m256i max_value_lanes =
+      _mm256_set1_epi32(static_cast<int>(max_value));
+
+  UInt64 i = 0;
+  for ( ; (i + 4) <= num_units; i += 4) {
+    __m256i * const block = reinterpret_cast<__m256i *>(units + i);
+    const __m256i x = _mm256_loadu_si256(block);
+    __m256i words[2];
+    if (value_size == 8) {
+      words[0] = _mm256_unpacklo_epi8(x, zero);
+      words[1] = _mm256_unpackhi_epi8(x, zero);
+    } else {
+      words[0] = x;
+    }
+    const UInt64 num_words = (value_size == 8) ? 2 : 1;
+    for (UInt64 j = 0; j < num_words; ++j) {
+      const __m256i lo = filter_epi32(_mm256_unpacklo_epi16(words[j], zero),
+                                      threshold_lanes, multiplier_lanes,
+                                      shift_count, max_value_lanes);
+      const __m256i hi = filter_epi32(_mm256_unpackhi_epi16(words[j], zero),
+                                      threshold_lanes, multiplier_lanes,
+                                      shift_count, max_value_lanes);
+      words[j] = _mm256_packus_epi32(lo, hi);
+    }
+    _mm256_storeu_si256(block, (value_size == 8) ?
+        _mm256_packus_epi16(words[0], words[1]) : words[0]);
+  }
+  filter_scalar(units + i, num_units - i, value_size, threshold, multiplier,
+                shift, max_value);
+}
+
+// approx_encode_avx2() takes the index of the most significant 1 bit from
+// the exponent of a double. A value v < 2^52 is converted exactly by putting
+// it into the significand of 2^52 and then subtracting 2^52.
+MADOKA_TARGET("avx2")
+void approx_encode_avx2(const UInt64 *values, UInt64 num_values,
+                        UInt64 *approxes) {
+  const __m256i value_mask = _mm256_set1_epi64x(APPROX_VALUE_MASK);
+  const __m256i significand_mask =
+      _mm256_set1_epi64x(APPROX_SIGNIFICAND_MASK);
+  const __m256i magic = _mm256_set1_epi64x(0x4330000000000000LL);
+  const __m256i exponent_bias =
+      _mm256_set1_epi64x(1023 + (APPROX_SIGNIFICAND_SIZE - 1));
+  const __m256i ones = _mm256_set1_epi64x(1);
+
+  UInt64 i = 0;
+  for ( ; (i + 4) <= num_values; i += 4) {
+    const __m256i value = _mm256_and_si256(_mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(values + i)), value_mask);
+    const __m256d x = _mm256_sub_pd(
+        _mm256_castsi256_pd(_mm256_or_si256(
+            _mm256_or_si256(value, significand_mask), magic)),
+        _mm256_castsi256_pd(magic));
+    const __m256i exponent = _mm256_sub_epi64(
+        _mm256_srli_epi64(_mm256_castpd_si256(x), 52), exponent_bias);
+    const __m256i is_large = _mm256_cmpgt_epi64(exponent, ones);
+
+    const __m256i approx = _mm256_or_si256(
+        _mm256_slli_epi64(exponent,
+                          static_cast<int>(APPROX_EXPONENT_SHIFT)),
+        _mm256_and_si256(_mm256_srlv_epi64(
+            value, _mm256_sub_epi64(exponent, ones)), significand_mask));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(approxes + i),
+                        _mm256_blendv_epi8(value, approx, is_large));
+  }
+  approx_encode_scalar(values + i, num_values - i, approxes + i);
+}
+
+MADOKA_TARGET("avx2")
+void approx_decode_avx2(const UInt64 *units, UInt64 num_units,
+                        UInt64 table_id, UInt64 *values, UInt64 *masks) {
+  const __m128i table_shift =
+      _mm_cvtsi64_si128(static_cast<long long>(APPROX_SIZE * table_id));
+  const __m256i approx_mask = _mm256_set1_epi64x(APPROX_MASK);
+  const __m256i exponent_mask = _mm256_set1_epi64x(APPROX_EXPONENT_MASK);
+  const __m256i significand_mask =
+      _mm256_set1_epi64x(APPROX_SIGNIFICAND_MASK);
+  const __m256i offset_shift =
+      _mm256_set1_epi64x(APPROX_SIGNIFICAND_SIZE - 1);
+  const __m256i ones = _mm256_set1_epi64x(1);
+
+  UInt64 i = 0;
+  for ( ; (i + 4) <= num_units; i += 4) {
+    const __m256i approx = _mm256_and_si256(_mm256_srl_epi64(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(units + i)),
+        table_shift), approx_mask);
+    const __m256i exponent = _mm256_and_si256(_mm256_srli_epi64(
+        approx, static_cast<int>(APPROX_EXPONENT_SHIFT)), exponent_mask);
+    const __m256i significand = _mm256_and_si256(approx, significand_mask);
+    const __m256i is_large = _mm256_cmpgt_epi64(exponent, ones);
+    const __m256i shift = _mm256_sub_epi64(exponent, ones);
+
+    const __m256i value = _mm256_or_si256(
+        _mm256_sllv_epi64(ones, _mm256_add_epi64(exponent, offset_shift)),
+        _mm256_sllv_epi64(significand, shift));
+    const __m256i mask = _mm256_and_si256(
+        _mm256_sub_epi64(_mm256_sllv_epi64(ones, shift), ones), is_large);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(values + i),
+                        _mm256_blendv_epi8(approx, value, is_large));
+    if (masks != NULL) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(masks + i), mask);
+    }
+  }
+  approx_decode_scalar(units + i, num_units - i, table_id, values + i,
+                       (masks != NULL) ? (masks + i) : NULL);
+}
+
+MADOKA_TARGET("avx2")
+void inner_product_avx2(const UInt64 *lhs, const UInt64 *rhs,
+                        UInt64 num_values, double sums[3]) {
+  __m256d inner_product = _mm256_setzero_pd();
+  __m256d lhs_square_length = _mm256_setzero_pd();
+  __m256d rhs_square_length = _mm256_setzero_pd();
+
+  UInt64 i = 0;
+  for ( ; (i + 4) <= num_values; i += 4) {
+    const __m256d lhs_values = to_double_avx2(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lhs + i)));
+    const __m256d rhs_values = to_double_avx2(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rhs + i)));
+    inner_product = _mm256_add_pd(inner_product,
+                                  _mm256_mul_pd(lhs_values, rhs_values));
+    lhs_square_length = _mm256_add_pd(lhs_square_length,
+                                      _mm256_mul_pd(lhs_values, lhs_values));
+    rhs_square_length = _mm256_add_pd(rhs_square_length,
+                                      _mm256_mul_pd(rhs_values, rhs_values));
+  }
+  sums[0] += sum_avx2(inner_product);
+  sums[1] += sum_avx2(lhs_square_length);
+  sums[2] += sum_avx2(rhs_square_length);
+  inner_product_scalar(lhs + i, rhs + i, num_values - i, sums);
+}
+
+MADOKA_TARGET("avx2")
+void exact_inner_product_avx2(const UInt64 *lhs, const UInt64 *rhs,
+                              UInt64 num_units, UInt64 value_size,
+                              UInt64 sums[3]) {
+  switch (value_size) {
+    case 1: {
+      exact_inner_product_avx2_<1>(lhs, rhs, num_units, sums);
+      break;
+    }
+    case 2: {
+      exact_inner_product_avx2_<2>(lhs, rhs, num_units, sums);
+      break;
+    }
+    case 4: {
+      exact_inner_product_avx2_<4>(lhs, rhs, num_units, sums);
+      break;
+    }
+    case 8: {
+      exact_inner_product_avx2_<8>(lhs, rhs, num_units, sums);
+      break;
+    }
+    default: {
+      exact_inner_product_avx2_<16>(lhs, rhs, num_units, sums);
+      break;
+    }
+  }
+}
+
+}  // namespace kernels
+}  // namespace madoka
+
+#endif  // MADOKA_KERNEL_X86
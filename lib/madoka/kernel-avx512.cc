@@ -0,0 +1,294 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "kernel-impl.h"
+
+#ifdef MADOKA_KERNEL_X86
+
+#include <immintrin.h>
+
+#include "approx.h"
+#include "hash.h"
+
+// GCC warns that _mm512_undefined_epi32() in the shift and rotate intrinsics
+// returns an uninitialized value, although the value is never used.
+#if defined(__GNUC__) && !defined(__clang__)
+ #pragma GCC diagnostic ignored "-Wuninitialized"
+ #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif  // defined(__GNUC__) && !defined(__clang__)
+
+namespace madoka {
+namespace kernels {
+namespace {
+
+MADOKA_TARGET("avx512f,avx512dq,avx512bw")
+inline __m512i mul_avx512(__m512i x, UInt64 y) {
+  return _mm512_mullo_epi64(x, _mm512_set1_epi64(static_cast<long long>(y)));
+}
+
+template <int Y>
+MADOKA_TARGET("avx512f,avx512dq,avx512bw")
+inline __m512i rotate_avx512(__m512i x) {
+  return _mm512_rol_epi64(x, Y);
+}
+
+MADOKA_TARGET("avx512f,avx512dq,avx512bw")
+inline __m512i mix_avx512(__m512i x) {
+  x = _mm512_xor_si512(x, _mm512_srli_epi64(x, 33));
+  x = mul_avx512(x, HASH_MIX_C1);
+  x = _mm512_xor_si512(x, _mm512_srli_epi64(x, 33));
+  x = mul_avx512(x, HASH_MIX_C2);
+  return _mm512_xor_si512(x, _mm512_srli_epi64(x, 33));
+}
+
+// hash_lanes_avx512() is the same as hash_lanes_avx2() except that it hashes
+// 8 keys and uses mask registers to keep inactive lanes.
+MADOKA_TARGET("avx512f,avx512dq,avx512bw")
+void hash_lanes_avx512(const void * const *key_addrs,
+                       const std::size_t *key_sizes, UInt64 seed,
+                       UInt64 (*hash_values)[2]) {
+  const std::size_t NUM_LANES = 8;
+
+  UInt64 k1s[NUM_LANES];
+  UInt64 k2s[NUM_LANES];
+  UInt64 nums_blocks[NUM_LANES];
+  UInt64 max_num_blocks = 0;
+  for (std::size_t i = 0; i < NUM_LANES; ++i) {
+    nums_blocks[i] = key_sizes[i] / 16;
+    if (nums_blocks[i] > max_num_blocks) {
+      max_num_blocks = nums_blocks[i];
+    }
+  }
+
+  const __m512i num_blocks = _mm512_loadu_si512(nums_blocks);
+  __m512i h1 = _mm512_set1_epi64(static_cast<long long>(seed));
+  __m512i h2 = h1;
+
+  for (UInt64 block_id = 0; block_id < max_num_blocks; ++block_id) {
+    for (std::size_t i = 0; i < NUM_LANES; ++i) {
+      if (block_id < nums_blocks[i]) {
+        load_block(key_addrs[i], block_id, &k1s[i], &k2s[i]);
+      } else {
+        k1s[i] = k2s[i] = 0;
+      }
+    }
+    __m512i k1 = _mm512_loadu_si512(k1s);
+    __m512i k2 = _mm512_loadu_si512(k2s);
+
+    k1 = mul_avx512(k1, HASH_C1);
+    k1 = rotate_avx512<31>(k1);
+    k1 = mul_avx512(k1, HASH_C2);
+    __m512i new_h1 = _mm512_xor_si512(h1, k1);
+
+    new_h1 = rotate_avx512<27>(new_h1);
+    new_h1 = _mm512_add_epi64(new_h1, h2);
+    new_h1 = _mm512_add_epi64(mul_avx512(new_h1, 5),
+                              _mm512_set1_epi64(0x52DCE729));
+
+    k2 = mul_avx512(k2, HASH_C2);
+    k2 = rotate_avx512<33>(k2);
+    k2 = mul_avx512(k2, HASH_C1);
+    __m512i new_h2 = _mm512_xor_si512(h2, k2);
+
+    new_h2 = rotate_avx512<31>(new_h2);
+    new_h2 = _mm512_add_epi64(new_h2, new_h1);
+    new_h2 = _mm512_add_epi64(mul_avx512(new_h2, 5),
+                              _mm512_set1_epi64(0x38495AB5));
+
+    const __mmask8 is_active = _mm512_cmpgt_epu64_mask(
+        num_blocks, _mm512_set1_epi64(static_cast<long long>(block_id)));
+    h1 = _mm512_mask_mov_epi64(h1, is_active, new_h1);
+    h2 = _mm512_mask_mov_epi64(h2, is_active, new_h2);
+  }
+
+  for (std::size_t i = 0; i < NUM_LANES; ++i) {
+    load_tail(key_addrs[i], key_sizes[i], &k1s[i], &k2s[i]);
+  }
+  __m512i k1 = _mm512_loadu_si512(k1s);
+  __m512i k2 = _mm512_loadu_si512(k2s);
+
+  k2 = mul_avx512(k2, HASH_C2);
+  k2 = rotate_avx512<33>(k2);
+  k2 = mul_avx512(k2, HASH_C1);
+  h2 = _mm512_xor_si512(h2, k2);
+
+  k1 = mul_avx512(k1, HASH_C1);
+  k1 = rotate_avx512<31>(k1);
+  k1 = mul_avx512(k1, HASH_C2);
+  h1 = _mm512_xor_si512(h1, k1);
+
+  UInt64 sizes[NUM_LANES];
+  for (std::size_t i = 0; i < NUM_LANES; ++i) {
+    sizes[i] = key_sizes[i];
+  }
+  const __m512i size = _mm512_loadu_si512(sizes);
+  h1 = _mm512_xor_si512(h1, size);
+  h2 = _mm512_xor_si512(h2, size);
+
+  h1 = _mm512_add_epi64(h1, h2);
+  h2 = _mm512_add_epi64(h2, h1);
+
+  h1 = mix_avx512(h1);
+  h2 = mix_avx512(h2);
+
+  h1 = _mm512_add_epi64(h1, h2);
+  h2 = _mm512_add_epi64(h2, h1);
+
+  _mm512_storeu_si512(k1s, h1);
+  _mm512_storeu_si512(k2s, h2);
+  for (std::size_t i = 0; i < NUM_LANES; ++i) {
+    hash_values[i][0] = k1s[i];
+    hash_values[i][1] = k2s[i];
+  }
+}
+
+}  // namespace
+
+MADOKA_TARGET("avx512f,avx512dq,avx512bw")
+void hash_avx512(const void * const *key_addrs,
+                 const std::size_t *key_sizes, std::size_t num_keys,
+                 UInt64 seed, UInt64 (*hash_values)[2]) {
+  std::size_t i = 0;
+  for ( ; (i + 8) <= num_keys; i += 8) {
+    hash_lanes_avx512(key_addrs + i, key_sizes + i, seed, hash_values + i);
+  }
+  hash_scalar(key_addrs + i, key_sizes + i, num_keys - i, seed,
+             hash_values + i);
+}
+
+MADOKA_TARGET("avx512f,avx512dq,avx512bw")
+void saturated_add_avx512(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                          UInt64 value_size) {
+  if ((value_size != 8) && (value_size != 16)) {
+    saturated_add_scalar(lhs, rhs, num_units, value_size);
+    return;
+  }
+
+  UInt64 i = 0;
+  for ( ; (i + 8) <= num_units; i += 8) {
+    const __m512i x = _mm512_loadu_si512(lhs + i);
+    const __m512i y = _mm512_loadu_si512(rhs + i);
+    _mm512_storeu_si512(lhs + i, (value_size == 8) ?
+        _mm512_adds_epu8(x, y) : _mm512_adds_epu16(x, y));
+  }
+  saturated_add_scalar(lhs + i, rhs + i, num_units - i, value_size);
+}
+
+// approx_encode_avx512() takes the index of the most significant 1 bit from
+// the exponent of a double, which is exact for values less than 2^53.
+MADOKA_TARGET("avx512f,avx512dq,avx512bw")
+void approx_encode_avx512(const UInt64 *values, UInt64 num_values,
+                          UInt64 *approxes) {
+  const __m512i value_mask = _mm512_set1_epi64(APPROX_VALUE_MASK);
+  const __m512i significand_mask = _mm512_set1_epi64(APPROX_SIGNIFICAND_MASK);
+  const __m512i exponent_bias =
+      _mm512_set1_epi64(1023 + (APPROX_SIGNIFICAND_SIZE - 1));
+  const __m512i ones = _mm512_set1_epi64(1);
+
+  UInt64 i = 0;
+  for ( ; (i + 8) <= num_values; i += 8) {
+    const __m512i value =
+        _mm512_and_si512(_mm512_loadu_si512(values + i), value_mask);
+    const __m512d x =
+        _mm512_cvtepu64_pd(_mm512_or_si512(value, significand_mask));
+    const __m512i exponent = _mm512_sub_epi64(
+        _mm512_srli_epi64(_mm512_castpd_si512(x), 52), exponent_bias);
+    const __mmask8 is_large = _mm512_cmpgt_epu64_mask(exponent, ones);
+
+    const __m512i approx = _mm512_or_si512(
+        _mm512_slli_epi64(exponent,
+                          static_cast<unsigned int>(APPROX_EXPONENT_SHIFT)),
+        _mm512_and_si512(_mm512_srlv_epi64(
+            value, _mm512_sub_epi64(exponent, ones)), significand_mask));
+    _mm512_storeu_si512(approxes + i,
+                        _mm512_mask_blend_epi64(is_large, value, approx));
+  }
+  approx_encode_scalar(values + i, num_values - i, approxes + i);
+}
+
+MADOKA_TARGET("avx512f,avx512dq,avx512bw")
+void approx_decode_avx512(const UInt64 *units, UInt64 num_units,
+                          UInt64 table_id, UInt64 *values, UInt64 *masks) {
+  const __m128i table_shift =
+      _mm_cvtsi64_si128(static_cast<long long>(APPROX_SIZE * table_id));
+  const __m512i approx_mask = _mm512_set1_epi64(APPROX_MASK);
+  const __m512i exponent_mask = _mm512_set1_epi64(APPROX_EXPONENT_MASK);
+  const __m512i significand_mask = _mm512_set1_epi64(APPROX_SIGNIFICAND_MASK);
+  const __m512i offset_shift = _mm512_set1_epi64(APPROX_SIGNIFICAND_SIZE - 1);
+  const __m512i ones = _mm512_set1_epi64(1);
+
+  UInt64 i = 0;
+  for ( ; (i + 8) <= num_units; i += 8) {
+    const __m512i approx = _mm512_and_si512(_mm512_srl_epi64(
+        _mm512_loadu_si512(units + i), table_shift), approx_mask);
+    const __m512i exponent = _mm512_and_si512(_mm512_srli_epi64(
+        approx, static_cast<unsigned int>(APPROX_EXPONENT_SHIFT)),
+        exponent_mask);
+    const __m512i significand = _mm512_and_si512(approx, significand_mask);
+    const __mmask8 is_large = _mm512_cmpgt_epu64_mask(exponent, ones);
+    const __m512i shift = _mm512_sub_epi64(exponent, ones);
+
+    const __m512i value = _mm512_or_si512(
+        _mm512_sllv_epi64(ones, _mm512_add_epi64(exponent, offset_shift)),
+        _mm512_sllv_epi64(significand, shift));
+    _mm512_storeu_si512(values + i,
+                        _mm512_mask_blend_epi64(is_large, approx, value));
+    if (masks != NULL) {
+      _mm512_storeu_si512(masks + i, _mm512_maskz_sub_epi64(
+          is_large, _mm512_sllv_epi64(ones, shift), ones));
+    }
+  }
+  approx_decode_scalar(units + i, num_units - i, table_id, values + i,
+                       (masks != NULL) ? (masks + i) : NULL);
+}
+
+MADOKA_TARGET("avx512f,avx512dq,avx512bw")
+void inner_product_avx512(const UInt64 *lhs, const UInt64 *rhs,
+                          UInt64 num_values, double sums[3]) {
+  __m512d inner_product = _mm512_setzero_pd();
+  __m512d lhs_square_length = _mm512_setzero_pd();
+  __m512d rhs_square_length = _mm512_setzero_pd();
+
+  UInt64 i = 0;
+  for ( ; (i + 8) <= num_values; i += 8) {
+    const __m512d lhs_values =
+        _mm512_cvtepu64_pd(_mm512_loadu_si512(lhs + i));
+    const __m512d rhs_values =
+        _mm512_cvtepu64_pd(_mm512_loadu_si512(rhs + i));
+    inner_product = _mm512_fmadd_pd(lhs_values, rhs_values, inner_product);
+    lhs_square_length =
+        _mm512_fmadd_pd(lhs_values, lhs_values, lhs_square_length);
+    rhs_square_length =
+        _mm512_fmadd_pd(rhs_values, rhs_values, rhs_square_length);
+  }
+  sums[0] += _mm512_reduce_add_pd(inner_product);
+  sums[1] += _mm512_reduce_add_pd(lhs_square_length);
+  sums[2] += _mm512_reduce_add_pd(rhs_square_length);
+  inner_product_scalar(lhs + i, rhs + i, num_values - i, sums);
+}
+
+}  // namespace kernels
+}  // namespace madoka
+
+#endif  // MADOKA_KERNEL_X86
@@ -0,0 +1,68 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "kernel-impl.h"
+
+#ifdef MADOKA_KERNEL_X86
+
+#include <immintrin.h>
+
+namespace madoka {
+namespace kernels {
+
+// exact_decode_bmi2() spreads 8 packed values over 8 bytes at once.
+MADOKA_TARGET("bmi2")
+void exact_decode_bmi2(const UInt64 *units, UInt64 cell_id,
+                       UInt64 num_cells, UInt64 value_size, UInt64 *values) {
+  if (value_size >= 8) {
+    exact_decode_scalar(units, cell_id, num_cells, value_size, values);
+    return;
+  }
+
+  UInt64 i = 0;
+  const UInt64 num_head_cells = (8 - (cell_id % 8)) % 8;
+  if (num_head_cells != 0) {
+    i = (num_head_cells < num_cells) ? num_head_cells : num_cells;
+    exact_decode_scalar(units, cell_id, i, value_size, values);
+  }
+
+  const UInt64 value_mask = (1ULL << value_size) - 1;
+  const UInt64 chunk_mask = (1ULL << (value_size * 8)) - 1;
+  const UInt64 byte_mask = 0x0101010101010101ULL * value_mask;
+  for ( ; (i + 8) <= num_cells; i += 8) {
+    const UInt64 bit_id = (cell_id + i) * value_size;
+    const UInt64 chunk = (units[bit_id / 64] >> (bit_id % 64)) & chunk_mask;
+    const UInt64 bytes = _pdep_u64(chunk, byte_mask);
+    for (UInt64 j = 0; j < 8; ++j) {
+      values[i + j] = (bytes >> (j * 8)) & 0xFF;
+    }
+  }
+  exact_decode_scalar(units, cell_id + i, num_cells - i, value_size,
+                      values + i);
+}
+
+}  // namespace kernels
+}  // namespace madoka
+
+#endif  // MADOKA_KERNEL_X86
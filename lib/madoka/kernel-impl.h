@@ -0,0 +1,223 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MADOKA_KERNEL_IMPL_H
+#define MADOKA_KERNEL_IMPL_H
+
+// This header declares the implementations of Kernel entries and is not
+// installed.
+
+#include <cstring>
+
+#include "approx.h"
+#include "kernel.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+ #define MADOKA_KERNEL_X86
+ #define MADOKA_TARGET(features) __attribute__((target(features)))
+#endif  // defined(__GNUC__) && defined(__x86_64__)
+
+namespace madoka {
+namespace kernels {
+
+// load_block() reads the `block_id'-th 16-byte block of a key as 2 words.
+inline void load_block(const void *key_addr, std::size_t block_id,
+                       UInt64 *k1, UInt64 *k2) {
+  const UInt8 * const block =
+      static_cast<const UInt8 *>(key_addr) + (block_id * 16);
+  std::memcpy(k1, block, sizeof(UInt64));
+  std::memcpy(k2, block + sizeof(UInt64), sizeof(UInt64));
+}
+
+// load_tail() reads the last (`key_size' % 16) bytes of a key as 2 words.
+// Missing bytes are filled with 0s. Note that a zero word never changes h1
+// and h2, so the tail words can be mixed unconditionally.
+inline void load_tail(const void *key_addr, std::size_t key_size,
+                      UInt64 *k1, UInt64 *k2) {
+  UInt8 buf[16] = { 0 };
+  if ((key_size & 15) != 0) {
+    std::memcpy(buf, static_cast<const UInt8 *>(key_addr) + (key_size & ~15),
+                key_size & 15);
+  }
+  std::memcpy(k1, buf, sizeof(UInt64));
+  std::memcpy(k2, buf + sizeof(UInt64), sizeof(UInt64));
+}
+
+// plane_inner_product() returns the inner product of the `value_size'-bit
+// values of units `lhs' and `rhs', where `value_size' is 1, 2 or 4. The
+// p-th bit plane of a unit keeps the p-th bit of each value, and the
+// product of two values is the sum of the products of their bit planes.
+inline UInt64 plane_inner_product(UInt64 lhs, UInt64 rhs,
+                                  UInt64 value_size) noexcept {
+  const UInt64 plane_mask = (value_size == 1) ? ~0ULL :
+      ((value_size == 2) ? 0x5555555555555555ULL : 0x1111111111111111ULL);
+  UInt64 inner_product = 0;
+  for (UInt64 p = 0; p < value_size; ++p) {
+    const UInt64 lhs_plane = (lhs >> p) & plane_mask;
+    for (UInt64 q = 0; q < value_size; ++q) {
+      inner_product += util::pop_count(lhs_plane & (rhs >> q)) << (p + q);
+    }
+  }
+  return inner_product;
+}
+
+// exact_inner_product_unit() adds the sums of exact_inner_product() for a
+// pair of units.
+inline void exact_inner_product_unit(UInt64 lhs, UInt64 rhs,
+                                     UInt64 value_size,
+                                     UInt64 sums[3]) noexcept {
+  if (value_size <= 4) {
+    sums[0] += plane_inner_product(lhs, rhs, value_size);
+    sums[1] += plane_inner_product(lhs, lhs, value_size);
+    sums[2] += plane_inner_product(rhs, rhs, value_size);
+    return;
+  }
+  const UInt64 mask = (1ULL << value_size) - 1;
+  for (UInt64 shift = 0; shift < 64; shift += value_size) {
+    const UInt64 x = (lhs >> shift) & mask;
+    const UInt64 y = (rhs >> shift) & mask;
+    sums[0] += x * y;
+    sums[1] += x * x;
+    sums[2] += y * y;
+  }
+}
+
+// MergeLanes describes the values in a unit for max_merge() and
+// min_merge(). `value_bits' and `highest_bits' are the bits of the values
+// and the highest bit of each value. An approx unit keeps the owner bits of
+// its values above them.
+struct MergeLanes {
+  explicit MergeLanes(UInt64 value_size) noexcept
+    : value_bits((value_size == APPROX_SIZE) ?
+                 ((1ULL << (APPROX_SIZE * 3)) - 1) : ~0ULL),
+      highest_bits((value_size == APPROX_SIZE) ?
+                   (((1ULL << (APPROX_SIZE * 3)) - 1) /
+                    APPROX_MASK) << (APPROX_SIZE - 1) :
+                   (~0ULL / ((1ULL << value_size) - 1)) << (value_size - 1)),
+      is_approx(value_size == APPROX_SIZE) {}
+
+  UInt64 value_bits;
+  UInt64 highest_bits;
+  bool is_approx;
+};
+
+// less_lanes() returns the highest bit of each value where x < y. x and y
+// must have 0s out of the values. The values are subtracted without borrows
+// across them, and the borrow out of each value gives the result.
+inline UInt64 less_lanes(UInt64 x, UInt64 y, UInt64 highest_bits) {
+  const UInt64 diff = ((x | highest_bits) - (y & ~highest_bits)) ^
+      (~(x ^ y) & highest_bits);
+  return ((~x & y) | (~(x ^ y) & diff)) & highest_bits;
+}
+
+// approx_owner_shift() returns the distance from the highest bit of the
+// `table_id'-th value of an approx unit to its owner bits.
+inline int approx_owner_shift(UInt64 table_id) {
+  return static_cast<int>(((APPROX_SIZE * 3) + (2 * table_id)) -
+                          ((APPROX_SIZE * (table_id + 1)) - 1));
+}
+
+void hash_scalar(const void * const *key_addrs,
+                 const std::size_t *key_sizes, std::size_t num_keys,
+                 UInt64 seed, UInt64 (*hash_values)[2]);
+void saturated_add_scalar(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                          UInt64 value_size);
+void max_merge_scalar(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                      UInt64 value_size);
+void min_merge_scalar(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                      UInt64 value_size);
+void filter_scalar(UInt64 *units, UInt64 num_units, UInt64 value_size,
+                   UInt64 threshold, UInt64 multiplier, UInt64 shift,
+                   UInt64 max_value);
+void exact_decode_scalar(const UInt64 *units, UInt64 cell_id,
+                         UInt64 num_cells, UInt64 value_size,
+                         UInt64 *values);
+void approx_encode_scalar(const UInt64 *values, UInt64 num_values,
+                          UInt64 *approxes);
+void approx_decode_scalar(const UInt64 *units, UInt64 num_units,
+                          UInt64 table_id, UInt64 *values, UInt64 *masks);
+void inner_product_scalar(const UInt64 *lhs, const UInt64 *rhs,
+                          UInt64 num_values, double sums[3]);
+
+void exact_inner_product_scalar(const UInt64 *lhs, const UInt64 *rhs,
+                                UInt64 num_units, UInt64 value_size,
+                                UInt64 sums[3]);
+
+#ifdef MADOKA_KERNEL_X86
+
+void saturated_add_sse42(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                         UInt64 value_size);
+void max_merge_sse42(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                     UInt64 value_size);
+void min_merge_sse42(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                     UInt64 value_size);
+void filter_sse42(UInt64 *units, UInt64 num_units, UInt64 value_size,
+                  UInt64 threshold, UInt64 multiplier, UInt64 shift,
+                  UInt64 max_value);
+void exact_inner_product_sse42(const UInt64 *lhs, const UInt64 *rhs,
+                               UInt64 num_units, UInt64 value_size,
+                               UInt64 sums[3]);
+
+void exact_decode_bmi2(const UInt64 *units, UInt64 cell_id,
+                       UInt64 num_cells, UInt64 value_size, UInt64 *values);
+
+void hash_avx2(const void * const *key_addrs, const std::size_t *key_sizes,
+               std::size_t num_keys, UInt64 seed, UInt64 (*hash_values)[2]);
+void saturated_add_avx2(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                        UInt64 value_size);
+void max_merge_avx2(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                    UInt64 value_size);
+void min_merge_avx2(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                    UInt64 value_size);
+void filter_avx2(UInt64 *units, UInt64 num_units, UInt64 value_size,
+                 UInt64 threshold, UInt64 multiplier, UInt64 shift,
+                 UInt64 max_value);
+void approx_encode_avx2(const UInt64 *values, UInt64 num_values,
+                        UInt64 *approxes);
+void approx_decode_avx2(const UInt64 *units, UInt64 num_units,
+                        UInt64 table_id, UInt64 *values, UInt64 *masks);
+void inner_product_avx2(const UInt64 *lhs, const UInt64 *rhs,
+                        UInt64 num_values, double sums[3]);
+void exact_inner_product_avx2(const UInt64 *lhs, const UInt64 *rhs,
+                              UInt64 num_units, UInt64 value_size,
+                              UInt64 sums[3]);
+
+void hash_avx512(const void * const *key_addrs,
+                 const std::size_t *key_sizes, std::size_t num_keys,
+                 UInt64 seed, UInt64 (*hash_values)[2]);
+void saturated_add_avx512(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                          UInt64 value_size);
+void approx_encode_avx512(const UInt64 *values, UInt64 num_values,
+                          UInt64 *approxes);
+void approx_decode_avx512(const UInt64 *units, UInt64 num_units,
+                          UInt64 table_id, UInt64 *values, UInt64 *masks);
+void inner_product_avx512(const UInt64 *lhs, const UInt64 *rhs,
+                          UInt64 num_values, double sums[3]);
+
+#endif  // MADOKA_KERNEL_X86
+
+}  // namespace kernels
+}  // namespace madoka
+
+#endif  // MADOKA_KERNEL_IMPL_H
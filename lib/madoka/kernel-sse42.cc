@@ -0,0 +1,203 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "kernel-impl.h"
+
+#ifdef MADOKA_KERNEL_X86
+
+#include <immintrin.h>
+
+namespace madoka {
+namespace kernels {
+
+MADOKA_TARGET("sse4.2")
+void saturated_add_sse42(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                         UInt64 value_size) {
+  if ((value_size != 8) && (value_size != 16)) {
+    saturated_add_scalar(lhs, rhs, num_units, value_size);
+    return;
+  }
+
+  UInt64 i = 0;
+  for ( ; (i + 2) <= num_units; i += 2) {
+    __m128i *const lhs_units = reinterpret_cast<__m128i *>(lhs + i);
+    const __m128i x = _mm_loadu_si128(lhs_units);
+    const __m128i y =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs + i));
+    _mm_storeu_si128(lhs_units, (value_size == 8) ?
+        _mm_adds_epu8(x, y) : _mm_adds_epu16(x, y));
+  }
+  saturated_add_scalar(lhs + i, rhs + i, num_units - i, value_size);
+}
+
+MADOKA_TARGET("sse4.2")
+void max_merge_sse42(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                     UInt64 value_size) {
+  if ((value_size != 8) && (value_size != 16)) {
+    max_merge_scalar(lhs, rhs, num_units, value_size);
+    return;
+  }
+
+  UInt64 i = 0;
+  for ( ; (i + 2) <= num_units; i += 2) {
+    __m128i * const lhs_units = reinterpret_cast<__m128i *>(lhs + i);
+    const __m128i x = _mm_loadu_si128(lhs_units);
+    const __m128i y =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs + i));
+    _mm_storeu_si128(lhs_units, (value_size == 8) ?
+        _mm_max_epu8(x, y) : _mm_max_epu16(x, y));
+  }
+  max_merge_scalar(lhs + i, rhs + i, num_units - i, value_size);
+}
+
+MADOKA_TARGET("sse4.2")
+void min_merge_sse42(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                     UInt64 value_size) {
+  if ((value_size != 8) && (value_size != 16)) {
+    min_merge_scalar(lhs, rhs, num_units, value_size);
+    return;
+  }
+
+  UInt64 i = 0;
+  for ( ; (i + 2) <= num_units; i += 2) {
+    __m128i * const lhs_units = reinterpret_cast<__m128i *>(lhs + i);
+    const __m128i x = _mm_loadu_si128(lhs_units);
+    const __m128i y =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs + i));
+    _mm_storeu_si128(lhs_units, (value_size == 8) ?
+        _mm_min_epu8(x, y) : _mm_min_epu16(x, y));
+  }
+  min_merge_scalar(lhs + i, rhs + i, num_units - i, value_size);
+}
+
+namespace {
+
+// filter_epi32() filters 4 values in 32-bit lanes. The values and the
+// threshold do not exceed 2^16, so a signed comparison is safe.
+MADOKA_TARGET("sse4.2")
+inline __m128i filter_epi32(__m128i values, __m128i threshold,
+                            __m128i multiplier, __m128i shift,
+                            __m128i max_value) {
+  const __m128i is_small = _mm_cmpgt_epi32(threshold, values);
+  const __m128i results = _mm_min_epu32(
+      _mm_srl_epi32(_mm_mullo_epi32(values, multiplier), shift), max_value);
+  return _mm_andnot_si128(is_small, results);
+}
+
+}  // namespace
+
+// filter_sse42() widens values to 32-bit lanes, where the products never
+// overflow, and packs the results back. Unpacking and packing keep the
+// order of values.
+MADOKA_TARGET("sse4.2")
+void filter_sse42(UInt64 *units, UInt64 num_units, UInt64 value_size,
+                  UInt64 threshold, UInt64 multiplier, UInt64 shift,
+                  UInt64 max_value) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i threshold_lanes =
+      _mm_set1_epi32(static_cast<int>(threshold));
+  const __m128i multiplier_lanes =
+      _mm_set1_epi32(static_cast<int>(multiplier));
+  const __m128i shift_count = _mm_cvtsi64_si128(static_cast<long long>(shift));
+  const __m128i max_value_lanes = _mm_set1_epi32(static_cast<int>(max_value));
+
+  UInt64 i = 0;
+  for ( ; (i + 2) <= num_units; i += 2) {
+    __m128i * const block = reinterpret_cast<__m128i *>(units + i);
+    const __m128i x = _mm_loadu_si128(block);
+    __m128i words[2];
+    if (value_size == 8) {
+      words[0] = _mm_unpacklo_epi8(x, zero);
+      words[1] = _mm_unpackhi_epi8(x, zero);
+    } else {
+      words[0] = x;
+    }
+    const UInt64 num_words = (value_size == 8) ? 2 : 1;
+    for (UInt64 j = 0; j < num_words; ++j) {
+      const __m128i lo = filter_epi32(_mm_unpacklo_epi16(words[j], zero),
+                                      threshold_lanes, multiplier_lanes,
+                                      shift_count, max_value_lanes);
+      const __m128i hi = filter_epi32(_mm_unpackhi_epi16(words[j], zero),
+                                      threshold_lanes, multiplier_lanes,
+                                      shift_count, max_value_lanes);
+      words[j] = _mm_packus_epi32(lo, hi);
+    }
+    _mm_storeu_si128(block, (value_size == 8) ?
+        _mm_packus_epi16(words[0], words[1]) : words[0]);
+  }
+  filter_scalar(units + i, num_units - i, value_size, threshold, multiplier,
+                shift, max_value);
+}
+
+// exact_inner_product_sse42() counts the bit planes of 1, 2 and 4-bit values
+// with POPCNT. 8-bit values are widened to 16-bit lanes and multiplied into
+// 32-bit lanes, which are widened again before they overflow.
+MADOKA_TARGET("sse4.2,popcnt")
+void exact_inner_product_sse42(const UInt64 *lhs, const UInt64 *rhs,
+                               UInt64 num_units, UInt64 value_size,
+                               UInt64 sums[3]) {
+  if (value_size != 8) {
+    for (UInt64 i = 0; i < num_units; ++i) {
+      exact_inner_product_unit(lhs[i], rhs[i], value_size, sums);
+    }
+    return;
+  }
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i low_mask = _mm_set1_epi64x(0xFFFFFFFFLL);
+  __m128i lane_sums[3] = { zero, zero, zero };
+  UInt64 i = 0;
+  for ( ; (i + 2) <= num_units; i += 2) {
+    const __m128i x =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(lhs + i));
+    const __m128i y =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs + i));
+    const __m128i x_lo = _mm_unpacklo_epi8(x, zero);
+    const __m128i x_hi = _mm_unpackhi_epi8(x, zero);
+    const __m128i y_lo = _mm_unpacklo_epi8(y, zero);
+    const __m128i y_hi = _mm_unpackhi_epi8(y, zero);
+    const __m128i products[3] = {
+      _mm_add_epi32(_mm_madd_epi16(x_lo, y_lo), _mm_madd_epi16(x_hi, y_hi)),
+      _mm_add_epi32(_mm_madd_epi16(x_lo, x_lo), _mm_madd_epi16(x_hi, x_hi)),
+      _mm_add_epi32(_mm_madd_epi16(y_lo, y_lo), _mm_madd_epi16(y_hi, y_hi))
+    };
+    for (int j = 0; j < 3; ++j) {
+      lane_sums[j] = _mm_add_epi64(lane_sums[j], _mm_add_epi64(
+          _mm_and_si128(products[j], low_mask),
+          _mm_srli_epi64(products[j], 32)));
+    }
+  }
+  for (int j = 0; j < 3; ++j) {
+    UInt64 values[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(values), lane_sums[j]);
+    sums[j] += values[0] + values[1];
+  }
+  exact_inner_product_scalar(lhs + i, rhs + i, num_units - i, value_size,
+                             sums);
+}
+
+}  // namespace kernels
+}  // namespace madoka
+
+#endif  // MADOKA_KERNEL_X86
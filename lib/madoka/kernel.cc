@@ -0,0 +1,287 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "kernel-impl.h"
+
+#include "approx.h"
+#include "hash.h"
+
+extern "C" {
+
+int madoka_get_cpu_features(void) {
+  return madoka::cpu_features();
+}
+
+void madoka_set_cpu_features(int features) {
+  madoka::set_cpu_features(features);
+}
+
+}  // extern "C"
+
+namespace madoka {
+namespace kernels {
+
+void hash_scalar(const void * const *key_addrs,
+                 const std::size_t *key_sizes, std::size_t num_keys,
+                 UInt64 seed, UInt64 (*hash_values)[2]) {
+  for (std::size_t i = 0; i < num_keys; ++i) {
+    Hash()(key_addrs[i], key_sizes[i], seed, hash_values[i]);
+  }
+}
+
+// saturated_add_scalar() adds all the values in a unit at once. The sums of
+// the lower bits never carry into the next value, and then the carries out
+// of the highest bits are spread over the overflowed values.
+void saturated_add_scalar(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                          UInt64 value_size) {
+  const UInt64 lowest_bits = ~0ULL / ((1ULL << value_size) - 1);
+  const UInt64 highest_bits = lowest_bits << (value_size - 1);
+  const UInt64 value_mask = (1ULL << value_size) - 1;
+  for (UInt64 i = 0; i < num_units; ++i) {
+    const UInt64 x = lhs[i];
+    const UInt64 y = rhs[i];
+    const UInt64 sum = ((x & ~highest_bits) + (y & ~highest_bits)) ^
+        ((x ^ y) & highest_bits);
+    const UInt64 carries = ((x & y) | ((x | y) & ~sum)) & highest_bits;
+    lhs[i] = sum | ((carries >> (value_size - 1)) * value_mask);
+  }
+}
+
+namespace {
+
+// select_merge() takes the values of `rhs' where they are larger (IS_MAX)
+// or smaller (!IS_MAX) than the values of `lhs'. Each selected value is
+// expanded from its highest bit to a mask of the value.
+template <bool IS_MAX>
+void select_merge(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                  UInt64 value_size) {
+  const MergeLanes lanes(value_size);
+  for (UInt64 i = 0; i < num_units; ++i) {
+    const UInt64 x = lhs[i] & lanes.value_bits;
+    const UInt64 y = rhs[i] & lanes.value_bits;
+    const UInt64 selected = IS_MAX ? less_lanes(x, y, lanes.highest_bits) :
+        less_lanes(y, x, lanes.highest_bits);
+    UInt64 mask = (selected << 1) - (selected >> (value_size - 1));
+    if (lanes.is_approx) {
+      UInt64 owner_mask = 0;
+      for (UInt64 table_id = 0; table_id < 3; ++table_id) {
+        owner_mask |= (selected & (1ULL << ((APPROX_SIZE * (table_id + 1)) -
+            1))) << approx_owner_shift(table_id);
+      }
+      mask |= owner_mask | (owner_mask << 1);
+    }
+    lhs[i] = (lhs[i] & ~mask) | (rhs[i] & mask);
+  }
+}
+
+template <typename T>
+void filter_values(T *values, UInt64 num_values, UInt64 threshold,
+                   UInt64 multiplier, UInt64 shift, UInt64 max_value) {
+  for (UInt64 i = 0; i < num_values; ++i) {
+    const UInt64 value = values[i];
+    const UInt64 result =
+        (value < threshold) ? 0 : ((value * multiplier) >> shift);
+    values[i] = static_cast<T>((result < max_value) ? result : max_value);
+  }
+}
+
+}  // namespace
+
+void max_merge_scalar(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                      UInt64 value_size) {
+  select_merge<true>(lhs, rhs, num_units, value_size);
+}
+
+void min_merge_scalar(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                      UInt64 value_size) {
+  select_merge<false>(lhs, rhs, num_units, value_size);
+}
+
+void filter_scalar(UInt64 *units, UInt64 num_units, UInt64 value_size,
+                   UInt64 threshold, UInt64 multiplier, UInt64 shift,
+                   UInt64 max_value) {
+  if (value_size == 8) {
+    filter_values(reinterpret_cast<UInt8 *>(units), num_units * 8,
+                  threshold, multiplier, shift, max_value);
+  } else {
+    filter_values(reinterpret_cast<UInt16 *>(units), num_units * 4,
+                  threshold, multiplier, shift, max_value);
+  }
+}
+
+void exact_decode_scalar(const UInt64 *units, UInt64 cell_id,
+                         UInt64 num_cells, UInt64 value_size,
+                         UInt64 *values) {
+  const UInt64 value_mask = (1ULL << value_size) - 1;
+  for (UInt64 i = 0; i < num_cells; ++i) {
+    const UInt64 bit_id = (cell_id + i) * value_size;
+    values[i] = (units[bit_id / 64] >> (bit_id % 64)) & value_mask;
+  }
+}
+
+void approx_encode_scalar(const UInt64 *values, UInt64 num_values,
+                          UInt64 *approxes) {
+  for (UInt64 i = 0; i < num_values; ++i) {
+    approxes[i] = Approx::encode(values[i]);
+  }
+}
+
+void approx_decode_scalar(const UInt64 *units, UInt64 num_units,
+                          UInt64 table_id, UInt64 *values, UInt64 *masks) {
+  for (UInt64 i = 0; i < num_units; ++i) {
+    const UInt64 approx = (units[i] >> (APPROX_SIZE * table_id)) & APPROX_MASK;
+    values[i] = Approx::decode(approx);
+    if (masks != NULL) {
+      const UInt64 exponent =
+          (approx >> APPROX_EXPONENT_SHIFT) & APPROX_EXPONENT_MASK;
+      masks[i] = (exponent <= 1) ? 0 : ((1ULL << (exponent - 1)) - 1);
+    }
+  }
+}
+
+void inner_product_scalar(const UInt64 *lhs, const UInt64 *rhs,
+                          UInt64 num_values, double sums[3]) {
+  for (UInt64 i = 0; i < num_values; ++i) {
+    const double lhs_value = static_cast<double>(lhs[i]);
+    const double rhs_value = static_cast<double>(rhs[i]);
+    sums[0] += lhs_value * rhs_value;
+    sums[1] += lhs_value * lhs_value;
+    sums[2] += rhs_value * rhs_value;
+  }
+}
+
+void exact_inner_product_scalar(const UInt64 *lhs, const UInt64 *rhs,
+                                UInt64 num_units, UInt64 value_size,
+                                UInt64 sums[3]) {
+  for (UInt64 i = 0; i < num_units; ++i) {
+    exact_inner_product_unit(lhs[i], rhs[i], value_size, sums);
+  }
+}
+
+}  // namespace kernels
+
+namespace {
+
+int detect_cpu_features() noexcept {
+  int features = 0;
+#ifdef MADOKA_KERNEL_X86
+  __builtin_cpu_init();
+  // Every CPU with SSE4.2 has POPCNT, which the SSE4.2 kernels also use.
+  if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+    features |= CPU_SSE42;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    features |= CPU_AVX2;
+  }
+  if (__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512dq") &&
+      __builtin_cpu_supports("avx512bw")) {
+    features |= CPU_AVX512;
+  }
+  if (__builtin_cpu_supports("bmi2")) {
+    features |= CPU_BMI2;
+  }
+#endif  // MADOKA_KERNEL_X86
+  return features;
+}
+
+Kernel select_kernel(int features) noexcept {
+  Kernel kernel = {
+    kernels::hash_scalar,
+    kernels::saturated_add_scalar,
+    kernels::max_merge_scalar,
+    kernels::min_merge_scalar,
+    kernels::filter_scalar,
+    kernels::exact_decode_scalar,
+    kernels::approx_encode_scalar,
+    kernels::approx_decode_scalar,
+    kernels::inner_product_scalar,
+    kernels::exact_inner_product_scalar
+  };
+#ifdef MADOKA_KERNEL_X86
+  if (features & CPU_SSE42) {
+    kernel.saturated_add = kernels::saturated_add_sse42;
+    kernel.max_merge = kernels::max_merge_sse42;
+    kernel.min_merge = kernels::min_merge_sse42;
+    kernel.filter = kernels::filter_sse42;
+    kernel.exact_inner_product = kernels::exact_inner_product_sse42;
+  }
+  if (features & CPU_BMI2) {
+    kernel.exact_decode = kernels::exact_decode_bmi2;
+  }
+  if (features & CPU_AVX2) {
+    kernel.hash = kernels::hash_avx2;
+    kernel.saturated_add = kernels::saturated_add_avx2;
+    kernel.max_merge = kernels::max_merge_avx2;
+    kernel.min_merge = kernels::min_merge_avx2;
+    kernel.filter = kernels::filter_avx2;
+    kernel.approx_encode = kernels::approx_encode_avx2;
+    kernel.approx_decode = kernels::approx_decode_avx2;
+    kernel.inner_product = kernels::inner_product_avx2;
+    kernel.exact_inner_product = kernels::exact_inner_product_avx2;
+  }
+  if (features & CPU_AVX512) {
+    kernel.hash = kernels::hash_avx512;
+    kernel.saturated_add = kernels::saturated_add_avx512;
+    kernel.approx_encode = kernels::approx_encode_avx512;
+    kernel.approx_decode = kernels::approx_decode_avx512;
+    kernel.inner_product = kernels::inner_product_avx512;
+  }
+#else  // MADOKA_KERNEL_X86
+  static_cast<void>(features);
+#endif  // MADOKA_KERNEL_X86
+  return kernel;
+}
+
+int detected_cpu_features() noexcept {
+  static const int features = detect_cpu_features();
+  return features;
+}
+
+int &current_cpu_features() noexcept {
+  static int features = detected_cpu_features();
+  return features;
+}
+
+Kernel &current_kernel() noexcept {
+  static Kernel kernel = select_kernel(current_cpu_features());
+  return kernel;
+}
+
+}  // namespace
+
+int cpu_features() noexcept {
+  return current_cpu_features();
+}
+
+void set_cpu_features(int features) noexcept {
+  current_cpu_features() = features & detected_cpu_features();
+  current_kernel() = select_kernel(current_cpu_features());
+}
+
+const Kernel &kernel() noexcept {
+  return current_kernel();
+}
+
+}  // namespace madoka
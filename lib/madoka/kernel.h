@@ -0,0 +1,144 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MADOKA_KERNEL_H
+#define MADOKA_KERNEL_H
+
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+typedef enum {
+  MADOKA_CPU_SSE42  = 1 << 0,
+  MADOKA_CPU_AVX2   = 1 << 1,
+  MADOKA_CPU_AVX512 = 1 << 2,
+  MADOKA_CPU_BMI2   = 1 << 3
+} madoka_cpu_feature;
+
+int madoka_get_cpu_features(void);
+void madoka_set_cpu_features(int features);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif  // __cplusplus
+
+#ifdef __cplusplus
+namespace madoka {
+
+// CPU_AVX512 stands for AVX-512F, AVX-512DQ and AVX-512BW.
+enum CpuFeature {
+  CPU_SSE42  = MADOKA_CPU_SSE42,
+  CPU_AVX2   = MADOKA_CPU_AVX2,
+  CPU_AVX512 = MADOKA_CPU_AVX512,
+  CPU_BMI2   = MADOKA_CPU_BMI2
+};
+
+const int CPU_ALL_FEATURES =
+    CPU_SSE42 | CPU_AVX2 | CPU_AVX512 | CPU_BMI2;
+
+// Kernel is a table of the hot loops of libmadoka. Every entry has a scalar
+// implementation and kernel() returns the table specialized for the CPU
+// features detected at load time. All the implementations of an entry give
+// the same results, except that inner_product() may round differently.
+struct Kernel {
+  // hash() computes the hash values of `num_keys' keys. See also Hash.
+  void (*hash)(const void * const *key_addrs, const std::size_t *key_sizes,
+               std::size_t num_keys, UInt64 seed,
+               UInt64 (*hash_values)[2]);
+
+  // saturated_add() adds `rhs' to `lhs', where both of them are arrays of
+  // `num_units' units that consist of `value_size'-bit values. Each sum
+  // saturates at the maximum value. `value_size' must be 8 or 16.
+  void (*saturated_add)(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                        UInt64 value_size);
+
+  // max_merge() and min_merge() replace each value of `lhs' with the larger
+  // or the smaller of it and the value of `rhs', where both of them are
+  // arrays of `num_units' units. `value_size' must be 1, 2, 4, 8 or 16, or
+  // APPROX_SIZE for the units of an approx sketch, which have 3 values and
+  // the owner bits of each value. The owner bits of a value from `rhs' come
+  // from `rhs' too.
+  void (*max_merge)(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                    UInt64 value_size);
+  void (*min_merge)(UInt64 *lhs, const UInt64 *rhs, UInt64 num_units,
+                    UInt64 value_size);
+
+  // filter() maps each `value_size'-bit value v of `num_units' units to 0 if
+  // v < `threshold', and to min((v * `multiplier') >> `shift', `max_value')
+  // otherwise. `value_size' must be 8 or 16, `threshold' and `multiplier'
+  // must not exceed 2^16, and `shift' must not exceed 32.
+  void (*filter)(UInt64 *units, UInt64 num_units, UInt64 value_size,
+                 UInt64 threshold, UInt64 multiplier, UInt64 shift,
+                 UInt64 max_value);
+
+  // exact_decode() reads `num_cells' `value_size'-bit values from the
+  // `cell_id'-th cell of `units'. `value_size' must be 1, 2, 4, 8 or 16.
+  void (*exact_decode)(const UInt64 *units, UInt64 cell_id, UInt64 num_cells,
+                       UInt64 value_size, UInt64 *values);
+
+  // approx_encode() encodes `num_values' values as Approx::encode() does.
+  // `approxes' may be `values'.
+  void (*approx_encode)(const UInt64 *values, UInt64 num_values,
+                        UInt64 *approxes);
+
+  // approx_decode() decodes the `table_id'-th approximate values of
+  // `num_units' units. The lower bits of a value are lost in encoding, so
+  // approx_decode() also returns a mask of the lost bits per value unless
+  // `masks' is NULL. A caller fills them with random bits, as
+  // Approx::decode(approx, random) does.
+  void (*approx_decode)(const UInt64 *units, UInt64 num_units,
+                        UInt64 table_id, UInt64 *values, UInt64 *masks);
+
+  // inner_product() adds the inner product of `lhs' and `rhs', and the square
+  // lengths of `lhs' and `rhs' to `sums'. Values must be less than 2^52.
+  void (*inner_product)(const UInt64 *lhs, const UInt64 *rhs,
+                        UInt64 num_values, double sums[3]);
+
+  // exact_inner_product() adds the inner product of the values of `lhs' and
+  // `rhs', and the square lengths of them to `sums', where both of them are
+  // arrays of `num_units' units that consist of `value_size'-bit values.
+  // `value_size' must be 1, 2, 4, 8 or 16. The values are never decoded and
+  // the sums are exact.
+  void (*exact_inner_product)(const UInt64 *lhs, const UInt64 *rhs,
+                              UInt64 num_units, UInt64 value_size,
+                              UInt64 sums[3]);
+};
+
+// cpu_features() returns the features that kernel() uses.
+int cpu_features() noexcept;
+
+// set_cpu_features() makes kernel() use only `features' out of the detected
+// features. set_cpu_features(CPU_ALL_FEATURES) restores the default. This
+// function is for testing and benchmarking and must not be called while any
+// other thread uses libmadoka.
+void set_cpu_features(int features) noexcept;
+
+const Kernel &kernel() noexcept;
+
+}  // namespace madoka
+#endif  // __cplusplus
+
+#endif  // MADOKA_KERNEL_H
@@ -84,6 +84,38 @@ class Random {
   UInt32 w_;
 };
 
+// CounterRandom is a counter-based generator. The n-th number of a stream is
+// a SplitMix64 hash of `key' and `counter' + n, so a stream has no state to
+// share and the same key and counter always give the same numbers.
+class CounterRandom {
+ public:
+  CounterRandom(UInt64 key, UInt64 counter) noexcept
+    : key_(key), counter_(counter) {}
+  ~CounterRandom() noexcept {}
+
+  UInt32 operator()() noexcept {
+    UInt64 x = key_ + (++counter_ * 0x9E3779B97F4A7C15ULL);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return static_cast<UInt32>((x ^ (x >> 31)) >> 32);
+  }
+
+  UInt32 operator()(UInt32 x) noexcept {
+    return operator()() % x;
+  }
+
+  UInt64 key() const noexcept {
+    return key_;
+  }
+  UInt64 counter() const noexcept {
+    return counter_;
+  }
+
+ private:
+  UInt64 key_;
+  UInt64 counter_;
+};
+
 }  // namespace madoka
 #endif  // __cplusplus
 
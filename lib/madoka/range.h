@@ -0,0 +1,106 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MADOKA_RANGE_H
+#define MADOKA_RANGE_H
+
+#include "util.h"
+
+#ifdef __cplusplus
+namespace madoka {
+
+// Range maps IDs to [0, size()). Sketch and Croquis use it to map hash
+// IDs to cells and IDs must be less than 2^48.
+//
+// If `fast' is true, Range scales an `id_size'-bit ID by size() with a
+// multiplication ("fastrange"), so an ID goes to cell (ID * size()) >>
+// `id_size'. Otherwise, Range gives ID % size(), which is the mapping of
+// sketches created without the fast range flag. The remainder is computed
+// with a mask if size() is a power of two, or with a precomputed
+// reciprocal instead of a division.
+class Range {
+ public:
+  Range() noexcept
+    : size_(1), mask_(0), shift_(0), reciprocal_(1.0), fast_(false) {}
+  ~Range() noexcept {}
+
+  Range(const Range &range) noexcept
+    : size_(range.size_), mask_(range.mask_), shift_(range.shift_),
+      reciprocal_(range.reciprocal_), fast_(range.fast_) {}
+
+  Range &operator=(const Range &rhs) noexcept {
+    size_ = rhs.size_;
+    mask_ = rhs.mask_;
+    shift_ = rhs.shift_;
+    reciprocal_ = rhs.reciprocal_;
+    fast_ = rhs.fast_;
+    return *this;
+  }
+
+  void reset(UInt64 size, UInt64 id_size, bool fast) noexcept {
+    size_ = size;
+    mask_ = ((size & (size - 1)) == 0) ? (size - 1) : 0;
+    shift_ = 64 - id_size;
+    reciprocal_ = 1.0 / static_cast<double>(size);
+    fast_ = fast;
+  }
+
+  UInt64 size() const noexcept {
+    return size_;
+  }
+  bool fast() const noexcept {
+    return fast_;
+  }
+
+  UInt64 operator()(UInt64 id) const noexcept {
+    if (fast_) {
+      return util::mul_high(id << shift_, size_);
+    } else if (mask_ != 0) {
+      return id & mask_;
+    }
+
+    // The estimated quotient is off by at most 1 because ID < 2^48.
+    const UInt64 quotient = static_cast<UInt64>(static_cast<long long>(
+        static_cast<double>(static_cast<long long>(id)) * reciprocal_));
+    UInt64 remainder = id - (quotient * size_);
+    if (static_cast<long long>(remainder) < 0) {
+      remainder += size_;
+    } else if (remainder >= size_) {
+      remainder -= size_;
+    }
+    return remainder;
+  }
+
+ private:
+  UInt64 size_;
+  UInt64 mask_;
+  UInt64 shift_;
+  double reciprocal_;
+  bool fast_;
+};
+
+}  // namespace madoka
+#endif  // __cplusplus
+
+#endif  // MADOKA_RANGE_H
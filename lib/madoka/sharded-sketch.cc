@@ -0,0 +1,117 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "sharded-sketch.h"
+
+#include <new>
+
+namespace madoka {
+
+ShardedSketch::ShardedSketch() noexcept
+  : master_(), shards_(NULL), num_shards_(0) {}
+
+ShardedSketch::~ShardedSketch() noexcept {
+  delete [] shards_;
+}
+
+void ShardedSketch::create(UInt64 num_shards, UInt64 width,
+                           UInt64 max_value, const char *path, int flags,
+                           UInt64 seed) {
+  ShardedSketch new_sketch;
+  new_sketch.master_.create(width, max_value, path, flags, seed);
+  new_sketch.create_shards_(num_shards, flags);
+  new_sketch.swap(this);
+}
+
+void ShardedSketch::open(UInt64 num_shards, const char *path, int flags) {
+  ShardedSketch new_sketch;
+  new_sketch.master_.open(path, flags);
+  new_sketch.create_shards_(num_shards, flags);
+  new_sketch.swap(this);
+}
+
+void ShardedSketch::load(UInt64 num_shards, const char *path, int flags) {
+  ShardedSketch new_sketch;
+  new_sketch.master_.load(path, flags);
+  new_sketch.create_shards_(num_shards, flags);
+  new_sketch.swap(this);
+}
+
+void ShardedSketch::close() noexcept {
+  ShardedSketch().swap(this);
+}
+
+UInt64 ShardedSketch::get_live(const void *key_addr,
+                               std::size_t key_size) const noexcept {
+  const KeyHash key_hash = master_.hash(key_addr, key_size);
+  const UInt64 max_value = master_.max_value();
+  UInt64 value = master_.get(key_hash);
+  for (UInt64 i = 0; i < num_shards_; ++i) {
+    const UInt64 shard_value = shards_[i].get(key_hash);
+    value = ((max_value - value) > shard_value) ?
+        (value + shard_value) : max_value;
+  }
+  return value;
+}
+
+void ShardedSketch::sync() {
+  for (UInt64 i = 0; i < num_shards_; ++i) {
+    sync(i);
+  }
+}
+
+void ShardedSketch::sync(UInt64 shard_id) {
+  MADOKA_THROW_IF(shard_id >= num_shards_);
+  master_.merge(shards_[shard_id]);
+  shards_[shard_id].clear();
+}
+
+void ShardedSketch::swap(ShardedSketch *sketch) noexcept {
+  master_.swap(&sketch->master_);
+  util::swap(shards_, sketch->shards_);
+  util::swap(num_shards_, sketch->num_shards_);
+}
+
+// create_shards_() creates in-memory shards that can be merged into the
+// master. The shards take the layout of the master and the flags of a sketch
+// object, such as SKETCH_CONCURRENT. SKETCH_HOT_TIER and SKETCH_TOP_K are left
+// to the master, which keeps its hot keys across sync().
+void ShardedSketch::create_shards_(UInt64 num_shards, int flags) {
+  MADOKA_THROW_IF(num_shards < SHARDED_SKETCH_MIN_NUM_SHARDS);
+  MADOKA_THROW_IF(num_shards > SHARDED_SKETCH_MAX_NUM_SHARDS);
+
+  shards_ = new (std::nothrow) Sketch[num_shards];
+  MADOKA_THROW_IF(shards_ == NULL);
+  num_shards_ = num_shards;
+
+  const int shard_flags =
+      (master_.flags() & (SKETCH_BLOCKED_LAYOUT | SKETCH_FAST_RANGE)) |
+      (flags & SKETCH_OBJECT_FLAGS);
+  for (UInt64 i = 0; i < num_shards_; ++i) {
+    shards_[i].create(master_.width(), master_.max_value(), NULL,
+                      shard_flags, master_.seed());
+  }
+}
+
+}  // namespace madoka
@@ -0,0 +1,107 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MADOKA_SHARDED_SKETCH_H
+#define MADOKA_SHARDED_SKETCH_H
+
+#include "sketch.h"
+
+#ifdef __cplusplus
+namespace madoka {
+
+const UInt64 SHARDED_SKETCH_MIN_NUM_SHARDS = 1;
+const UInt64 SHARDED_SKETCH_MAX_NUM_SHARDS = 1024;
+
+// ShardedSketch gives each writer thread a private shard, which is an
+// in-memory sketch with the same shape and seed as the master sketch. A
+// writer updates only its own shard, so writers never contend. sync()
+// folds the shards into the master with Sketch::merge() and clears them.
+//
+// Queries go to the master, or to the master and the shards with
+// get_live(). sync() must not run concurrently with any update or query,
+// and the caller must serialize it, for example at the end of each batch.
+class ShardedSketch {
+ public:
+  ShardedSketch() noexcept;
+  ~ShardedSketch() noexcept;
+
+  // create() creates a master sketch as Sketch::create() does, and
+  // `num_shards' shards with the same width, max_value, layout and seed.
+  // Only the master keeps a hot tier or top keys.
+  void create(UInt64 num_shards, UInt64 width = 0, UInt64 max_value = 0,
+              const char *path = NULL, int flags = 0, UInt64 seed = 0);
+  // open() and load() use an existing sketch as the master.
+  void open(UInt64 num_shards, const char *path, int flags = 0);
+  void load(UInt64 num_shards, const char *path, int flags = 0);
+  void close() noexcept;
+
+  UInt64 num_shards() const noexcept {
+    return num_shards_;
+  }
+
+  Sketch &master() noexcept {
+    return master_;
+  }
+  const Sketch &master() const noexcept {
+    return master_;
+  }
+
+  Sketch &shard(UInt64 shard_id) noexcept {
+    return shards_[shard_id];
+  }
+  const Sketch &shard(UInt64 shard_id) const noexcept {
+    return shards_[shard_id];
+  }
+
+  // get() returns the value of a key in the master, which does not include
+  // the updates after the last sync(). get_live() also adds the values in
+  // the shards.
+  UInt64 get(const void *key_addr, std::size_t key_size) const noexcept {
+    return master_.get(key_addr, key_size);
+  }
+  UInt64 get_live(const void *key_addr, std::size_t key_size) const noexcept;
+
+  // sync() merges all the shards into the master. sync(shard_id) merges
+  // only the specified shard.
+  void sync();
+  void sync(UInt64 shard_id);
+
+  void swap(ShardedSketch *sketch) noexcept;
+
+ private:
+  Sketch master_;
+  Sketch *shards_;
+  UInt64 num_shards_;
+
+  void create_shards_(UInt64 num_shards, int flags);
+
+  // Disallows copy and assignment.
+  ShardedSketch(const ShardedSketch &);
+  ShardedSketch &operator=(const ShardedSketch &);
+};
+
+}  // namespace madoka
+#endif  // __cplusplus
+
+#endif  // MADOKA_SHARDED_SKETCH_H
@@ -0,0 +1,115 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "sketch-group.h"
+
+namespace madoka {
+
+SketchGroup::SketchGroup() noexcept : sketches_(), size_(0) {}
+
+SketchGroup::~SketchGroup() noexcept {}
+
+void SketchGroup::insert(Sketch *sketch) {
+  MADOKA_THROW_IF(sketch == NULL);
+  MADOKA_THROW_IF(size_ >= SKETCH_GROUP_MAX_SIZE);
+  MADOKA_THROW_IF(!empty() && (sketch->seed() != seed()));
+  MADOKA_THROW_IF(sketch->flags() & SKETCH_TOP_K);
+
+  sketches_[size_++] = sketch;
+}
+
+void SketchGroup::clear() noexcept {
+  size_ = 0;
+}
+
+void SketchGroup::get(const void *key_addr, std::size_t key_size,
+                      UInt64 *values) const noexcept {
+  get(hash(key_addr, key_size), values);
+}
+
+void SketchGroup::set(const void *key_addr, std::size_t key_size,
+                      UInt64 value) noexcept {
+  set(hash(key_addr, key_size), value);
+}
+
+void SketchGroup::inc(const void *key_addr, std::size_t key_size,
+                      UInt64 *values) noexcept {
+  inc(hash(key_addr, key_size), values);
+}
+
+void SketchGroup::add(const void *key_addr, std::size_t key_size,
+                      UInt64 value, UInt64 *values) noexcept {
+  add(hash(key_addr, key_size), value, values);
+}
+
+void SketchGroup::get(const KeyHash &key_hash,
+                      UInt64 *values) const noexcept {
+  UInt64 cell_ids[SKETCH_GROUP_MAX_SIZE][3];
+  locate_(key_hash, cell_ids);
+  for (std::size_t i = 0; i < size_; ++i) {
+    values[i] = sketches_[i]->get_at_(cell_ids[i]);
+  }
+}
+
+void SketchGroup::set(const KeyHash &key_hash, UInt64 value) noexcept {
+  UInt64 cell_ids[SKETCH_GROUP_MAX_SIZE][3];
+  locate_(key_hash, cell_ids);
+  for (std::size_t i = 0; i < size_; ++i) {
+    sketches_[i]->set_at_(cell_ids[i], value);
+  }
+}
+
+void SketchGroup::inc(const KeyHash &key_hash, UInt64 *values) noexcept {
+  UInt64 cell_ids[SKETCH_GROUP_MAX_SIZE][3];
+  locate_(key_hash, cell_ids);
+  for (std::size_t i = 0; i < size_; ++i) {
+    const UInt64 value = sketches_[i]->inc_at_(cell_ids[i]);
+    if (values != NULL) {
+      values[i] = value;
+    }
+  }
+}
+
+void SketchGroup::add(const KeyHash &key_hash, UInt64 value,
+                      UInt64 *values) noexcept {
+  UInt64 cell_ids[SKETCH_GROUP_MAX_SIZE][3];
+  locate_(key_hash, cell_ids);
+  for (std::size_t i = 0; i < size_; ++i) {
+    const UInt64 result = sketches_[i]->add_at_(cell_ids[i], value);
+    if (values != NULL) {
+      values[i] = result;
+    }
+  }
+}
+
+// locate_() computes the cell IDs of all the sketches before the first
+// access, so that every cache line of the key is already in flight.
+void SketchGroup::locate_(const KeyHash &key_hash,
+                          UInt64 (*cell_ids)[3]) const noexcept {
+  for (std::size_t i = 0; i < size_; ++i) {
+    sketches_[i]->locate_(key_hash, cell_ids[i]);
+  }
+}
+
+}  // namespace madoka
@@ -0,0 +1,105 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MADOKA_SKETCH_GROUP_H
+#define MADOKA_SKETCH_GROUP_H
+
+#include "sketch.h"
+
+#ifdef __cplusplus
+namespace madoka {
+
+const UInt64 SKETCH_GROUP_MAX_SIZE = 64;
+
+// SketchGroup applies an operation on a key to every sketch in the group.
+// The key is hashed only once and the cells of all the sketches are
+// prefetched before any of them is accessed, so that the cache misses
+// overlap each other. A group does not own its sketches and all the
+// sketches must have the same seed.
+class SketchGroup {
+ public:
+  SketchGroup() noexcept;
+  ~SketchGroup() noexcept;
+
+  // insert() appends `sketch' to the group. It throws an exception if the
+  // group is full, if the seed of `sketch' differs from seed(), or if
+  // `sketch' has SKETCH_TOP_K.
+  void insert(Sketch *sketch);
+  void clear() noexcept;
+
+  std::size_t size() const noexcept {
+    return size_;
+  }
+  bool empty() const noexcept {
+    return size_ == 0;
+  }
+  UInt64 seed() const noexcept {
+    return empty() ? 0 : sketches_[0]->seed();
+  }
+
+  Sketch &operator[](std::size_t i) noexcept {
+    return *sketches_[i];
+  }
+  const Sketch &operator[](std::size_t i) const noexcept {
+    return *sketches_[i];
+  }
+
+  KeyHash hash(const void *key_addr, std::size_t key_size) const noexcept {
+    return KeyHash(key_addr, key_size, seed());
+  }
+
+  // The following functions store the i-th result in `values[i]'. `values'
+  // of set(), inc() and add() may be NULL.
+  void get(const void *key_addr, std::size_t key_size,
+           UInt64 *values) const noexcept;
+  void set(const void *key_addr, std::size_t key_size, UInt64 value) noexcept;
+  void inc(const void *key_addr, std::size_t key_size,
+           UInt64 *values = NULL) noexcept;
+  void add(const void *key_addr, std::size_t key_size, UInt64 value,
+           UInt64 *values = NULL) noexcept;
+
+  // The following overloads take a KeyHash, which must be computed with
+  // seed().
+  void get(const KeyHash &key_hash, UInt64 *values) const noexcept;
+  void set(const KeyHash &key_hash, UInt64 value) noexcept;
+  void inc(const KeyHash &key_hash, UInt64 *values = NULL) noexcept;
+  void add(const KeyHash &key_hash, UInt64 value,
+           UInt64 *values = NULL) noexcept;
+
+ private:
+  Sketch *sketches_[SKETCH_GROUP_MAX_SIZE];
+  std::size_t size_;
+
+  void locate_(const KeyHash &key_hash,
+               UInt64 (*cell_ids)[3]) const noexcept;
+
+  // Disallows copy and assignment.
+  SketchGroup(const SketchGroup &);
+  SketchGroup &operator=(const SketchGroup &);
+};
+
+}  // namespace madoka
+#endif  // __cplusplus
+
+#endif  // MADOKA_SKETCH_GROUP_H
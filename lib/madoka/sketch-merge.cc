@@ -0,0 +1,194 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "sketch-merge.h"
+
+#include <new>
+
+namespace madoka {
+namespace {
+
+// MergeTree runs the tasks of merge_sketch_files(). The i-th group merges
+// the sources from the (i * num_src_paths / num_groups)-th one.
+class MergeTree {
+ public:
+  MergeTree() noexcept
+    : groups_(NULL), errors_(NULL), num_groups_(0), path_(NULL),
+      src_paths_(NULL), num_src_paths_(0), mode_(SKETCH_SUM_MERGE),
+      flags_(0), src_flags_(0), step_(0) {}
+  ~MergeTree() noexcept {
+    delete [] groups_;
+    delete [] errors_;
+  }
+
+  void init(const char *path, const char * const *src_paths,
+            std::size_t num_src_paths, SketchMergeMode mode, int flags,
+            std::size_t num_groups, int src_flags) {
+    groups_ = new (std::nothrow) Sketch[num_groups];
+    MADOKA_THROW_IF(groups_ == NULL);
+    errors_ = new (std::nothrow) const char *[num_groups];
+    MADOKA_THROW_IF(errors_ == NULL);
+    for (std::size_t i = 0; i < num_groups; ++i) {
+      errors_[i] = NULL;
+    }
+    num_groups_ = num_groups;
+    path_ = path;
+    src_paths_ = src_paths;
+    num_src_paths_ = num_src_paths;
+    mode_ = mode;
+    flags_ = flags;
+    src_flags_ = src_flags;
+  }
+
+  void run(SketchExecutor executor) {
+    run_tasks(executor, num_groups_, merge_group);
+    for (step_ = 1; step_ < num_groups_; step_ *= 2) {
+      run_tasks(executor, ((num_groups_ - step_) + (2 * step_) - 1) /
+                (2 * step_), merge_pair);
+    }
+  }
+
+ private:
+  Sketch *groups_;
+  const char **errors_;
+  std::size_t num_groups_;
+  const char *path_;
+  const char * const *src_paths_;
+  std::size_t num_src_paths_;
+  SketchMergeMode mode_;
+  int flags_;
+  int src_flags_;
+  std::size_t step_;
+
+  // run_tasks() runs tasks and throws the first error of them.
+  void run_tasks(SketchExecutor executor, std::size_t num_tasks,
+                 SketchTask task) {
+    if ((executor != NULL) && (num_tasks > 1)) {
+      executor(task, this, num_tasks);
+    } else {
+      for (std::size_t i = 0; i < num_tasks; ++i) {
+        task(this, i);
+      }
+    }
+    for (std::size_t i = 0; i < num_groups_; ++i) {
+      if (errors_[i] != NULL) {
+        throw Exception(errors_[i]);
+      }
+    }
+  }
+
+  // merge_group() merges the sources of a group. Exceptions are kept until
+  // all the tasks finish, because they must not leave an executor.
+  static void merge_group(void *arg, madoka_uint64 task_id) {
+    MergeTree * const tree = static_cast<MergeTree *>(arg);
+    const std::size_t group_id = static_cast<std::size_t>(task_id);
+    const std::size_t begin = static_cast<std::size_t>(
+        (static_cast<UInt64>(group_id) * tree->num_src_paths_) /
+        tree->num_groups_);
+    const std::size_t end = static_cast<std::size_t>(
+        (static_cast<UInt64>(group_id + 1) * tree->num_src_paths_) /
+        tree->num_groups_);
+    try {
+      Sketch &sketch = tree->groups_[group_id];
+      Sketch src;
+      src.open(tree->src_paths_[begin], tree->src_flags_);
+      if (group_id == 0) {
+        sketch.copy(src, tree->path_, tree->flags_);
+      } else {
+        sketch.copy(src);
+      }
+      src.close();
+      for (std::size_t i = begin + 1; i < end; ++i) {
+        src.open(tree->src_paths_[i], tree->src_flags_);
+        sketch.merge(src, tree->mode_);
+        src.close();
+      }
+    } catch (const Exception &ex) {
+      tree->errors_[group_id] = ex.what();
+    }
+  }
+
+  // merge_pair() merges a group into its left neighbor at the current level
+  // of the tree, and closes it.
+  static void merge_pair(void *arg, madoka_uint64 task_id) {
+    MergeTree * const tree = static_cast<MergeTree *>(arg);
+    const std::size_t group_id =
+        static_cast<std::size_t>(task_id) * 2 * tree->step_;
+    try {
+      Sketch &src = tree->groups_[group_id + tree->step_];
+      tree->groups_[group_id].merge(src, tree->mode_);
+      src.close();
+    } catch (const Exception &ex) {
+      tree->errors_[group_id] = ex.what();
+    }
+  }
+
+  // Disallows copy and assignment.
+  MergeTree(const MergeTree &);
+  MergeTree &operator=(const MergeTree &);
+};
+
+}  // namespace
+
+void merge_sketch_files(const char *path, const char * const *src_paths,
+                        std::size_t num_src_paths, SketchMergeMode mode,
+                        int flags, std::size_t max_num_files,
+                        SketchExecutor executor) {
+  MADOKA_THROW_IF(path == NULL);
+  MADOKA_THROW_IF(src_paths == NULL);
+  MADOKA_THROW_IF(num_src_paths == 0);
+  MADOKA_THROW_IF(max_num_files < SKETCH_MERGE_MIN_NUM_FILES);
+  MADOKA_THROW_IF((mode != SKETCH_SUM_MERGE) && (mode != SKETCH_MAX_MERGE) &&
+                  (mode != SKETCH_MIN_MERGE));
+
+  // The headers are checked before any merge, so that an incompatible
+  // source does not waste a pass over the others.
+  Sketch first;
+  first.open(src_paths[0], FILE_READONLY);
+  for (std::size_t i = 1; i < num_src_paths; ++i) {
+    Sketch src;
+    src.open(src_paths[i], FILE_READONLY);
+    MADOKA_THROW_IF(src.width() != first.width());
+    MADOKA_THROW_IF(src.seed() != first.seed());
+    MADOKA_THROW_IF(src.max_value() != first.max_value());
+    MADOKA_THROW_IF(src.mode() != first.mode());
+    MADOKA_THROW_IF(src.block_width() != first.block_width());
+    MADOKA_THROW_IF((src.flags() & SKETCH_FAST_RANGE) !=
+                    (first.flags() & SKETCH_FAST_RANGE));
+  }
+  const bool draws_random = (mode == SKETCH_SUM_MERGE) &&
+      (first.mode() == SKETCH_APPROX_MODE);
+  first.close();
+
+  std::size_t num_groups = max_num_files / 2;
+  if (num_groups > num_src_paths) {
+    num_groups = num_src_paths;
+  }
+  MergeTree tree;
+  tree.init(path, src_paths, num_src_paths, mode, flags, num_groups,
+            FILE_SEQUENTIAL | (draws_random ? FILE_PRIVATE : FILE_READONLY));
+  tree.run(executor);
+}
+
+}  // namespace madoka
@@ -0,0 +1,64 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MADOKA_SKETCH_MERGE_H
+#define MADOKA_SKETCH_MERGE_H
+
+#include "sketch.h"
+
+#ifdef __cplusplus
+namespace madoka {
+
+const std::size_t SKETCH_MERGE_MIN_NUM_FILES     = 2;
+const std::size_t SKETCH_MERGE_DEFAULT_NUM_FILES = 16;
+
+// merge_sketch_files() merges `num_src_paths' sketch files into a new sketch
+// at `path', which takes the shape, the seed and the header flags of the
+// first source. The sources must have the same width, seed, max_value and
+// so mode, layout and mapping, which are checked from their headers before
+// any merge.
+//
+// The sources are split into groups of consecutive files, and each group is
+// merged into its own sketch, where the first group goes into the new
+// sketch and the others stay in memory. Then, the groups are merged in a
+// binary tree. A group maps its sketch and one source at a time, so at most
+// `max_num_files' sketches are mapped at once. Sources are opened with
+// FILE_SEQUENTIAL, and FILE_READONLY unless an approx sum merge draws random
+// numbers from them, in which case FILE_PRIVATE keeps the files as they are.
+//
+// With `executor', the groups and the pairs of each level of the tree run as
+// tasks in parallel. The order of merges depends only on `num_src_paths' and
+// `max_num_files', so the result does not depend on `executor'.
+void merge_sketch_files(const char *path, const char * const *src_paths,
+                        std::size_t num_src_paths,
+                        SketchMergeMode mode = SKETCH_SUM_MERGE,
+                        int flags = 0,
+                        std::size_t max_num_files =
+                            SKETCH_MERGE_DEFAULT_NUM_FILES,
+                        SketchExecutor executor = NULL);
+
+}  // namespace madoka
+#endif  // __cplusplus
+
+#endif  // MADOKA_SKETCH_MERGE_H
@@ -142,6 +142,10 @@ madoka_uint64 madoka_get_depth(const madoka_sketch *sketch) {
   return sketch->impl.depth();
 }
 
+madoka_uint64 madoka_get_block_width(const madoka_sketch *sketch) {
+  return sketch->impl.block_width();
+}
+
 madoka_uint64 madoka_get_max_value(const madoka_sketch *sketch) {
   return sketch->impl.max_value();
 }
@@ -166,6 +170,10 @@ madoka_uint64 madoka_get_file_size(const madoka_sketch *sketch) {
   return sketch->impl.file_size();
 }
 
+madoka_uint64 madoka_get_version(const madoka_sketch *sketch) {
+  return sketch->impl.version();
+}
+
 int madoka_get_flags(const madoka_sketch *sketch) {
   return sketch->impl.flags();
 }
@@ -182,11 +190,27 @@ madoka_sketch_mode madoka_get_mode(const madoka_sketch *sketch) {
   return MADOKA_SKETCH_APPROX_MODE;
 }
 
+madoka_uint64 madoka_get_num_hot_keys(const madoka_sketch *sketch) {
+  return sketch->impl.num_hot_keys();
+}
+
+size_t madoka_get_top_keys(const madoka_sketch *sketch,
+                           madoka_top_key *top_keys, size_t max_num_keys) {
+  return sketch->impl.top_keys(top_keys, max_num_keys);
+}
+
 madoka_uint64 madoka_get(const madoka_sketch *sketch, const void *key_addr,
                          size_t key_size) {
   return sketch->impl.get(key_addr, key_size);
 }
 
+madoka_uint64 madoka_get_decoded(const madoka_sketch *sketch,
+                                 const void *key_addr, size_t key_size,
+                                 madoka_sketch_decode decode) {
+  return sketch->impl.get(key_addr, key_size,
+                          static_cast<madoka::SketchDecode>(decode));
+}
+
 void madoka_set(madoka_sketch *sketch, const void *key_addr,
                 size_t key_size, madoka_uint64 value) {
   sketch->impl.set(key_addr, key_size, value);
@@ -202,10 +226,74 @@ madoka_uint64 madoka_add(madoka_sketch *sketch, const void *key_addr,
   return sketch->impl.add(key_addr, key_size, value);
 }
 
+void madoka_hash_key(const madoka_sketch *sketch, const void *key_addr,
+                     size_t key_size, madoka_key_hash *key_hash) {
+  const madoka::KeyHash impl = sketch->impl.hash(key_addr, key_size);
+  key_hash->seed = impl.seed();
+  key_hash->values[0] = impl.values()[0];
+  key_hash->values[1] = impl.values()[1];
+}
+
+madoka_uint64 madoka_get_hashed(const madoka_sketch *sketch,
+                                const madoka_key_hash *key_hash) {
+  return sketch->impl.get(madoka::KeyHash(key_hash->seed, key_hash->values));
+}
+
+void madoka_set_hashed(madoka_sketch *sketch, const madoka_key_hash *key_hash,
+                       madoka_uint64 value) {
+  sketch->impl.set(madoka::KeyHash(key_hash->seed, key_hash->values), value);
+}
+
+madoka_uint64 madoka_inc_hashed(madoka_sketch *sketch,
+                                const madoka_key_hash *key_hash) {
+  return sketch->impl.inc(madoka::KeyHash(key_hash->seed, key_hash->values));
+}
+
+madoka_uint64 madoka_add_hashed(madoka_sketch *sketch,
+                                const madoka_key_hash *key_hash,
+                                madoka_uint64 value) {
+  return sketch->impl.add(madoka::KeyHash(key_hash->seed, key_hash->values),
+                          value);
+}
+
+void madoka_get_batch(const madoka_sketch *sketch,
+                      const void * const *key_addrs, const size_t *key_sizes,
+                      size_t num_keys, madoka_uint64 *values) {
+  sketch->impl.get_batch(key_addrs, key_sizes, num_keys, values);
+}
+
+void madoka_set_batch(madoka_sketch *sketch, const void * const *key_addrs,
+                      const size_t *key_sizes, size_t num_keys,
+                      const madoka_uint64 *values) {
+  sketch->impl.set_batch(key_addrs, key_sizes, num_keys, values);
+}
+
+void madoka_inc_batch(madoka_sketch *sketch, const void * const *key_addrs,
+                      const size_t *key_sizes, size_t num_keys,
+                      madoka_uint64 *values) {
+  sketch->impl.inc_batch(key_addrs, key_sizes, num_keys, values);
+}
+
+void madoka_add_batch(madoka_sketch *sketch, const void * const *key_addrs,
+                      const size_t *key_sizes, size_t num_keys,
+                      const madoka_uint64 *values, madoka_uint64 *results) {
+  sketch->impl.add_batch(key_addrs, key_sizes, num_keys, values, results);
+}
+
+void madoka_set_executor(madoka_sketch *sketch,
+                         madoka_sketch_executor executor) {
+  sketch->impl.set_executor(executor);
+}
+
 void madoka_clear(madoka_sketch *sketch) {
   sketch->impl.clear();
 }
 
+void madoka_clear_range(madoka_sketch *sketch, madoka_uint64 offset,
+                        madoka_uint64 size) {
+  sketch->impl.clear(offset, size);
+}
+
 madoka_sketch *madoka_copy(const madoka_sketch *src, const char *path,
                            int flags, const char **what) try {
   madoka::Sketch impl;
@@ -225,6 +313,17 @@ void madoka_filter(madoka_sketch *sketch, madoka_sketch_filter filter) {
   sketch->impl.filter(filter);
 }
 
+int madoka_filter_op(madoka_sketch *sketch, madoka_sketch_filter_op op,
+                     madoka_uint64 param, const char **what) try {
+  sketch->impl.filter(static_cast<madoka::SketchFilterOp>(op), param);
+  return 0;
+} catch (const madoka::Exception &ex) {
+  if (what != NULL) {
+    *what = ex.what();
+  }
+  return -1;
+}
+
 madoka_sketch *madoka_shrink(const madoka_sketch *src,
                              madoka_uint64 width, madoka_uint64 max_value,
                              madoka_sketch_filter filter, const char *path,
@@ -254,6 +353,21 @@ int madoka_merge(madoka_sketch *lhs, const madoka_sketch *rhs,
   return -1;
 }
 
+int madoka_merge_with_mode(madoka_sketch *lhs, const madoka_sketch *rhs,
+                           madoka_sketch_merge_mode mode,
+                           madoka_sketch_filter lhs_filter,
+                           madoka_sketch_filter rhs_filter,
+                           const char **what) try {
+  lhs->impl.merge(rhs->impl, static_cast<madoka::SketchMergeMode>(mode),
+                  lhs_filter, rhs_filter);
+  return 0;
+} catch (const madoka::Exception &ex) {
+  if (what != NULL) {
+    *what = ex.what();
+  }
+  return -1;
+}
+
 void madoka_swap(madoka_sketch *lhs, madoka_sketch *rhs) {
   lhs->impl.swap(&rhs->impl);
 }
@@ -274,12 +388,443 @@ int madoka_inner_product(const madoka_sketch *lhs, const madoka_sketch *rhs,
   return -1;
 }
 
+int madoka_inner_products(const madoka_sketch * const *sketches,
+                          madoka_uint64 num_sketches, double *inner_products,
+                          double *square_lengths, const char **what) try {
+  MADOKA_THROW_IF(sketches == NULL);
+  const std::size_t size = static_cast<std::size_t>(num_sketches);
+  const madoka::Sketch **impls =
+      new (std::nothrow) const madoka::Sketch *[(size != 0) ? size : 1];
+  MADOKA_THROW_IF(impls == NULL);
+  for (std::size_t i = 0; i < size; ++i) {
+    impls[i] = &sketches[i]->impl;
+  }
+  try {
+    madoka::Sketch::inner_products(impls, size, inner_products,
+                                   square_lengths);
+  } catch (...) {
+    delete [] impls;
+    throw;
+  }
+  delete [] impls;
+  return 0;
+} catch (const madoka::Exception &ex) {
+  if (what != NULL) {
+    *what = ex.what();
+  }
+  return -1;
+}
+
 }  // extern "C"
 
 namespace madoka {
+namespace {
+
+// Batch operations hash BATCH_WINDOW_SIZE keys at once and prefetch their
+// cells while processing the previous BATCH_WINDOW_SIZE keys.
+const std::size_t BATCH_WINDOW_SIZE = 16;
+
+// Each hot key has a cell in each row, so the pending cells of a sketch are
+// at most MAX_NUM_PENDING_CELLS.
+const UInt64 MAX_NUM_PENDING_CELLS = HOT_TIER_SIZE * SKETCH_DEPTH;
+
+UInt64 normalize_max_value(UInt64 max_value) noexcept {
+  if (max_value == 0) {
+    return SKETCH_DEFAULT_MAX_VALUE;
+  } else if (max_value < (1ULL << 1)) {
+    return (1ULL << 1) - 1;
+  } else if (max_value < (1ULL << 2)) {
+    return (1ULL << 2) - 1;
+  } else if (max_value < (1ULL << 4)) {
+    return (1ULL << 4) - 1;
+  } else if (max_value < (1ULL << 8)) {
+    return (1ULL << 8) - 1;
+  } else if (max_value < (1ULL << 16)) {
+    return (1ULL << 16) - 1;
+  } else {
+    return SKETCH_MAX_MAX_VALUE;
+  }
+}
+
+// get_block_cells() returns the number of cells in a 64-byte block. In
+// approx mode, a cell is a 64-bit unit that holds a value of each row.
+UInt64 get_block_cells(UInt64 value_size) noexcept {
+  return (value_size == SKETCH_APPROX_VALUE_SIZE) ?
+      SKETCH_BLOCK_UNITS : ((SKETCH_BLOCK_SIZE * 8) / value_size);
+}
+
+// get_block_width() returns the number of cells assigned to each row in a
+// 64-byte block.
+UInt64 get_block_width(UInt64 value_size, int flags) noexcept {
+  if (~flags & SKETCH_BLOCKED_LAYOUT) {
+    return 1;
+  }
+  return (value_size == SKETCH_APPROX_VALUE_SIZE) ?
+      SKETCH_BLOCK_UNITS : (get_block_cells(value_size) / SKETCH_DEPTH);
+}
+
+// get_table_offset() returns the offset of the table from the beginning of
+// a sketch of format `version'. The table of a version 0 sketch starts at a
+// 64-byte boundary if blocked, and right after the TopK otherwise.
+UInt64 get_table_offset(int flags, UInt64 version) noexcept {
+  UInt64 offset = sizeof(Header) + sizeof(Random);
+  if (flags & SKETCH_HOT_TIER) {
+    offset += sizeof(HotTier);
+  }
+  if (flags & SKETCH_TOP_K) {
+    offset += sizeof(TopK);
+  }
+  UInt64 alignment = 1;
+  if (version != 0) {
+    alignment = (flags & SKETCH_HUGE_PAGE_ALIGNED) ?
+        SKETCH_HUGE_PAGE_SIZE : SKETCH_PAGE_SIZE;
+  } else if (flags & SKETCH_BLOCKED_LAYOUT) {
+    alignment = SKETCH_BLOCK_SIZE;
+  }
+  return ((offset + alignment - 1) / alignment) * alignment;
+}
+
+UInt64 get_table_size(UInt64 width, UInt64 value_size, int flags) noexcept {
+  if (value_size == SKETCH_APPROX_VALUE_SIZE) {
+    return sizeof(UInt64) * width;
+  } else if (flags & SKETCH_BLOCKED_LAYOUT) {
+    return (width / get_block_width(value_size, flags)) * SKETCH_BLOCK_SIZE;
+  }
+  return (((value_size * width * SKETCH_DEPTH) + 63) / 64) * 8;
+}
+
+// ExactUnit<VALUE_SIZE>::Type is the unit that the concurrent mode updates
+// with a compare-and-swap. 8-bit and 16-bit values are updated directly and
+// the others are updated with their 64-bit units.
+template <UInt64 VALUE_SIZE>
+struct ExactUnit {
+  typedef UInt64 Type;
+};
+
+template <>
+struct ExactUnit<8> {
+  typedef UInt8 Type;
+};
+
+template <>
+struct ExactUnit<16> {
+  typedef UInt16 Type;
+};
+
+UInt64 get_thread_seed(const void *addr) noexcept {
+  UInt64 hash_values[2];
+  Hash()(&addr, sizeof(addr), 0, hash_values);
+  return hash_values[0];
+}
+
+// get_thread_random() returns the generator of the calling thread. A sketch
+// in concurrent mode uses it instead of the generator in its header.
+Random *get_thread_random() noexcept {
+  static thread_local Random random(get_thread_seed(&random));
+  return &random;
+}
+
+// get_thread_counter() returns the counter of CounterRandom for the calling
+// thread, and get_thread_stream_key() returns the part of its key that comes
+// from the stream ID of the thread.
+UInt64 &get_thread_counter() noexcept {
+  static thread_local UInt64 counter = 0;
+  return counter;
+}
+
+UInt64 &get_thread_stream_key() noexcept {
+  static thread_local UInt64 stream_key = 0;
+  return stream_key;
+}
+
+// The approx mode operations construct one of the following generators
+// from the generator in the header and the cell IDs of a key.
+//
+// SharedRandom uses the generator in the header.
+class SharedRandom {
+ public:
+  SharedRandom(Random *random, const UInt64 *) noexcept : random_(random) {}
+  ~SharedRandom() noexcept {}
+
+  UInt32 operator()() noexcept {
+    return (*random_)();
+  }
+
+ private:
+  Random *random_;
+
+  // Disallows copy and assignment.
+  SharedRandom(const SharedRandom &);
+  SharedRandom &operator=(const SharedRandom &);
+};
+
+// ThreadRandom uses the generator of the calling thread.
+class ThreadRandom {
+ public:
+  ThreadRandom(Random *, const UInt64 *) noexcept
+    : random_(get_thread_random()) {}
+  ~ThreadRandom() noexcept {}
+
+  UInt32 operator()() noexcept {
+    return (*random_)();
+  }
+
+ private:
+  Random *random_;
+
+  // Disallows copy and assignment.
+  ThreadRandom(const ThreadRandom &);
+  ThreadRandom &operator=(const ThreadRandom &);
+};
+
+// KeyedRandom uses a CounterRandom keyed by the cell IDs of a key and the
+// stream ID of the calling thread, starting from the counter of the thread,
+// and then advances the counter. Threads of the same stream ID and counter
+// draw the same numbers for a key.
+class KeyedRandom {
+ public:
+  KeyedRandom(Random *, const UInt64 cell_ids[3]) noexcept
+    : random_(cell_ids[0] ^ (cell_ids[1] << 21) ^ (cell_ids[2] << 42) ^
+              (cell_ids[2] >> 22) ^ get_thread_stream_key(),
+              get_thread_counter()) {}
+  ~KeyedRandom() noexcept {
+    get_thread_counter() = random_.counter();
+  }
+
+  UInt32 operator()() noexcept {
+    return random_();
+  }
+
+ private:
+  CounterRandom random_;
+
+  // Disallows copy and assignment.
+  KeyedRandom(const KeyedRandom &);
+  KeyedRandom &operator=(const KeyedRandom &);
+};
+
+// AffineFilter implements the built-in filters for the sketches that
+// Kernel::filter() does not cover. It computes min(v * multiplier >> shift,
+// clamp) for v >= threshold without overflow.
+class AffineFilter {
+ public:
+  AffineFilter(UInt64 threshold, UInt64 multiplier, UInt64 shift,
+               UInt64 clamp) noexcept
+    : threshold_(threshold), multiplier_(multiplier), shift_(shift),
+      clamp_(clamp) {}
+
+  UInt64 operator()(UInt64 value) const noexcept {
+    if ((value < threshold_) || (multiplier_ == 0)) {
+      return 0;
+    }
+    const UInt64 high = value >> shift_;
+    if (high > (~0ULL / multiplier_)) {
+      return clamp_;
+    }
+    const UInt64 product = high * multiplier_;
+    const UInt64 low =
+        ((value & ((1ULL << shift_) - 1)) * multiplier_) >> shift_;
+    const UInt64 result = ((~0ULL - product) > low) ? (product + low) : ~0ULL;
+    return (result < clamp_) ? result : clamp_;
+  }
+
+ private:
+  UInt64 threshold_;
+  UInt64 multiplier_;
+  UInt64 shift_;
+  UInt64 clamp_;
+};
+
+// merge_values() combines the values of a cell as merge() does. A sum
+// saturates at `max_value'.
+inline UInt64 merge_values(SketchMergeMode mode, UInt64 lhs, UInt64 rhs,
+                           UInt64 max_value) noexcept {
+  if (mode == SKETCH_MAX_MERGE) {
+    return (lhs > rhs) ? lhs : rhs;
+  } else if (mode == SKETCH_MIN_MERGE) {
+    return (lhs < rhs) ? lhs : rhs;
+  } else if ((lhs >= max_value) || (rhs >= (max_value - lhs))) {
+    return max_value;
+  }
+  return lhs + rhs;
+}
+
+// call_task() lets an executor call a functor given to run_tasks_().
+template <typename T>
+void call_task(void *arg, madoka_uint64 task_id) {
+  (*static_cast<const T *>(arg))(task_id);
+}
+
+// get_task_units() returns the number of units per task of a bulk operation
+// over `num_units' units.
+inline UInt64 get_task_units(UInt64 num_units) noexcept {
+  const UInt64 MIN_TASK_UNITS = SKETCH_MIN_TASK_SIZE / sizeof(UInt64);
+  UInt64 task_units =
+      (num_units + SKETCH_MAX_NUM_TASKS - 1) / SKETCH_MAX_NUM_TASKS;
+  if (task_units < MIN_TASK_UNITS) {
+    task_units = MIN_TASK_UNITS;
+  }
+  return ((task_units + SKETCH_BLOCK_UNITS - 1) / SKETCH_BLOCK_UNITS) *
+      SKETCH_BLOCK_UNITS;
+}
+
+// get_chunk_cells() returns the number of cells per chunk of a row, which
+// inner_product() and inner_products() sum up separately. Chunks depend only
+// on the width, and the partial sums of the chunks are added in order, so
+// that the results are the same with or without an executor.
+inline UInt64 get_chunk_cells(UInt64 width) noexcept {
+  const UInt64 MAX_NUM_CHUNKS = SKETCH_MAX_NUM_TASKS / SKETCH_DEPTH;
+  const UInt64 MIN_CHUNK_CELLS = SKETCH_MIN_TASK_SIZE / sizeof(UInt64);
+  const UInt64 chunk_cells = (width + MAX_NUM_CHUNKS - 1) / MAX_NUM_CHUNKS;
+  return (chunk_cells < MIN_CHUNK_CELLS) ? MIN_CHUNK_CELLS : chunk_cells;
+}
+
+// get_task_key() draws the key of the generators for the tasks of a bulk
+// operation from `random'. The task that starts at the `begin'-th unit
+// uses CounterRandom(key, begin << 32), so its numbers depend only on its
+// units, and tasks of fewer than 2^32 draws never share a number.
+inline UInt64 get_task_key(Random *random) noexcept {
+  const UInt64 high = (*random)();
+  return (high << 32) | (*random)();
+}
+
+// ScopedArray owns an array allocated with new (std::nothrow). get()
+// returns NULL if the allocation failed.
+template <typename T>
+class ScopedArray {
+ public:
+  explicit ScopedArray(std::size_t size) noexcept
+    : array_(new (std::nothrow) T[size]) {}
+  ~ScopedArray() noexcept {
+    delete [] array_;
+  }
+
+  T &operator[](std::size_t i) const noexcept {
+    return array_[i];
+  }
+  T *get() const noexcept {
+    return array_;
+  }
+
+ private:
+  T *array_;
+
+  // Disallows copy and assignment.
+  ScopedArray(const ScopedArray &);
+  ScopedArray &operator=(const ScopedArray &);
+};
+
+}  // namespace
+
+template <typename T>
+void Sketch::run_tasks_(UInt64 num_tasks, bool is_parallel,
+                        const T &task) const noexcept {
+  if (is_parallel && (executor_ != NULL) && (num_tasks > 1)) {
+    executor_(call_task<T>, const_cast<T *>(&task), num_tasks);
+  } else {
+    for (UInt64 task_id = 0; task_id < num_tasks; ++task_id) {
+      task(task_id);
+    }
+  }
+}
+
+template <typename T>
+void Sketch::run_unit_tasks_(UInt64 num_units, bool is_parallel,
+                             const T &task) const noexcept {
+  const UInt64 task_units = get_task_units(num_units);
+  run_tasks_((num_units + task_units - 1) / task_units, is_parallel,
+             [&](UInt64 task_id) {
+    const UInt64 begin = task_id * task_units;
+    task(begin, ((num_units - begin) < task_units) ?
+         num_units : (begin + task_units));
+  });
+}
+
+template <typename T>
+void Sketch::for_each_cell_(UInt64 begin, UInt64 end,
+                            const T &f) const noexcept {
+  if (mode() == SKETCH_APPROX_MODE) {
+    // A unit of an approx sketch is a cell of every row.
+    for (UInt64 cell_id = begin; cell_id < end; ++cell_id) {
+      for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
+        f(table_id, cell_id);
+      }
+    }
+  } else if (block_width_ != 1) {
+    // Tasks consist of whole blocks.
+    for (UInt64 block_id = begin / SKETCH_BLOCK_UNITS;
+         block_id < (end / SKETCH_BLOCK_UNITS); ++block_id) {
+      for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
+        for (UInt64 i = 0; i < block_width_; ++i) {
+          f(table_id, (block_id * block_width_) + i);
+        }
+      }
+    }
+  } else {
+    // The rows are stored one after another.
+    const UInt64 cells_per_unit = 64 / value_size();
+    const UInt64 num_cells = width() * SKETCH_DEPTH;
+    const UInt64 first = begin * cells_per_unit;
+    const UInt64 last = ((end * cells_per_unit) < num_cells) ?
+        (end * cells_per_unit) : num_cells;
+    UInt64 table_id = first / width();
+    UInt64 cell_id = first % width();
+    for (UInt64 i = first; i < last; ++i) {
+      f(table_id, cell_id);
+      if (++cell_id == width()) {
+        cell_id = 0;
+        ++table_id;
+      }
+    }
+  }
+}
+
+template <typename T>
+void Sketch::for_each_run_(UInt64 begin, UInt64 end,
+                           const T &f) const noexcept {
+  if (mode() == SKETCH_APPROX_MODE) {
+    for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
+      f(table_id, begin, end - begin);
+    }
+  } else if (block_width_ != 1) {
+    for (UInt64 block_id = begin / SKETCH_BLOCK_UNITS;
+         block_id < (end / SKETCH_BLOCK_UNITS); ++block_id) {
+      for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
+        f(table_id, block_id * block_width_, block_width_);
+      }
+    }
+  } else {
+    // A run ends at the end of a row.
+    const UInt64 cells_per_unit = 64 / value_size();
+    const UInt64 num_cells = width() * SKETCH_DEPTH;
+    const UInt64 last = ((end * cells_per_unit) < num_cells) ?
+        (end * cells_per_unit) : num_cells;
+    for (UInt64 i = begin * cells_per_unit; i < last; ) {
+      const UInt64 cell_id = i % width();
+      const UInt64 num_run_cells = ((width() - cell_id) < (last - i)) ?
+          (width() - cell_id) : (last - i);
+      f(i / width(), cell_id, num_run_cells);
+      i += num_run_cells;
+    }
+  }
+}
+
+// Sketch::Ops is a table of the operations specialized for the mode and the
+// value size of a sketch, so that the operations have neither a mode branch
+// nor a value size switch. init_() selects one with get_ops_().
+struct Sketch::Ops {
+  UInt64 (Sketch::*get)(const UInt64 cell_ids[3]) const;
+  void (Sketch::*set)(const UInt64 cell_ids[3], UInt64 value);
+  UInt64 (Sketch::*inc)(const UInt64 cell_ids[3]);
+  UInt64 (Sketch::*add)(const UInt64 cell_ids[3], UInt64 value);
+};
 
 Sketch::Sketch() noexcept
-  : file_(), header_(NULL), random_(NULL), table_(NULL) {}
+  : file_(), header_(NULL), random_(NULL), hot_tier_(NULL), top_k_(NULL),
+    table_(NULL),
+    block_width_(1), block_cells_(0), cell_range_(), block_range_(),
+    object_flags_(0), decode_(SKETCH_RANDOM_DECODE), ops_(NULL),
+    table_ops_(NULL), executor_(NULL) {}
 
 Sketch::~Sketch() noexcept {}
 
@@ -329,55 +874,174 @@ void Sketch::serialize(void *buf, UInt64 size) const {
 UInt64 Sketch::get(const void *key_addr, std::size_t key_size) const noexcept {
   UInt64 cell_ids[3];
   hash(key_addr, key_size, cell_ids);
-  if (mode() == SKETCH_EXACT_MODE) {
-    cell_ids[1] += width();
-    cell_ids[2] += width() * 2;
-    return exact_get(cell_ids);
-  } else {
-    return approx_get(cell_ids);
-  }
+  return (this->*ops_->get)(cell_ids);
 }
 
 void Sketch::set(const void *key_addr, std::size_t key_size,
                  UInt64 value) noexcept {
   UInt64 cell_ids[3];
   hash(key_addr, key_size, cell_ids);
-  if (mode() == SKETCH_EXACT_MODE) {
-    cell_ids[1] += width();
-    cell_ids[2] += width() * 2;
-    exact_set(cell_ids, value);
-  } else {
-    approx_set(cell_ids, value);
-  }
+  (this->*ops_->set)(cell_ids, value);
 }
 
 UInt64 Sketch::inc(const void *key_addr, std::size_t key_size) noexcept {
   UInt64 cell_ids[3];
   hash(key_addr, key_size, cell_ids);
-  if (mode() == SKETCH_EXACT_MODE) {
-    cell_ids[1] += width();
-    cell_ids[2] += width() * 2;
-    return exact_inc(cell_ids);
-  } else {
-    return approx_inc(cell_ids);
-  }
+  const UInt64 value = (this->*ops_->inc)(cell_ids);
+  track_(key_addr, key_size, cell_ids, value);
+  return value;
 }
 
 UInt64 Sketch::add(const void *key_addr, std::size_t key_size,
                    UInt64 value) noexcept {
   UInt64 cell_ids[3];
   hash(key_addr, key_size, cell_ids);
-  if (mode() == SKETCH_EXACT_MODE) {
-    cell_ids[1] += width();
-    cell_ids[2] += width() * 2;
-    return exact_add(cell_ids, value);
-  } else {
-    return approx_add(cell_ids, value);
+  const UInt64 result = (this->*ops_->add)(cell_ids, value);
+  track_(key_addr, key_size, cell_ids, result);
+  return result;
+}
+
+UInt64 Sketch::get(const KeyHash &key_hash) const noexcept {
+  UInt64 cell_ids[3];
+  hash_(key_hash.values(), cell_ids);
+  return (this->*ops_->get)(cell_ids);
+}
+
+UInt64 Sketch::get(const void *key_addr, std::size_t key_size,
+                   Decode decode) const noexcept {
+  UInt64 cell_ids[3];
+  hash(key_addr, key_size, cell_ids);
+  return decoded_get_(cell_ids, decode);
+}
+
+UInt64 Sketch::get(const KeyHash &key_hash, Decode decode) const noexcept {
+  UInt64 cell_ids[3];
+  hash_(key_hash.values(), cell_ids);
+  return decoded_get_(cell_ids, decode);
+}
+
+void Sketch::set(const KeyHash &key_hash, UInt64 value) noexcept {
+  UInt64 cell_ids[3];
+  hash_(key_hash.values(), cell_ids);
+  (this->*ops_->set)(cell_ids, value);
+}
+
+UInt64 Sketch::inc(const KeyHash &key_hash) noexcept {
+  UInt64 cell_ids[3];
+  hash_(key_hash.values(), cell_ids);
+  return (this->*ops_->inc)(cell_ids);
+}
+
+UInt64 Sketch::add(const KeyHash &key_hash, UInt64 value) noexcept {
+  UInt64 cell_ids[3];
+  hash_(key_hash.values(), cell_ids);
+  return (this->*ops_->add)(cell_ids, value);
+}
+
+// for_each_batch_key_() calls f(i, cell_ids) for the i-th key of a batch in
+// order, and is the pipeline that all the batch operations share.
+template <typename T>
+void Sketch::for_each_batch_key_(const void * const *key_addrs,
+                                 const std::size_t *key_sizes,
+                                 std::size_t num_keys,
+                                 const T &f) const noexcept {
+  UInt64 cell_ids[2][BATCH_WINDOW_SIZE][3];
+  prefetch_(key_addrs, key_sizes, num_keys, cell_ids[0]);
+
+  for (std::size_t begin = 0, window_id = 0; begin < num_keys;
+       begin += BATCH_WINDOW_SIZE, window_id ^= 1) {
+    const std::size_t next_begin = begin + BATCH_WINDOW_SIZE;
+    if (next_begin < num_keys) {
+      prefetch_(key_addrs + next_begin, key_sizes + next_begin,
+                num_keys - next_begin, cell_ids[window_id ^ 1]);
+    }
+
+    const std::size_t end = (next_begin < num_keys) ? next_begin : num_keys;
+    for (std::size_t i = begin; i < end; ++i) {
+      f(i, cell_ids[window_id][i - begin]);
+    }
   }
 }
 
+void Sketch::get_batch(const void * const *key_addrs,
+                       const std::size_t *key_sizes, std::size_t num_keys,
+                       UInt64 *values) const noexcept {
+  const Ops &ops = *ops_;
+  for_each_batch_key_(key_addrs, key_sizes, num_keys,
+                      [&](std::size_t i, const UInt64 ids[3]) {
+    values[i] = (this->*ops.get)(ids);
+  });
+}
+
+void Sketch::set_batch(const void * const *key_addrs,
+                       const std::size_t *key_sizes, std::size_t num_keys,
+                       const UInt64 *values) noexcept {
+  const Ops &ops = *ops_;
+  for_each_batch_key_(key_addrs, key_sizes, num_keys,
+                      [&](std::size_t i, const UInt64 ids[3]) {
+    (this->*ops.set)(ids, values[i]);
+  });
+}
+
+void Sketch::inc_batch(const void * const *key_addrs,
+                       const std::size_t *key_sizes, std::size_t num_keys,
+                       UInt64 *values) noexcept {
+  const Ops &ops = *ops_;
+  for_each_batch_key_(key_addrs, key_sizes, num_keys,
+                      [&](std::size_t i, const UInt64 ids[3]) {
+    const UInt64 value = (this->*ops.inc)(ids);
+    track_(key_addrs[i], key_sizes[i], ids, value);
+    if (values != NULL) {
+      values[i] = value;
+    }
+  });
+}
+
+void Sketch::add_batch(const void * const *key_addrs,
+                       const std::size_t *key_sizes, std::size_t num_keys,
+                       const UInt64 *values, UInt64 *results) noexcept {
+  const Ops &ops = *ops_;
+  for_each_batch_key_(key_addrs, key_sizes, num_keys,
+                      [&](std::size_t i, const UInt64 ids[3]) {
+    const UInt64 result = (this->*ops.add)(ids, values[i]);
+    track_(key_addrs[i], key_sizes[i], ids, result);
+    if (results != NULL) {
+      results[i] = result;
+    }
+  });
+}
+
 void Sketch::clear() noexcept {
-  std::memset(table_, 0, static_cast<std::size_t>(table_size()));
+  if (hot_tier_ != NULL) {
+    hot_tier_->clear();
+  }
+  if (top_k_ != NULL) {
+    top_k_->clear();
+  }
+  run_unit_tasks_(table_size() / sizeof(UInt64), true,
+                  [this](UInt64 begin, UInt64 end) {
+    std::memset(table_ + begin, 0,
+                static_cast<std::size_t>((end - begin) * sizeof(UInt64)));
+  });
+}
+
+void Sketch::clear(UInt64 offset, UInt64 size) noexcept {
+  if (offset == 0) {
+    if (hot_tier_ != NULL) {
+      hot_tier_->clear();
+    }
+    if (top_k_ != NULL) {
+      top_k_->clear();
+    }
+  }
+  if (offset >= table_size()) {
+    return;
+  }
+  if (size > (table_size() - offset)) {
+    size = table_size() - offset;
+  }
+  std::memset(reinterpret_cast<UInt8 *>(table_) + offset, 0,
+              static_cast<std::size_t>(size));
 }
 
 void Sketch::copy(const Sketch &src, const char *path, int flags) {
@@ -388,12 +1052,74 @@ void Sketch::copy(const Sketch &src, const char *path, int flags) {
 
 void Sketch::filter(Filter filter) noexcept {
   if (filter != NULL) {
-    for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
-      for (UInt64 cell_id = 0; cell_id < width(); ++cell_id) {
-        const UInt64 value = filter(get_(table_id, cell_id));
-        set_(table_id, cell_id, (value <= max_value()) ? value : max_value());
+    demote_();
+    filter_cells_(filter);
+    refresh_top_k_(NULL);
+  }
+}
+
+void Sketch::filter(FilterOp op, UInt64 param) {
+  UInt64 threshold = 0;
+  UInt64 multiplier = 1;
+  UInt64 shift = 0;
+  UInt64 clamp = max_value();
+  switch (op) {
+    case SKETCH_THRESHOLD_FILTER: {
+      threshold = param;
+      break;
+    }
+    case SKETCH_SHIFT_FILTER: {
+      if (param < 64) {
+        shift = param;
+      } else {
+        multiplier = 0;
       }
+      break;
+    }
+    case SKETCH_SCALE_FILTER: {
+      multiplier = param;
+      break;
+    }
+    case SKETCH_CLAMP_FILTER: {
+      if (param < clamp) {
+        clamp = param;
+      }
+      break;
+    }
+    case SKETCH_DECAY_FILTER: {
+      MADOKA_THROW_IF(param > SKETCH_DECAY_FILTER_ONE);
+      multiplier = param;
+      shift = 16;
+      break;
     }
+    default: {
+      MADOKA_THROW("invalid filter op");
+    }
+  }
+
+  if ((mode() == SKETCH_EXACT_MODE) &&
+      ((value_size() == 8) || (value_size() == 16))) {
+    // Values are less than 2^16, so the limits of Kernel::filter() change
+    // no results.
+    const UInt64 LIMIT = 1ULL << 16;
+    if (threshold > LIMIT) {
+      threshold = LIMIT;
+    }
+    if (multiplier > LIMIT) {
+      multiplier = LIMIT;
+    }
+    if (shift > 32) {
+      shift = 32;
+    }
+    demote_();
+    run_unit_tasks_(table_size() / sizeof(UInt64), true,
+                    [&](UInt64 begin, UInt64 end) {
+      kernel().filter(table_ + begin, end - begin, value_size(), threshold,
+                      multiplier, shift, clamp);
+    });
+    refresh_top_k_(NULL);
+  } else {
+    filter_(AffineFilter(threshold, multiplier, shift, clamp));
   }
 }
 
@@ -401,67 +1127,259 @@ void Sketch::shrink(const Sketch &src, UInt64 width,
                     UInt64 max_value, Filter filter,
                     const char *path, int flags) {
   Sketch new_sketch;
+  new_sketch.set_executor(executor_);
   new_sketch.shrink_(src, width, max_value, filter, path, flags);
   new_sketch.swap(this);
 }
 
 void Sketch::merge(const Sketch &rhs, Filter lhs_filter, Filter rhs_filter) {
+  merge(rhs, SKETCH_SUM_MERGE, lhs_filter, rhs_filter);
+}
+
+void Sketch::merge(const Sketch &rhs, MergeMode mode, Filter lhs_filter,
+                   Filter rhs_filter) {
+  MADOKA_THROW_IF((mode != SKETCH_SUM_MERGE) && (mode != SKETCH_MAX_MERGE) &&
+                  (mode != SKETCH_MIN_MERGE));
   MADOKA_THROW_IF(width() != rhs.width());
   MADOKA_THROW_IF(seed() != rhs.seed());
+  MADOKA_THROW_IF(block_width() != rhs.block_width());
+  MADOKA_THROW_IF(cell_range_.fast() != rhs.cell_range_.fast());
+
+  // The tables are merged as they are. Then the pending cells of `rhs' are
+  // merged again with the values that demote_() would leave in them, and
+  // the hot keys of this sketch stay in its HotTier with their counts
+  // merged with their estimates in `rhs'. Both are read before the tables
+  // are merged, because `rhs' may be this sketch.
+  PendingCell rhs_cells[MAX_NUM_PENDING_CELLS];
+  const UInt64 num_rhs_cells = rhs.get_pending_cells_(rhs_cells);
+  UInt64 lhs_values[MAX_NUM_PENDING_CELLS];
+  for (UInt64 i = 0; i < num_rhs_cells; ++i) {
+    lhs_values[i] = get_(rhs_cells[i].table_id, rhs_cells[i].cell_id);
+  }
+  UInt64 hot_counts[HOT_TIER_SIZE];
+  for (UInt64 i = 0; i < num_hot_keys(); ++i) {
+    const HotTier::Entry &entry = (*hot_tier_)[i];
+    UInt64 rhs_value = rhs.max_value();
+    for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
+      const UInt64 value = rhs.get_pending_value_(rhs_cells, num_rhs_cells,
+          table_id, row_cell_id_(table_id, entry.cell_ids[table_id]),
+          rhs.random_);
+      if (value < rhs_value) {
+        rhs_value = value;
+      }
+    }
+    hot_counts[i] = merge_values(mode,
+        (lhs_filter != NULL) ? lhs_filter(entry.count) : entry.count,
+        (rhs_filter != NULL) ? rhs_filter(rhs_value) : rhs_value,
+        max_value());
+  }
 
   if ((lhs_filter != NULL) || (rhs_filter != NULL) ||
-      (mode() == SKETCH_EXACT_MODE) || (rhs.mode() == SKETCH_EXACT_MODE)) {
-    if (mode() == SKETCH_EXACT_MODE) {
-      exact_merge_(rhs, lhs_filter, rhs_filter);
+      (this->mode() == SKETCH_EXACT_MODE) ||
+      (rhs.mode() == SKETCH_EXACT_MODE)) {
+    if (this->mode() == SKETCH_EXACT_MODE) {
+      exact_merge_(rhs, mode, lhs_filter, rhs_filter);
     } else {
-      approx_merge_(rhs, lhs_filter, rhs_filter);
+      approx_merge_(rhs, mode, lhs_filter, rhs_filter);
     }
   } else {
-    approx_merge_(rhs);
+    approx_merge_(rhs, mode);
   }
+
+  for (UInt64 i = 0; i < num_rhs_cells; ++i) {
+    const PendingCell &cell = rhs_cells[i];
+    set_(cell.table_id, cell.cell_id, merge_values(mode,
+        (lhs_filter != NULL) ? lhs_filter(lhs_values[i]) : lhs_values[i],
+        (rhs_filter != NULL) ? rhs_filter(cell.value) : cell.value,
+        max_value()));
+  }
+  for (UInt64 i = 0; i < num_hot_keys(); ++i) {
+    const HotTier::Entry &entry = (*hot_tier_)[i];
+    hot_tier_->reset(i, entry.cell_ids, hot_counts[i],
+                     (this->*table_ops_->get)(entry.cell_ids));
+  }
+  refresh_top_k_(&rhs);
 }
 
 double Sketch::inner_product(const Sketch &rhs, double *lhs_square_length,
                              double *rhs_square_length) const {
   MADOKA_THROW_IF(width() != rhs.width());
   MADOKA_THROW_IF(seed() != rhs.seed());
+  MADOKA_THROW_IF(block_width() != rhs.block_width());
+  MADOKA_THROW_IF(cell_range_.fast() != rhs.cell_range_.fast());
+
+  // The pending cells of both sketches are added to the sums of the rows
+  // after the tables.
+  PendingCell lhs_cells[MAX_NUM_PENDING_CELLS];
+  PendingCell rhs_cells[MAX_NUM_PENDING_CELLS];
+  const UInt64 num_lhs_cells = get_pending_cells_(lhs_cells);
+  const UInt64 num_rhs_cells = rhs.get_pending_cells_(rhs_cells);
+
+  const UInt64 chunk_cells = get_chunk_cells(width());
+  const UInt64 num_chunks = (width() + chunk_cells - 1) / chunk_cells;
+
+  // chunk_sums[i][0], chunk_sums[i][1] and chunk_sums[i][2] are the inner
+  // product and the square lengths of the i-th chunk.
+  double chunk_sums[SKETCH_MAX_NUM_TASKS][3];
+  const bool is_packed = is_packed_pair_(rhs);
+  run_tasks_(num_chunks * SKETCH_DEPTH,
+             (mode() == SKETCH_EXACT_MODE) &&
+             (rhs.mode() == SKETCH_EXACT_MODE), [&](UInt64 task_id) {
+    const UInt64 table_id = task_id / num_chunks;
+    const UInt64 begin = (task_id % num_chunks) * chunk_cells;
+    const UInt64 end = ((width() - begin) < chunk_cells) ?
+        width() : (begin + chunk_cells);
+    double * const sums = chunk_sums[task_id];
+    sums[0] = sums[1] = sums[2] = 0.0;
+    UInt64 lhs_values[SKETCH_BULK_SIZE];
+    UInt64 rhs_values[SKETCH_BULK_SIZE];
+    for (UInt64 offset = begin; offset < end; offset += SKETCH_BULK_SIZE) {
+      const UInt64 num_cells = ((end - offset) < SKETCH_BULK_SIZE) ?
+          (end - offset) : SKETCH_BULK_SIZE;
+      if (is_packed) {
+        exact_inner_product_(rhs, table_id, offset, num_cells, sums);
+      } else {
+        get_bulk_(table_id, offset, num_cells, lhs_values);
+        rhs.get_bulk_(table_id, offset, num_cells, rhs_values);
+        kernel().inner_product(lhs_values, rhs_values, num_cells, sums);
+      }
+    }
+  });
 
   double inner_product = std::numeric_limits<double>::max();
   for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
-    double current_inner_product = 0.0;
-    double current_lhs_square_length = 0.0;
-    double current_rhs_square_length = 0.0;
-    for (UInt64 cell_id = 0; cell_id < width(); ++cell_id) {
-      const double lhs_value =
-          static_cast<double>(get_(table_id, cell_id));
-      const double rhs_value =
-          static_cast<double>(rhs.get_(table_id, cell_id));
-      current_inner_product += lhs_value * rhs_value;
-      if (lhs_square_length != NULL) {
-        current_lhs_square_length += lhs_value * lhs_value;
-      }
-      if (rhs_square_length != NULL) {
-        current_rhs_square_length += rhs_value * rhs_value;
+    // sums[0], sums[1] and sums[2] are the inner product and the square
+    // lengths of the current rows.
+    double sums[3] = { 0.0, 0.0, 0.0 };
+    for (UInt64 i = 0; i < num_chunks; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        sums[j] += chunk_sums[(table_id * num_chunks) + i][j];
       }
     }
-    if (current_inner_product < inner_product) {
-      inner_product = current_inner_product;
+    add_pending_products_(rhs, table_id, lhs_cells, num_lhs_cells,
+                          rhs_cells, num_rhs_cells, sums);
+    if (sums[0] < inner_product) {
+      inner_product = sums[0];
       if (lhs_square_length != NULL) {
-        *lhs_square_length = current_lhs_square_length;
+        *lhs_square_length = sums[1];
       }
       if (rhs_square_length != NULL) {
-        *rhs_square_length = current_rhs_square_length;
+        *rhs_square_length = sums[2];
       }
     }
   }
   return inner_product;
 }
 
+void Sketch::inner_products(const Sketch * const *sketches,
+                            std::size_t num_sketches, double *inner_products,
+                            double *square_lengths) {
+  MADOKA_THROW_IF(sketches == NULL);
+  MADOKA_THROW_IF(num_sketches == 0);
+  MADOKA_THROW_IF(inner_products == NULL);
+  const Sketch &first = *sketches[0];
+  for (std::size_t i = 1; i < num_sketches; ++i) {
+    const Sketch &sketch = *sketches[i];
+    MADOKA_THROW_IF(sketch.width() != first.width());
+    MADOKA_THROW_IF(sketch.seed() != first.seed());
+    MADOKA_THROW_IF(sketch.block_width() != first.block_width());
+    MADOKA_THROW_IF(sketch.cell_range_.fast() != first.cell_range_.fast());
+  }
+
+  // Only the sketches with hot keys have pending cells, so the cells are
+  // allocated for their hot keys.
+  std::size_t max_num_pending_cells = 0;
+  bool is_exact = true;
+  for (std::size_t i = 0; i < num_sketches; ++i) {
+    max_num_pending_cells += static_cast<std::size_t>(
+        sketches[i]->num_hot_keys() * SKETCH_DEPTH);
+    is_exact = is_exact && (sketches[i]->mode() == SKETCH_EXACT_MODE);
+  }
+  ScopedArray<PendingCell> pending_cells(max_num_pending_cells);
+  ScopedArray<const PendingCell *> pending_cell_ptrs(num_sketches);
+  ScopedArray<UInt64> num_pending_cells(num_sketches);
+  MADOKA_THROW_IF(pending_cells.get() == NULL);
+  MADOKA_THROW_IF(pending_cell_ptrs.get() == NULL);
+  MADOKA_THROW_IF(num_pending_cells.get() == NULL);
+  PendingCell *cells = pending_cells.get();
+  for (std::size_t i = 0; i < num_sketches; ++i) {
+    pending_cell_ptrs[i] = cells;
+    num_pending_cells[i] = (sketches[i]->num_hot_keys() != 0) ?
+        sketches[i]->get_pending_cells_(cells) : 0;
+    cells += num_pending_cells[i];
+  }
+
+  // The sketches are split into tiles and a task computes the pairs of two
+  // tiles, or of one tile with itself. A tile is as large as possible
+  // without an executor, because each task reads the rows of its tiles once.
+  // With an executor, NUM_PARALLEL_TILES tiles give enough tasks.
+  const std::size_t NUM_PARALLEL_TILES = 6;
+  std::size_t tile_size = num_sketches;
+  if (is_exact && (first.executor() != NULL)) {
+    tile_size = (num_sketches + NUM_PARALLEL_TILES - 1) / NUM_PARALLEL_TILES;
+  }
+  if (tile_size > SKETCH_MAX_TILE_SKETCHES) {
+    tile_size = static_cast<std::size_t>(SKETCH_MAX_TILE_SKETCHES);
+  }
+  const std::size_t num_tiles = (num_sketches + tile_size - 1) / tile_size;
+  const std::size_t num_tasks = (num_tiles * (num_tiles + 1)) / 2;
+  ScopedArray<bool> results(num_tasks);
+  MADOKA_THROW_IF(results.get() == NULL);
+
+  first.run_tasks_(num_tasks, is_exact, [&](UInt64 task_id) {
+    std::size_t lhs_tile = 0;
+    std::size_t rhs_tile = static_cast<std::size_t>(task_id);
+    while (rhs_tile >= (num_tiles - lhs_tile)) {
+      rhs_tile -= num_tiles - lhs_tile;
+      ++lhs_tile;
+    }
+    rhs_tile += lhs_tile;
+    const std::size_t lhs_begin = lhs_tile * tile_size;
+    const std::size_t rhs_begin = rhs_tile * tile_size;
+    const std::size_t lhs_end = ((num_sketches - lhs_begin) < tile_size) ?
+        num_sketches : (lhs_begin + tile_size);
+    const std::size_t rhs_end = ((num_sketches - rhs_begin) < tile_size) ?
+        num_sketches : (rhs_begin + tile_size);
+    results[task_id] = inner_products_(sketches, num_sketches, lhs_begin,
+                                       lhs_end, rhs_begin, rhs_end,
+                                       pending_cell_ptrs.get(),
+                                       num_pending_cells.get(),
+                                       inner_products, square_lengths);
+  });
+  for (std::size_t i = 0; i < num_tasks; ++i) {
+    MADOKA_THROW_IF(!results[i]);
+  }
+}
+
 void Sketch::swap(Sketch *sketch) noexcept {
   file_.swap(&sketch->file_);
   util::swap(header_, sketch->header_);
   util::swap(random_, sketch->random_);
+  util::swap(hot_tier_, sketch->hot_tier_);
+  util::swap(top_k_, sketch->top_k_);
   util::swap(table_, sketch->table_);
+  util::swap(block_width_, sketch->block_width_);
+  util::swap(block_cells_, sketch->block_cells_);
+  util::swap(cell_range_, sketch->cell_range_);
+  util::swap(block_range_, sketch->block_range_);
+  util::swap(object_flags_, sketch->object_flags_);
+  util::swap(decode_, sketch->decode_);
+  util::swap(ops_, sketch->ops_);
+  util::swap(table_ops_, sketch->table_ops_);
+}
+
+std::size_t Sketch::top_keys(TopKey *top_keys,
+                             std::size_t max_num_keys) const noexcept {
+  return (top_k_ != NULL) ? top_k_->top(top_keys, max_num_keys) : 0;
+}
+
+void Sketch::reset_thread_counter(UInt64 counter) noexcept {
+  get_thread_counter() = counter;
+}
+
+void Sketch::reset_thread_counter(UInt64 counter, UInt64 stream_id) noexcept {
+  get_thread_counter() = counter;
+  get_thread_stream_key() = stream_id * 0xBF58476D1CE4E5B9ULL;
 }
 
 void Sketch::create_(UInt64 width, UInt64 max_value, const char *path,
@@ -470,75 +1388,74 @@ void Sketch::create_(UInt64 width, UInt64 max_value, const char *path,
     width = SKETCH_DEFAULT_WIDTH;
   }
 
-  if (max_value == 0) {
-    max_value = SKETCH_DEFAULT_MAX_VALUE;
-  } else if (max_value < (1ULL << 1)) {
-    max_value = (1ULL << 1) - 1;
-  } else if (max_value < (1ULL << 2)) {
-    max_value = (1ULL << 2) - 1;
-  } else if (max_value < (1ULL << 4)) {
-    max_value = (1ULL << 4) - 1;
-  } else if (max_value < (1ULL << 8)) {
-    max_value = (1ULL << 8) - 1;
-  } else if (max_value < (1ULL << 16)) {
-    max_value = (1ULL << 16) - 1;
-  } else {
-    max_value = SKETCH_MAX_MAX_VALUE;
-  }
+  max_value = normalize_max_value(max_value);
 
   MADOKA_THROW_IF(width < SKETCH_MIN_WIDTH);
   MADOKA_THROW_IF(width > SKETCH_MAX_WIDTH);
   MADOKA_THROW_IF(max_value > SKETCH_MAX_MAX_VALUE);
 
   const UInt64 value_size = util::bit_scan_reverse(max_value) + 1;
-  UInt64 table_size = sizeof(UInt64) * width;
-  if (value_size != SKETCH_APPROX_VALUE_SIZE) {
-    table_size = (((value_size * width * SKETCH_DEPTH) + 63) / 64) * 8;
-  }
+  const UInt64 block_width = get_block_width(value_size, flags);
+  width = ((width + block_width - 1) / block_width) * block_width;
+  MADOKA_THROW_IF(width > SKETCH_MAX_WIDTH);
 
-  const UInt64 file_size = sizeof(Header) + sizeof(Random) + table_size;
+  const UInt64 table_size = get_table_size(width, value_size, flags);
+  const UInt64 file_size =
+      get_table_offset(flags, SKETCH_FORMAT_VERSION) + table_size;
   MADOKA_THROW_IF(file_size > std::numeric_limits<std::size_t>::max());
 
-  file_.create(path, static_cast<std::size_t>(file_size), flags);
+  file_.create(path, static_cast<std::size_t>(file_size),
+               flags & ~(SKETCH_HEADER_FLAGS | SKETCH_OBJECT_FLAGS));
   header_ = static_cast<Header *>(file_.addr());
   random_ = reinterpret_cast<Random *>(header_ + 1);
-  table_ = reinterpret_cast<UInt64 *>(random_ + 1);
+  table_ = reinterpret_cast<UInt64 *>(static_cast<UInt8 *>(file_.addr()) +
+      get_table_offset(flags, SKETCH_FORMAT_VERSION));
 
   header().set_width(width);
   header().set_depth(SKETCH_DEPTH);
+  header().set_version(SKETCH_FORMAT_VERSION);
+  header().set_magic(HEADER_MAGIC);
+  header().set_flags(flags & SKETCH_HEADER_FLAGS);
   header().set_max_value(max_value);
   header().set_value_size(value_size);
   header().set_seed(seed);
   header().set_table_size(table_size);
   header().set_file_size(file_size);
   check_header();
+  init_(flags);
 
   random_->reset(seed);
 }
 
 void Sketch::open_(const char *path, int flags) {
-  file_.open(path, flags);
+  file_.open(path, flags & ~SKETCH_OBJECT_FLAGS);
   header_ = static_cast<Header *>(file_.addr());
   random_ = reinterpret_cast<Random *>(header_ + 1);
-  table_ = reinterpret_cast<UInt64 *>(random_ + 1);
+  table_ = reinterpret_cast<UInt64 *>(static_cast<UInt8 *>(file_.addr()) +
+      get_table_offset(static_cast<int>(header().flags()), version()));
   check_header();
+  init_(flags);
 }
 
 void Sketch::load_(const char *path, int flags) {
-  file_.load(path, flags);
+  file_.load(path, flags & ~SKETCH_OBJECT_FLAGS);
   header_ = static_cast<Header *>(file_.addr());
   random_ = reinterpret_cast<Random *>(header_ + 1);
-  table_ = reinterpret_cast<UInt64 *>(random_ + 1);
+  table_ = reinterpret_cast<UInt64 *>(static_cast<UInt8 *>(file_.addr()) +
+      get_table_offset(static_cast<int>(header().flags()), version()));
   check_header();
+  init_(flags);
 }
 
 void Sketch::deserialize_(const void *buf, UInt64 size, int flags) {
-  file_.create(NULL, size, flags);
+  file_.create(NULL, size, flags & ~SKETCH_OBJECT_FLAGS);
   std::memcpy(file_.addr(), buf, size);
   header_ = static_cast<Header *>(file_.addr());
   random_ = reinterpret_cast<Random *>(header_ + 1);
-  table_ = reinterpret_cast<UInt64 *>(random_ + 1);
+  table_ = reinterpret_cast<UInt64 *>(static_cast<UInt8 *>(file_.addr()) +
+      get_table_offset(static_cast<int>(header().flags()), version()));
   check_header();
+  init_(flags);
 }
 
 void Sketch::check_header() const {
@@ -546,231 +1463,629 @@ void Sketch::check_header() const {
   MADOKA_THROW_IF(width() > SKETCH_MAX_WIDTH);
   MADOKA_THROW_IF((width_mask() != 0) && (width_mask() != (width() - 1)));
   MADOKA_THROW_IF(depth() != SKETCH_DEPTH);
+  if (header().magic() == 0) {
+    MADOKA_THROW_IF(version() != 0);
+    MADOKA_THROW_IF(header().flags() & SKETCH_HUGE_PAGE_ALIGNED);
+  } else {
+    MADOKA_THROW_IF(header().magic() != HEADER_MAGIC);
+    MADOKA_THROW_IF(version() == 0);
+    MADOKA_THROW_IF(version() > SKETCH_FORMAT_VERSION);
+  }
+  MADOKA_THROW_IF(header().flags() & ~SKETCH_HEADER_FLAGS);
   MADOKA_THROW_IF(max_value() == 0);
   MADOKA_THROW_IF(value_size() != (util::bit_scan_reverse(max_value()) + 1));
-  if (mode() == SKETCH_APPROX_MODE) {
-    MADOKA_THROW_IF(table_size() != (sizeof(UInt64)) * width());
+  MADOKA_THROW_IF(max_value() != normalize_max_value(max_value()));
+  const int flags = static_cast<int>(header().flags());
+  MADOKA_THROW_IF((width() % get_block_width(value_size(), flags)) != 0);
+  MADOKA_THROW_IF(table_size() != get_table_size(width(), value_size(), flags));
+  MADOKA_THROW_IF(file_size() !=
+                  (get_table_offset(flags, version()) + table_size()));
+  MADOKA_THROW_IF(file_size() != file_.size());
+}
+
+void Sketch::init_(int flags) {
+  const int header_flags = static_cast<int>(header().flags());
+  block_width_ = get_block_width(value_size(), header_flags);
+  block_cells_ = get_block_cells(value_size());
+  const bool fast_range = (header_flags & SKETCH_FAST_RANGE) != 0;
+  cell_range_.reset(width(), SKETCH_ID_SIZE, fast_range);
+  block_range_.reset(width() / block_width_, SKETCH_ID_SIZE, fast_range);
+  object_flags_ = flags & SKETCH_OBJECT_FLAGS;
+  MADOKA_THROW_IF((object_flags_ & SKETCH_DECODE_LOWER) &&
+                  (object_flags_ & SKETCH_DECODE_MIDPOINT));
+  if (object_flags_ & SKETCH_DECODE_LOWER) {
+    decode_ = SKETCH_LOWER_DECODE;
+  } else if (object_flags_ & SKETCH_DECODE_MIDPOINT) {
+    decode_ = SKETCH_MIDPOINT_DECODE;
   } else {
-    const UInt64 expected_table_size =
-        (((value_size() * width() * SKETCH_DEPTH) + 63) / 64) * 8;
-    MADOKA_THROW_IF(table_size() != expected_table_size);
+    decode_ = SKETCH_RANDOM_DECODE;
+  }
+  MADOKA_THROW_IF((header_flags & (SKETCH_HOT_TIER | SKETCH_TOP_K)) &&
+                  (object_flags_ & SKETCH_CONCURRENT));
+  table_ops_ = get_ops_(value_size(), object_flags_);
+
+  // The HotTier and the TopK follow the generator in this order.
+  UInt8 *region = reinterpret_cast<UInt8 *>(random_ + 1);
+  if (header_flags & SKETCH_HOT_TIER) {
+    hot_tier_ = reinterpret_cast<HotTier *>(region);
+    region += sizeof(HotTier);
+    ops_ = get_hot_tier_ops_();
+  } else {
+    hot_tier_ = NULL;
+    ops_ = table_ops_;
+  }
+  top_k_ = (header_flags & SKETCH_TOP_K) ?
+      reinterpret_cast<TopK *>(region) : NULL;
+}
+
+const Sketch::Ops *Sketch::get_ops_(UInt64 value_size, int flags) noexcept {
+  static const Ops OPS_TABLE[] = {
+    { &Sketch::exact_get<1>, &Sketch::exact_set<1>,
+      &Sketch::exact_inc<1>, &Sketch::exact_add<1> },
+    { &Sketch::exact_get<2>, &Sketch::exact_set<2>,
+      &Sketch::exact_inc<2>, &Sketch::exact_add<2> },
+    { &Sketch::exact_get<4>, &Sketch::exact_set<4>,
+      &Sketch::exact_inc<4>, &Sketch::exact_add<4> },
+    { &Sketch::exact_get<8>, &Sketch::exact_set<8>,
+      &Sketch::exact_inc<8>, &Sketch::exact_add<8> },
+    { &Sketch::exact_get<16>, &Sketch::exact_set<16>,
+      &Sketch::exact_inc<16>, &Sketch::exact_add<16> },
+    { &Sketch::approx_get<SharedRandom>, &Sketch::approx_set,
+      &Sketch::approx_inc<SharedRandom>, &Sketch::approx_add<SharedRandom> },
+    { &Sketch::concurrent_exact_get<1>, &Sketch::concurrent_exact_set<1>,
+      &Sketch::concurrent_exact_inc<1>, &Sketch::concurrent_exact_add<1> },
+    { &Sketch::concurrent_exact_get<2>, &Sketch::concurrent_exact_set<2>,
+      &Sketch::concurrent_exact_inc<2>, &Sketch::concurrent_exact_add<2> },
+    { &Sketch::concurrent_exact_get<4>, &Sketch::concurrent_exact_set<4>,
+      &Sketch::concurrent_exact_inc<4>, &Sketch::concurrent_exact_add<4> },
+    { &Sketch::concurrent_exact_get<8>, &Sketch::concurrent_exact_set<8>,
+      &Sketch::concurrent_exact_inc<8>, &Sketch::concurrent_exact_add<8> },
+    { &Sketch::concurrent_exact_get<16>, &Sketch::concurrent_exact_set<16>,
+      &Sketch::concurrent_exact_inc<16>, &Sketch::concurrent_exact_add<16> },
+    { &Sketch::concurrent_approx_get<ThreadRandom>,
+      &Sketch::concurrent_approx_set,
+      &Sketch::concurrent_approx_inc<ThreadRandom>,
+      &Sketch::concurrent_approx_add<ThreadRandom> },
+    { &Sketch::approx_get<KeyedRandom>, &Sketch::approx_set,
+      &Sketch::approx_inc<KeyedRandom>, &Sketch::approx_add<KeyedRandom> },
+    { &Sketch::concurrent_approx_get<KeyedRandom>,
+      &Sketch::concurrent_approx_set,
+      &Sketch::concurrent_approx_inc<KeyedRandom>,
+      &Sketch::concurrent_approx_add<KeyedRandom> }
+  };
+
+  const Ops * const ops =
+      (flags & SKETCH_CONCURRENT) ? &OPS_TABLE[6] : &OPS_TABLE[0];
+  if ((value_size == SKETCH_APPROX_VALUE_SIZE) &&
+      (flags & SKETCH_COUNTER_RANDOM)) {
+    return (flags & SKETCH_CONCURRENT) ? &OPS_TABLE[13] : &OPS_TABLE[12];
+  }
+  switch (value_size) {
+    case 1: {
+      return &ops[0];
+    }
+    case 2: {
+      return &ops[1];
+    }
+    case 4: {
+      return &ops[2];
+    }
+    case 8: {
+      return &ops[3];
+    }
+    case 16: {
+      return &ops[4];
+    }
+    default: {
+      return &ops[5];
+    }
   }
-  MADOKA_THROW_IF(file_size() != file_.size());
 }
 
 UInt64 Sketch::get_(UInt64 table_id, UInt64 cell_id) const noexcept {
+  return get_(table_id, cell_id, random_);
+}
+
+template <typename T>
+UInt64 Sketch::get_(UInt64 table_id, UInt64 cell_id,
+                    T *random) const noexcept {
   if (mode() == SKETCH_EXACT_MODE) {
-    return exact_get_((width() * table_id) + cell_id);
+    return exact_get_(exact_cell_id_(table_id, cell_id));
   } else {
-    return Approx::decode(approx_get_(table_id, cell_id), random_);
+    return Approx::decode(approx_get_(table_id, cell_id), random);
   }
 }
 
 void Sketch::set_(UInt64 table_id, UInt64 cell_id, UInt64 value) noexcept {
   if (mode() == SKETCH_EXACT_MODE) {
-    exact_set_((width() * table_id) + cell_id, value);
+    exact_set_(exact_cell_id_(table_id, cell_id), value);
   } else {
     approx_set_(table_id, cell_id, Approx::encode(value));
   }
 }
 
+// get_bulk_() reads the values of `num_cells' cells from the `cell_id'-th
+// cell of a row. It gives the same values as get_() and consumes the same
+// random numbers.
+void Sketch::get_bulk_(UInt64 table_id, UInt64 cell_id, UInt64 num_cells,
+                       UInt64 *values) const noexcept {
+  get_bulk_(table_id, cell_id, num_cells, values, random_);
+}
+
+template <typename T>
+void Sketch::get_bulk_(UInt64 table_id, UInt64 cell_id, UInt64 num_cells,
+                       UInt64 *values, T *random) const noexcept {
+  if (mode() == SKETCH_EXACT_MODE) {
+    // The cells of a row are contiguous in each block.
+    while (num_cells != 0) {
+      UInt64 num_contiguous_cells = num_cells;
+      if (block_width_ != 1) {
+        const UInt64 block_offset = cell_id % block_width_;
+        if ((block_width_ - block_offset) < num_contiguous_cells) {
+          num_contiguous_cells = block_width_ - block_offset;
+        }
+      }
+      kernel().exact_decode(table_, exact_cell_id_(table_id, cell_id),
+                            num_contiguous_cells, value_size(), values);
+      cell_id += num_contiguous_cells;
+      num_cells -= num_contiguous_cells;
+      values += num_contiguous_cells;
+    }
+  } else {
+    UInt64 masks[SKETCH_BULK_SIZE];
+    while (num_cells != 0) {
+      const UInt64 num_units =
+          (num_cells < SKETCH_BULK_SIZE) ? num_cells : SKETCH_BULK_SIZE;
+      kernel().approx_decode(table_ + cell_id, num_units, table_id,
+                             values, masks);
+      for (UInt64 i = 0; i < num_units; ++i) {
+#ifndef MADOKA_NOT_PREFER_BRANCH
+        if (masks[i] != 0) {
+          values[i] |= (*random)() & masks[i];
+        }
+#else  // MADOKA_NOT_PREFER_BRANCH
+        values[i] |= (*random)() & masks[i];
+#endif  // MADOKA_NOT_PREFER_BRANCH
+      }
+      cell_id += num_units;
+      num_cells -= num_units;
+      values += num_units;
+    }
+  }
+}
+
+// set_bulk_() writes the values of `num_cells' cells from the `cell_id'-th
+// cell of a row.
+void Sketch::set_bulk_(UInt64 table_id, UInt64 cell_id, UInt64 num_cells,
+                       const UInt64 *values) noexcept {
+  if (mode() == SKETCH_EXACT_MODE) {
+    for (UInt64 i = 0; i < num_cells; ++i) {
+      exact_set_(exact_cell_id_(table_id, cell_id + i), values[i]);
+    }
+    return;
+  }
+
+  UInt64 approxes[SKETCH_BULK_SIZE];
+  while (num_cells != 0) {
+    const UInt64 num_units =
+        (num_cells < SKETCH_BULK_SIZE) ? num_cells : SKETCH_BULK_SIZE;
+    Approx::encode_n(values, num_units, approxes);
+    for (UInt64 i = 0; i < num_units; ++i) {
+      approx_set_(table_id, cell_id + i, approxes[i]);
+    }
+    cell_id += num_units;
+    num_cells -= num_units;
+    values += num_units;
+  }
+}
+
+// filter_cells_() filters the runs of cells of each task in bulk. An approx
+// task decodes its cells with its own generator.
+void Sketch::filter_cells_(
+    void (*filter_bulk)(void *, UInt64 *, UInt64, UInt64),
+    void *filter) noexcept {
+  const UInt64 key =
+      (mode() == SKETCH_APPROX_MODE) ? get_task_key(random_) : 0;
+  run_unit_tasks_(table_size() / sizeof(UInt64), true,
+                  [&](UInt64 begin, UInt64 end) {
+    CounterRandom random(key, begin << 32);
+    UInt64 values[SKETCH_BULK_SIZE];
+    for_each_run_(begin, end,
+                  [&](UInt64 table_id, UInt64 cell_id, UInt64 num_cells) {
+      while (num_cells != 0) {
+        const UInt64 num_bulk_cells =
+            (num_cells < SKETCH_BULK_SIZE) ? num_cells : SKETCH_BULK_SIZE;
+        get_bulk_(table_id, cell_id, num_bulk_cells, values, &random);
+        filter_bulk(filter, values, num_bulk_cells, max_value());
+        set_bulk_(table_id, cell_id, num_bulk_cells, values);
+        cell_id += num_bulk_cells;
+        num_cells -= num_bulk_cells;
+      }
+    });
+  });
+}
+
+// filter_by_table_() replaces each value v of an exact sketch with values of
+// less than 16 bits by table[v]. A byte of cells is mapped at once with a
+// table of bytes.
+void Sketch::filter_by_table_(const UInt64 *table) noexcept {
+  const UInt64 value_mask = (1ULL << value_size()) - 1;
+  UInt8 byte_table[256];
+  for (UInt64 byte = 0; byte < 256; ++byte) {
+    UInt64 result = 0;
+    for (UInt64 shift = 0; shift < 8; shift += value_size()) {
+      result |= table[(byte >> shift) & value_mask] << shift;
+    }
+    byte_table[byte] = static_cast<UInt8>(result);
+  }
+
+  run_unit_tasks_(table_size() / sizeof(UInt64), true,
+                  [&](UInt64 begin, UInt64 end) {
+    UInt8 * const bytes = reinterpret_cast<UInt8 *>(table_);
+    for (UInt64 i = begin * sizeof(UInt64); i < (end * sizeof(UInt64)); ++i) {
+      bytes[i] = byte_table[bytes[i]];
+    }
+  });
+}
+
+UInt64 Sketch::exact_cell_id_(UInt64 table_id,
+                              UInt64 cell_id) const noexcept {
+  if (block_width_ == 1) {
+    return (width() * table_id) + cell_id;
+  }
+  return ((cell_id / block_width_) * block_cells_) +
+      (block_width_ * table_id) + (cell_id % block_width_);
+}
+
+// exact_get_(), exact_set_() and exact_set_floor_() are specialized for
+// each value size. 8-bit and 16-bit values are accessed directly and the
+// others are packed into 64-bit units.
+template <UInt64 VALUE_SIZE>
+UInt64 Sketch::exact_get_(UInt64 cell_id) const noexcept {
+  const UInt64 max_cell_value = (1ULL << VALUE_SIZE) - 1;
+  if (VALUE_SIZE == 8) {
+    return reinterpret_cast<const UInt8 *>(table_)[cell_id];
+  } else if (VALUE_SIZE == 16) {
+    return reinterpret_cast<const UInt16 *>(table_)[cell_id];
+  }
+  const UInt64 num_unit_cells = 64 / VALUE_SIZE;
+  return (table_[cell_id / num_unit_cells] >>
+      ((cell_id % num_unit_cells) * VALUE_SIZE)) & max_cell_value;
+}
+
+template <UInt64 VALUE_SIZE>
+void Sketch::exact_set_(UInt64 cell_id, UInt64 value) noexcept {
+  const UInt64 max_cell_value = (1ULL << VALUE_SIZE) - 1;
+  if (VALUE_SIZE == 8) {
+    reinterpret_cast<UInt8 *>(table_)[cell_id] = static_cast<UInt8>(value);
+  } else if (VALUE_SIZE == 16) {
+    reinterpret_cast<UInt16 *>(table_)[cell_id] = static_cast<UInt16>(value);
+  } else {
+    const UInt64 num_unit_cells = 64 / VALUE_SIZE;
+    UInt64 &unit = table_[cell_id / num_unit_cells];
+    const UInt64 unit_offset = (cell_id % num_unit_cells) * VALUE_SIZE;
+    unit &= ~(max_cell_value << unit_offset);
+    unit |= value << unit_offset;
+  }
+}
+
+template <UInt64 VALUE_SIZE>
+void Sketch::exact_set_floor_(UInt64 cell_id, UInt64 value) noexcept {
+  const UInt64 max_cell_value = (1ULL << VALUE_SIZE) - 1;
+  if (VALUE_SIZE == 1) {
+    table_[cell_id / 64] |= value << (cell_id % 64);
+  } else if (VALUE_SIZE == 8) {
+    UInt8 &cell = reinterpret_cast<UInt8 *>(table_)[cell_id];
+    if (cell < value) {
+      cell = static_cast<UInt8>(value);
+    }
+  } else if (VALUE_SIZE == 16) {
+    UInt16 &cell = reinterpret_cast<UInt16 *>(table_)[cell_id];
+    if (cell < value) {
+      cell = static_cast<UInt16>(value);
+    }
+  } else {
+    const UInt64 num_unit_cells = 64 / VALUE_SIZE;
+    UInt64 &unit = table_[cell_id / num_unit_cells];
+    const UInt64 unit_offset = (cell_id % num_unit_cells) * VALUE_SIZE;
+    if (((unit >> unit_offset) & max_cell_value) < value) {
+      unit &= ~(max_cell_value << unit_offset);
+      unit |= value << unit_offset;
+    }
+  }
+}
+
+UInt64 Sketch::exact_get_(UInt64 cell_id) const noexcept {
+  switch (value_size()) {
+    case 1: {
+      return exact_get_<1>(cell_id);
+    }
+    case 2: {
+      return exact_get_<2>(cell_id);
+    }
+    case 4: {
+      return exact_get_<4>(cell_id);
+    }
+    case 8: {
+      return exact_get_<8>(cell_id);
+    }
+    case 16: {
+      return exact_get_<16>(cell_id);
+    }
+    default: {
+      return 0;
+    }
+  }
+}
+
+void Sketch::exact_set_(UInt64 cell_id, UInt64 value) noexcept {
+  switch (value_size()) {
+    case 1: {
+      exact_set_<1>(cell_id, value);
+      break;
+    }
+    case 2: {
+      exact_set_<2>(cell_id, value);
+      break;
+    }
+    case 4: {
+      exact_set_<4>(cell_id, value);
+      break;
+    }
+    case 8: {
+      exact_set_<8>(cell_id, value);
+      break;
+    }
+    case 16: {
+      exact_set_<16>(cell_id, value);
+      break;
+    }
+  }
+}
+
+template <UInt64 VALUE_SIZE>
 UInt64 Sketch::exact_get(const UInt64 cell_ids[3]) const noexcept {
-  UInt64 min_value = exact_get_(cell_ids[0]);
+  UInt64 min_value = exact_get_<VALUE_SIZE>(cell_ids[0]);
   if (min_value == 0) {
     return 0;
   }
 
-  UInt64 value = exact_get_(cell_ids[1]);
+  UInt64 value = exact_get_<VALUE_SIZE>(cell_ids[1]);
   if (value == 0) {
     return 0;
   } else if (value < min_value) {
     min_value = value;
   }
 
-  value = exact_get_(cell_ids[2]);
+  value = exact_get_<VALUE_SIZE>(cell_ids[2]);
   return (value < min_value) ? value : min_value;
 }
 
+template <UInt64 VALUE_SIZE>
 void Sketch::exact_set(const UInt64 cell_ids[3], UInt64 value) noexcept {
-  if (value > max_value()) {
-    value = max_value();
+  const UInt64 max_cell_value = (1ULL << VALUE_SIZE) - 1;
+  if (value > max_cell_value) {
+    value = max_cell_value;
   }
 
-  exact_set_floor_(cell_ids[0], value);
-  exact_set_floor_(cell_ids[1], value);
-  exact_set_floor_(cell_ids[2], value);
+  exact_set_floor_<VALUE_SIZE>(cell_ids[0], value);
+  exact_set_floor_<VALUE_SIZE>(cell_ids[1], value);
+  exact_set_floor_<VALUE_SIZE>(cell_ids[2], value);
 }
 
+template <UInt64 VALUE_SIZE>
 UInt64 Sketch::exact_inc(const UInt64 cell_ids[3]) noexcept {
+  const UInt64 max_cell_value = (1ULL << VALUE_SIZE) - 1;
   UInt64 values[3];
-  values[0] = exact_get_(cell_ids[0]);
-  values[1] = exact_get_(cell_ids[1]);
-  values[2] = exact_get_(cell_ids[2]);
+  values[0] = exact_get_<VALUE_SIZE>(cell_ids[0]);
+  values[1] = exact_get_<VALUE_SIZE>(cell_ids[1]);
+  values[2] = exact_get_<VALUE_SIZE>(cell_ids[2]);
   if (values[0] < values[1]) {
     if (values[0] > values[2]) {
-      exact_set_(cell_ids[2], ++values[2]);
+      exact_set_<VALUE_SIZE>(cell_ids[2], ++values[2]);
       return values[2];
     } else {
       if (values[0]++ == values[2]) {
-        exact_set_(cell_ids[2], values[0]);
+        exact_set_<VALUE_SIZE>(cell_ids[2], values[0]);
       }
-      exact_set_(cell_ids[0], values[0]);
+      exact_set_<VALUE_SIZE>(cell_ids[0], values[0]);
       return values[0];
     }
   } else if (values[0] > values[1]) {
     if (values[1] > values[2]) {
-      exact_set_(cell_ids[2], ++values[2]);
+      exact_set_<VALUE_SIZE>(cell_ids[2], ++values[2]);
       return values[2];
     } else {
       if (values[1]++ == values[2]) {
-        exact_set_(cell_ids[2], values[1]);
+        exact_set_<VALUE_SIZE>(cell_ids[2], values[1]);
       }
-      exact_set_(cell_ids[1], values[1]);
+      exact_set_<VALUE_SIZE>(cell_ids[1], values[1]);
       return values[1];
     }
   } else if (values[0] > values[2]) {
-    exact_set_(cell_ids[2], ++values[2]);
+    exact_set_<VALUE_SIZE>(cell_ids[2], ++values[2]);
     return values[2];
-  } else if (values[0] < max_value()) {
+  } else if (values[0] < max_cell_value) {
     if (values[0]++ == values[2]) {
-      exact_set_(cell_ids[2], values[0]);
+      exact_set_<VALUE_SIZE>(cell_ids[2], values[0]);
     }
-    exact_set_(cell_ids[0], values[0]);
-    exact_set_(cell_ids[1], values[0]);
+    exact_set_<VALUE_SIZE>(cell_ids[0], values[0]);
+    exact_set_<VALUE_SIZE>(cell_ids[1], values[0]);
   }
   return values[0];
 }
 
+template <UInt64 VALUE_SIZE>
 UInt64 Sketch::exact_add(const UInt64 cell_ids[3], UInt64 value) noexcept {
-  UInt64 new_value = max_value();
+  const UInt64 max_cell_value = (1ULL << VALUE_SIZE) - 1;
+  UInt64 new_value = max_cell_value;
   UInt64 values[3];
 
-  values[0] = exact_get_(cell_ids[0]);
+  values[0] = exact_get_<VALUE_SIZE>(cell_ids[0]);
   if ((new_value - values[0]) > value) {
     new_value = values[0] + value;
   }
 
-  values[1] = exact_get_(cell_ids[1]);
+  values[1] = exact_get_<VALUE_SIZE>(cell_ids[1]);
   if (values[1] < new_value) {
     if ((new_value - values[1]) > value) {
       new_value = values[1] + value;
     }
   }
 
-  values[2] = exact_get_(cell_ids[2]);
+  values[2] = exact_get_<VALUE_SIZE>(cell_ids[2]);
   if (values[2] < new_value) {
     if ((new_value - values[2]) > value) {
       new_value = values[2] + value;
     }
-    exact_set_(cell_ids[2], new_value);
+    exact_set_<VALUE_SIZE>(cell_ids[2], new_value);
   }
 
   if (values[1] < new_value) {
-    exact_set_(cell_ids[1], new_value);
+    exact_set_<VALUE_SIZE>(cell_ids[1], new_value);
   }
 
   if (values[0] < new_value) {
-    exact_set_(cell_ids[0], new_value);
+    exact_set_<VALUE_SIZE>(cell_ids[0], new_value);
   }
 
   return new_value;
 }
 
-UInt64 Sketch::exact_get_(UInt64 cell_id) const noexcept {
-  switch (value_size()) {
-    case 1: {
-      return (table_[cell_id / 64] >> (cell_id % 64)) & value_mask();
-    }
-    case 2: {
-      return (table_[cell_id / 32] >> ((cell_id % 32) * 2)) & value_mask();
-    }
-    case 4: {
-      return (table_[cell_id / 16] >> ((cell_id % 16) * 4)) & value_mask();
-    }
-    case 8: {
-      return reinterpret_cast<const UInt8 *>(table_)[cell_id];
-    }
-    case 16: {
-      return reinterpret_cast<const UInt16 *>(table_)[cell_id];
-    }
-    default: {
-      return 0;
+// The concurrent mode reads and updates each cell atomically. Because a
+// thread cannot read and update the 3 cells of a key at once, inc() and
+// add() add to every cell instead of only the smallest ones. Otherwise,
+// concurrent increments of one key could be lost.
+template <UInt64 VALUE_SIZE>
+UInt64 Sketch::concurrent_exact_get_(UInt64 cell_id) const noexcept {
+  typedef typename ExactUnit<VALUE_SIZE>::Type Unit;
+  const UInt64 max_cell_value = (1ULL << VALUE_SIZE) - 1;
+  const UInt64 num_unit_cells = (sizeof(Unit) * 8) / VALUE_SIZE;
+  const Unit unit = util::atomic_load(
+      reinterpret_cast<const Unit *>(table_) + (cell_id / num_unit_cells));
+  return (static_cast<UInt64>(unit) >>
+      ((cell_id % num_unit_cells) * VALUE_SIZE)) & max_cell_value;
+}
+
+template <UInt64 VALUE_SIZE>
+void Sketch::concurrent_exact_set_floor_(UInt64 cell_id,
+                                         UInt64 value) noexcept {
+  typedef typename ExactUnit<VALUE_SIZE>::Type Unit;
+  const UInt64 max_cell_value = (1ULL << VALUE_SIZE) - 1;
+  const UInt64 num_unit_cells = (sizeof(Unit) * 8) / VALUE_SIZE;
+  Unit * const unit = reinterpret_cast<Unit *>(table_) +
+      (cell_id / num_unit_cells);
+  const UInt64 unit_offset = (cell_id % num_unit_cells) * VALUE_SIZE;
+  Unit old_unit = util::atomic_load(unit);
+  while (((static_cast<UInt64>(old_unit) >> unit_offset) &
+          max_cell_value) < value) {
+    const Unit new_unit = static_cast<Unit>(
+        (static_cast<UInt64>(old_unit) & ~(max_cell_value << unit_offset)) |
+        (value << unit_offset));
+    if (util::atomic_compare_exchange(unit, &old_unit, new_unit)) {
+      break;
     }
   }
 }
 
-void Sketch::exact_set_(UInt64 cell_id, UInt64 value) noexcept {
-  switch (value_size()) {
-    case 1: {
-      table_[cell_id / 64] &= ~(value_mask() << (cell_id % 64));
-      table_[cell_id / 64] |= value << (cell_id % 64);
-      break;
+template <UInt64 VALUE_SIZE>
+UInt64 Sketch::concurrent_exact_add_(UInt64 cell_id, UInt64 value) noexcept {
+  typedef typename ExactUnit<VALUE_SIZE>::Type Unit;
+  const UInt64 max_cell_value = (1ULL << VALUE_SIZE) - 1;
+  const UInt64 num_unit_cells = (sizeof(Unit) * 8) / VALUE_SIZE;
+  Unit * const unit = reinterpret_cast<Unit *>(table_) +
+      (cell_id / num_unit_cells);
+  const UInt64 unit_offset = (cell_id % num_unit_cells) * VALUE_SIZE;
+  Unit old_unit = util::atomic_load(unit);
+  for ( ; ; ) {
+    const UInt64 old_value =
+        (static_cast<UInt64>(old_unit) >> unit_offset) & max_cell_value;
+    const UInt64 new_value = ((max_cell_value - old_value) > value) ?
+        (old_value + value) : max_cell_value;
+    if (new_value == old_value) {
+      return new_value;
     }
-    case 2: {
-      table_[cell_id / 32] &= ~(value_mask() << ((cell_id % 32) * 2));
-      table_[cell_id / 32] |= value << ((cell_id % 32) * 2);
-      break;
-    }
-    case 4: {
-      table_[cell_id / 16] &= ~(value_mask() << ((cell_id % 16) * 4));
-      table_[cell_id / 16] |= value << ((cell_id % 16) * 4);
-      break;
-    }
-    case 8: {
-      reinterpret_cast<UInt8 *>(table_)[cell_id] =
-          static_cast<UInt8>(value);
-      break;
-    }
-    case 16: {
-      reinterpret_cast<UInt16 *>(table_)[cell_id] =
-          static_cast<UInt16>(value);
-      break;
+    const Unit new_unit = static_cast<Unit>(
+        (static_cast<UInt64>(old_unit) & ~(max_cell_value << unit_offset)) |
+        (new_value << unit_offset));
+    if (util::atomic_compare_exchange(unit, &old_unit, new_unit)) {
+      return new_value;
     }
   }
 }
 
-void Sketch::exact_set_floor_(UInt64 cell_id, UInt64 value) noexcept {
-  switch (value_size()) {
-    case 1: {
-      table_[cell_id / 64] |= value << (cell_id % 64);
-      break;
-    }
-    case 2: {
-      const std::size_t unit_id = static_cast<std::size_t>(cell_id / 32);
-      const std::size_t unit_offset = static_cast<std::size_t>((cell_id % 32) * 2);
-      if (((table_[unit_id] >> unit_offset) & value_mask()) < value) {
-        table_[unit_id] &= ~(value_mask() << unit_offset);
-        table_[unit_id] |= value << unit_offset;
-      }
-      break;
-    }
-    case 4: {
-      const std::size_t unit_id = static_cast<std::size_t>(cell_id / 16);
-      const std::size_t unit_offset = static_cast<std::size_t>((cell_id % 16) * 4);
-      if (((table_[unit_id] >> unit_offset) & value_mask()) < value) {
-        table_[unit_id] &= ~(value_mask() << unit_offset);
-        table_[unit_id] |= value << unit_offset;
-      }
-      break;
+template <UInt64 VALUE_SIZE>
+UInt64 Sketch::concurrent_exact_get(
+    const UInt64 cell_ids[3]) const noexcept {
+  UInt64 min_value = concurrent_exact_get_<VALUE_SIZE>(cell_ids[0]);
+  if (min_value == 0) {
+    return 0;
+  }
+
+  UInt64 value = concurrent_exact_get_<VALUE_SIZE>(cell_ids[1]);
+  if (value == 0) {
+    return 0;
+  } else if (value < min_value) {
+    min_value = value;
+  }
+
+  value = concurrent_exact_get_<VALUE_SIZE>(cell_ids[2]);
+  return (value < min_value) ? value : min_value;
+}
+
+template <UInt64 VALUE_SIZE>
+void Sketch::concurrent_exact_set(const UInt64 cell_ids[3],
+                                  UInt64 value) noexcept {
+  const UInt64 max_cell_value = (1ULL << VALUE_SIZE) - 1;
+  if (value > max_cell_value) {
+    value = max_cell_value;
+  }
+
+  concurrent_exact_set_floor_<VALUE_SIZE>(cell_ids[0], value);
+  concurrent_exact_set_floor_<VALUE_SIZE>(cell_ids[1], value);
+  concurrent_exact_set_floor_<VALUE_SIZE>(cell_ids[2], value);
+}
+
+template <UInt64 VALUE_SIZE>
+UInt64 Sketch::concurrent_exact_inc(const UInt64 cell_ids[3]) noexcept {
+  return concurrent_exact_add<VALUE_SIZE>(cell_ids, 1);
+}
+
+template <UInt64 VALUE_SIZE>
+UInt64 Sketch::concurrent_exact_add(const UInt64 cell_ids[3],
+                                    UInt64 value) noexcept {
+  UInt64 min_value = concurrent_exact_add_<VALUE_SIZE>(cell_ids[0], value);
+  UInt64 new_value = concurrent_exact_add_<VALUE_SIZE>(cell_ids[1], value);
+  if (new_value < min_value) {
+    min_value = new_value;
+  }
+  new_value = concurrent_exact_add_<VALUE_SIZE>(cell_ids[2], value);
+  return (new_value < min_value) ? new_value : min_value;
+}
+
+template <typename Generator>
+UInt64 Sketch::approx_get(const UInt64 cell_ids[3]) const noexcept {
+  return approx_decode_<Generator>(approx_min_(cell_ids), cell_ids, decode_);
+}
+
+template <typename Generator>
+UInt64 Sketch::approx_decode_(UInt64 approx, const UInt64 cell_ids[3],
+                              Decode decode) const noexcept {
+  switch (decode) {
+    case SKETCH_LOWER_DECODE: {
+      return Approx::decode(approx);
     }
-    case 8: {
-      UInt8 &cell = reinterpret_cast<UInt8 *>(table_)[cell_id];
-      if (cell < value) {
-        cell = static_cast<UInt8>(value);
-      }
-      break;
+    case SKETCH_MIDPOINT_DECODE: {
+      return Approx::decode_midpoint(approx);
     }
-    case 16: {
-      UInt16 &cell = reinterpret_cast<UInt16 *>(table_)[cell_id];
-      if (cell < value) {
-        cell = static_cast<UInt16>(value);
-      }
-      break;
+    default: {
+      Generator random(random_, cell_ids);
+      return Approx::decode(approx, &random);
     }
   }
 }
 
-UInt64 Sketch::approx_get(const UInt64 cell_ids[3]) const noexcept {
+UInt64 Sketch::approx_min_(const UInt64 cell_ids[3]) const noexcept {
   UInt64 min_approx = approx_get_(0, cell_ids[0]);
   if (min_approx == 0) {
     return 0;
@@ -784,10 +2099,29 @@ UInt64 Sketch::approx_get(const UInt64 cell_ids[3]) const noexcept {
   }
   
   approx = approx_get_(2, cell_ids[2]);
-  if (approx < min_approx) {
-    min_approx = approx;
+  return (approx < min_approx) ? approx : min_approx;
+}
+
+UInt64 Sketch::decoded_get_(const UInt64 cell_ids[3],
+                            Decode decode) const noexcept {
+  if (mode() != SKETCH_APPROX_MODE) {
+    return (this->*ops_->get)(cell_ids);
+  } else if (hot_tier_ != NULL) {
+    const UInt64 hot_id = hot_tier_->find(cell_ids);
+    if (hot_id != hot_tier_->size()) {
+      return (*hot_tier_)[hot_id].count;
+    }
+  }
+
+  const bool concurrent = (object_flags_ & SKETCH_CONCURRENT) != 0;
+  const UInt64 min_approx = concurrent ?
+      concurrent_approx_min_(cell_ids) : approx_min_(cell_ids);
+  if (object_flags_ & SKETCH_COUNTER_RANDOM) {
+    return approx_decode_<KeyedRandom>(min_approx, cell_ids, decode);
+  } else if (concurrent) {
+    return approx_decode_<ThreadRandom>(min_approx, cell_ids, decode);
   }
-  return Approx::decode(min_approx, random_);
+  return approx_decode_<SharedRandom>(min_approx, cell_ids, decode);
 }
 
 void Sketch::approx_set(const UInt64 cell_ids[3], UInt64 value) noexcept {
@@ -810,7 +2144,9 @@ void Sketch::approx_set(const UInt64 cell_ids[3], UInt64 value) noexcept {
   }
 }
 
+template <typename Generator>
 UInt64 Sketch::approx_inc(const UInt64 cell_ids[3]) noexcept {
+  Generator random(random_, cell_ids);
   const UInt64 flag = 1ULL << ((cell_ids[0] ^ cell_ids[1] ^ cell_ids[2]) & 1);
 
   UInt64 approxes[3];
@@ -830,7 +2166,7 @@ UInt64 Sketch::approx_inc(const UInt64 cell_ids[3]) noexcept {
        !((table_[cell_ids[1]] >> (SKETCH_OWNER_OFFSET + 2)) & flag)) &&
       ((approxes[2] != min_approx) ||
        !((table_[cell_ids[2]] >> (SKETCH_OWNER_OFFSET + 4)) & flag))) {
-    new_approx = Approx::inc(new_approx, random_);
+    new_approx = Approx::inc(new_approx, &random);
   }
 
   if (approxes[0] < new_approx) {
@@ -850,9 +2186,10 @@ UInt64 Sketch::approx_inc(const UInt64 cell_ids[3]) noexcept {
   } else if (approxes[2] == new_approx) {
     table_[cell_ids[2]] &= ~(flag << (SKETCH_OWNER_OFFSET + 4));
   }
-  return Approx::decode(new_approx, random_);
+  return Approx::decode(new_approx, &random);
 }
 
+template <typename Generator>
 UInt64 Sketch::approx_add(const UInt64 cell_ids[3], UInt64 value) noexcept {
   if (value >= APPROX_MAX_VALUE) {
     table_[cell_ids[0]] |= APPROX_MASK;
@@ -869,17 +2206,24 @@ UInt64 Sketch::approx_add(const UInt64 cell_ids[3], UInt64 value) noexcept {
   const UInt64 min_approx = (approxes[0] < approxes[1]) ?
       ((approxes[0] < approxes[2]) ? approxes[0] : approxes[2]) :
       ((approxes[1] < approxes[2]) ? approxes[1] : approxes[2]);
-  const UInt64 min_value = Approx::decode(min_approx, random_);
-  if (min_value >= (APPROX_MAX_VALUE - value)) {
-    table_[cell_ids[0]] |= APPROX_MASK;
-    table_[cell_ids[1]] |= APPROX_MASK << APPROX_SIZE;
-    table_[cell_ids[2]] |= APPROX_MASK << (APPROX_SIZE * 2);
-    return APPROX_MAX_VALUE;
+  Generator random(random_, cell_ids);
+  UInt64 new_value;
+  UInt64 new_approx;
+  if (object_flags_ & SKETCH_GEOMETRIC_ADD) {
+    new_approx = Approx::add(min_approx, value, &random);
+    new_value = Approx::decode(new_approx, &random);
+  } else {
+    const UInt64 min_value = Approx::decode(min_approx, &random);
+    if (min_value >= (APPROX_MAX_VALUE - value)) {
+      table_[cell_ids[0]] |= APPROX_MASK;
+      table_[cell_ids[1]] |= APPROX_MASK << APPROX_SIZE;
+      table_[cell_ids[2]] |= APPROX_MASK << (APPROX_SIZE * 2);
+      return APPROX_MAX_VALUE;
+    }
+    new_value = min_value + value;
+    new_approx = Approx::encode(new_value);
   }
 
-  const UInt64 new_value = min_value + value;
-  const UInt64 new_approx = Approx::encode(new_value);
-
   if (approxes[0] < new_approx) {
     approx_set_(0, cell_ids[0], new_approx);
   }
@@ -910,109 +2254,883 @@ void Sketch::approx_set_(UInt64 table_id, UInt64 cell_id,
       (mask << (SKETCH_OWNER_OFFSET + (2 * table_id)));
 }
 
+template <typename Generator>
+UInt64 Sketch::concurrent_approx_get(
+    const UInt64 cell_ids[3]) const noexcept {
+  return approx_decode_<Generator>(concurrent_approx_min_(cell_ids),
+                                   cell_ids, decode_);
+}
+
+UInt64 Sketch::concurrent_approx_min_(
+    const UInt64 cell_ids[3]) const noexcept {
+  UInt64 min_approx = concurrent_approx_get_(0, cell_ids[0]);
+  if (min_approx == 0) {
+    return 0;
+  }
+
+  UInt64 approx = concurrent_approx_get_(1, cell_ids[1]);
+  if (approx == 0) {
+    return 0;
+  } else if (approx < min_approx) {
+    min_approx = approx;
+  }
+
+  approx = concurrent_approx_get_(2, cell_ids[2]);
+  return (approx < min_approx) ? approx : min_approx;
+}
+
+void Sketch::concurrent_approx_set(const UInt64 cell_ids[3],
+                                   UInt64 value) noexcept {
+  const UInt64 new_approx = (value < APPROX_MAX_VALUE) ?
+      Approx::encode(value) : APPROX_MASK;
+  concurrent_approx_set_floor_(0, cell_ids[0], new_approx);
+  concurrent_approx_set_floor_(1, cell_ids[1], new_approx);
+  concurrent_approx_set_floor_(2, cell_ids[2], new_approx);
+}
+
+template <typename Generator>
+UInt64 Sketch::concurrent_approx_inc(const UInt64 cell_ids[3]) noexcept {
+  Generator random(random_, cell_ids);
+  UInt64 min_approx = concurrent_approx_inc_(0, cell_ids[0], &random);
+  UInt64 approx = concurrent_approx_inc_(1, cell_ids[1], &random);
+  if (approx < min_approx) {
+    min_approx = approx;
+  }
+  approx = concurrent_approx_inc_(2, cell_ids[2], &random);
+  if (approx < min_approx) {
+    min_approx = approx;
+  }
+  return Approx::decode(min_approx, &random);
+}
+
+template <typename Generator>
+UInt64 Sketch::concurrent_approx_add(const UInt64 cell_ids[3],
+                                     UInt64 value) noexcept {
+  if (value >= APPROX_MAX_VALUE) {
+    concurrent_approx_set(cell_ids, APPROX_MAX_VALUE);
+    return APPROX_MAX_VALUE;
+  }
+
+  Generator random(random_, cell_ids);
+  UInt64 min_value = concurrent_approx_add_(0, cell_ids[0], value, &random);
+  UInt64 new_value = concurrent_approx_add_(1, cell_ids[1], value, &random);
+  if (new_value < min_value) {
+    min_value = new_value;
+  }
+  new_value = concurrent_approx_add_(2, cell_ids[2], value, &random);
+  return (new_value < min_value) ? new_value : min_value;
+}
+
+UInt64 Sketch::concurrent_approx_get_(UInt64 table_id,
+                                      UInt64 cell_id) const noexcept {
+  return (util::atomic_load(table_ + cell_id) >> (APPROX_SIZE * table_id)) &
+      APPROX_MASK;
+}
+
+void Sketch::concurrent_approx_set_floor_(UInt64 table_id, UInt64 cell_id,
+                                          UInt64 approx) noexcept {
+  const UInt64 offset = APPROX_SIZE * table_id;
+  UInt64 old_unit = util::atomic_load(table_ + cell_id);
+  while (((old_unit >> offset) & APPROX_MASK) < approx) {
+    const UInt64 new_unit =
+        (old_unit & ~(APPROX_MASK << offset)) | (approx << offset);
+    if (util::atomic_compare_exchange(table_ + cell_id, &old_unit,
+                                      new_unit)) {
+      break;
+    }
+  }
+}
+
+// concurrent_approx_inc_() returns the new approximate value of a cell.
+template <typename Generator>
+UInt64 Sketch::concurrent_approx_inc_(UInt64 table_id, UInt64 cell_id,
+                                      Generator *random) noexcept {
+  const UInt64 offset = APPROX_SIZE * table_id;
+  UInt64 old_unit = util::atomic_load(table_ + cell_id);
+  for ( ; ; ) {
+    const UInt64 old_approx = (old_unit >> offset) & APPROX_MASK;
+    if (old_approx == APPROX_MASK) {
+      return old_approx;
+    }
+    const UInt64 new_approx = Approx::inc(old_approx, random);
+    if (new_approx == old_approx) {
+      return old_approx;
+    }
+    const UInt64 new_unit =
+        (old_unit & ~(APPROX_MASK << offset)) | (new_approx << offset);
+    if (util::atomic_compare_exchange(table_ + cell_id, &old_unit,
+                                      new_unit)) {
+      return new_approx;
+    }
+  }
+}
+
+// concurrent_approx_add_() returns the new value of a cell.
+template <typename Generator>
+UInt64 Sketch::concurrent_approx_add_(UInt64 table_id, UInt64 cell_id,
+                                      UInt64 value,
+                                      Generator *random) noexcept {
+  const UInt64 offset = APPROX_SIZE * table_id;
+  UInt64 old_unit = util::atomic_load(table_ + cell_id);
+  for ( ; ; ) {
+    const UInt64 old_approx = (old_unit >> offset) & APPROX_MASK;
+    if (object_flags_ & SKETCH_GEOMETRIC_ADD) {
+      const UInt64 new_approx = Approx::add(old_approx, value, random);
+      const UInt64 new_unit =
+          (old_unit & ~(APPROX_MASK << offset)) | (new_approx << offset);
+      if ((new_approx == old_approx) ||
+          util::atomic_compare_exchange(table_ + cell_id, &old_unit,
+                                        new_unit)) {
+        return Approx::decode(new_approx, random);
+      }
+      continue;
+    }
+
+    const UInt64 old_value = Approx::decode(old_approx, random);
+    if (old_value >= (APPROX_MAX_VALUE - value)) {
+      concurrent_approx_set_floor_(table_id, cell_id, APPROX_MASK);
+      return APPROX_MAX_VALUE;
+    }
+    const UInt64 new_value = old_value + value;
+    const UInt64 new_approx = Approx::encode(new_value);
+    if (new_approx <= old_approx) {
+      return new_value;
+    }
+    const UInt64 new_unit =
+        (old_unit & ~(APPROX_MASK << offset)) | (new_approx << offset);
+    if (util::atomic_compare_exchange(table_ + cell_id, &old_unit,
+                                      new_unit)) {
+      return new_value;
+    }
+  }
+}
+
+const Sketch::Ops *Sketch::get_hot_tier_ops_() noexcept {
+  static const Ops HOT_TIER_OPS = {
+    &Sketch::hot_get, &Sketch::hot_set, &Sketch::hot_inc, &Sketch::hot_add
+  };
+  return &HOT_TIER_OPS;
+}
+
+UInt64 Sketch::hot_get(const UInt64 cell_ids[3]) const noexcept {
+  const UInt64 hot_id = hot_tier_->find(cell_ids);
+  if (hot_id != hot_tier_->size()) {
+    return (*hot_tier_)[hot_id].count;
+  }
+  return (this->*table_ops_->get)(cell_ids);
+}
+
+void Sketch::hot_set(const UInt64 cell_ids[3], UInt64 value) noexcept {
+  const UInt64 hot_id = hot_tier_->find(cell_ids);
+  if (hot_id == hot_tier_->size()) {
+    (this->*table_ops_->set)(cell_ids, value);
+    return;
+  }
+  if (value > max_value()) {
+    value = max_value();
+  }
+  if (value > (*hot_tier_)[hot_id].count) {
+    hot_tier_->raise(hot_id, value);
+  }
+}
+
+UInt64 Sketch::hot_inc(const UInt64 cell_ids[3]) noexcept {
+  return hot_add_(cell_ids, 1);
+}
+
+UInt64 Sketch::hot_add(const UInt64 cell_ids[3], UInt64 value) noexcept {
+  return hot_add_(cell_ids, value);
+}
+
+// hot_add_() adds `value' to the entry of a hot key. Otherwise, it fills an
+// empty entry with the key, or updates the cells and promotes the key if
+// its estimate exceeds the smallest count in the HotTier by more than
+// 1 / 2^HOT_TIER_MARGIN_SHIFT of it. The margin keeps keys near the smallest
+// count from replacing each other on every update.
+UInt64 Sketch::hot_add_(const UInt64 cell_ids[3], UInt64 value) noexcept {
+  HotTier &tier = *hot_tier_;
+  const UInt64 hot_id = tier.find(cell_ids);
+  if (hot_id != tier.size()) {
+    const UInt64 count = tier[hot_id].count;
+    tier.raise(hot_id, ((max_value() - count) > value) ?
+               (count + value) : max_value());
+    return tier[hot_id].count;
+  } else if (value == 0) {
+    return (this->*table_ops_->get)(cell_ids);
+  }
+
+  if (!tier.full()) {
+    const UInt64 base = (this->*table_ops_->get)(cell_ids);
+    const UInt64 count = ((max_value() - base) > value) ?
+        (base + value) : max_value();
+    tier.insert(cell_ids, count, base);
+    return count;
+  }
+
+  const UInt64 estimate = (value == 1) ? (this->*table_ops_->inc)(cell_ids) :
+      (this->*table_ops_->add)(cell_ids, value);
+  const UInt64 min_id = tier.find_min();
+  const HotTier::Entry &min_entry = tier[min_id];
+  const UInt64 threshold =
+      min_entry.count + (min_entry.count >> HOT_TIER_MARGIN_SHIFT);
+  if (estimate > threshold) {
+    if (min_entry.count > min_entry.base) {
+      (this->*table_ops_->add)(min_entry.cell_ids,
+                               min_entry.count - min_entry.base);
+    }
+    tier.reset(min_id, cell_ids, estimate, estimate);
+  }
+  return estimate;
+}
+
+// inner_products_() computes a tile of pairs. Each bulk of cells of a row
+// is decoded once per sketch and then shared by all the pairs in the tile.
+bool Sketch::inner_products_(const Sketch * const *sketches,
+                             std::size_t num_sketches, std::size_t lhs_begin,
+                             std::size_t lhs_end, std::size_t rhs_begin,
+                             std::size_t rhs_end,
+                             const PendingCell * const *pending_cells,
+                             const UInt64 *num_pending_cells,
+                             double *inner_products,
+                             double *square_lengths) noexcept {
+  // A tile paired with itself decodes its rows once and computes only the
+  // pairs (i, j) with i <= j.
+  const bool is_diagonal = (lhs_begin == rhs_begin);
+  const std::size_t num_lhs = lhs_end - lhs_begin;
+  const std::size_t num_rhs = rhs_end - rhs_begin;
+  const std::size_t num_decoded = is_diagonal ? num_lhs : (num_lhs + num_rhs);
+  // Rows are decoded unless every pair of the task reads packed values.
+  bool is_packed = true;
+  for (std::size_t i = 0; is_packed && (i < num_lhs); ++i) {
+    for (std::size_t j = 0; is_packed && (j < num_rhs); ++j) {
+      is_packed = sketches[lhs_begin + i]->is_packed_pair_(
+          *sketches[rhs_begin + j]);
+    }
+  }
+  ScopedArray<UInt64> values(num_decoded * SKETCH_BULK_SIZE);
+  // sums[(i * num_rhs) + j] has the sums of the current chunk and the sums
+  // of the current row for the pair of the i-th and the j-th sketches.
+  ScopedArray<double[6]> sums(num_lhs * num_rhs);
+  if ((values.get() == NULL) || (sums.get() == NULL)) {
+    return false;
+  }
+  UInt64 * const lhs_values = values.get();
+  UInt64 * const rhs_values = is_diagonal ? values.get() :
+      (values.get() + (num_lhs * SKETCH_BULK_SIZE));
+
+  for (std::size_t i = 0; i < num_lhs; ++i) {
+    for (std::size_t j = 0; j < num_rhs; ++j) {
+      inner_products[((lhs_begin + i) * num_sketches) + rhs_begin + j] =
+          std::numeric_limits<double>::max();
+    }
+  }
+
+  const UInt64 width = sketches[lhs_begin]->width();
+  const UInt64 chunk_cells = get_chunk_cells(width);
+  for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
+    for (std::size_t i = 0; i < (num_lhs * num_rhs); ++i) {
+      sums[i][3] = sums[i][4] = sums[i][5] = 0.0;
+    }
+    for (UInt64 begin = 0; begin < width; begin += chunk_cells) {
+      const UInt64 end = ((width - begin) < chunk_cells) ?
+          width : (begin + chunk_cells);
+      for (std::size_t i = 0; i < (num_lhs * num_rhs); ++i) {
+        sums[i][0] = sums[i][1] = sums[i][2] = 0.0;
+      }
+      for (UInt64 offset = begin; offset < end; offset += SKETCH_BULK_SIZE) {
+        const UInt64 num_cells = ((end - offset) < SKETCH_BULK_SIZE) ?
+            (end - offset) : SKETCH_BULK_SIZE;
+        for (std::size_t i = 0; !is_packed && (i < num_lhs); ++i) {
+          sketches[lhs_begin + i]->get_bulk_(table_id, offset, num_cells,
+              lhs_values + (i * SKETCH_BULK_SIZE));
+        }
+        if (!is_packed && !is_diagonal) {
+          for (std::size_t j = 0; j < num_rhs; ++j) {
+            sketches[rhs_begin + j]->get_bulk_(table_id, offset, num_cells,
+                rhs_values + (j * SKETCH_BULK_SIZE));
+          }
+        }
+        for (std::size_t i = 0; i < num_lhs; ++i) {
+          const Sketch &lhs = *sketches[lhs_begin + i];
+          for (std::size_t j = is_diagonal ? i : 0; j < num_rhs; ++j) {
+            const Sketch &rhs = *sketches[rhs_begin + j];
+            if (lhs.is_packed_pair_(rhs)) {
+              lhs.exact_inner_product_(rhs, table_id, offset, num_cells,
+                                       sums[(i * num_rhs) + j]);
+            } else {
+              kernel().inner_product(lhs_values + (i * SKETCH_BULK_SIZE),
+                                     rhs_values + (j * SKETCH_BULK_SIZE),
+                                     num_cells, sums[(i * num_rhs) + j]);
+            }
+          }
+        }
+      }
+      for (std::size_t i = 0; i < (num_lhs * num_rhs); ++i) {
+        for (int k = 0; k < 3; ++k) {
+          sums[i][k + 3] += sums[i][k];
+        }
+      }
+    }
+
+    // The row with the smallest inner product gives the results of a pair,
+    // as inner_product() does.
+    for (std::size_t i = 0; i < num_lhs; ++i) {
+      for (std::size_t j = is_diagonal ? i : 0; j < num_rhs; ++j) {
+        double * const row_sums = sums[(i * num_rhs) + j] + 3;
+        const std::size_t lhs_id = lhs_begin + i;
+        const std::size_t rhs_id = rhs_begin + j;
+        sketches[lhs_id]->add_pending_products_(*sketches[rhs_id], table_id,
+            pending_cells[lhs_id], num_pending_cells[lhs_id],
+            pending_cells[rhs_id], num_pending_cells[rhs_id], row_sums);
+        if (row_sums[0] < inner_products[(lhs_id * num_sketches) + rhs_id]) {
+          inner_products[(lhs_id * num_sketches) + rhs_id] = row_sums[0];
+          inner_products[(rhs_id * num_sketches) + lhs_id] = row_sums[0];
+          if (square_lengths != NULL) {
+            square_lengths[(lhs_id * num_sketches) + rhs_id] = row_sums[1];
+            square_lengths[(rhs_id * num_sketches) + lhs_id] = row_sums[2];
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool Sketch::is_packed_pair_(const Sketch &rhs) const noexcept {
+  return (mode() == SKETCH_EXACT_MODE) && (rhs.mode() == SKETCH_EXACT_MODE) &&
+      (block_width_ == 1) && (rhs.block_width_ == 1) &&
+      (value_size() == rhs.value_size());
+}
+
+// exact_inner_product_() gives the units that are entirely in the range to
+// the kernel, and decodes the cells at both ends. The integer sums are
+// exact, so the results depend only on the ranges given by a caller.
+void Sketch::exact_inner_product_(const Sketch &rhs, UInt64 table_id,
+                                  UInt64 cell_id, UInt64 num_cells,
+                                  double sums[3]) const noexcept {
+  const UInt64 value_size = this->value_size();
+  const UInt64 unit_cells = 64 / value_size;
+  const UInt64 begin = exact_cell_id_(table_id, cell_id);
+  const UInt64 end = begin + num_cells;
+  UInt64 unit_begin = (begin + unit_cells - 1) / unit_cells;
+  UInt64 unit_end = end / unit_cells;
+  // edges[0] and edges[1] are the cells before and after the units. A short
+  // range may have no unit, and then edges[0] covers it.
+  UInt64 edges[2][2] = {
+    { begin, unit_begin * unit_cells },
+    { unit_end * unit_cells, end }
+  };
+  if (unit_begin >= unit_end) {
+    unit_begin = unit_end;
+    edges[0][1] = end;
+    edges[1][0] = end;
+  }
+
+  UInt64 int_sums[3] = { 0, 0, 0 };
+  kernel().exact_inner_product(table_ + unit_begin, rhs.table_ + unit_begin,
+                               unit_end - unit_begin, value_size, int_sums);
+  for (int i = 0; i < 2; ++i) {
+    // An edge has less than 2 units of cells.
+    UInt64 lhs_values[128];
+    UInt64 rhs_values[128];
+    const UInt64 num_edge_cells = edges[i][1] - edges[i][0];
+    kernel().exact_decode(table_, edges[i][0], num_edge_cells, value_size,
+                          lhs_values);
+    kernel().exact_decode(rhs.table_, edges[i][0], num_edge_cells,
+                          value_size, rhs_values);
+    for (UInt64 j = 0; j < num_edge_cells; ++j) {
+      int_sums[0] += lhs_values[j] * rhs_values[j];
+      int_sums[1] += lhs_values[j] * lhs_values[j];
+      int_sums[2] += rhs_values[j] * rhs_values[j];
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    sums[i] += static_cast<double>(int_sums[i]);
+  }
+}
+
+// demote_() moves the pending counts of all the hot keys to the cells and
+// empties the HotTier.
+void Sketch::demote_() noexcept {
+  if (hot_tier_ != NULL) {
+    for (UInt64 i = 0; i < hot_tier_->size(); ++i) {
+      const HotTier::Entry &entry = (*hot_tier_)[i];
+      if (entry.count > entry.base) {
+        (this->*table_ops_->add)(entry.cell_ids, entry.count - entry.base);
+      }
+    }
+    hot_tier_->clear();
+  }
+}
+
+// get_pending_cells_() follows demote_() on the values of the cells. A cell
+// of a hot key takes the smallest value of the key plus its pending count,
+// as the cells take on add(), and only the cells that change are kept.
+UInt64 Sketch::get_pending_cells_(PendingCell *cells) const noexcept {
+  UInt64 num_cells = 0;
+  for (UInt64 i = 0; i < num_hot_keys(); ++i) {
+    const HotTier::Entry &entry = (*hot_tier_)[i];
+    if (entry.count <= entry.base) {
+      continue;
+    }
+    UInt64 cell_ids[SKETCH_DEPTH];
+    UInt64 values[SKETCH_DEPTH];
+    UInt64 min_value = max_value();
+    for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
+      cell_ids[table_id] = row_cell_id_(table_id, entry.cell_ids[table_id]);
+      values[table_id] = get_pending_value_(cells, num_cells, table_id,
+                                            cell_ids[table_id], random_);
+      if (values[table_id] < min_value) {
+        min_value = values[table_id];
+      }
+    }
+    const UInt64 pending_count = entry.count - entry.base;
+    const UInt64 new_value = ((max_value() - min_value) > pending_count) ?
+        (min_value + pending_count) : max_value();
+    for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
+      if (values[table_id] >= new_value) {
+        continue;
+      }
+      const UInt64 j = find_pending_cell_(cells, num_cells, table_id,
+                                          cell_ids[table_id]);
+      if ((j == num_cells) || (cells[j].table_id != table_id) ||
+          (cells[j].cell_id != cell_ids[table_id])) {
+        for (UInt64 k = num_cells; k > j; --k) {
+          cells[k] = cells[k - 1];
+        }
+        cells[j].table_id = table_id;
+        cells[j].cell_id = cell_ids[table_id];
+        ++num_cells;
+      }
+      cells[j].value = new_value;
+    }
+  }
+  return num_cells;
+}
+
+// get_pending_value_() returns the value of a cell as demote_() would leave
+// it.
+template <typename T>
+UInt64 Sketch::get_pending_value_(const PendingCell *cells, UInt64 num_cells,
+                                  UInt64 table_id, UInt64 cell_id,
+                                  T *random) const noexcept {
+  if (num_cells != 0) {
+    const UInt64 i = find_pending_cell_(cells, num_cells, table_id, cell_id);
+    if ((i != num_cells) && (cells[i].table_id == table_id) &&
+        (cells[i].cell_id == cell_id)) {
+      return cells[i].value;
+    }
+  }
+  return get_(table_id, cell_id, random);
+}
+
+// find_pending_cell_() returns the position of the first cell that is not
+// before the `cell_id'-th cell of the `table_id'-th row.
+UInt64 Sketch::find_pending_cell_(const PendingCell *cells, UInt64 num_cells,
+                                  UInt64 table_id, UInt64 cell_id) noexcept {
+  UInt64 begin = 0;
+  UInt64 end = num_cells;
+  while (begin < end) {
+    const UInt64 middle = begin + ((end - begin) / 2);
+    if ((cells[middle].table_id < table_id) ||
+        ((cells[middle].table_id == table_id) &&
+         (cells[middle].cell_id < cell_id))) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+  return begin;
+}
+
+void Sketch::add_pending_products_(const Sketch &rhs, UInt64 table_id,
+                                   const PendingCell *lhs_cells,
+                                   UInt64 num_lhs_cells,
+                                   const PendingCell *rhs_cells,
+                                   UInt64 num_rhs_cells,
+                                   double sums[3]) const noexcept {
+  // The pending cells of the row are visited in order of cells, and a cell
+  // pending in both sketches is visited once.
+  UInt64 i = find_pending_cell_(lhs_cells, num_lhs_cells, table_id, 0);
+  UInt64 j = find_pending_cell_(rhs_cells, num_rhs_cells, table_id, 0);
+  for ( ; ; ) {
+    const bool has_lhs_cell =
+        (i != num_lhs_cells) && (lhs_cells[i].table_id == table_id);
+    const bool has_rhs_cell =
+        (j != num_rhs_cells) && (rhs_cells[j].table_id == table_id);
+    if (!has_lhs_cell && !has_rhs_cell) {
+      break;
+    }
+    const UInt64 cell_id = (!has_rhs_cell || (has_lhs_cell &&
+        (lhs_cells[i].cell_id <= rhs_cells[j].cell_id))) ?
+        lhs_cells[i].cell_id : rhs_cells[j].cell_id;
+    const double old_lhs_value = static_cast<double>(get_(table_id, cell_id));
+    const double old_rhs_value =
+        static_cast<double>(rhs.get_(table_id, cell_id));
+    double lhs_value = old_lhs_value;
+    double rhs_value = old_rhs_value;
+    if (has_lhs_cell && (lhs_cells[i].cell_id == cell_id)) {
+      lhs_value = static_cast<double>(lhs_cells[i++].value);
+    }
+    if (has_rhs_cell && (rhs_cells[j].cell_id == cell_id)) {
+      rhs_value = static_cast<double>(rhs_cells[j++].value);
+    }
+    sums[0] += (lhs_value * rhs_value) - (old_lhs_value * old_rhs_value);
+    sums[1] += (lhs_value * lhs_value) - (old_lhs_value * old_lhs_value);
+    sums[2] += (rhs_value * rhs_value) - (old_rhs_value * old_rhs_value);
+  }
+}
+
+UInt64 Sketch::row_cell_id_(UInt64 table_id, UInt64 cell_id) const noexcept {
+  if (mode() != SKETCH_EXACT_MODE) {
+    return cell_id;
+  } else if (block_width_ == 1) {
+    return cell_id - (width() * table_id);
+  }
+  return ((cell_id / block_cells_) * block_width_) +
+      (cell_id % block_cells_) - (block_width_ * table_id);
+}
+
+// track_() offers a key to the TopK. The fingerprint of a key is made from
+// its cell IDs.
+void Sketch::track_(const void *key_addr, std::size_t key_size,
+                    const UInt64 cell_ids[3], UInt64 value) noexcept {
+  if (top_k_ != NULL) {
+    top_k_->update(key_addr, key_size, cell_ids[0] ^ (cell_ids[1] << 21) ^
+                   (cell_ids[2] << 42) ^ (cell_ids[2] >> 22), value);
+  }
+}
+
+// refresh_top_k_() replaces the values in the TopK with the current values
+// after an operation on whole tables, and then offers the keys tracked by
+// `src'.
+void Sketch::refresh_top_k_(const Sketch *src) noexcept {
+  if (top_k_ == NULL) {
+    return;
+  }
+
+  UInt64 cell_ids[3];
+  for (UInt64 i = 0; i < top_k_->size(); ++i) {
+    const TopK::Entry &entry = (*top_k_)[i];
+    hash(entry.key, static_cast<std::size_t>(entry.key_size), cell_ids);
+    top_k_->reset(i, (this->*ops_->get)(cell_ids));
+  }
+  top_k_->build();
+
+  if ((src != NULL) && (src != this) && (src->top_k_ != NULL)) {
+    for (UInt64 i = 0; i < src->top_k_->size(); ++i) {
+      const TopK::Entry &entry = (*src->top_k_)[i];
+      const std::size_t key_size = static_cast<std::size_t>(entry.key_size);
+      hash(entry.key, key_size, cell_ids);
+      track_(entry.key, key_size, cell_ids, (this->*ops_->get)(cell_ids));
+    }
+  }
+}
+
 void Sketch::hash(const void *key_addr, std::size_t key_size,
                   UInt64 cell_ids[3]) const noexcept {
   UInt64 hash_values[2];
   Hash()(key_addr, key_size, seed(), hash_values);
+  hash_(hash_values, cell_ids);
+}
 
+// hash_() maps a pair of hash values to cell IDs.
+void Sketch::hash_(const UInt64 hash_values[2],
+                   UInt64 cell_ids[3]) const noexcept {
   cell_ids[0] = hash_values[0] & SKETCH_ID_MASK;
   cell_ids[1] = ((hash_values[0] >> SKETCH_ID_SIZE) |
       (hash_values[1] << (64 - SKETCH_ID_SIZE))) & SKETCH_ID_MASK;
   cell_ids[2] = hash_values[1] >> (64 - SKETCH_ID_SIZE);
 
-  if (width_mask() != 0) {
-    cell_ids[0] &= width_mask();
-    cell_ids[1] &= width_mask();
-    cell_ids[2] &= width_mask();
+  if (block_width_ != 1) {
+    block_hash_(cell_ids);
+    return;
+  }
+
+  cell_ids[0] = cell_range_(cell_ids[0]);
+  cell_ids[1] = cell_range_(cell_ids[1]);
+  cell_ids[2] = cell_range_(cell_ids[2]);
+
+  if (mode() == SKETCH_EXACT_MODE) {
+    cell_ids[1] += width();
+    cell_ids[2] += width() * 2;
+  }
+}
+
+// block_hash_() selects a block with the 1st ID and then selects a cell of
+// each row in that block with 16-bit fragments of the 2nd and 3rd IDs.
+void Sketch::block_hash_(UInt64 cell_ids[3]) const noexcept {
+  const UInt64 block_id = block_range_(cell_ids[0]);
+  const UInt64 slot_ids[3] = {
+    ((cell_ids[1] & 0xFFFF) * block_width_) >> 16,
+    (((cell_ids[1] >> 16) & 0xFFFF) * block_width_) >> 16,
+    ((cell_ids[2] & 0xFFFF) * block_width_) >> 16
+  };
+
+  if (mode() == SKETCH_EXACT_MODE) {
+    const UInt64 offset = block_id * block_cells_;
+    cell_ids[0] = offset + slot_ids[0];
+    cell_ids[1] = offset + block_width_ + slot_ids[1];
+    cell_ids[2] = offset + (block_width_ * 2) + slot_ids[2];
   } else {
-    cell_ids[0] %= width();
-    cell_ids[1] %= width();
-    cell_ids[2] %= width();
+    const UInt64 offset = block_id * block_width_;
+    cell_ids[0] = offset + slot_ids[0];
+    cell_ids[1] = offset + slot_ids[1];
+    cell_ids[2] = offset + slot_ids[2];
   }
 }
 
+// prefetch_() computes cell IDs of up to BATCH_WINDOW_SIZE keys at once and
+// then prefetches the cells.
+void Sketch::prefetch_(const void * const *key_addrs,
+                       const std::size_t *key_sizes, std::size_t num_keys,
+                       UInt64 (*cell_ids)[3]) const noexcept {
+  if (num_keys > BATCH_WINDOW_SIZE) {
+    num_keys = BATCH_WINDOW_SIZE;
+  }
+
+  UInt64 hash_values[BATCH_WINDOW_SIZE][2];
+  Hash()(key_addrs, key_sizes, num_keys, seed(), hash_values);
+
+  for (std::size_t i = 0; i < num_keys; ++i) {
+    hash_(hash_values[i], cell_ids[i]);
+    prefetch_(cell_ids[i]);
+  }
+}
+
+void Sketch::prefetch_(const UInt64 cell_ids[3]) const noexcept {
+  // The cells of a blocked sketch share one cache line.
+  const UInt64 num_cells = (block_width_ != 1) ? 1 : SKETCH_DEPTH;
+  const UInt8 * const bytes = reinterpret_cast<const UInt8 *>(table_);
+  for (UInt64 i = 0; i < num_cells; ++i) {
+    if (mode() == SKETCH_EXACT_MODE) {
+      util::prefetch(bytes + ((cell_ids[i] * value_size()) / 8));
+    } else {
+      util::prefetch(table_ + cell_ids[i]);
+    }
+  }
+}
+
+void Sketch::locate_(const KeyHash &key_hash,
+                     UInt64 cell_ids[3]) const noexcept {
+  hash_(key_hash.values(), cell_ids);
+  prefetch_(cell_ids);
+}
+
+UInt64 Sketch::get_at_(const UInt64 cell_ids[3]) const noexcept {
+  return (this->*ops_->get)(cell_ids);
+}
+
+void Sketch::set_at_(const UInt64 cell_ids[3], UInt64 value) noexcept {
+  (this->*ops_->set)(cell_ids, value);
+}
+
+UInt64 Sketch::inc_at_(const UInt64 cell_ids[3]) noexcept {
+  return (this->*ops_->inc)(cell_ids);
+}
+
+UInt64 Sketch::add_at_(const UInt64 cell_ids[3], UInt64 value) noexcept {
+  return (this->*ops_->add)(cell_ids, value);
+}
+
+// copy_() and shrink_() take the header flags only from `src', because the
+// cells of the new sketch are derived from the layout of `src'.
 void Sketch::copy_(const Sketch &src, const char *path, int flags) {
-  create_(src.width(), src.max_value(), path, flags, src.seed());
+  create_(src.width(), src.max_value(), path,
+          (flags & ~SKETCH_HEADER_FLAGS) | src.object_flags_ |
+          static_cast<int>(src.header().flags()), src.seed());
   *random_ = *src.random_;
+  if (hot_tier_ != NULL) {
+    std::memcpy(static_cast<void *>(hot_tier_), src.hot_tier_,
+                sizeof(HotTier));
+  }
+  if (top_k_ != NULL) {
+    std::memcpy(static_cast<void *>(top_k_), src.top_k_, sizeof(TopK));
+  }
   std::memcpy(table_, src.table_, static_cast<std::size_t>(table_size()));
 }
 
-void Sketch::exact_merge_(const Sketch &rhs, Filter lhs_filter,
-                          Filter rhs_filter) noexcept {
-  for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
-    for (UInt64 cell_id = 0; cell_id < width(); ++cell_id) {
-      UInt64 lhs_value = get_(table_id, cell_id);
-      UInt64 rhs_value = rhs.get_(table_id, cell_id);
-      if (lhs_filter != NULL) {
-        lhs_value = lhs_filter(lhs_value);
-      }
-      if (rhs_filter != NULL) {
-        rhs_value = rhs_filter(rhs_value);
-      }
-
-      if ((lhs_value >= max_value()) ||
-          (rhs_value >= (max_value() - lhs_value))) {
-        lhs_value = max_value();
+void Sketch::exact_merge_(const Sketch &rhs, MergeMode mode,
+                          Filter lhs_filter, Filter rhs_filter) noexcept {
+  // If the tables have the same shape, they can be merged as they are.
+  if ((lhs_filter == NULL) && (rhs_filter == NULL) &&
+      (rhs.mode() == SKETCH_EXACT_MODE) &&
+      (rhs.value_size() == value_size())) {
+    run_unit_tasks_(table_size() / sizeof(UInt64), true,
+                    [&](UInt64 begin, UInt64 end) {
+      if (mode == SKETCH_MAX_MERGE) {
+        kernel().max_merge(table_ + begin, rhs.table_ + begin, end - begin,
+                           value_size());
+      } else if (mode == SKETCH_MIN_MERGE) {
+        kernel().min_merge(table_ + begin, rhs.table_ + begin, end - begin,
+                           value_size());
       } else {
-        lhs_value += rhs_value;
+        kernel().saturated_add(table_ + begin, rhs.table_ + begin,
+                               end - begin, value_size());
       }
-      set_(table_id, cell_id, lhs_value);
-    }
+    });
+    return;
   }
-}
 
-void Sketch::approx_merge_(const Sketch &rhs, Filter lhs_filter,
-                           Filter rhs_filter) noexcept {
-  for (UInt64 cell_id = 0; cell_id < width(); ++cell_id) {
-    for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
-      UInt64 lhs_value = get_(table_id, cell_id);
-      UInt64 rhs_value = rhs.get_(table_id, cell_id);
-      if (lhs_filter != NULL) {
-        lhs_value = lhs_filter(lhs_value);
+  // Exact values are decoded without random numbers, so the cells can be
+  // merged in any order.
+  if (rhs.mode() == SKETCH_EXACT_MODE) {
+    run_unit_tasks_(table_size() / sizeof(UInt64), true,
+                    [&](UInt64 begin, UInt64 end) {
+      for_each_cell_(begin, end, [&](UInt64 table_id, UInt64 cell_id) {
+        UInt64 lhs_value = get_(table_id, cell_id);
+        UInt64 rhs_value = rhs.get_(table_id, cell_id);
+        if (lhs_filter != NULL) {
+          lhs_value = lhs_filter(lhs_value);
+        }
+        if (rhs_filter != NULL) {
+          rhs_value = rhs_filter(rhs_value);
+        }
+        set_(table_id, cell_id,
+             merge_values(mode, lhs_value, rhs_value, max_value()));
+      });
+    });
+    return;
+  }
+
+  // Approx values of `rhs' are decoded with the generator of each task.
+  const UInt64 key = get_task_key(random_);
+  run_unit_tasks_(table_size() / sizeof(UInt64), true,
+                  [&](UInt64 begin, UInt64 end) {
+    CounterRandom random(key, begin << 32);
+    UInt64 lhs_values[SKETCH_BULK_SIZE];
+    UInt64 rhs_values[SKETCH_BULK_SIZE];
+    for_each_run_(begin, end,
+                  [&](UInt64 table_id, UInt64 cell_id, UInt64 num_cells) {
+      while (num_cells != 0) {
+        const UInt64 num_bulk_cells =
+            (num_cells < SKETCH_BULK_SIZE) ? num_cells : SKETCH_BULK_SIZE;
+        get_bulk_(table_id, cell_id, num_bulk_cells, lhs_values);
+        rhs.get_bulk_(table_id, cell_id, num_bulk_cells, rhs_values,
+                      &random);
+        for (UInt64 i = 0; i < num_bulk_cells; ++i) {
+          UInt64 lhs_value = lhs_values[i];
+          UInt64 rhs_value = rhs_values[i];
+          if (lhs_filter != NULL) {
+            lhs_value = lhs_filter(lhs_value);
+          }
+          if (rhs_filter != NULL) {
+            rhs_value = rhs_filter(rhs_value);
+          }
+          lhs_values[i] =
+              merge_values(mode, lhs_value, rhs_value, max_value());
+        }
+        set_bulk_(table_id, cell_id, num_bulk_cells, lhs_values);
+        cell_id += num_bulk_cells;
+        num_cells -= num_bulk_cells;
       }
-      if (rhs_filter != NULL) {
-        rhs_value = rhs_filter(rhs_value);
+    });
+  });
+}
+
+// approx_merge_() decodes a bulk of cells of a task in the order of cells
+// and then tables, which fixes the order of random draws in the task, and
+// encodes them at once.
+void Sketch::approx_merge_(const Sketch &rhs, MergeMode mode,
+                           Filter lhs_filter, Filter rhs_filter) noexcept {
+  const UInt64 key = get_task_key(random_);
+  run_unit_tasks_(width(), true, [&](UInt64 begin, UInt64 end) {
+    CounterRandom random(key, begin << 32);
+    UInt64 values[SKETCH_BULK_SIZE * SKETCH_DEPTH];
+    for (UInt64 offset = begin; offset < end; offset += SKETCH_BULK_SIZE) {
+      const UInt64 num_cells = ((end - offset) < SKETCH_BULK_SIZE) ?
+          (end - offset) : SKETCH_BULK_SIZE;
+      for (UInt64 i = 0; i < num_cells; ++i) {
+        for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
+          UInt64 lhs_value = get_(table_id, offset + i, &random);
+          UInt64 rhs_value = rhs.get_(table_id, offset + i, &random);
+          if (lhs_filter != NULL) {
+            lhs_value = lhs_filter(lhs_value);
+          }
+          if (rhs_filter != NULL) {
+            rhs_value = rhs_filter(rhs_value);
+          }
+          values[(i * SKETCH_DEPTH) + table_id] =
+              merge_values(mode, lhs_value, rhs_value, APPROX_MAX_VALUE);
+        }
       }
-
-      if ((lhs_value >= APPROX_MAX_VALUE) ||
-          (rhs_value >= (APPROX_MAX_VALUE - lhs_value))) {
-        lhs_value = max_value();
-      } else {
-        lhs_value += rhs_value;
+      Approx::encode_n(values, num_cells * SKETCH_DEPTH, values);
+      for (UInt64 i = 0; i < num_cells; ++i) {
+        for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
+          approx_set_(table_id, offset + i,
+                      values[(i * SKETCH_DEPTH) + table_id], 0);
+        }
       }
-      approx_set_(table_id, cell_id, Approx::encode(lhs_value), 0);
     }
-  }
+  });
 }
 
-void Sketch::approx_merge_(const Sketch &rhs) noexcept {
+void Sketch::approx_merge_(const Sketch &rhs, MergeMode mode) noexcept {
   static const UInt64 MASK_TABLE[4] = { 0, 1, 2, 0 };
 
-  for (UInt64 cell_id = 0; cell_id < width(); ++cell_id) {
-    table_[cell_id] |= rhs.table_[cell_id] & SKETCH_OWNER_MASK;
-    for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
-      const UInt64 mask = ((table_[cell_id] | rhs.table_[cell_id]) >>
-          (SKETCH_OWNER_OFFSET + (2 * table_id))) & 3;
-
-      UInt64 lhs_value = get_(table_id, cell_id);
-      const UInt64 rhs_value = rhs.get_(table_id, cell_id);
-      if ((rhs_value > (APPROX_MAX_VALUE - lhs_value))) {
-        lhs_value = APPROX_MAX_VALUE;
+  // Approximate values are monotone in their codes, so the larger or the
+  // smaller codes are taken as they are, together with their owner bits.
+  if (mode != SKETCH_SUM_MERGE) {
+    run_unit_tasks_(width(), true, [&](UInt64 begin, UInt64 end) {
+      if (mode == SKETCH_MAX_MERGE) {
+        kernel().max_merge(table_ + begin, rhs.table_ + begin, end - begin,
+                           APPROX_SIZE);
       } else {
-        lhs_value += rhs_value;
-        if ((mask == 3) && (lhs_value != 0)) {
-          --lhs_value;
+        kernel().min_merge(table_ + begin, rhs.table_ + begin, end - begin,
+                           APPROX_SIZE);
+      }
+    });
+    return;
+  }
+
+  const UInt64 key = get_task_key(random_);
+  run_unit_tasks_(width(), true, [&](UInt64 begin, UInt64 end) {
+    CounterRandom random(key, begin << 32);
+    UInt64 values[SKETCH_BULK_SIZE * SKETCH_DEPTH];
+    UInt64 masks[SKETCH_BULK_SIZE * SKETCH_DEPTH];
+    for (UInt64 offset = begin; offset < end; offset += SKETCH_BULK_SIZE) {
+      const UInt64 num_cells = ((end - offset) < SKETCH_BULK_SIZE) ?
+          (end - offset) : SKETCH_BULK_SIZE;
+      for (UInt64 i = 0; i < num_cells; ++i) {
+        const UInt64 cell_id = offset + i;
+        table_[cell_id] |= rhs.table_[cell_id] & SKETCH_OWNER_MASK;
+        for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
+          const UInt64 mask = ((table_[cell_id] | rhs.table_[cell_id]) >>
+              (SKETCH_OWNER_OFFSET + (2 * table_id))) & 3;
+
+          UInt64 lhs_value = get_(table_id, cell_id, &random);
+          const UInt64 rhs_value = rhs.get_(table_id, cell_id, &random);
+          if ((rhs_value > (APPROX_MAX_VALUE - lhs_value))) {
+            lhs_value = APPROX_MAX_VALUE;
+          } else {
+            lhs_value += rhs_value;
+            if ((mask == 3) && (lhs_value != 0)) {
+              --lhs_value;
+            }
+          }
+          values[(i * SKETCH_DEPTH) + table_id] = lhs_value;
+          masks[(i * SKETCH_DEPTH) + table_id] = MASK_TABLE[mask];
+        }
+      }
+      Approx::encode_n(values, num_cells * SKETCH_DEPTH, values);
+      for (UInt64 i = 0; i < num_cells; ++i) {
+        for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
+          approx_set_(table_id, offset + i,
+                      values[(i * SKETCH_DEPTH) + table_id],
+                      masks[(i * SKETCH_DEPTH) + table_id]);
         }
       }
-      approx_set_(table_id, cell_id, Approx::encode(lhs_value),
-                  MASK_TABLE[mask]);
     }
-  }
+  });
 }
 
 void Sketch::shrink_(const Sketch &src, UInt64 width,
                      UInt64 max_value, Filter filter,
                      const char *path, int flags) {
+  // The hot keys of `src' are read from its pending cells.
+  PendingCell src_cells[MAX_NUM_PENDING_CELLS];
+  const UInt64 num_src_cells = src.get_pending_cells_(src_cells);
+
   if (width == 0) {
     width = src.width();
   }
@@ -1023,9 +3141,31 @@ void Sketch::shrink_(const Sketch &src, UInt64 width,
 
   MADOKA_THROW_IF(src.width() == 0);
   MADOKA_THROW_IF(width > src.width());
-  MADOKA_THROW_IF((src.width() % width) != 0);
 
-  create_(width, max_value, path, flags, src.seed());
+  // A blocked sketch is folded block by block, so its number of blocks is
+  // rounded up to a divisor of the number of source blocks. A source block
+  // cannot be split, so there are at most as many blocks as the source has.
+  const int src_flags = static_cast<int>(src.header().flags());
+  const UInt64 src_block_width = src.block_width();
+  const UInt64 num_src_blocks = src.width() / src_block_width;
+  if (src_block_width != 1) {
+    const UInt64 value_size =
+        util::bit_scan_reverse(normalize_max_value(max_value)) + 1;
+    const UInt64 block_width = get_block_width(value_size, src_flags);
+    UInt64 num_blocks = (width + block_width - 1) / block_width;
+    if (num_blocks > num_src_blocks) {
+      num_blocks = num_src_blocks;
+    }
+    while ((num_src_blocks % num_blocks) != 0) {
+      ++num_blocks;
+    }
+    width = num_blocks * block_width;
+  } else {
+    MADOKA_THROW_IF((src.width() % width) != 0);
+  }
+
+  create_(width, max_value, path, (flags & ~SKETCH_HEADER_FLAGS) | src_flags,
+          src.seed());
   *random_ = *src.random_;
 
   width = this->width();
@@ -1035,33 +3175,54 @@ void Sketch::shrink_(const Sketch &src, UInt64 width,
     clear();
   }
 
-  for (UInt64 table_id = 0; table_id < SKETCH_DEPTH; ++table_id) {
-    for (UInt64 cell_id = 0; cell_id < width; ++cell_id) {
-      UInt64 value = src.get_(table_id, cell_id);
-      if (filter != NULL) {
-        value = filter(value);
-      }
-      if (value > max_value) {
-        value = max_value;
-      }
-      set_(table_id, cell_id, value);
-    }
-
-    for (UInt64 offset = width; offset < src.width(); offset += width) {
-      for (UInt64 cell_id = 0; cell_id < width; ++cell_id) {
-        UInt64 value = src.get_(table_id, offset + cell_id);
-        if (filter != NULL) {
-          value = filter(value);
-        }
-        if (value > max_value) {
-          value = max_value;
-        }
-        if (value > get_(table_id, cell_id)) {
-          set_(table_id, cell_id, value);
+  // The modulo mapping folds the (k * num_blocks + i)-th source block into
+  // the i-th block, and the fast range mapping folds the (i * num_folds + k)-th
+  // source block into the i-th block, where a block is a cell if unblocked.
+  // A key goes to slot (f * block_width) >> 16 of a block for a 16-bit
+  // fragment f of its hash, so a slot takes the source slots of all the
+  // fragments that it covers. If the block width is unchanged, a slot takes
+  // only the same slot. Each cell takes the largest of its source values,
+  // and approx source values are decoded with the generator of each task.
+  const UInt64 num_blocks = width / block_width_;
+  const UInt64 num_folds = num_src_blocks / num_blocks;
+  const UInt64 key =
+      (src.mode() == SKETCH_APPROX_MODE) ? get_task_key(random_) : 0;
+  run_unit_tasks_(table_size() / sizeof(UInt64), true,
+                  [&](UInt64 begin, UInt64 end) {
+    CounterRandom random(key, begin << 32);
+    for_each_cell_(begin, end, [&](UInt64 table_id, UInt64 cell_id) {
+      const UInt64 block_id = cell_id / block_width_;
+      const UInt64 slot_id = cell_id % block_width_;
+      const UInt64 min_fragment =
+          ((slot_id << 16) + block_width_ - 1) / block_width_;
+      const UInt64 max_fragment =
+          ((((slot_id + 1) << 16) + block_width_ - 1) / block_width_) - 1;
+      const UInt64 min_src_slot_id = (min_fragment * src_block_width) >> 16;
+      const UInt64 max_src_slot_id = (max_fragment * src_block_width) >> 16;
+
+      UInt64 max_src_value = 0;
+      for (UInt64 fold_id = 0; fold_id < num_folds; ++fold_id) {
+        const UInt64 src_block_id = cell_range_.fast() ?
+            ((block_id * num_folds) + fold_id) :
+            ((fold_id * num_blocks) + block_id);
+        for (UInt64 src_slot_id = min_src_slot_id;
+             src_slot_id <= max_src_slot_id; ++src_slot_id) {
+          UInt64 value = src.get_pending_value_(src_cells, num_src_cells,
+              table_id, (src_block_id * src_block_width) + src_slot_id,
+              &random);
+          if (filter != NULL) {
+            value = filter(value);
+          }
+          if (value > max_src_value) {
+            max_src_value = value;
+          }
         }
       }
-    }
-  }
+      set_(table_id, cell_id,
+           (max_src_value < max_value) ? max_src_value : max_value);
+    });
+  });
+  refresh_top_k_(&src);
 }
 
 }  // namespace madoka
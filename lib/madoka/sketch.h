@@ -29,7 +29,11 @@
 #include "file.h"
 #include "hash.h"
 #include "header.h"
+#include "hot-tier.h"
+#include "kernel.h"
 #include "random.h"
+#include "range.h"
+#include "top-k.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -37,13 +41,58 @@ extern "C" {
 
 typedef madoka_uint64 (*madoka_sketch_filter)(madoka_uint64);
 
+typedef void (*madoka_sketch_task)(void *arg, madoka_uint64 task_id);
+typedef void (*madoka_sketch_executor)(madoka_sketch_task task, void *arg,
+                                       madoka_uint64 num_tasks);
+
 typedef enum {
   MADOKA_SKETCH_EXACT_MODE,
   MADOKA_SKETCH_APPROX_MODE
 } madoka_sketch_mode;
 
+typedef enum {
+  MADOKA_SKETCH_BLOCKED_LAYOUT    = 1 << 16,
+  MADOKA_SKETCH_FAST_RANGE        = 1 << 17,
+  MADOKA_SKETCH_CONCURRENT        = 1 << 18,
+  MADOKA_SKETCH_COUNTER_RANDOM    = 1 << 19,
+  MADOKA_SKETCH_DECODE_LOWER      = 1 << 20,
+  MADOKA_SKETCH_DECODE_MIDPOINT   = 1 << 21,
+  MADOKA_SKETCH_HOT_TIER          = 1 << 22,
+  MADOKA_SKETCH_TOP_K             = 1 << 23,
+  MADOKA_SKETCH_HUGE_PAGE_ALIGNED = 1 << 25,
+  MADOKA_SKETCH_GEOMETRIC_ADD     = 1 << 26
+} madoka_sketch_flag;
+
+typedef enum {
+  MADOKA_SKETCH_RANDOM_DECODE,
+  MADOKA_SKETCH_LOWER_DECODE,
+  MADOKA_SKETCH_MIDPOINT_DECODE
+} madoka_sketch_decode;
+
+typedef enum {
+  MADOKA_SKETCH_THRESHOLD_FILTER,
+  MADOKA_SKETCH_SHIFT_FILTER,
+  MADOKA_SKETCH_SCALE_FILTER,
+  MADOKA_SKETCH_CLAMP_FILTER,
+  MADOKA_SKETCH_DECAY_FILTER
+} madoka_sketch_filter_op;
+
+typedef enum {
+  MADOKA_SKETCH_SUM_MERGE,
+  MADOKA_SKETCH_MAX_MERGE,
+  MADOKA_SKETCH_MIN_MERGE
+} madoka_sketch_merge_mode;
+
 typedef struct madoka_sketch_ madoka_sketch;
 
+void madoka_set_executor(madoka_sketch *sketch,
+                         madoka_sketch_executor executor);
+
+typedef struct {
+  madoka_uint64 seed;
+  madoka_uint64 values[2];
+} madoka_key_hash;
+
 madoka_sketch *madoka_create(madoka_uint64 width, madoka_uint64 max_value,
                              const char *path, int flags, madoka_uint64 seed,
                              const char **what);
@@ -66,17 +115,26 @@ int madoka_serialize(const madoka_sketch *sketch, void *buf,
 madoka_uint64 madoka_get_width(const madoka_sketch *sketch);
 madoka_uint64 madoka_get_width_mask(const madoka_sketch *sketch);
 madoka_uint64 madoka_get_depth(const madoka_sketch *sketch);
+madoka_uint64 madoka_get_block_width(const madoka_sketch *sketch);
 madoka_uint64 madoka_get_max_value(const madoka_sketch *sketch);
 madoka_uint64 madoka_get_value_mask(const madoka_sketch *sketch);
 madoka_uint64 madoka_get_value_size(const madoka_sketch *sketch);
 madoka_uint64 madoka_get_seed(const madoka_sketch *sketch);
 madoka_uint64 madoka_get_table_size(const madoka_sketch *sketch);
 madoka_uint64 madoka_get_file_size(const madoka_sketch *sketch);
+madoka_uint64 madoka_get_version(const madoka_sketch *sketch);
 int madoka_get_flags(const madoka_sketch *sketch);
 madoka_sketch_mode madoka_get_mode(const madoka_sketch *sketch);
+madoka_uint64 madoka_get_num_hot_keys(const madoka_sketch *sketch);
+
+size_t madoka_get_top_keys(const madoka_sketch *sketch,
+                           madoka_top_key *top_keys, size_t max_num_keys);
 
 madoka_uint64 madoka_get(const madoka_sketch *sketch, const void *key_addr,
                          size_t key_size);
+madoka_uint64 madoka_get_decoded(const madoka_sketch *sketch,
+                                 const void *key_addr, size_t key_size,
+                                 madoka_sketch_decode decode);
 void madoka_set(madoka_sketch *sketch, const void *key_addr,
                 size_t key_size, madoka_uint64 value);
 madoka_uint64 madoka_inc(madoka_sketch *sketch, const void *key_addr,
@@ -84,12 +142,42 @@ madoka_uint64 madoka_inc(madoka_sketch *sketch, const void *key_addr,
 madoka_uint64 madoka_add(madoka_sketch *sketch, const void *key_addr,
                          size_t key_size, madoka_uint64 value);
 
+void madoka_hash_key(const madoka_sketch *sketch, const void *key_addr,
+                     size_t key_size, madoka_key_hash *key_hash);
+
+madoka_uint64 madoka_get_hashed(const madoka_sketch *sketch,
+                                const madoka_key_hash *key_hash);
+void madoka_set_hashed(madoka_sketch *sketch, const madoka_key_hash *key_hash,
+                       madoka_uint64 value);
+madoka_uint64 madoka_inc_hashed(madoka_sketch *sketch,
+                                const madoka_key_hash *key_hash);
+madoka_uint64 madoka_add_hashed(madoka_sketch *sketch,
+                                const madoka_key_hash *key_hash,
+                                madoka_uint64 value);
+
+void madoka_get_batch(const madoka_sketch *sketch,
+                      const void * const *key_addrs, const size_t *key_sizes,
+                      size_t num_keys, madoka_uint64 *values);
+void madoka_set_batch(madoka_sketch *sketch, const void * const *key_addrs,
+                      const size_t *key_sizes, size_t num_keys,
+                      const madoka_uint64 *values);
+void madoka_inc_batch(madoka_sketch *sketch, const void * const *key_addrs,
+                      const size_t *key_sizes, size_t num_keys,
+                      madoka_uint64 *values);
+void madoka_add_batch(madoka_sketch *sketch, const void * const *key_addrs,
+                      const size_t *key_sizes, size_t num_keys,
+                      const madoka_uint64 *values, madoka_uint64 *results);
+
 void madoka_clear(madoka_sketch *sketch);
+void madoka_clear_range(madoka_sketch *sketch, madoka_uint64 offset,
+                       madoka_uint64 size);
 
 madoka_sketch *madoka_copy(const madoka_sketch *src, const char *path,
                            int flags, const char **what);
 
 void madoka_filter(madoka_sketch *sketch, madoka_sketch_filter filter);
+int madoka_filter_op(madoka_sketch *sketch, madoka_sketch_filter_op op,
+                     madoka_uint64 param, const char **what);
 
 madoka_sketch *madoka_shrink(const madoka_sketch *src,
                              madoka_uint64 width, madoka_uint64 max_value,
@@ -99,12 +187,20 @@ madoka_sketch *madoka_shrink(const madoka_sketch *src,
 int madoka_merge(madoka_sketch *lhs, const madoka_sketch *rhs,
                  madoka_sketch_filter lhs_filter,
                  madoka_sketch_filter rhs_filter, const char **what);
+int madoka_merge_with_mode(madoka_sketch *lhs, const madoka_sketch *rhs,
+                           madoka_sketch_merge_mode mode,
+                           madoka_sketch_filter lhs_filter,
+                           madoka_sketch_filter rhs_filter,
+                           const char **what);
 
 void madoka_swap(madoka_sketch *lhs, madoka_sketch *rhs);
 
 int madoka_inner_product(const madoka_sketch *lhs, const madoka_sketch *rhs,
                          double *inner_product, double *lhs_square_length,
                          double *rhs_square_length, const char **what);
+int madoka_inner_products(const madoka_sketch * const *sketches,
+                          madoka_uint64 num_sketches, double *inner_products,
+                          double *square_lengths, const char **what);
 
 #ifdef __cplusplus
 }  // extern "C"
@@ -115,11 +211,141 @@ namespace madoka {
 
 typedef madoka_sketch_filter SketchFilter;
 
+// SketchExecutor runs the tasks of a bulk operation, such as clear(),
+// filter(), shrink(), merge() and inner_product(). An executor calls
+// task(arg, task_id) for each task_id in [0, num_tasks), possibly on many
+// threads at once, and returns after all of them have finished. Tasks never
+// share a cache line, so they can run in any order. A task that decodes
+// approx values draws random numbers from its own CounterRandom, keyed by
+// the generator in the header and numbered by the first unit of the task,
+// so results never depend on an executor. inner_product() and
+// inner_products() of approx sketches still decode on the calling thread.
+typedef madoka_sketch_task SketchTask;
+typedef madoka_sketch_executor SketchExecutor;
+
 enum SketchMode {
   SKETCH_EXACT_MODE  = MADOKA_SKETCH_EXACT_MODE,
   SKETCH_APPROX_MODE = MADOKA_SKETCH_APPROX_MODE
 };
 
+// SketchDecode specifies how get() of approx mode decodes a value.
+// SKETCH_RANDOM_DECODE fills the bits lost in encoding with random bits, so
+// that estimates are unbiased. SKETCH_LOWER_DECODE and SKETCH_MIDPOINT_DECODE
+// return the lower bound and the midpoint of the values that a cell stands
+// for, and never touch a generator.
+enum SketchDecode {
+  SKETCH_RANDOM_DECODE   = MADOKA_SKETCH_RANDOM_DECODE,
+  SKETCH_LOWER_DECODE    = MADOKA_SKETCH_LOWER_DECODE,
+  SKETCH_MIDPOINT_DECODE = MADOKA_SKETCH_MIDPOINT_DECODE
+};
+
+// SketchFilterOp specifies a built-in filter, which maps each value v with
+// a parameter p as follows:
+// - SKETCH_THRESHOLD_FILTER: 0 if v < p, v otherwise.
+// - SKETCH_SHIFT_FILTER: v >> p, so that p = 1 halves values.
+// - SKETCH_SCALE_FILTER: v * p, saturated at max_value().
+// - SKETCH_CLAMP_FILTER: min(v, p).
+// - SKETCH_DECAY_FILTER: (v * p) >> 16, where p must not exceed
+//   SKETCH_DECAY_FILTER_ONE, for example, 0.9 * SKETCH_DECAY_FILTER_ONE.
+enum SketchFilterOp {
+  SKETCH_THRESHOLD_FILTER = MADOKA_SKETCH_THRESHOLD_FILTER,
+  SKETCH_SHIFT_FILTER     = MADOKA_SKETCH_SHIFT_FILTER,
+  SKETCH_SCALE_FILTER     = MADOKA_SKETCH_SCALE_FILTER,
+  SKETCH_CLAMP_FILTER     = MADOKA_SKETCH_CLAMP_FILTER,
+  SKETCH_DECAY_FILTER     = MADOKA_SKETCH_DECAY_FILTER
+};
+
+// SketchMergeMode specifies how merge() combines the values of a cell.
+// SKETCH_SUM_MERGE adds them and saturates at max_value(), so that the result
+// counts the keys of both sketches. SKETCH_MAX_MERGE and SKETCH_MIN_MERGE
+// keep the larger and the smaller one, for example, to take the union or the
+// intersection of sketches built from overlapping streams. Unfiltered merges
+// of sketches with the same layout run as SIMD sweeps over the tables.
+enum SketchMergeMode {
+  SKETCH_SUM_MERGE = MADOKA_SKETCH_SUM_MERGE,
+  SKETCH_MAX_MERGE = MADOKA_SKETCH_MAX_MERGE,
+  SKETCH_MIN_MERGE = MADOKA_SKETCH_MIN_MERGE
+};
+
+// SKETCH_BLOCKED_LAYOUT puts the 3 cells of a key into one 64-byte block, so
+// that get(), set(), inc() and add() touch only one cache line. The width of
+// a blocked sketch is rounded up to a multiple of block_width().
+//
+// SKETCH_FAST_RANGE maps hash IDs to cells with a multiplication instead of
+// a modulo operation (see Range), so that any width is as fast as a power
+// of two. Sketches created without this flag keep the modulo mapping. The
+// mapping of a sketch never changes, so copy() and shrink() keep it, and
+// merge() and inner_product() reject sketches with different mappings.
+//
+// SKETCH_CONCURRENT allows threads to call get(), set(), inc() and add(),
+// including their batch and KeyHash variants, on one sketch at the same
+// time. Each cell is updated with a compare-and-swap loop and readers never
+// wait. Note that inc() and add() then add to all the cells of a key instead
+// of only the smallest ones, because the conservative update is not safe
+// under concurrent updates. Also, the other functions, such as clear() and
+// merge(), must not run concurrently with any other function.
+//
+// SKETCH_COUNTER_RANDOM makes get(), set(), inc() and add() of approx mode
+// draw random numbers from a CounterRandom keyed by the cells of a key and
+// a stream ID of the calling thread, and numbered by a counter of the
+// thread, instead of the generator in the header. So, these functions never
+// write shared state other than cells, and give the same results for the
+// same sequence of operations in each thread. See reset_thread_counter().
+//
+// SKETCH_DECODE_LOWER and SKETCH_DECODE_MIDPOINT make get() of approx mode
+// use SKETCH_LOWER_DECODE and SKETCH_MIDPOINT_DECODE respectively, so that
+// get() of a sketch opened with FILE_READONLY writes nothing and many threads
+// can serve queries from it. These flags are exclusive.
+//
+// SKETCH_HOT_TIER puts a HotTier in front of the cells. The current top
+// keys and their counts are kept in the HotTier, and never touch the cells
+// while they stay there. A key is promoted when its estimate exceeds the
+// smallest count in the HotTier by more than 1 / 2^HOT_TIER_MARGIN_SHIFT of
+// it, and the demoted key's pending count goes to the cells. The HotTier is
+// saved in the file of a sketch. filter() demotes all the keys first.
+// merge() keeps the hot keys of this sketch and merges their counts. The
+// hot keys of a sketch that merge(), shrink() and inner_product() only read
+// are taken as if demoted, without changing or copying the sketch. This
+// flag cannot be used with SKETCH_CONCURRENT.
+//
+// SKETCH_TOP_K keeps a TopK in the file of a sketch. inc(), add(),
+// inc_batch() and add_batch() offer each key with the value they return,
+// so top_keys() gives the heavy hitters without a pass over the keys.
+// The KeyHash overloads have no key to offer and do not track it, so
+// SketchGroup, UpdateBuffer and WindowedSketch reject this flag.
+// filter(), merge() and shrink() re-evaluate the tracked keys. This flag
+// cannot be used with SKETCH_CONCURRENT.
+//
+// SKETCH_HUGE_PAGE_ALIGNED starts the table of a sketch at a multiple of
+// SKETCH_HUGE_PAGE_SIZE bytes instead of SKETCH_PAGE_SIZE bytes, so that a
+// table mapped with FILE_HUGETLB does not share a huge page with the header.
+//
+// SKETCH_GEOMETRIC_ADD makes add() of approx mode behave like `value' calls
+// of inc() by Approx::add(), instead of adding `value' to a decoded value.
+// It draws a random number per bump, not per count, so an UpdateBuffer in
+// front of a sketch with this flag applies a hot key with far fewer draws
+// than its count.
+enum SketchFlag {
+  SKETCH_BLOCKED_LAYOUT    = MADOKA_SKETCH_BLOCKED_LAYOUT,
+  SKETCH_FAST_RANGE        = MADOKA_SKETCH_FAST_RANGE,
+  SKETCH_CONCURRENT        = MADOKA_SKETCH_CONCURRENT,
+  SKETCH_COUNTER_RANDOM    = MADOKA_SKETCH_COUNTER_RANDOM,
+  SKETCH_DECODE_LOWER      = MADOKA_SKETCH_DECODE_LOWER,
+  SKETCH_DECODE_MIDPOINT   = MADOKA_SKETCH_DECODE_MIDPOINT,
+  SKETCH_HOT_TIER          = MADOKA_SKETCH_HOT_TIER,
+  SKETCH_TOP_K             = MADOKA_SKETCH_TOP_K,
+  SKETCH_HUGE_PAGE_ALIGNED = MADOKA_SKETCH_HUGE_PAGE_ALIGNED,
+  SKETCH_GEOMETRIC_ADD     = MADOKA_SKETCH_GEOMETRIC_ADD
+};
+
+// Flags in SKETCH_HEADER_FLAGS are saved in the header of a sketch.
+const int SKETCH_HEADER_FLAGS = SKETCH_BLOCKED_LAYOUT | SKETCH_FAST_RANGE |
+    SKETCH_HOT_TIER | SKETCH_TOP_K | SKETCH_HUGE_PAGE_ALIGNED;
+// Flags in SKETCH_OBJECT_FLAGS are given to create(), open(), load() and so
+// on, and apply only to the sketch object.
+const int SKETCH_OBJECT_FLAGS = SKETCH_CONCURRENT | SKETCH_COUNTER_RANDOM |
+    SKETCH_DECODE_LOWER | SKETCH_DECODE_MIDPOINT | SKETCH_GEOMETRIC_ADD;
+
 const UInt64 SKETCH_ID_SIZE           = 128 / 3;
 const UInt64 SKETCH_MAX_ID            = (1ULL << SKETCH_ID_SIZE) - 1;
 const UInt64 SKETCH_ID_MASK           = SKETCH_MAX_ID;
@@ -138,10 +364,42 @@ const UInt64 SKETCH_APPROX_VALUE_SIZE = APPROX_VALUE_SIZE;
 const UInt64 SKETCH_OWNER_OFFSET      = APPROX_SIZE * 3;
 const UInt64 SKETCH_OWNER_MASK        = 0x3FULL << SKETCH_OWNER_OFFSET;
 
+// create() writes sketches of SKETCH_FORMAT_VERSION, where the table starts
+// at a multiple of SKETCH_PAGE_SIZE bytes after the header, the generator,
+// the HotTier and the TopK. open(), load() and deserialize() also accept
+// sketches of format version 0, where the table follows them directly.
+const UInt64 SKETCH_FORMAT_VERSION    = 1;
+const UInt64 SKETCH_PAGE_SIZE         = 1ULL << 12;
+const UInt64 SKETCH_HUGE_PAGE_SIZE    = 1ULL << 21;
+
+const UInt64 SKETCH_BLOCK_SIZE        = 64;
+const UInt64 SKETCH_BLOCK_UNITS       = SKETCH_BLOCK_SIZE / sizeof(UInt64);
+
+// Bulk operations, such as filter() and inner_product(), decode
+// SKETCH_BULK_SIZE values of each row at once.
+const UInt64 SKETCH_BULK_SIZE         = 256;
+
+// A bulk operation splits a table into up to SKETCH_MAX_NUM_TASKS tasks of
+// at least SKETCH_MIN_TASK_SIZE bytes, where each task is a multiple of
+// SKETCH_BLOCK_SIZE bytes.
+const UInt64 SKETCH_MIN_TASK_SIZE     = 1ULL << 16;
+const UInt64 SKETCH_MAX_NUM_TASKS     = 256;
+
+// inner_products() decodes the rows of up to SKETCH_MAX_TILE_SKETCHES
+// sketches into a tile of SKETCH_BULK_SIZE cells per sketch, and computes
+// the sums of all the pairs in the tile before decoding the next cells.
+const UInt64 SKETCH_MAX_TILE_SKETCHES = 64;
+
+const UInt64 SKETCH_DECAY_FILTER_ONE  = 1ULL << 16;
+
 class Sketch {
  public:
   typedef SketchFilter Filter;
   typedef SketchMode Mode;
+  typedef SketchDecode Decode;
+  typedef SketchFilterOp FilterOp;
+  typedef SketchMergeMode MergeMode;
+  typedef SketchExecutor Executor;
 
   Sketch() noexcept;
   ~Sketch() noexcept;
@@ -166,6 +424,9 @@ class Sketch {
   UInt64 depth() const noexcept {
     return SKETCH_DEPTH;
   }
+  UInt64 block_width() const noexcept {
+    return block_width_;
+  }
   UInt64 max_value() const noexcept {
     return header().max_value();
   }
@@ -184,42 +445,169 @@ class Sketch {
   UInt64 file_size() const noexcept {
     return header().file_size();
   }
+  UInt64 version() const noexcept {
+    return header().version();
+  }
   int flags() const noexcept {
-    return file_.flags();
+    return file_.flags() | object_flags_ |
+        ((header_ != NULL) ? static_cast<int>(header().flags()) : 0);
   }
   Mode mode() const noexcept {
     return (value_size() == SKETCH_APPROX_VALUE_SIZE) ?
         SKETCH_APPROX_MODE : SKETCH_EXACT_MODE;
   }
+  Decode decode() const noexcept {
+    return decode_;
+  }
+  UInt64 num_hot_keys() const noexcept {
+    return (hot_tier_ != NULL) ? hot_tier_->size() : 0;
+  }
+
+  // set_executor() sets an executor for bulk operations, which otherwise run
+  // on the calling thread. An executor belongs to the object, so it stays
+  // across create(), open(), shrink(), swap() and so on. Note that filters
+  // given to shrink() and merge() may be called from many threads at once.
+  void set_executor(Executor executor) noexcept {
+    executor_ = executor;
+  }
+  Executor executor() const noexcept {
+    return executor_;
+  }
 
   UInt64 get(const void *key_addr, std::size_t key_size) const noexcept;
   void set(const void *key_addr, std::size_t key_size, UInt64 value) noexcept;
   UInt64 inc(const void *key_addr, std::size_t key_size) noexcept;
   UInt64 add(const void *key_addr, std::size_t key_size, UInt64 value) noexcept;
 
-  void clear() noexcept;
+  // The following overloads of get() use `decode' instead of decode().
+  UInt64 get(const void *key_addr, std::size_t key_size,
+             Decode decode) const noexcept;
+  UInt64 get(const KeyHash &key_hash, Decode decode) const noexcept;
 
+  // The following overloads take a KeyHash instead of a key, which must be
+  // computed with seed(). Use hash() to get a KeyHash of this sketch.
+  KeyHash hash(const void *key_addr, std::size_t key_size) const noexcept {
+    return KeyHash(key_addr, key_size, seed());
+  }
+  UInt64 get(const KeyHash &key_hash) const noexcept;
+  void set(const KeyHash &key_hash, UInt64 value) noexcept;
+  UInt64 inc(const KeyHash &key_hash) noexcept;
+  UInt64 add(const KeyHash &key_hash, UInt64 value) noexcept;
+
+  // The following functions apply get(), set(), inc() or add() to
+  // `num_keys' keys in order. They compute cell IDs of the next keys in
+  // advance and prefetch those cells, so that cache misses on a large sketch
+  // overlap each other. `values' and `results' of inc_batch() and
+  // add_batch() may be NULL. Also, `results' may be `values'.
+  void get_batch(const void * const *key_addrs, const std::size_t *key_sizes,
+                 std::size_t num_keys, UInt64 *values) const noexcept;
+  void set_batch(const void * const *key_addrs, const std::size_t *key_sizes,
+                 std::size_t num_keys, const UInt64 *values) noexcept;
+  void inc_batch(const void * const *key_addrs, const std::size_t *key_sizes,
+                 std::size_t num_keys, UInt64 *values = NULL) noexcept;
+  void add_batch(const void * const *key_addrs, const std::size_t *key_sizes,
+                 std::size_t num_keys, const UInt64 *values,
+                 UInt64 *results = NULL) noexcept;
+
+  void clear() noexcept;
+  // clear(offset, size) clears only the bytes [offset, offset + size) of the
+  // table, so that a large sketch can be cleared in steps. The hot tier and
+  // the tracked keys are cleared with the first step, where `offset' is 0.
+  // The range is clipped to table_size().
+  void clear(UInt64 offset, UInt64 size) noexcept;
+
+  // copy() and shrink() take the flags in SKETCH_HEADER_FLAGS from `src' and
+  // ignore those in `flags', so the new sketch keeps the layout of `src'.
   void copy(const Sketch &src, const char *path = NULL, int flags = 0);
 
+  // filter() replaces each value v with filter(v). The overload for
+  // function pointers calls `filter' once per cell, as it always has. The
+  // overload for functors, such as lambdas, lets the compiler inline
+  // `filter' and may call it once per possible value instead, so a functor
+  // must be pure: a function of v alone, without side effects such as
+  // counting calls. With an executor, either overload may call `filter' on
+  // many threads at once. filter(op, param) applies a built-in filter, which
+  // runs as a SIMD sweep over the cells of an exact sketch with 8-bit or
+  // 16-bit values.
   void filter(Filter filter) noexcept;
+  template <typename T>
+  void filter(T filter, int T::* = NULL) noexcept {
+    filter_(filter);
+  }
+  void filter(FilterOp op, UInt64 param);
 
+  // shrink() folds the cells of `src' into `width' cells, where `width' must
+  // divide the width of `src'. A blocked sketch is instead given the fewest
+  // blocks that hold `width' cells and divide the blocks of `src', but no
+  // more blocks than `src' has. Note that `max_value' decides the number of
+  // cells in a block.
   void shrink(const Sketch &src, UInt64 width = 0,
               UInt64 max_value = 0, Filter filter = NULL,
               const char *path = NULL, int flags = 0);
 
   void merge(const Sketch &rhs, Filter lhs_filter = NULL,
              Filter rhs_filter = NULL);
+  void merge(const Sketch &rhs, MergeMode mode, Filter lhs_filter = NULL,
+             Filter rhs_filter = NULL);
 
   void swap(Sketch *sketch) noexcept;
 
+  // top_keys() stores up to `max_num_keys' tracked keys in descending order
+  // of value and returns the number of stored keys. The keys point to the
+  // sketch and are valid until the next update. A sketch without
+  // SKETCH_TOP_K has no tracked keys.
+  std::size_t top_keys(TopKey *top_keys,
+                       std::size_t max_num_keys) const noexcept;
+
+  // reset_thread_counter() sets the counter of the calling thread, which
+  // sketches with SKETCH_COUNTER_RANDOM use to draw random numbers, and
+  // optionally its stream ID, which is 0 for a fresh thread. A thread that
+  // resets its counter and repeats a sequence of operations gets the same
+  // results. Threads of the same stream ID and counter draw the same numbers
+  // for a key, so threads that update a sketch at the same time should take
+  // distinct stream IDs, such as their indices, to keep their draws
+  // independent.
+  static void reset_thread_counter(UInt64 counter = 0) noexcept;
+  static void reset_thread_counter(UInt64 counter, UInt64 stream_id) noexcept;
+
   double inner_product(const Sketch &rhs, double *lhs_square_length = NULL,
                        double *rhs_square_length = NULL) const;
 
+  // inner_products() computes inner_product() of every pair of
+  // `num_sketches' sketches, which must have the same width, seed and
+  // layout. `inner_products[i * num_sketches + j]' is the inner product of
+  // the i-th and the j-th sketches, and `square_lengths[i * num_sketches +
+  // j]' is the square length of the i-th sketch that comes with it.
+  // `square_lengths' may be NULL. Each row is read once per tile of
+  // sketches instead of once per pair, and the results for exact sketches
+  // are the same as those of inner_product(). The tiles run on the
+  // executor of the first sketch if all the sketches are in exact mode.
+  static void inner_products(const Sketch * const *sketches,
+                             std::size_t num_sketches,
+                             double *inner_products,
+                             double *square_lengths = NULL);
+
  private:
+  friend class SketchGroup;
+
+  struct Ops;
+  struct PendingCell;
+
   File file_;
   Header *header_;
   Random *random_;
+  HotTier *hot_tier_;
+  TopK *top_k_;
   UInt64 *table_;
+  UInt64 block_width_;
+  UInt64 block_cells_;
+  Range cell_range_;
+  Range block_range_;
+  int object_flags_;
+  Decode decode_;
+  const Ops *ops_;
+  const Ops *table_ops_;
+  Executor executor_;
 
   const Header &header() const noexcept {
     return *header_;
@@ -237,22 +625,133 @@ class Sketch {
   void deserialize_(const void *buf, UInt64 size, int flags);
 
   void check_header() const;
+  void init_(int flags);
 
+  // get_() and get_bulk_() decode approx values with the generator in the
+  // header, or with `random' if given, which the tasks of bulk operations
+  // use instead.
   inline UInt64 get_(UInt64 table_id, UInt64 cell_id) const noexcept;
+  template <typename T>
+  UInt64 get_(UInt64 table_id, UInt64 cell_id, T *random) const noexcept;
   inline void set_(UInt64 table_id, UInt64 cell_id, UInt64 value) noexcept;
-
+  void get_bulk_(UInt64 table_id, UInt64 cell_id, UInt64 num_cells,
+                 UInt64 *values) const noexcept;
+  template <typename T>
+  void get_bulk_(UInt64 table_id, UInt64 cell_id, UInt64 num_cells,
+                 UInt64 *values, T *random) const noexcept;
+  void set_bulk_(UInt64 table_id, UInt64 cell_id, UInt64 num_cells,
+                 const UInt64 *values) noexcept;
+  template <typename T>
+  void filter_(T filter) noexcept;
+  // filter_cells_() calls `filter' once per cell. filter_bulk_() applies
+  // `filter' to a bulk of values, so that the tasks of filter_cells_() call
+  // a functor through a pointer once per bulk, not once per cell.
+  template <typename T>
+  void filter_cells_(T filter) noexcept;
+  void filter_cells_(void (*filter_bulk)(void *, UInt64 *, UInt64, UInt64),
+                     void *filter) noexcept;
+  template <typename T>
+  static void filter_bulk_(void *filter, UInt64 *values, UInt64 num_values,
+                           UInt64 max_value) noexcept;
+  void filter_by_table_(const UInt64 *table) noexcept;
+
+  // run_tasks_() calls task(task_id) for each task_id in [0, num_tasks),
+  // with the executor if `is_parallel' and in order otherwise.
+  // run_unit_tasks_() splits `num_units' units of the table into tasks and
+  // calls task(begin, end) for each range of units.
+  template <typename T>
+  void run_tasks_(UInt64 num_tasks, bool is_parallel,
+                  const T &task) const noexcept;
+  template <typename T>
+  void run_unit_tasks_(UInt64 num_units, bool is_parallel,
+                       const T &task) const noexcept;
+  // for_each_cell_() calls f(table_id, cell_id) for each cell stored in the
+  // `begin'-th to the (`end' - 1)-th units.
+  template <typename T>
+  void for_each_cell_(UInt64 begin, UInt64 end, const T &f) const noexcept;
+  // for_each_run_() is the bulk version of for_each_cell_(). It calls
+  // f(table_id, cell_id, num_cells) for each run of contiguous cells of a row.
+  template <typename T>
+  void for_each_run_(UInt64 begin, UInt64 end, const T &f) const noexcept;
+
+  // is_packed_pair_() returns true if inner_product() of this sketch and
+  // `rhs' can use exact_inner_product_(), which needs unblocked exact
+  // sketches of the same value size. exact_inner_product_() adds the sums
+  // of `num_cells' cells from the `cell_id'-th cell of the `table_id'-th rows
+  // to `sums', without decoding the packed values.
+  bool is_packed_pair_(const Sketch &rhs) const noexcept;
+  void exact_inner_product_(const Sketch &rhs, UInt64 table_id,
+                            UInt64 cell_id, UInt64 num_cells,
+                            double sums[3]) const noexcept;
+
+  // inner_products_() computes the pairs of the sketches in [`lhs_begin',
+  // `lhs_end') and [`rhs_begin', `rhs_end') for inner_products(), and
+  // returns false if it fails to allocate memory.
+  static bool inner_products_(const Sketch * const *sketches,
+                              std::size_t num_sketches,
+                              std::size_t lhs_begin, std::size_t lhs_end,
+                              std::size_t rhs_begin, std::size_t rhs_end,
+                              const PendingCell * const *pending_cells,
+                              const UInt64 *num_pending_cells,
+                              double *inner_products,
+                              double *square_lengths) noexcept;
+
+  inline UInt64 exact_cell_id_(UInt64 table_id,
+                               UInt64 cell_id) const noexcept;
+
+  static const Ops *get_ops_(UInt64 value_size, int flags) noexcept;
+  static const Ops *get_hot_tier_ops_() noexcept;
+
+  template <UInt64 VALUE_SIZE>
   UInt64 exact_get(const UInt64 cell_ids[3]) const noexcept;
+  template <UInt64 VALUE_SIZE>
   void exact_set(const UInt64 cell_ids[3], UInt64 value) noexcept;
+  template <UInt64 VALUE_SIZE>
   UInt64 exact_inc(const UInt64 cell_ids[3]) noexcept;
+  template <UInt64 VALUE_SIZE>
   UInt64 exact_add(const UInt64 cell_ids[3], UInt64 value) noexcept;
 
+  template <UInt64 VALUE_SIZE>
   inline UInt64 exact_get_(UInt64 cell_id) const noexcept;
+  template <UInt64 VALUE_SIZE>
   inline void exact_set_(UInt64 cell_id, UInt64 value) noexcept;
+  template <UInt64 VALUE_SIZE>
   inline void exact_set_floor_(UInt64 cell_id, UInt64 value) noexcept;
 
+  UInt64 exact_get_(UInt64 cell_id) const noexcept;
+  void exact_set_(UInt64 cell_id, UInt64 value) noexcept;
+
+  template <UInt64 VALUE_SIZE>
+  UInt64 concurrent_exact_get(const UInt64 cell_ids[3]) const noexcept;
+  template <UInt64 VALUE_SIZE>
+  void concurrent_exact_set(const UInt64 cell_ids[3], UInt64 value) noexcept;
+  template <UInt64 VALUE_SIZE>
+  UInt64 concurrent_exact_inc(const UInt64 cell_ids[3]) noexcept;
+  template <UInt64 VALUE_SIZE>
+  UInt64 concurrent_exact_add(const UInt64 cell_ids[3],
+                              UInt64 value) noexcept;
+
+  template <UInt64 VALUE_SIZE>
+  inline UInt64 concurrent_exact_get_(UInt64 cell_id) const noexcept;
+  template <UInt64 VALUE_SIZE>
+  inline void concurrent_exact_set_floor_(UInt64 cell_id,
+                                          UInt64 value) noexcept;
+  template <UInt64 VALUE_SIZE>
+  inline UInt64 concurrent_exact_add_(UInt64 cell_id, UInt64 value) noexcept;
+
+  // The approx mode operations take the type of random number generator
+  // (see sketch.cc) as a template parameter.
+  template <typename Generator>
   UInt64 approx_get(const UInt64 cell_ids[3]) const noexcept;
+  template <typename Generator>
+  inline UInt64 approx_decode_(UInt64 approx, const UInt64 cell_ids[3],
+                               Decode decode) const noexcept;
+  inline UInt64 approx_min_(const UInt64 cell_ids[3]) const noexcept;
+  UInt64 decoded_get_(const UInt64 cell_ids[3], Decode decode) const noexcept;
   void approx_set(const UInt64 cell_ids[3], UInt64 value) noexcept;
+  template <typename Generator>
   UInt64 approx_inc(const UInt64 cell_ids[3]) noexcept;
+  template <typename Generator>
   UInt64 approx_add(const UInt64 cell_ids[3], UInt64 value) noexcept;
 
   inline UInt64 approx_get_(UInt64 table_id, UInt64 cell_id) const noexcept;
@@ -261,16 +760,102 @@ class Sketch {
   inline void approx_set_(UInt64 table_id, UInt64 cell_id,
                           UInt64 approx, UInt64 mask) noexcept;
 
+  template <typename Generator>
+  UInt64 concurrent_approx_get(const UInt64 cell_ids[3]) const noexcept;
+  void concurrent_approx_set(const UInt64 cell_ids[3], UInt64 value) noexcept;
+  template <typename Generator>
+  UInt64 concurrent_approx_inc(const UInt64 cell_ids[3]) noexcept;
+  template <typename Generator>
+  UInt64 concurrent_approx_add(const UInt64 cell_ids[3],
+                               UInt64 value) noexcept;
+
+  inline UInt64 concurrent_approx_get_(UInt64 table_id,
+                                       UInt64 cell_id) const noexcept;
+  inline UInt64 concurrent_approx_min_(
+      const UInt64 cell_ids[3]) const noexcept;
+  inline void concurrent_approx_set_floor_(UInt64 table_id, UInt64 cell_id,
+                                           UInt64 approx) noexcept;
+  template <typename Generator>
+  inline UInt64 concurrent_approx_inc_(UInt64 table_id, UInt64 cell_id,
+                                       Generator *random) noexcept;
+  template <typename Generator>
+  inline UInt64 concurrent_approx_add_(UInt64 table_id, UInt64 cell_id,
+                                       UInt64 value,
+                                       Generator *random) noexcept;
+
+  // The hot tier operations look up the HotTier and fall back to the
+  // operations in `table_ops_'.
+  UInt64 hot_get(const UInt64 cell_ids[3]) const noexcept;
+  void hot_set(const UInt64 cell_ids[3], UInt64 value) noexcept;
+  UInt64 hot_inc(const UInt64 cell_ids[3]) noexcept;
+  UInt64 hot_add(const UInt64 cell_ids[3], UInt64 value) noexcept;
+
+  inline UInt64 hot_add_(const UInt64 cell_ids[3], UInt64 value) noexcept;
+  void demote_() noexcept;
+
+  // A PendingCell is a cell of a hot key and the value that demote_() would
+  // leave in it. get_pending_cells_() fills `cells' with up to
+  // HOT_TIER_SIZE * SKETCH_DEPTH cells, sorted by row and then by cell, and
+  // returns their number. Operations that only read a sketch use them in
+  // place of demote_(), so that they neither change nor copy the sketch.
+  struct PendingCell {
+    UInt64 table_id;
+    UInt64 cell_id;
+    UInt64 value;
+  };
+  UInt64 get_pending_cells_(PendingCell *cells) const noexcept;
+  template <typename T>
+  UInt64 get_pending_value_(const PendingCell *cells, UInt64 num_cells,
+                            UInt64 table_id, UInt64 cell_id,
+                            T *random) const noexcept;
+  static UInt64 find_pending_cell_(const PendingCell *cells,
+                                   UInt64 num_cells, UInt64 table_id,
+                                   UInt64 cell_id) noexcept;
+  // add_pending_products_() adds to `sums' the differences that the pending
+  // cells of both sketches make to the sums of the `table_id'-th rows.
+  void add_pending_products_(const Sketch &rhs, UInt64 table_id,
+                             const PendingCell *lhs_cells,
+                             UInt64 num_lhs_cells,
+                             const PendingCell *rhs_cells,
+                             UInt64 num_rhs_cells,
+                             double sums[3]) const noexcept;
+  // row_cell_id_() is the inverse of exact_cell_id_() for the cell IDs of
+  // a key in either mode.
+  inline UInt64 row_cell_id_(UInt64 table_id, UInt64 cell_id) const noexcept;
+
+  inline void track_(const void *key_addr, std::size_t key_size,
+                     const UInt64 cell_ids[3], UInt64 value) noexcept;
+  void refresh_top_k_(const Sketch *src) noexcept;
+
   inline void hash(const void *key_addr, std::size_t key_size,
                    UInt64 cell_ids[3]) const noexcept;
+  inline void hash_(const UInt64 hash_values[2],
+                    UInt64 cell_ids[3]) const noexcept;
+  inline void block_hash_(UInt64 cell_ids[3]) const noexcept;
+
+  void prefetch_(const void * const *key_addrs, const std::size_t *key_sizes,
+                 std::size_t num_keys, UInt64 (*cell_ids)[3]) const noexcept;
+  inline void prefetch_(const UInt64 cell_ids[3]) const noexcept;
+  template <typename T>
+  void for_each_batch_key_(const void * const *key_addrs,
+                           const std::size_t *key_sizes, std::size_t num_keys,
+                           const T &f) const noexcept;
+
+  // SketchGroup splits an operation into locate_(), which computes and
+  // prefetches the cells of a key, and one of the following *_at_().
+  void locate_(const KeyHash &key_hash, UInt64 cell_ids[3]) const noexcept;
+  UInt64 get_at_(const UInt64 cell_ids[3]) const noexcept;
+  void set_at_(const UInt64 cell_ids[3], UInt64 value) noexcept;
+  UInt64 inc_at_(const UInt64 cell_ids[3]) noexcept;
+  UInt64 add_at_(const UInt64 cell_ids[3], UInt64 value) noexcept;
 
   void copy_(const Sketch &src, const char *path, int flags);
 
-  void exact_merge_(const Sketch &rhs, Filter lhs_filter,
+  void exact_merge_(const Sketch &rhs, MergeMode mode, Filter lhs_filter,
                     Filter rhs_filter) noexcept;
-  void approx_merge_(const Sketch &rhs, Filter lhs_filter,
+  void approx_merge_(const Sketch &rhs, MergeMode mode, Filter lhs_filter,
                      Filter rhs_filter) noexcept;
-  void approx_merge_(const Sketch &rhs) noexcept;
+  void approx_merge_(const Sketch &rhs, MergeMode mode) noexcept;
 
   void shrink_(const Sketch &src, UInt64 width, UInt64 max_value,
                Filter filter, const char *path, int flags);
@@ -280,6 +865,40 @@ class Sketch {
   Sketch &operator=(const Sketch &);
 };
 
+// filter_() maps the values of an exact sketch with values of less than 16
+// bits through a table, because such a sketch has at most 256 possible
+// values. Otherwise, it filters the cells with filter_cells_().
+template <typename T>
+void Sketch::filter_(T filter) noexcept {
+  demote_();
+  if ((mode() == SKETCH_EXACT_MODE) && (value_size() < 16)) {
+    UInt64 table[256];
+    for (UInt64 value = 0; value <= max_value(); ++value) {
+      const UInt64 result = filter(value);
+      table[value] = (result <= max_value()) ? result : max_value();
+    }
+    filter_by_table_(table);
+  } else {
+    filter_cells_(filter);
+  }
+  refresh_top_k_(NULL);
+}
+
+template <typename T>
+void Sketch::filter_cells_(T filter) noexcept {
+  filter_cells_(filter_bulk_<T>, &filter);
+}
+
+template <typename T>
+void Sketch::filter_bulk_(void *filter, UInt64 *values, UInt64 num_values,
+                          UInt64 max_value) noexcept {
+  T &f = *static_cast<T *>(filter);
+  for (UInt64 i = 0; i < num_values; ++i) {
+    const UInt64 result = f(values[i]);
+    values[i] = (result <= max_value) ? result : max_value;
+  }
+}
+
 }  // namespace madoka
 #endif  // __cplusplus
 
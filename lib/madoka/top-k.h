@@ -0,0 +1,277 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MADOKA_TOP_K_H
+#define MADOKA_TOP_K_H
+
+#include "util.h"
+
+#ifdef __cplusplus
+ #include <cstring>
+#else  // __cplusplus
+ #include <string.h>
+#endif  // __cplusplus
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+typedef struct {
+  const void *key_addr;
+  size_t key_size;
+  madoka_uint64 value;
+} madoka_top_key;
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif  // __cplusplus
+
+#ifdef __cplusplus
+namespace madoka {
+
+typedef madoka_top_key TopKey;
+
+const UInt64 TOP_K_SIZE         = 256;
+const UInt64 TOP_K_MAX_KEY_SIZE = 40;
+const UInt64 TOP_K_NUM_SLOTS    = TOP_K_SIZE * 2;
+
+// TopK is a min-heap of the keys with the largest values, which a sketch
+// with SKETCH_TOP_K keeps in its file. Each update offers a key and the
+// estimate that inc() or add() returned, and the key replaces the root if
+// its estimate is larger. Keys longer than TOP_K_MAX_KEY_SIZE bytes are not
+// tracked.
+//
+// A heavy hitter is offered on every update, so the entries are indexed by
+// an open-addressed table of their fingerprints with linear probing. A slot
+// has an entry ID plus 1, or 0 if empty, and each entry has the position
+// of its slot, so that moving an entry in the heap moves its slot in O(1).
+// The index is kept in the file with the heap and is all zeros for an
+// empty table.
+class TopK {
+ public:
+  struct Entry {
+    UInt64 value;
+    UInt64 fingerprint;
+    UInt64 key_size;
+    UInt8 key[TOP_K_MAX_KEY_SIZE];
+  };
+
+  TopK() noexcept : size_(0), entries_(), slots_(), slot_ids_() {}
+  ~TopK() noexcept {}
+
+  UInt64 size() const noexcept {
+    return size_;
+  }
+
+  // The entries are in heap order, and operator[](0) is the smallest.
+  const Entry &operator[](UInt64 i) const noexcept {
+    return entries_[i];
+  }
+
+  // update() offers a key with its current value. `fingerprint' must be
+  // the same for the same key.
+  void update(const void *key_addr, std::size_t key_size, UInt64 fingerprint,
+              UInt64 value) noexcept {
+    if ((key_size > TOP_K_MAX_KEY_SIZE) ||
+        ((size_ == TOP_K_SIZE) && (value <= entries_[0].value))) {
+      return;
+    }
+
+    const UInt64 i = find(key_addr, key_size, fingerprint);
+    if (i != size_) {
+      if (value > entries_[i].value) {
+        entries_[i].value = value;
+        sift_down(i);
+      }
+      return;
+    }
+
+    // The key takes a new entry, or else replaces the root.
+    UInt64 entry_id = 0;
+    if (size_ < TOP_K_SIZE) {
+      entry_id = size_++;
+    } else {
+      erase_slot(0);
+    }
+    Entry &entry = entries_[entry_id];
+    entry.value = value;
+    entry.fingerprint = fingerprint;
+    entry.key_size = key_size;
+    std::memcpy(entry.key, key_addr, key_size);
+    insert_slot(entry_id);
+    if (entry_id == 0) {
+      sift_down(0);
+    } else {
+      sift_up(entry_id);
+    }
+  }
+
+  // reset() replaces the value of the i-th entry. Call build() after
+  // resetting values.
+  void reset(UInt64 i, UInt64 value) noexcept {
+    entries_[i].value = value;
+  }
+  void build() noexcept {
+    for (UInt64 i = size_ / 2; i > 0; --i) {
+      sift_down(i - 1);
+    }
+  }
+
+  // top() stores up to `max_num_keys' keys in descending order of value and
+  // returns the number of stored keys. The keys point to this table.
+  std::size_t top(TopKey *top_keys, std::size_t max_num_keys) const noexcept {
+    std::size_t num_keys = 0;
+    for (UInt64 i = 0; i < size_; ++i) {
+      const Entry &entry = entries_[i];
+      std::size_t j = num_keys;
+      if (j < max_num_keys) {
+        ++num_keys;
+      } else if ((j == 0) || (entry.value <= top_keys[j - 1].value)) {
+        continue;
+      } else {
+        --j;
+      }
+      for ( ; (j > 0) && (entry.value > top_keys[j - 1].value); --j) {
+        top_keys[j] = top_keys[j - 1];
+      }
+      top_keys[j].key_addr = entry.key;
+      top_keys[j].key_size = static_cast<std::size_t>(entry.key_size);
+      top_keys[j].value = entry.value;
+    }
+    return num_keys;
+  }
+
+  void clear() noexcept {
+    size_ = 0;
+    for (UInt64 i = 0; i < TOP_K_NUM_SLOTS; ++i) {
+      slots_[i] = 0;
+    }
+  }
+
+ private:
+  UInt64 size_;
+  Entry entries_[TOP_K_SIZE];
+  UInt16 slots_[TOP_K_NUM_SLOTS];
+  UInt16 slot_ids_[TOP_K_SIZE];
+
+  // get_home_slot_id() returns the upper 9 bits of the mixed fingerprint,
+  // an ID in [0, TOP_K_NUM_SLOTS).
+  static UInt64 get_home_slot_id(UInt64 fingerprint) noexcept {
+    return (fingerprint * 0x9E3779B97F4A7C15ULL) >> 55;
+  }
+
+  UInt64 find(const void *key_addr, std::size_t key_size,
+              UInt64 fingerprint) const noexcept {
+    for (UInt64 slot_id = get_home_slot_id(fingerprint); slots_[slot_id] != 0;
+         slot_id = (slot_id + 1) % TOP_K_NUM_SLOTS) {
+      const UInt64 i = slots_[slot_id] - 1;
+      if ((entries_[i].fingerprint == fingerprint) &&
+          (entries_[i].key_size == key_size) &&
+          (std::memcmp(entries_[i].key, key_addr, key_size) == 0)) {
+        return i;
+      }
+    }
+    return size_;
+  }
+
+  void insert_slot(UInt64 i) noexcept {
+    UInt64 slot_id = get_home_slot_id(entries_[i].fingerprint);
+    while (slots_[slot_id] != 0) {
+      slot_id = (slot_id + 1) % TOP_K_NUM_SLOTS;
+    }
+    set_slot(slot_id, i);
+  }
+  // erase_slot() empties the slot of the i-th entry and shifts back the
+  // following slots that would not be found past an empty slot.
+  void erase_slot(UInt64 i) noexcept {
+    UInt64 slot_id = slot_ids_[i];
+    for (UInt64 next_id = (slot_id + 1) % TOP_K_NUM_SLOTS;
+         slots_[next_id] != 0; next_id = (next_id + 1) % TOP_K_NUM_SLOTS) {
+      const UInt64 entry_id = slots_[next_id] - 1;
+      const UInt64 home_id = get_home_slot_id(entries_[entry_id].fingerprint);
+      // The entry stays if its home is cyclically in (slot_id, next_id].
+      const UInt64 distance =
+          (next_id + TOP_K_NUM_SLOTS - home_id) % TOP_K_NUM_SLOTS;
+      const UInt64 gap =
+          (next_id + TOP_K_NUM_SLOTS - slot_id) % TOP_K_NUM_SLOTS;
+      if (distance >= gap) {
+        set_slot(slot_id, entry_id);
+        slot_id = next_id;
+      }
+    }
+    slots_[slot_id] = 0;
+  }
+  void set_slot(UInt64 slot_id, UInt64 i) noexcept {
+    slots_[slot_id] = static_cast<UInt16>(i + 1);
+    slot_ids_[i] = static_cast<UInt16>(slot_id);
+  }
+
+  void sift_up(UInt64 i) noexcept {
+    while (i > 0) {
+      const UInt64 parent = (i - 1) / 2;
+      if (entries_[parent].value <= entries_[i].value) {
+        break;
+      }
+      swap(i, parent);
+      i = parent;
+    }
+  }
+  void sift_down(UInt64 i) noexcept {
+    for ( ; ; ) {
+      UInt64 min_id = i;
+      const UInt64 left = (i * 2) + 1;
+      const UInt64 right = left + 1;
+      if ((left < size_) && (entries_[left].value < entries_[min_id].value)) {
+        min_id = left;
+      }
+      if ((right < size_) &&
+          (entries_[right].value < entries_[min_id].value)) {
+        min_id = right;
+      }
+      if (min_id == i) {
+        break;
+      }
+      swap(i, min_id);
+      i = min_id;
+    }
+  }
+  void swap(UInt64 lhs, UInt64 rhs) noexcept {
+    Entry temp;
+    std::memcpy(&temp, &entries_[lhs], sizeof(Entry));
+    std::memcpy(&entries_[lhs], &entries_[rhs], sizeof(Entry));
+    std::memcpy(&entries_[rhs], &temp, sizeof(Entry));
+    const UInt64 lhs_slot_id = slot_ids_[lhs];
+    set_slot(slot_ids_[rhs], lhs);
+    set_slot(lhs_slot_id, rhs);
+  }
+
+  // Disallows copy and assignment.
+  TopK(const TopK &);
+  TopK &operator=(const TopK &);
+};
+
+}  // namespace madoka
+#endif  // __cplusplus
+
+#endif  // MADOKA_TOP_K_H
@@ -0,0 +1,163 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "update-buffer.h"
+
+#include <new>
+
+namespace madoka {
+
+// An entry with count 0 is empty.
+struct UpdateBuffer::Entry {
+  UInt64 hash_values[2];
+  UInt64 count;
+};
+
+UpdateBuffer::UpdateBuffer() noexcept
+  : sketch_(NULL), entries_(NULL), capacity_(0), max_updates_(0), size_(0),
+    num_updates_(0) {}
+
+UpdateBuffer::~UpdateBuffer() noexcept {
+  flush();
+  delete [] entries_;
+}
+
+void UpdateBuffer::open(Sketch *sketch, UInt64 capacity,
+                        UInt64 max_updates) {
+  MADOKA_THROW_IF(sketch == NULL);
+  MADOKA_THROW_IF(sketch->flags() & SKETCH_TOP_K);
+  if (capacity == 0) {
+    capacity = UPDATE_BUFFER_DEFAULT_CAPACITY;
+  }
+  MADOKA_THROW_IF(capacity > UPDATE_BUFFER_MAX_CAPACITY);
+  if (capacity < UPDATE_BUFFER_MIN_CAPACITY) {
+    capacity = UPDATE_BUFFER_MIN_CAPACITY;
+  }
+  capacity = 2ULL << util::bit_scan_reverse(capacity - 1);
+  if (max_updates == 0) {
+    max_updates = UPDATE_BUFFER_DEFAULT_MAX_UPDATES;
+  }
+
+  UpdateBuffer new_buffer;
+  new_buffer.entries_ = new (std::nothrow) Entry[capacity]();
+  MADOKA_THROW_IF(new_buffer.entries_ == NULL);
+  new_buffer.sketch_ = sketch;
+  new_buffer.capacity_ = capacity;
+  new_buffer.max_updates_ = max_updates;
+  new_buffer.swap(this);
+}
+
+void UpdateBuffer::close() noexcept {
+  UpdateBuffer().swap(this);
+}
+
+UInt64 UpdateBuffer::get(const void *key_addr,
+                         std::size_t key_size) const noexcept {
+  return get(hash(key_addr, key_size));
+}
+
+void UpdateBuffer::inc(const void *key_addr, std::size_t key_size) noexcept {
+  add(hash(key_addr, key_size), 1);
+}
+
+void UpdateBuffer::add(const void *key_addr, std::size_t key_size,
+                       UInt64 value) noexcept {
+  add(hash(key_addr, key_size), value);
+}
+
+UInt64 UpdateBuffer::get(const KeyHash &key_hash) const noexcept {
+  const UInt64 max_value = sketch_->max_value();
+  const UInt64 value = sketch_->get(key_hash);
+  const UInt64 count = entries_[find_(key_hash.values())].count;
+  return ((max_value - value) > count) ? (value + count) : max_value;
+}
+
+void UpdateBuffer::inc(const KeyHash &key_hash) noexcept {
+  add(key_hash, 1);
+}
+
+void UpdateBuffer::add(const KeyHash &key_hash, UInt64 value) noexcept {
+  if (value == 0) {
+    return;
+  }
+
+  Entry &entry = entries_[find_(key_hash.values())];
+  if (entry.count == 0) {
+    entry.hash_values[0] = key_hash.values()[0];
+    entry.hash_values[1] = key_hash.values()[1];
+    ++size_;
+  }
+  // A pending count never exceeds max_value(), so that it cannot overflow.
+  const UInt64 max_value = sketch_->max_value();
+  entry.count = ((max_value - entry.count) > value) ?
+      (entry.count + value) : max_value;
+
+  if ((++num_updates_ >= max_updates_) ||
+      (size_ >= (capacity_ - (capacity_ / 4)))) {
+    flush();
+  }
+}
+
+void UpdateBuffer::flush() noexcept {
+  if (size_ != 0) {
+    const UInt64 seed = sketch_->seed();
+    for (UInt64 i = 0; i < capacity_; ++i) {
+      Entry &entry = entries_[i];
+      if (entry.count != 0) {
+        sketch_->add(KeyHash(seed, entry.hash_values), entry.count);
+        entry.count = 0;
+      }
+    }
+    size_ = 0;
+  }
+  num_updates_ = 0;
+}
+
+void UpdateBuffer::swap(UpdateBuffer *buffer) noexcept {
+  util::swap(sketch_, buffer->sketch_);
+  util::swap(entries_, buffer->entries_);
+  util::swap(capacity_, buffer->capacity_);
+  util::swap(max_updates_, buffer->max_updates_);
+  util::swap(size_, buffer->size_);
+  util::swap(num_updates_, buffer->num_updates_);
+}
+
+// find_() returns the index of the entry of a key or the empty entry where
+// the key should be inserted. The table is never full, so the linear
+// probing always terminates.
+UInt64 UpdateBuffer::find_(const UInt64 hash_values[2]) const noexcept {
+  const UInt64 mask = capacity_ - 1;
+  UInt64 index = hash_values[1] & mask;
+  for ( ; ; ) {
+    const Entry &entry = entries_[index];
+    if ((entry.count == 0) ||
+        ((entry.hash_values[0] == hash_values[0]) &&
+         (entry.hash_values[1] == hash_values[1]))) {
+      return index;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
+}  // namespace madoka
@@ -0,0 +1,123 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MADOKA_UPDATE_BUFFER_H
+#define MADOKA_UPDATE_BUFFER_H
+
+#include "sketch.h"
+
+#ifdef __cplusplus
+namespace madoka {
+
+const UInt64 UPDATE_BUFFER_MIN_CAPACITY         = 4;
+const UInt64 UPDATE_BUFFER_MAX_CAPACITY         = 1ULL << 24;
+const UInt64 UPDATE_BUFFER_DEFAULT_CAPACITY     = 1ULL << 10;
+const UInt64 UPDATE_BUFFER_DEFAULT_MAX_UPDATES  = 1ULL << 16;
+
+// UpdateBuffer coalesces updates of the same key before they reach a
+// sketch. It keeps the hash values of recent keys and their pending counts
+// in a small open addressing table, and applies each pending count with one
+// Sketch::add(). So, a hot key costs one conservative update per flush
+// instead of one per inc().
+//
+// Pending counts are applied when the table is 3/4 full, when
+// `max_updates' updates have been buffered since the last flush, on
+// flush(), and on close(). Sketch::get() does not see pending counts
+// until then, but get() of a buffer does.
+//
+// A buffer is not thread-safe. Give each thread its own buffer in front of
+// a sketch with SKETCH_CONCURRENT or a shard of a ShardedSketch. Also, a
+// buffer must be closed before its sketch, because it flushes on close.
+class UpdateBuffer {
+ public:
+  UpdateBuffer() noexcept;
+  ~UpdateBuffer() noexcept;
+
+  // open() attaches a buffer to `sketch'. `capacity' is rounded up to a
+  // power of 2 and 0 means UPDATE_BUFFER_DEFAULT_CAPACITY. `max_updates' is
+  // the staleness bound and 0 means UPDATE_BUFFER_DEFAULT_MAX_UPDATES.
+  // A sketch with SKETCH_TOP_K is rejected.
+  void open(Sketch *sketch, UInt64 capacity = 0, UInt64 max_updates = 0);
+  // close() flushes and detaches the buffer.
+  void close() noexcept;
+
+  Sketch *sketch() const noexcept {
+    return sketch_;
+  }
+  UInt64 capacity() const noexcept {
+    return capacity_;
+  }
+  UInt64 max_updates() const noexcept {
+    return max_updates_;
+  }
+  // size() returns the number of keys with pending counts.
+  UInt64 size() const noexcept {
+    return size_;
+  }
+  // num_updates() returns the number of updates since the last flush.
+  UInt64 num_updates() const noexcept {
+    return num_updates_;
+  }
+
+  KeyHash hash(const void *key_addr, std::size_t key_size) const noexcept {
+    return sketch_->hash(key_addr, key_size);
+  }
+
+  // get() returns the value in the sketch plus the pending count.
+  UInt64 get(const void *key_addr, std::size_t key_size) const noexcept;
+  void inc(const void *key_addr, std::size_t key_size) noexcept;
+  void add(const void *key_addr, std::size_t key_size, UInt64 value) noexcept;
+
+  // The following overloads take a KeyHash, which must be computed with the
+  // seed of the sketch.
+  UInt64 get(const KeyHash &key_hash) const noexcept;
+  void inc(const KeyHash &key_hash) noexcept;
+  void add(const KeyHash &key_hash, UInt64 value) noexcept;
+
+  // flush() applies all the pending counts to the sketch.
+  void flush() noexcept;
+
+  void swap(UpdateBuffer *buffer) noexcept;
+
+ private:
+  struct Entry;
+
+  Sketch *sketch_;
+  Entry *entries_;
+  UInt64 capacity_;
+  UInt64 max_updates_;
+  UInt64 size_;
+  UInt64 num_updates_;
+
+  inline UInt64 find_(const UInt64 hash_values[2]) const noexcept;
+
+  // Disallows copy and assignment.
+  UpdateBuffer(const UpdateBuffer &);
+  UpdateBuffer &operator=(const UpdateBuffer &);
+};
+
+}  // namespace madoka
+#endif  // __cplusplus
+
+#endif  // MADOKA_UPDATE_BUFFER_H
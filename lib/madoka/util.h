@@ -34,9 +34,12 @@
 #ifdef _MSC_VER
  #ifdef __cplusplus
   #include <intrin.h>
+  #include <xmmintrin.h>
   #ifdef _WIN64
+   #pragma intrinsic(_BitScanForward64)
    #pragma intrinsic(_BitScanReverse64)
   #else  // _WIN64
+   #pragma intrinsic(_BitScanForward)
    #pragma intrinsic(_BitScanReverse)
   #endif  // _WIN64
  #endif  // __cplusplus
@@ -83,9 +86,10 @@ inline void swap(T &lhs, T &rhs) noexcept {
 
 // bit_scan_reverse() returns the index of the most significant 1 bit of
 // `value'. For example, if `value' == 12, the result is 3. Note that if
-// `value' == 0, the result is undefined.
-inline UInt64 bit_scan_reverse(UInt64 value) noexcept {
+// `value' == 0, the result is undefined. Except on MSVC, it is a constant
+// expression and compilers can vectorize loops that call it.
 #ifdef _MSC_VER
+inline UInt64 bit_scan_reverse(UInt64 value) noexcept {
   unsigned long index;
  #ifdef _WIN64
   ::_BitScanReverse64(&index, value);
@@ -98,27 +102,137 @@ inline UInt64 bit_scan_reverse(UInt64 value) noexcept {
   ::_BitScanReverse(&index, static_cast<unsigned long>(value));
   return index;
  #endif  // _WIN64
+}
 #else  // _MSC_VER
- #ifdef __x86_64__
-  UInt64 index;
-  __asm__ ("bsrq %1, %%rax; movq %%rax, %0"
-    : "=r"(index) : "r"(value) : "%rax");
+constexpr UInt64 bit_scan_reverse(UInt64 value) noexcept {
+  return static_cast<UInt64>(63 - ::__builtin_clzll(value));
+}
+#endif  // _MSC_VER
+
+// bit_scan_forward() returns the index of the least significant 1 bit of
+// `value'. For example, if `value' == 12, the result is 2. Note that if
+// `value' == 0, the result is undefined.
+#ifdef _MSC_VER
+inline UInt64 bit_scan_forward(UInt64 value) noexcept {
+  unsigned long index;
+ #ifdef _WIN64
+  ::_BitScanForward64(&index, value);
+  return index;
+ #else  // _WIN64
+  if (static_cast<unsigned long>(value) == 0) {
+    ::_BitScanForward(&index, static_cast<unsigned long>(value >> 32));
+    return index + 32;
+  }
+  ::_BitScanForward(&index, static_cast<unsigned long>(value));
   return index;
- #else  // __x86_64__
-  #ifdef __i386__
-   UInt32 index;
-   if ((value >> 32) != 0) {
-     __asm__ ("bsrl %1, %%eax; movl %%eax, %0"
-       : "=r"(index) : "r"(static_cast<UInt32>(value >> 32)) : "%eax");
-     return index + 32;
-   }
-   __asm__ ("bsrl %1, %%eax; movl %%eax, %0"
-     : "=r"(index) : "r"(static_cast<UInt32>(value)) : "%eax");
-   return index;
-  #else  // __i386__
-   return 63 - ::__builtin_clzll(value);
-  #endif  // __i386__
- #endif  // __x86_64__
+ #endif  // _WIN64
+}
+#else  // _MSC_VER
+constexpr UInt64 bit_scan_forward(UInt64 value) noexcept {
+  return static_cast<UInt64>(::__builtin_ctzll(value));
+}
+#endif  // _MSC_VER
+
+// mul_high() returns the upper 64 bits of the 128-bit product of `x' and
+// `y'.
+inline UInt64 mul_high(UInt64 x, UInt64 y) noexcept {
+#if defined(__SIZEOF_INT128__)
+  return static_cast<UInt64>((static_cast<unsigned __int128>(x) * y) >> 64);
+#elif defined(_MSC_VER) && defined(_WIN64)
+  return ::__umulh(x, y);
+#else  // defined(__SIZEOF_INT128__)
+  const UInt64 x_lo = x & 0xFFFFFFFFULL;
+  const UInt64 x_hi = x >> 32;
+  const UInt64 y_lo = y & 0xFFFFFFFFULL;
+  const UInt64 y_hi = y >> 32;
+  const UInt64 lo_lo = x_lo * y_lo;
+  const UInt64 hi_lo = x_hi * y_lo;
+  const UInt64 lo_hi = x_lo * y_hi;
+  const UInt64 cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFFULL) + lo_hi;
+  return (x_hi * y_hi) + (hi_lo >> 32) + (cross >> 32);
+#endif  // defined(__SIZEOF_INT128__)
+}
+
+// pop_count() returns the number of 1 bits in `value'. It compiles to a
+// single instruction in a function built for a CPU with POPCNT.
+inline UInt64 pop_count(UInt64 value) noexcept {
+#ifdef _MSC_VER
+  value -= (value >> 1) & 0x5555555555555555ULL;
+  value = (value & 0x3333333333333333ULL) +
+      ((value >> 2) & 0x3333333333333333ULL);
+  value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (value * 0x0101010101010101ULL) >> 56;
+#else  // _MSC_VER
+  return static_cast<UInt64>(::__builtin_popcountll(value));
+#endif  // _MSC_VER
+}
+
+// atomic_load() and atomic_compare_exchange() access a unit of a table that
+// other threads may update at the same time. They impose no ordering on
+// other memory accesses. atomic_compare_exchange() replaces `*addr' with
+// `desired' if `*addr' == `*expected' and returns true. Otherwise, it copies
+// `*addr' to `*expected' and returns false.
+template <typename T>
+inline T atomic_load(const T *addr) noexcept {
+#ifdef _MSC_VER
+  return *static_cast<const volatile T *>(addr);
+#else  // _MSC_VER
+  return ::__atomic_load_n(addr, __ATOMIC_RELAXED);
+#endif  // _MSC_VER
+}
+
+#ifdef _MSC_VER
+template <typename T>
+inline bool atomic_compare_exchange_result(T old_value, T *expected) noexcept {
+  if (old_value == *expected) {
+    return true;
+  }
+  *expected = old_value;
+  return false;
+}
+
+inline bool atomic_compare_exchange(UInt8 *addr, UInt8 *expected,
+                                    UInt8 desired) noexcept {
+  return atomic_compare_exchange_result(static_cast<UInt8>(
+      ::_InterlockedCompareExchange8(reinterpret_cast<volatile char *>(addr),
+                                     static_cast<char>(desired),
+                                     static_cast<char>(*expected))),
+      expected);
+}
+
+inline bool atomic_compare_exchange(UInt16 *addr, UInt16 *expected,
+                                    UInt16 desired) noexcept {
+  return atomic_compare_exchange_result(static_cast<UInt16>(
+      ::_InterlockedCompareExchange16(reinterpret_cast<volatile short *>(addr),
+                                      static_cast<short>(desired),
+                                      static_cast<short>(*expected))),
+      expected);
+}
+
+inline bool atomic_compare_exchange(UInt64 *addr, UInt64 *expected,
+                                    UInt64 desired) noexcept {
+  return atomic_compare_exchange_result(static_cast<UInt64>(
+      ::_InterlockedCompareExchange64(
+          reinterpret_cast<volatile __int64 *>(addr),
+          static_cast<__int64>(desired), static_cast<__int64>(*expected))),
+      expected);
+}
+#else  // _MSC_VER
+template <typename T>
+inline bool atomic_compare_exchange(T *addr, T *expected,
+                                    T desired) noexcept {
+  return ::__atomic_compare_exchange_n(addr, expected, desired, true,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+#endif  // _MSC_VER
+
+// prefetch() hints that the cache line which contains `addr' will be
+// accessed soon. Note that prefetch() never faults even if `addr' is invalid.
+inline void prefetch(const void *addr) noexcept {
+#ifdef _MSC_VER
+  ::_mm_prefetch(static_cast<const char *>(addr), _MM_HINT_T0);
+#else  // _MSC_VER
+  ::__builtin_prefetch(addr);
 #endif  // _MSC_VER
 }
 
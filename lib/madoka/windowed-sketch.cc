@@ -0,0 +1,157 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "windowed-sketch.h"
+
+#include <new>
+
+namespace madoka {
+
+WindowedSketch::WindowedSketch() noexcept
+  : slots_(NULL), num_slots_(0), head_(0), time_(0), max_slot_updates_(0),
+    num_slot_updates_(0), clear_offset_(0) {}
+
+WindowedSketch::~WindowedSketch() noexcept {
+  delete [] slots_;
+}
+
+void WindowedSketch::create(UInt64 num_slots, UInt64 width,
+                            UInt64 max_value, int flags, UInt64 seed) {
+  MADOKA_THROW_IF(num_slots < WINDOWED_SKETCH_MIN_NUM_SLOTS);
+  MADOKA_THROW_IF(num_slots > WINDOWED_SKETCH_MAX_NUM_SLOTS);
+  MADOKA_THROW_IF(flags & SKETCH_TOP_K);
+
+  WindowedSketch new_sketch;
+  new_sketch.slots_ = new (std::nothrow) Sketch[num_slots + 1];
+  MADOKA_THROW_IF(new_sketch.slots_ == NULL);
+  new_sketch.num_slots_ = num_slots;
+
+  new_sketch.slots_[0].create(width, max_value, NULL, flags, seed);
+  for (UInt64 i = 1; i <= num_slots; ++i) {
+    new_sketch.slots_[i].create(new_sketch.slots_[0].width(),
+                                new_sketch.slots_[0].max_value(), NULL,
+                                flags, new_sketch.slots_[0].seed());
+  }
+  new_sketch.clear_offset_ = new_sketch.slots_[0].table_size();
+  new_sketch.swap(this);
+}
+
+void WindowedSketch::close() noexcept {
+  WindowedSketch().swap(this);
+}
+
+UInt64 WindowedSketch::get(const KeyHash &key_hash) const noexcept {
+  const UInt64 max_value = this->max_value();
+  UInt64 value = 0;
+  for (UInt64 age = 0; age < num_slots_; ++age) {
+    const UInt64 slot_value = slot(age).get(key_hash);
+    value = ((max_value - value) > slot_value) ?
+        (value + slot_value) : max_value;
+  }
+  return value;
+}
+
+void WindowedSketch::inc(const KeyHash &key_hash) noexcept {
+  update_();
+  slots_[head_].inc(key_hash);
+}
+
+void WindowedSketch::add(const KeyHash &key_hash, UInt64 value) noexcept {
+  update_();
+  slots_[head_].add(key_hash, value);
+}
+
+// rotate() finishes clearing the spare, makes it the current slot, and
+// leaves the oldest slot to be cleared step by step as the next spare.
+void WindowedSketch::rotate() noexcept {
+  Sketch &spare = spare_();
+  if (clear_offset_ < spare.table_size()) {
+    spare.clear(clear_offset_, spare.table_size() - clear_offset_);
+  }
+  head_ = (head_ + 1) % (num_slots_ + 1);
+  clear_offset_ = 0;
+  num_slot_updates_ = 0;
+  ++time_;
+}
+
+void WindowedSketch::advance(UInt64 time) noexcept {
+  if (time <= time_) {
+    return;
+  } else if ((time - time_) >= num_slots_) {
+    clear();
+    time_ = time;
+    return;
+  }
+  while (time_ < time) {
+    rotate();
+  }
+}
+
+void WindowedSketch::clear() noexcept {
+  for (UInt64 i = 0; i <= num_slots_; ++i) {
+    slots_[i].clear();
+  }
+  clear_offset_ = (slots_ != NULL) ? slots_[0].table_size() : 0;
+  num_slot_updates_ = 0;
+}
+
+void WindowedSketch::flatten(Sketch *sketch, const char *path,
+                             int flags) const {
+  MADOKA_THROW_IF(sketch == NULL);
+  MADOKA_THROW_IF(slots_ == NULL);
+
+  Sketch new_sketch;
+  new_sketch.copy(slot(0), path, flags);
+  for (UInt64 age = 1; age < num_slots_; ++age) {
+    new_sketch.merge(slot(age));
+  }
+  new_sketch.swap(sketch);
+}
+
+void WindowedSketch::swap(WindowedSketch *sketch) noexcept {
+  util::swap(slots_, sketch->slots_);
+  util::swap(num_slots_, sketch->num_slots_);
+  util::swap(head_, sketch->head_);
+  util::swap(time_, sketch->time_);
+  util::swap(max_slot_updates_, sketch->max_slot_updates_);
+  util::swap(num_slot_updates_, sketch->num_slot_updates_);
+  util::swap(clear_offset_, sketch->clear_offset_);
+}
+
+// update_() ends the current slot if it is full, and clears a step of the
+// spare, so that the cost of clearing is spread over the updates.
+void WindowedSketch::update_() noexcept {
+  if ((max_slot_updates_ != 0) && (num_slot_updates_ >= max_slot_updates_)) {
+    rotate();
+  }
+  ++num_slot_updates_;
+
+  Sketch &spare = spare_();
+  if (clear_offset_ < spare.table_size()) {
+    spare.clear(clear_offset_, WINDOWED_SKETCH_CLEAR_STEP_SIZE);
+    clear_offset_ += WINDOWED_SKETCH_CLEAR_STEP_SIZE;
+  }
+}
+
+}  // namespace madoka
@@ -0,0 +1,167 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef MADOKA_WINDOWED_SKETCH_H
+#define MADOKA_WINDOWED_SKETCH_H
+
+#include "sketch.h"
+
+#ifdef __cplusplus
+namespace madoka {
+
+const UInt64 WINDOWED_SKETCH_MIN_NUM_SLOTS    = 1;
+const UInt64 WINDOWED_SKETCH_MAX_NUM_SLOTS    = 1024;
+const UInt64 WINDOWED_SKETCH_CLEAR_STEP_SIZE  = 1ULL << 12;
+
+// WindowedSketch counts keys over a sliding window of the last
+// `num_slots' slots. Each slot is an in-memory sketch and all the slots
+// share a seed, so a key is hashed once and its KeyHash is used for every
+// slot. Updates go to the current slot and get() sums the values of the
+// live slots.
+//
+// rotate() starts a new slot and drops the oldest one. The caller decides
+// when a slot ends: advance() rotates to a given time, such as the number
+// of minutes since an epoch, and set_max_slot_updates() rotates after a
+// fixed number of updates.
+//
+// A rotation does not clear the dropped slot at once. The window keeps one
+// spare slot, which is cleared WINDOWED_SKETCH_CLEAR_STEP_SIZE bytes per
+// update, and the dropped slot becomes the next spare. Only when a slot
+// gets fewer updates than the spare needs steps, rotate() clears the rest
+// of the spare itself.
+//
+// A window is not thread-safe.
+class WindowedSketch {
+ public:
+  WindowedSketch() noexcept;
+  ~WindowedSketch() noexcept;
+
+  // create() creates `num_slots' live slots and a spare slot with the same
+  // width, max_value, flags and seed. The time starts at 0. SKETCH_TOP_K is
+  // rejected.
+  void create(UInt64 num_slots, UInt64 width = 0, UInt64 max_value = 0,
+              int flags = 0, UInt64 seed = 0);
+  void close() noexcept;
+
+  UInt64 num_slots() const noexcept {
+    return num_slots_;
+  }
+  UInt64 width() const noexcept {
+    return (slots_ != NULL) ? slots_[0].width() : 0;
+  }
+  UInt64 max_value() const noexcept {
+    return (slots_ != NULL) ? slots_[0].max_value() : 0;
+  }
+  UInt64 seed() const noexcept {
+    return (slots_ != NULL) ? slots_[0].seed() : 0;
+  }
+
+  // time() returns the time of the current slot, which is incremented by
+  // each rotation.
+  UInt64 time() const noexcept {
+    return time_;
+  }
+
+  // max_slot_updates() returns the number of updates after which the
+  // current slot ends, and 0 means that only rotate() and advance() end a
+  // slot.
+  UInt64 max_slot_updates() const noexcept {
+    return max_slot_updates_;
+  }
+  void set_max_slot_updates(UInt64 max_slot_updates) noexcept {
+    max_slot_updates_ = max_slot_updates;
+  }
+  // num_slot_updates() returns the number of updates of the current slot.
+  UInt64 num_slot_updates() const noexcept {
+    return num_slot_updates_;
+  }
+
+  // slot() returns a live slot. An age of 0 means the current slot and an
+  // age of num_slots() - 1 means the oldest one.
+  const Sketch &slot(UInt64 age) const noexcept {
+    return slots_[slot_id_(age)];
+  }
+
+  KeyHash hash(const void *key_addr, std::size_t key_size) const noexcept {
+    return slots_[0].hash(key_addr, key_size);
+  }
+
+  // get() returns the sum of the values in the live slots, which is
+  // saturated at max_value().
+  UInt64 get(const void *key_addr, std::size_t key_size) const noexcept {
+    return get(hash(key_addr, key_size));
+  }
+  void inc(const void *key_addr, std::size_t key_size) noexcept {
+    inc(hash(key_addr, key_size));
+  }
+  void add(const void *key_addr, std::size_t key_size, UInt64 value) noexcept {
+    add(hash(key_addr, key_size), value);
+  }
+
+  UInt64 get(const KeyHash &key_hash) const noexcept;
+  void inc(const KeyHash &key_hash) noexcept;
+  void add(const KeyHash &key_hash, UInt64 value) noexcept;
+
+  // rotate() ends the current slot. advance() rotates until time() reaches
+  // `time' and does nothing if `time' is not later than time(). Rotations
+  // beyond num_slots() only clear the window.
+  void rotate() noexcept;
+  void advance(UInt64 time) noexcept;
+
+  // clear() clears all the slots at once.
+  void clear() noexcept;
+
+  // flatten() stores the sum of the live slots in `sketch' by copying the
+  // current slot and merging the others into it.
+  void flatten(Sketch *sketch, const char *path = NULL, int flags = 0) const;
+
+  void swap(WindowedSketch *sketch) noexcept;
+
+ private:
+  Sketch *slots_;
+  UInt64 num_slots_;
+  UInt64 head_;
+  UInt64 time_;
+  UInt64 max_slot_updates_;
+  UInt64 num_slot_updates_;
+  UInt64 clear_offset_;
+
+  UInt64 slot_id_(UInt64 age) const noexcept {
+    return (head_ + (num_slots_ + 1) - age) % (num_slots_ + 1);
+  }
+  Sketch &spare_() noexcept {
+    return slots_[slot_id_(num_slots_)];
+  }
+
+  inline void update_() noexcept;
+
+  // Disallows copy and assignment.
+  WindowedSketch(const WindowedSketch &);
+  WindowedSketch &operator=(const WindowedSketch &);
+};
+
+}  // namespace madoka
+#endif  // __cplusplus
+
+#endif  // MADOKA_WINDOWED_SKETCH_H
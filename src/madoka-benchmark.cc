@@ -67,6 +67,8 @@ double WIDTH_FACTOR = 1.4142135623730951;
 
 int FILE_FLAGS = 0;
 
+int COMPARED_FLAGS = 0;
+
 void print_version() {
   std::cout << "Version: " << PACKAGE_STRING << "\n"
             << "Description: "
@@ -97,6 +99,8 @@ void print_help(const char *name) {
             << "specify the factor of width expansion\n"
             << "  -i, --input=[PATH]      specify the path of a keyset file\n"
             << "  -o, --output=[PATH]     specify the path of sketches\n"
+            << "  -H, --hot-tier          "
+            << "compare the time of inc() with and without a HotTier\n"
             << "  -v, --version           print the version\n"
             << "  -h, --help              print this message\n"
             << "\n"
@@ -126,13 +130,14 @@ void parse_args(int argc, char *argv[]) {
     { "width-factor", 1, NULL, 'e' },
     { "input", 1, NULL, 'i' },
     { "output", 1, NULL, 'o' },
+    { "hot-tier", 0, NULL, 'H' },
     { "version", 0, NULL, 'v' },
     { "help", 0, NULL, 'h' },
     { NULL, 0, NULL, 0 }
   };
 
   int option_label = -1;
-  while ((option_label = ::getopt_long(argc, argv, "l:L:k:t:w:W:s:r:e:i:o:vh",
+  while ((option_label = ::getopt_long(argc, argv, "l:L:k:t:w:W:s:r:e:i:o:Hvh",
                                        long_options, NULL)) != -1) {
     switch (option_label) {
       case 'l': {
@@ -179,6 +184,10 @@ void parse_args(int argc, char *argv[]) {
         SKETCH_PATH = ::optarg;
         break;
       }
+      case 'H': {
+        COMPARED_FLAGS |= madoka::SKETCH_HOT_TIER;
+        break;
+      }
       case 'v': {
         print_version();
         std::exit(0);
@@ -451,6 +460,55 @@ void benchmark_counter(const std::vector<std::string> &keys,
       "---------+-------+--------+-------+-------+-------+-------\n");
 }
 
+// time_inc() returns the time of inc() per key in nanoseconds.
+double time_inc(const std::vector<std::string> &keys,
+                const std::vector<madoka::UInt64> &ids, madoka::UInt64 width,
+                madoka::UInt64 max_value, int flags) {
+  madoka::Sketch sketch;
+  sketch.create(width, max_value, SKETCH_PATH, FILE_FLAGS | flags);
+  madoka::Timer timer;
+  for (std::size_t j = 0; j < ids.size(); ++j) {
+    sketch.inc(keys[ids[j]].c_str(), keys[ids[j]].length());
+  }
+  return 1000000000.0 * timer.elapsed() / ids.size();
+}
+
+// benchmark_flags() compares the time of inc() with and without `flags'.
+// The sketches take turns in each trial and the fastest trial is printed,
+// so that a drift of the machine does not favor either of them.
+void benchmark_flags(const std::vector<std::string> &keys,
+                     const std::vector<madoka::UInt64> &ids, int flags) {
+  std::printf(
+      "---------+-----------------+-----------------\n"
+      "    width     exact inc [ns]   approx inc [ns]\n"
+      "             plain  flagged     plain  flagged\n"
+      "---------+--------+--------+--------+--------\n");
+
+  const madoka::UInt64 MAX_VALUES[] = { 65535, 0 };
+  madoka::UInt64 width = MIN_WIDTH;
+  for (int i = 0; width <= MAX_WIDTH; ++i) {
+    double times[4];
+    for (madoka::UInt64 trial_id = 0; trial_id < NUM_TRIALS; ++trial_id) {
+      for (int j = 0; j < 4; ++j) {
+        const double time = time_inc(keys, ids, width, MAX_VALUES[j / 2],
+                                     (j % 2) ? flags : 0);
+        if ((trial_id == 0) || (time < times[j])) {
+          times[j] = time;
+        }
+      }
+    }
+    std::printf("%9lu %8.2lf %8.2lf %8.2lf %8.2lf\n",
+                static_cast<unsigned long>(width),
+                times[0], times[1], times[2], times[3]);
+
+    width = static_cast<madoka::UInt64>(
+        MIN_WIDTH * std::pow(WIDTH_FACTOR, i + 1));
+  }
+
+  std::printf(
+      "---------+--------+--------+--------+--------\n");
+}
+
 void benchmark() {
   std::vector<std::string> keys;
   std::vector<madoka::UInt64> freqs;
@@ -485,7 +543,10 @@ void benchmark() {
   std::cerr << "WIDTH: " << MIN_WIDTH << " - " << MAX_WIDTH
             << " (x " << WIDTH_FACTOR << ")" << std::endl;
 
-  if (THRESHOLD != 0) {
+  if (COMPARED_FLAGS & madoka::SKETCH_HOT_TIER) {
+    std::cerr << "FLAGS: SKETCH_HOT_TIER" << std::endl;
+    benchmark_flags(keys, ids, madoka::SKETCH_HOT_TIER);
+  } else if (THRESHOLD != 0) {
     std::cerr << "THRESHOLD: " << THRESHOLD << std::endl;
     benchmark_filter(keys, freqs, ids);
   } else {
@@ -25,10 +25,14 @@
 #include <getopt.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <cmath>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <madoka.h>
 
@@ -42,6 +46,9 @@ enum Mode {
   MODE_SET,
   MODE_INC,
   MODE_ADD,
+  MODE_TOP,
+  MODE_MERGE,
+  MODE_COSINE,
   MODE_LIST
 };
 
@@ -52,8 +59,13 @@ const char *SKETCH_PATH = NULL;
 madoka::UInt64 WIDTH = 0;
 madoka::UInt64 MAX_VALUE = 0;
 madoka::UInt64 SEED = 0;
+madoka::UInt64 NUM_TOP_KEYS = 0;
+madoka::UInt64 NUM_THREADS = 1;
 
 bool TRUNCATE_FLAG = false;
+bool BLOCKED_FLAG = false;
+bool FAST_RANGE_FLAG = false;
+bool TOP_K_FLAG = false;
 bool PRELOAD_FLAG = false;
 
 madoka::UInt64 to_uint64(const char *arg, madoka::UInt64 min_value = 0,
@@ -67,18 +79,78 @@ madoka::UInt64 to_uint64(const char *arg, madoka::UInt64 min_value = 0,
   return static_cast<madoka::UInt64>(value);
 }
 
+// KeyBatch reads lines in batches, so that the batch interface of Sketch can
+// overlap cache misses of different keys.
+class KeyBatch {
+ public:
+  static const std::size_t MAX_SIZE = 1024;
+
+  KeyBatch()
+    : lines_(MAX_SIZE), key_addrs_(MAX_SIZE), key_sizes_(MAX_SIZE),
+      values_(MAX_SIZE), size_(0) {}
+
+  // read() reads up to MAX_SIZE lines from `stream'. If `has_values' is
+  // true, each line must consist of a key and a value separated by a tab.
+  std::size_t read(std::istream *stream, bool has_values) {
+    size_ = 0;
+    while ((size_ < MAX_SIZE) && std::getline(*stream, lines_[size_])) {
+      const std::string &line = lines_[size_];
+      std::size_t key_size = line.length();
+      if (has_values) {
+        const std::string::size_type delim_pos = line.find_last_of('\t');
+        MADOKA_THROW_IF(delim_pos == std::string::npos);
+        values_[size_] = to_uint64(line.c_str() + delim_pos + 1);
+        key_size = delim_pos;
+      }
+      key_addrs_[size_] = line.c_str();
+      key_sizes_[size_] = key_size;
+      ++size_;
+    }
+    return size_;
+  }
+
+  const std::string &line(std::size_t i) const {
+    return lines_[i];
+  }
+  const void * const *key_addrs() const {
+    return key_addrs_.data();
+  }
+  const std::size_t *key_sizes() const {
+    return key_sizes_.data();
+  }
+  madoka::UInt64 *values() {
+    return values_.data();
+  }
+  std::size_t size() const {
+    return size_;
+  }
+
+ private:
+  std::vector<std::string> lines_;
+  std::vector<const void *> key_addrs_;
+  std::vector<std::size_t> key_sizes_;
+  std::vector<madoka::UInt64> values_;
+  std::size_t size_;
+};
+
 int mode_create_main(int, char *[]) {
   madoka::Sketch sketch;
   sketch.create(WIDTH, MAX_VALUE, SKETCH_PATH,
-                TRUNCATE_FLAG ? madoka::FILE_TRUNCATE : 0, SEED);
+                (TRUNCATE_FLAG ? madoka::FILE_TRUNCATE : 0) |
+                (BLOCKED_FLAG ? madoka::SKETCH_BLOCKED_LAYOUT : 0) |
+                (FAST_RANGE_FLAG ? madoka::SKETCH_FAST_RANGE : 0) |
+                (TOP_K_FLAG ? madoka::SKETCH_TOP_K : 0), SEED);
   return 0;
 }
 
 void mode_get_sub(const madoka::Sketch &sketch, std::istream *stream) {
-  std::string key;
-  while (std::getline(*stream, key)) {
-    const madoka::UInt64 value = sketch.get(key.c_str(), key.length());
-    std::cout << key << '\t' << value << '\n';
+  KeyBatch batch;
+  while (batch.read(stream, false) != 0) {
+    sketch.get_batch(batch.key_addrs(), batch.key_sizes(), batch.size(),
+                     batch.values());
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      std::cout << batch.line(i) << '\t' << batch.values()[i] << '\n';
+    }
   }
 }
 
@@ -98,12 +170,10 @@ int mode_get_main(int argc, char *argv[]) {
 }
 
 void mode_set_sub(std::istream *stream, madoka::Sketch *sketch) {
-  std::string key;
-  while (std::getline(*stream, key)) {
-    const std::string::size_type delim_pos = key.find_last_of('\t');
-    MADOKA_THROW_IF(delim_pos == std::string::npos);
-    const madoka::UInt64 value = to_uint64(key.c_str() + delim_pos + 1);
-    sketch->set(key.c_str(), delim_pos, value);
+  KeyBatch batch;
+  while (batch.read(stream, true) != 0) {
+    sketch->set_batch(batch.key_addrs(), batch.key_sizes(), batch.size(),
+                      batch.values());
   }
 }
 
@@ -122,9 +192,9 @@ int mode_set_main(int argc, char *argv[]) {
 }
 
 void mode_inc_sub(std::istream *stream, madoka::Sketch *sketch) {
-  std::string key;
-  while (std::getline(*stream, key)) {
-    sketch->inc(key.c_str(), key.length());
+  KeyBatch batch;
+  while (batch.read(stream, false) != 0) {
+    sketch->inc_batch(batch.key_addrs(), batch.key_sizes(), batch.size());
   }
 }
 
@@ -143,12 +213,10 @@ int mode_inc_main(int argc, char *argv[]) {
 }
 
 void mode_add_sub(std::istream *stream, madoka::Sketch *sketch) {
-  std::string key;
-  while (std::getline(*stream, key)) {
-    const std::string::size_type delim_pos = key.find_last_of('\t');
-    MADOKA_THROW_IF(delim_pos == std::string::npos);
-    const madoka::UInt64 value = to_uint64(key.c_str() + delim_pos + 1);
-    sketch->add(key.c_str(), delim_pos, value);
+  KeyBatch batch;
+  while (batch.read(stream, true) != 0) {
+    sketch->add_batch(batch.key_addrs(), batch.key_sizes(), batch.size(),
+                      batch.values());
   }
 }
 
@@ -166,19 +234,113 @@ int mode_add_main(int argc, char *argv[]) {
   return 0;
 }
 
+int mode_top_main(int, char *[]) {
+  madoka::Sketch sketch;
+  sketch.open(SKETCH_PATH, madoka::FILE_READONLY);
+  MADOKA_THROW_IF(!(sketch.flags() & madoka::SKETCH_TOP_K));
+  std::vector<madoka::TopKey> top_keys(
+      static_cast<std::size_t>(NUM_TOP_KEYS));
+  const std::size_t num_keys =
+      sketch.top_keys(top_keys.data(), top_keys.size());
+  for (std::size_t i = 0; i < num_keys; ++i) {
+    std::cout.write(static_cast<const char *>(top_keys[i].key_addr),
+                    top_keys[i].key_size);
+    std::cout << '\t' << top_keys[i].value << '\n';
+  }
+  return 0;
+}
+
+// run_on_threads() is an executor that runs tasks on NUM_THREADS threads.
+void run_on_threads(madoka::SketchTask task, void *arg,
+                    madoka::UInt64 num_tasks) {
+  std::atomic<madoka::UInt64> next_task_id(0);
+  std::vector<std::thread> threads;
+  for (madoka::UInt64 i = 0; (i < NUM_THREADS) && (i < num_tasks); ++i) {
+    threads.push_back(std::thread([&]() {
+      for (madoka::UInt64 task_id = next_task_id++; task_id < num_tasks;
+           task_id = next_task_id++) {
+        task(arg, task_id);
+      }
+    }));
+  }
+  for (std::size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+}
+
+int mode_merge_main(int argc, char *argv[]) {
+  MADOKA_THROW_IF(::optind == argc);
+  // Each thread merges a group of sources into its own sketch.
+  madoka::merge_sketch_files(SKETCH_PATH, argv + ::optind,
+                             static_cast<std::size_t>(argc - ::optind),
+                             madoka::SKETCH_SUM_MERGE,
+                             TRUNCATE_FLAG ? madoka::FILE_TRUNCATE : 0,
+                             NUM_THREADS * 2,
+                             (NUM_THREADS > 1) ? run_on_threads : NULL);
+  return 0;
+}
+
+int mode_cosine_main(int argc, char *argv[]) {
+  MADOKA_THROW_IF(::optind == argc);
+  std::vector<const char *> paths(1, SKETCH_PATH);
+  paths.insert(paths.end(), argv + ::optind, argv + argc);
+
+  // Approx sketches draw random numbers in decoding, so sketches are opened
+  // with FILE_PRIVATE instead of FILE_READONLY.
+  std::vector<madoka::Sketch> sketches(paths.size());
+  std::vector<const madoka::Sketch *> sketch_ptrs(paths.size());
+  for (std::size_t i = 0; i < paths.size(); ++i) {
+    sketches[i].open(paths[i], madoka::FILE_PRIVATE);
+    sketch_ptrs[i] = &sketches[i];
+  }
+  if (NUM_THREADS > 1) {
+    sketches[0].set_executor(run_on_threads);
+  }
+
+  const std::size_t num_sketches = paths.size();
+  std::vector<double> inner_products(num_sketches * num_sketches);
+  std::vector<double> square_lengths(num_sketches * num_sketches);
+  madoka::Sketch::inner_products(sketch_ptrs.data(), num_sketches,
+                                 inner_products.data(),
+                                 square_lengths.data());
+  for (std::size_t i = 0; i < num_sketches; ++i) {
+    for (std::size_t j = i + 1; j < num_sketches; ++j) {
+      const double length =
+          std::sqrt(square_lengths[(i * num_sketches) + j]) *
+          std::sqrt(square_lengths[(j * num_sketches) + i]);
+      const double cosine = (length != 0.0) ?
+          (inner_products[(i * num_sketches) + j] / length) : 0.0;
+      std::cout << paths[i] << '\t' << paths[j] << '\t' << cosine << '\n';
+    }
+  }
+  return 0;
+}
+
 int mode_list_main(int, char *[]) {
   madoka::Sketch sketch;
   sketch.open(SKETCH_PATH, madoka::FILE_READONLY);
   std::cout << "Path: " << SKETCH_PATH << std::endl;
+  const bool fast_range = (sketch.flags() & madoka::SKETCH_FAST_RANGE) != 0;
   std::cout << "Width: " << sketch.width() << " "
-            << ((sketch.width_mask() != 0) ? "(FAST)" : "(SLOW)") << std::endl;
+            << (((sketch.width_mask() != 0) || fast_range) ?
+                "(FAST)" : "(SLOW)") << std::endl;
   std::cout << "Depth: " << sketch.depth() << std::endl;
   std::cout << "MaxValue: " << sketch.max_value() << std::endl;
   std::cout << "Seed: " << sketch.seed() << std::endl;
   std::cout << "FileSize: " << sketch.file_size() << std::endl;
+  std::cout << "Format: " << sketch.version() << std::endl;
   std::cout << "Mode: "
             << ((sketch.mode() == madoka::SKETCH_EXACT_MODE) ?
                 "EXACT_MODE" : "APPROX_MODE") << std::endl;
+  std::cout << "Layout: "
+            << ((sketch.flags() & madoka::SKETCH_BLOCKED_LAYOUT) ?
+                "BLOCKED" : "ROW") << std::endl;
+  std::cout << "Mapping: "
+            << (fast_range ? "FAST_RANGE" :
+                ((sketch.width_mask() != 0) ? "MASK" : "MODULO")) << std::endl;
+  std::cout << "TopK: "
+            << ((sketch.flags() & madoka::SKETCH_TOP_K) ? "ON" : "OFF")
+            << std::endl;
   return 0;
 }
 
@@ -202,12 +364,24 @@ void print_help(const char *name) {
             << "specify the seed of the new sketch\n"
             << "    -t, --truncate       "
             << "force creation when the sketch already exists\n"
+            << "    -b, --blocked        "
+            << "put the cells of each key into one cache line\n"
+            << "    -r, --fast-range     "
+            << "map keys to cells without division\n"
+            << "    -k, --top-k          "
+            << "track the keys with the largest values\n"
             << "  -g, --get      print given keys with their values\n"
             << "  -s, --set      set given key-value pairs\n"
             << "  -i, --inc      increment values of given keys\n"
             << "  -a, --add      add given values to given keys\n"
             << "    -p, --preload        "
             << "preload the whole sketch\n"
+            << "  -T, --top=[N]  print the top N keys with their values\n"
+            << "  -M, --merge    merge given sketches into a new sketch\n"
+            << "  -C, --cosine   "
+            << "print the cosine similarity of each pair of sketches\n"
+            << "    -j, --threads=[N]    "
+            << "merge or compare sketches in N threads\n"
             << "  -l, --list     list information of a sketch\n"
             << "  -v, --version  print the version\n"
             << "  -h, --help     print this message\n"
@@ -225,11 +399,18 @@ int main(int argc, char *argv[]) try {
       { "max-value", 1, NULL, 'm' },
       { "seed", 1, NULL, 'S' },
       { "truncate", 1, NULL, 't' },
+      { "blocked", 0, NULL, 'b' },
+      { "fast-range", 0, NULL, 'r' },
+      { "top-k", 0, NULL, 'k' },
     { "get", 0, NULL, 'g' },
     { "set", 0, NULL, 's' },
     { "inc", 0, NULL, 'i' },
     { "add", 0, NULL, 'a' },
       { "preload", 0, NULL, 'p' },
+    { "top", 1, NULL, 'T' },
+    { "merge", 0, NULL, 'M' },
+    { "cosine", 0, NULL, 'C' },
+      { "threads", 1, NULL, 'j' },
     { "list", 0, NULL, 'l' },
     { "version", 0, NULL, 'v' },
     { "help", 0, NULL, 'h' },
@@ -237,7 +418,7 @@ int main(int argc, char *argv[]) try {
   };
 
   int option_label;
-  while ((option_label = ::getopt_long(argc, argv, "cw:m:S:tgsiaplvh",
+  while ((option_label = ::getopt_long(argc, argv, "cw:m:S:tbrkgsiapT:MCj:lvh",
                                        long_options, NULL)) != -1) {
     switch (option_label) {
       case 'c': {
@@ -260,6 +441,18 @@ int main(int argc, char *argv[]) try {
         TRUNCATE_FLAG = true;
         break;
       }
+      case 'b': {
+        BLOCKED_FLAG = true;
+        break;
+      }
+      case 'r': {
+        FAST_RANGE_FLAG = true;
+        break;
+      }
+      case 'k': {
+        TOP_K_FLAG = true;
+        break;
+      }
       case 'g': {
         MODE = MODE_GET;
         break;
@@ -280,6 +473,23 @@ int main(int argc, char *argv[]) try {
         PRELOAD_FLAG = true;
         break;
       }
+      case 'T': {
+        MODE = MODE_TOP;
+        NUM_TOP_KEYS = to_uint64(::optarg, 1, madoka::TOP_K_SIZE);
+        break;
+      }
+      case 'M': {
+        MODE = MODE_MERGE;
+        break;
+      }
+      case 'C': {
+        MODE = MODE_COSINE;
+        break;
+      }
+      case 'j': {
+        NUM_THREADS = to_uint64(::optarg, 1, 1024);
+        break;
+      }
       case 'l': {
         MODE = MODE_LIST;
         break;
@@ -325,6 +535,15 @@ int main(int argc, char *argv[]) try {
     case MODE_ADD: {
       return mode_add_main(argc, argv);
     }
+    case MODE_TOP: {
+      return mode_top_main(argc, argv);
+    }
+    case MODE_MERGE: {
+      return mode_merge_main(argc, argv);
+    }
+    case MODE_COSINE: {
+      return mode_cosine_main(argc, argv);
+    }
     case MODE_LIST: {
       return mode_list_main(argc, argv);
     }
@@ -22,9 +22,11 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
 // THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <cmath>
 #include <cstdlib>
 #include <iomanip>
 #include <iostream>
+#include <vector>
 
 #include <madoka/approx.h>
 #include <madoka/exception.h>
@@ -36,7 +38,23 @@ int main() try {
     MADOKA_THROW_IF(value > madoka::APPROX_MAX_VALUE);
     MADOKA_THROW_IF(value < approx);
     MADOKA_THROW_IF(madoka::Approx::encode(value) != approx);
+
+    const madoka::UInt64 midpoint = madoka::Approx::decode_midpoint(approx);
+    MADOKA_THROW_IF(midpoint < value);
+    MADOKA_THROW_IF(madoka::Approx::encode(midpoint) != approx);
+  }
+
+  std::vector<madoka::UInt64> approxes(madoka::APPROX_MASK + 1);
+  std::vector<madoka::UInt64> values(approxes.size());
+  for (std::size_t i = 0; i < approxes.size(); ++i) {
+    approxes[i] = i;
+  }
+  madoka::Approx::decode_n(&approxes[0], approxes.size(), &values[0]);
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    MADOKA_THROW_IF(values[i] != madoka::Approx::decode(approxes[i]));
   }
+  madoka::Approx::encode_n(&values[0], values.size(), &values[0]);
+  MADOKA_THROW_IF(values != approxes);
 
   madoka::Random random;
   for (madoka::UInt64 i = 0; i < (1ULL << 16); ++i) {
@@ -77,6 +95,63 @@ int main() try {
     std::cout << std::endl;
   }
 
+  MADOKA_THROW_IF(madoka::Approx::add(12345, 0, &random) != 12345);
+  MADOKA_THROW_IF(madoka::Approx::add(12345, 100, &random) != 12445);
+  MADOKA_THROW_IF(madoka::Approx::add(madoka::APPROX_MASK, 100, &random) !=
+                  madoka::APPROX_MASK);
+  MADOKA_THROW_IF(madoka::Approx::decode(madoka::Approx::add(
+      0, madoka::APPROX_MAX_VALUE, &random)) <
+      (madoka::APPROX_MAX_VALUE * 0.975));
+
+  for (madoka::UInt64 count = 1 << 15; count <= (1 << 23); count <<= 1) {
+    std::cout << "info: " << std::setw(7) << count << ':' << std::flush;
+    for (int i = 0; i < 8; ++i) {
+      madoka::UInt64 approx = 0;
+      for (madoka::UInt64 j = 0; j < 4096; ++j) {
+        approx = madoka::Approx::add(approx, count / 4096, &random);
+      }
+      const madoka::UInt64 value = madoka::Approx::decode(approx);
+      std::cout << ' ' << std::setw(7) << std::setprecision(5)
+                << (static_cast<double>(value) / count) << std::flush;
+      MADOKA_THROW_IF(value < (count * 0.975));
+      MADOKA_THROW_IF(value > (count * 1.025));
+    }
+    std::cout << std::endl;
+  }
+
+  // add() spreads its results as much as the same number of inc() calls.
+  const madoka::UInt64 NUM_TRIALS = 256;
+  const madoka::UInt64 STARTS[] = { 100000, 1000000 };
+  for (std::size_t i = 0; i < (sizeof(STARTS) / sizeof(STARTS[0])); ++i) {
+    const madoka::UInt64 count = 100000;
+    double sums[2][2] = { { 0.0, 0.0 }, { 0.0, 0.0 } };
+    for (madoka::UInt64 j = 0; j < NUM_TRIALS; ++j) {
+      const madoka::UInt64 start = madoka::Approx::encode(STARTS[i]);
+      madoka::UInt64 approxes[2] = {
+        madoka::Approx::add(start, count, &random), start
+      };
+      for (madoka::UInt64 k = 0; k < count; ++k) {
+        approxes[1] = madoka::Approx::inc(approxes[1], &random);
+      }
+      for (int k = 0; k < 2; ++k) {
+        const double value =
+            static_cast<double>(madoka::Approx::decode(approxes[k]));
+        sums[k][0] += value;
+        sums[k][1] += value * value;
+      }
+    }
+    double deviations[2];
+    for (int k = 0; k < 2; ++k) {
+      const double mean = sums[k][0] / NUM_TRIALS;
+      deviations[k] = std::sqrt((sums[k][1] / NUM_TRIALS) - (mean * mean));
+    }
+    std::cout << "info: " << STARTS[i] << " + " << count
+              << ": deviation = " << deviations[0] << " (add), "
+              << deviations[1] << " (inc)" << std::endl;
+    MADOKA_THROW_IF(deviations[0] < (deviations[1] * 0.75));
+    MADOKA_THROW_IF(deviations[0] > (deviations[1] * 1.25));
+  }
+
   return 0;
 } catch (const madoka::Exception &ex) {
   std::cerr << "error: " << ex.what() << std::endl;
@@ -24,6 +24,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <madoka.h>
 
@@ -51,6 +52,7 @@ int main(void) {
   assert(madoka_get_width(sketch) == 100);
   assert(madoka_get_depth(sketch) == 3);
   assert(madoka_get_max_value(sketch) == 3);
+  assert(madoka_get_version(sketch) == 1);
 
   madoka_set(sketch, "banana", 6, 2);
   assert(madoka_get(sketch, "banana", 6) == 2);
@@ -63,6 +65,41 @@ int main(void) {
   assert(madoka_add(sketch, "orange", 6, 2) == 2);
   assert(madoka_add(sketch, "orange", 6, 100) == 3);
 
+  {
+    const void *key_addrs[3] = { "banana", "apple", "orange" };
+    size_t key_sizes[3] = { 6, 5, 6 };
+    madoka_uint64 values[3];
+
+    madoka_get_batch(sketch, key_addrs, key_sizes, 3, values);
+    assert(values[0] == 2);
+    assert(values[1] == 3);
+    assert(values[2] == 3);
+
+    key_addrs[0] = "grape";
+    key_sizes[0] = 5;
+    madoka_inc_batch(sketch, key_addrs, key_sizes, 1, values);
+    assert(values[0] == 1);
+    values[0] = 1;
+    madoka_add_batch(sketch, key_addrs, key_sizes, 1, values, values);
+    assert(values[0] == 2);
+    values[0] = 3;
+    madoka_set_batch(sketch, key_addrs, key_sizes, 1, values);
+    assert(madoka_get(sketch, "grape", 5) == 3);
+    assert(madoka_get_decoded(sketch, "grape", 5,
+                              MADOKA_SKETCH_LOWER_DECODE) == 3);
+  }
+
+  {
+    madoka_key_hash key_hash;
+    madoka_hash_key(sketch, "melon", 5, &key_hash);
+    assert(key_hash.seed == madoka_get_seed(sketch));
+    assert(madoka_inc_hashed(sketch, &key_hash) == 1);
+    assert(madoka_add_hashed(sketch, &key_hash, 1) == 2);
+    madoka_set_hashed(sketch, &key_hash, 3);
+    assert(madoka_get_hashed(sketch, &key_hash) == 3);
+    assert(madoka_get(sketch, "melon", 5) == 3);
+  }
+
   madoka_close(sketch);
 
   assert(madoka_open(PATH_2, 0, &what) == NULL);
@@ -85,12 +122,72 @@ int main(void) {
   assert(madoka_get(sketch, "apple", 5) == 3);
   assert(madoka_get(sketch, "orange", 6) == 3);
 
+  {
+    madoka_sketch *merged = madoka_create(100, 3, NULL, 0, 0, &what);
+    assert(merged != NULL);
+    madoka_set(merged, "banana", 6, 3);
+    madoka_set(merged, "apple", 5, 1);
+
+    assert(madoka_merge_with_mode(merged, sketch, MADOKA_SKETCH_MIN_MERGE,
+                                  NULL, NULL, &what) == 0);
+    assert(madoka_get(merged, "banana", 6) == 2);
+    assert(madoka_get(merged, "apple", 5) == 1);
+    assert(madoka_get(merged, "orange", 6) == 0);
+
+    assert(madoka_merge_with_mode(merged, sketch, MADOKA_SKETCH_MAX_MERGE,
+                                  NULL, NULL, &what) == 0);
+    assert(madoka_get(merged, "banana", 6) == 2);
+    assert(madoka_get(merged, "apple", 5) == 3);
+    assert(madoka_get(merged, "orange", 6) == 3);
+
+    assert(madoka_merge_with_mode(merged, sketch,
+                                  (madoka_sketch_merge_mode)-1,
+                                  NULL, NULL, &what) == -1);
+    printf("log: %s:%d: %s\n", __FILE__, __LINE__, what);
+
+    {
+      const madoka_sketch *sketches[2];
+      double inner_products[4];
+      double square_lengths[4];
+      double inner_product;
+      double lhs_square_length;
+      double rhs_square_length;
+      sketches[0] = sketch;
+      sketches[1] = merged;
+      assert(madoka_inner_products(sketches, 2, inner_products,
+                                   square_lengths, &what) == 0);
+      assert(madoka_inner_product(sketch, merged, &inner_product,
+                                  &lhs_square_length, &rhs_square_length,
+                                  &what) == 0);
+      assert(inner_products[1] == inner_product);
+      assert(inner_products[2] == inner_product);
+      assert(square_lengths[1] == lhs_square_length);
+      assert(square_lengths[2] == rhs_square_length);
+      assert(inner_products[0] == inner_product);
+
+      assert(madoka_inner_products(NULL, 2, inner_products, NULL,
+                                   &what) == -1);
+      printf("log: %s:%d: %s\n", __FILE__, __LINE__, what);
+    }
+    madoka_close(merged);
+  }
+
   madoka_filter(sketch, divide_by_2);
 
   assert(madoka_get(sketch, "banana", 6) == 1);
   assert(madoka_get(sketch, "apple", 5) == 1);
   assert(madoka_get(sketch, "orange", 6) == 1);
 
+  assert(madoka_filter_op(sketch, MADOKA_SKETCH_SHIFT_FILTER, 1, &what) == 0);
+
+  assert(madoka_get(sketch, "banana", 6) == 0);
+  assert(madoka_get(sketch, "apple", 5) == 0);
+  assert(madoka_get(sketch, "orange", 6) == 0);
+
+  assert(madoka_filter_op(sketch, MADOKA_SKETCH_DECAY_FILTER, 1 << 20,
+                          &what) == -1);
+  printf("log: %s:%d: %s\n", __FILE__, __LINE__, what);
+
   madoka_clear(sketch);
 
   assert(madoka_get(sketch, "banana", 6) == 0);
@@ -135,6 +232,28 @@ int main(void) {
   assert(madoka_shrink(sketch, 17, 1, NULL, NULL, 0, &what) == NULL);
   printf("log: %s:%d: %s\n", __FILE__, __LINE__, what);
 
+  madoka_clear_range(sketch, 0, madoka_get_table_size(sketch));
+  assert(madoka_get(sketch, "banana", 6) == 0);
+  assert(madoka_get(sketch, "apple", 5) == 0);
+
+  madoka_close(sketch);
+
+  sketch = madoka_create(100, 15, NULL, MADOKA_SKETCH_TOP_K, 0, &what);
+  assert(sketch != NULL);
+  assert(madoka_get_top_keys(sketch, NULL, 0) == 0);
+  madoka_add(sketch, "banana", 6, 2);
+  madoka_add(sketch, "apple", 5, 5);
+  madoka_inc(sketch, "orange", 6);
+  {
+    madoka_top_key top_keys[2];
+    assert(madoka_get_top_keys(sketch, top_keys, 2) == 2);
+    assert(top_keys[0].key_size == 5);
+    assert(memcmp(top_keys[0].key_addr, "apple", 5) == 0);
+    assert(top_keys[0].value == 5);
+    assert(top_keys[1].key_size == 6);
+    assert(memcmp(top_keys[1].key_addr, "banana", 6) == 0);
+    assert(top_keys[1].value == 2);
+  }
   madoka_close(sketch);
 
   assert(remove(PATH_1) == 0);
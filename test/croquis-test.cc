@@ -23,6 +23,7 @@
 // THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <iomanip>
 #include <iostream>
@@ -71,7 +72,7 @@ void generate_keys(std::vector<std::string> *keys,
 template <typename T>
 void test_croquis(const std::vector<std::string> &keys,
                   const std::vector<madoka::UInt64> &original_freqs,
-                  const std::vector<std::size_t> &ids) {
+                  const std::vector<std::size_t> &ids, int flags) {
   const char PATH[] = "croquis-test.temp.1";
 
   std::remove(PATH);
@@ -87,8 +88,10 @@ void test_croquis(const std::vector<std::string> &keys,
   }
   MADOKA_THROW_IF(freqs.size() != original_freqs.size());
 
-  croquis.create(keys.size(), 3, PATH, madoka::FILE_TRUNCATE);
+  croquis.create(keys.size(), 3, PATH, madoka::FILE_TRUNCATE | flags);
   MADOKA_THROW_IF(croquis.width() != keys.size());
+  MADOKA_THROW_IF((croquis.flags() & madoka::CROQUIS_FAST_RANGE) !=
+                  (flags & madoka::CROQUIS_FAST_RANGE));
   MADOKA_THROW_IF(croquis.depth() != 3);
   MADOKA_THROW_IF(croquis.seed() != 0);
 
@@ -102,6 +105,8 @@ void test_croquis(const std::vector<std::string> &keys,
   croquis.close();
 
   croquis.open(PATH, madoka::FILE_PRIVATE);
+  MADOKA_THROW_IF((croquis.flags() & madoka::CROQUIS_FAST_RANGE) !=
+                  (flags & madoka::CROQUIS_FAST_RANGE));
   for (std::size_t i = 0; i < keys.size(); ++i) {
     MADOKA_THROW_IF(croquis.get(keys[i].c_str(), keys[i].length()) < freqs[i]);
   }
@@ -120,7 +125,7 @@ void test_croquis(const std::vector<std::string> &keys,
     MADOKA_THROW_IF(croquis.get(keys[i].c_str(), keys[i].length()) != 0);
   }
 
-  croquis.create(keys.size() + 13, 5, NULL, 0, 123456789);
+  croquis.create(keys.size() + 13, 5, NULL, flags, 123456789);
   MADOKA_THROW_IF(croquis.width() != (keys.size() + 13));
   MADOKA_THROW_IF(croquis.depth() != 5);
   MADOKA_THROW_IF(croquis.seed() != 123456789);
@@ -160,6 +165,82 @@ void test_croquis(const std::vector<std::string> &keys,
   MADOKA_THROW_IF(std::remove(PATH) == -1);
 }
 
+template <typename T>
+void test_decayed_croquis(int flags) {
+  const char PATH[] = "croquis-test.temp.2";
+  const double HALF_LIFE = 10.0;
+  const double EPSILON = 1e-4;
+
+  std::remove(PATH);
+
+  madoka::Croquis<T> croquis;
+  croquis.create(1 << 12, 3, PATH,
+                 madoka::FILE_TRUNCATE | madoka::CROQUIS_DECAYED | flags);
+  MADOKA_THROW_IF(!(croquis.flags() & madoka::CROQUIS_DECAYED));
+  MADOKA_THROW_IF(croquis.decay_rate() != 0.0);
+  croquis.set_decay_rate(std::log(2.0) / HALF_LIFE);
+
+  // A value halves every HALF_LIFE.
+  croquis.add("apple", 5, 1, 0.0);
+  MADOKA_THROW_IF(std::fabs(croquis.get("apple", 5, HALF_LIFE) - 0.5) >
+                  EPSILON);
+  const T value = croquis.add("apple", 5, 1, HALF_LIFE);
+  MADOKA_THROW_IF(std::fabs(value - 1.5) > EPSILON);
+  MADOKA_THROW_IF(std::fabs(croquis.get("apple", 5, HALF_LIFE * 2) - 0.75) >
+                  EPSILON);
+
+  // A time earlier than the latest one is treated as the latest one.
+  croquis.add("banana", 6, 1, 0.0);
+  MADOKA_THROW_IF(std::fabs(croquis.get("banana", 6, HALF_LIFE) - 1.0) >
+                  EPSILON);
+
+  // A large scale renormalizes the table to a new landmark.
+  const double time = HALF_LIFE * 40;
+  croquis.advance(time);
+  MADOKA_THROW_IF(croquis.decay_time() != time);
+  MADOKA_THROW_IF(croquis.decay_landmark() != time);
+  croquis.add("apple", 5, 1, time);
+  MADOKA_THROW_IF(std::fabs(croquis.get("apple", 5, time) - 1.0) > EPSILON);
+  MADOKA_THROW_IF(std::fabs(croquis.get("apple", 5, time + HALF_LIFE) -
+                            0.5) > EPSILON);
+
+  // The decay is saved with the table.
+  croquis.close();
+  croquis.open(PATH);
+  MADOKA_THROW_IF(std::fabs(croquis.decay_rate() -
+                            (std::log(2.0) / HALF_LIFE)) > EPSILON);
+  MADOKA_THROW_IF(croquis.decay_time() != time);
+  MADOKA_THROW_IF(std::fabs(croquis.get("apple", 5, time) - 1.0) > EPSILON);
+
+  croquis.clear();
+  MADOKA_THROW_IF(croquis.get("apple", 5, time) != 0);
+  croquis.close();
+
+  // Without CROQUIS_DECAYED, a time is ignored.
+  croquis.create(1 << 12, 3, NULL, flags);
+  croquis.add("apple", 5, 1, 0.0);
+  MADOKA_THROW_IF(croquis.add("apple", 5, 1, HALF_LIFE) != 2);
+  MADOKA_THROW_IF(croquis.get("apple", 5, HALF_LIFE * 2) != 2);
+  bool is_thrown = false;
+  try {
+    croquis.set_decay_rate(1.0);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+
+  is_thrown = false;
+  try {
+    madoka::Croquis<madoka::UInt32> int_croquis;
+    int_croquis.create(1 << 12, 3, NULL, madoka::CROQUIS_DECAYED);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+
+  MADOKA_THROW_IF(std::remove(PATH) == -1);
+}
+
 void benchmark_croquis(const std::vector<std::string> &keys,
                        const std::vector<madoka::UInt64> &freqs,
                        const std::vector<std::size_t> &ids) {
@@ -204,21 +285,36 @@ int main() try {
   MADOKA_THROW_IF(keys.size() != NUM_KEYS);
   MADOKA_THROW_IF(freqs.size() != NUM_KEYS);
 
-#define TEST_CROQUIS(type) \
+#define TEST_CROQUIS(type, flags) \
   ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
-              << "test_croquis<" #type ">()" << std::endl), \
-   test_croquis<type>(keys, freqs, ids))
+              << "test_croquis<" #type ">(" #flags ")" << std::endl), \
+   test_croquis<type>(keys, freqs, ids, flags))
 
-  TEST_CROQUIS(madoka::UInt8);
-  TEST_CROQUIS(madoka::UInt16);
-  TEST_CROQUIS(madoka::UInt32);
-  TEST_CROQUIS(madoka::UInt64);
-  TEST_CROQUIS(bool);
-  TEST_CROQUIS(float);
-  TEST_CROQUIS(double);
+  TEST_CROQUIS(madoka::UInt8, 0);
+  TEST_CROQUIS(madoka::UInt16, 0);
+  TEST_CROQUIS(madoka::UInt32, 0);
+  TEST_CROQUIS(madoka::UInt64, 0);
+  TEST_CROQUIS(bool, 0);
+  TEST_CROQUIS(float, 0);
+  TEST_CROQUIS(double, 0);
+
+  TEST_CROQUIS(madoka::UInt8, madoka::CROQUIS_FAST_RANGE);
+  TEST_CROQUIS(madoka::UInt32, madoka::CROQUIS_FAST_RANGE);
+  TEST_CROQUIS(float, madoka::CROQUIS_FAST_RANGE);
 
 #undef TEST_CROQUIS
 
+#define TEST_DECAYED_CROQUIS(type, flags) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "test_decayed_croquis<" #type ">(" #flags ")" << std::endl), \
+   test_decayed_croquis<type>(flags))
+
+  TEST_DECAYED_CROQUIS(float, 0);
+  TEST_DECAYED_CROQUIS(double, 0);
+  TEST_DECAYED_CROQUIS(double, madoka::CROQUIS_FAST_RANGE);
+
+#undef TEST_DECAYED_CROQUIS
+
   benchmark_croquis(keys, freqs, ids);
 
   return 0;
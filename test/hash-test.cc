@@ -0,0 +1,86 @@
+// Copyright (c) 2012, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <madoka/hash.h>
+
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <madoka/exception.h>
+
+int main() try {
+  enum { NUM_KEYS = 1 << 10 };
+
+  std::srand(static_cast<unsigned int>(std::time(NULL)));
+
+  std::vector<std::string> keys(NUM_KEYS);
+  std::vector<const void *> key_addrs(NUM_KEYS);
+  std::vector<std::size_t> key_sizes(NUM_KEYS);
+  for (std::size_t i = 0; i < NUM_KEYS; ++i) {
+    const std::size_t key_size = static_cast<std::size_t>(std::rand() % 101);
+    for (std::size_t j = 0; j < key_size; ++j) {
+      keys[i] += static_cast<char>(std::rand() & 0xFF);
+    }
+    key_addrs[i] = keys[i].c_str();
+    key_sizes[i] = keys[i].length();
+  }
+
+  const madoka::UInt64 SEEDS[] = { 0, 1, 0x123456789ABCDEFULL, ~0ULL };
+  for (std::size_t seed_id = 0; seed_id < (sizeof(SEEDS) / sizeof(SEEDS[0]));
+       ++seed_id) {
+    const madoka::UInt64 seed = SEEDS[seed_id];
+    std::vector<madoka::UInt64> hash_values(NUM_KEYS * 2);
+    madoka::UInt64 (* const batch_hash_values)[2] =
+        reinterpret_cast<madoka::UInt64 (*)[2]>(&hash_values[0]);
+
+    // Every number of keys is tested to cover partially filled lanes.
+    for (std::size_t num_keys = 0; num_keys <= 20; ++num_keys) {
+      madoka::Hash()(&key_addrs[0], &key_sizes[0], num_keys, seed,
+                     batch_hash_values);
+      for (std::size_t i = 0; i < num_keys; ++i) {
+        madoka::UInt64 scalar_hash_values[2];
+        madoka::Hash()(key_addrs[i], key_sizes[i], seed, scalar_hash_values);
+        MADOKA_THROW_IF(batch_hash_values[i][0] != scalar_hash_values[0]);
+        MADOKA_THROW_IF(batch_hash_values[i][1] != scalar_hash_values[1]);
+      }
+    }
+
+    madoka::Hash()(&key_addrs[0], &key_sizes[0], NUM_KEYS, seed,
+                   batch_hash_values);
+    for (std::size_t i = 0; i < NUM_KEYS; ++i) {
+      madoka::UInt64 scalar_hash_values[2];
+      madoka::Hash()(key_addrs[i], key_sizes[i], seed, scalar_hash_values);
+      MADOKA_THROW_IF(batch_hash_values[i][0] != scalar_hash_values[0]);
+      MADOKA_THROW_IF(batch_hash_values[i][1] != scalar_hash_values[1]);
+    }
+  }
+
+  return 0;
+} catch (const madoka::Exception &ex) {
+  std::cerr << "error: " << ex.what() << std::endl;
+  return 1;
+}
@@ -32,8 +32,13 @@ int main() try {
 
   header.set_width(1ULL << 30);
   header.set_depth(3);
+  header.set_flags(1 << 16);
   header.set_max_value((1ULL << 28) - 1);
   header.set_value_size(28);
+  MADOKA_THROW_IF(header.magic() != 0);
+  MADOKA_THROW_IF(header.version() != 0);
+  header.set_magic(madoka::HEADER_MAGIC);
+  header.set_version(1);
   header.set_seed(123456789);
   header.set_table_size(1ULL << 32);
   header.set_file_size((1ULL << 32) + sizeof(madoka::Header));
@@ -41,8 +46,11 @@ int main() try {
   MADOKA_THROW_IF(header.width() != (1ULL << 30));
   MADOKA_THROW_IF(header.width_mask() != ((1ULL << 30) - 1));
   MADOKA_THROW_IF(header.depth() != (3));
+  MADOKA_THROW_IF(header.flags() != (1 << 16));
   MADOKA_THROW_IF(header.max_value() != ((1ULL << 28) - 1));
   MADOKA_THROW_IF(header.value_size() != 28);
+  MADOKA_THROW_IF(header.magic() != madoka::HEADER_MAGIC);
+  MADOKA_THROW_IF(header.version() != 1);
   MADOKA_THROW_IF(header.seed() != 123456789);
   MADOKA_THROW_IF(header.table_size() != (1ULL << 32));
   MADOKA_THROW_IF(header.file_size() !=
@@ -52,6 +60,8 @@ int main() try {
   MADOKA_THROW_IF(header.width() != 123456789);
   MADOKA_THROW_IF(header.width_mask() != 0);
 
+  MADOKA_THROW_IF(sizeof(madoka::Header) != 64);
+
   return 0;
 } catch (const madoka::Exception &ex) {
   std::cerr << "error: " << ex.what() << std::endl;
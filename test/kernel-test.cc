@@ -0,0 +1,377 @@
+// Copyright (c) 2012, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <madoka/kernel.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <madoka/approx.h>
+#include <madoka/exception.h>
+#include <madoka/hash.h>
+
+namespace {
+
+const int FEATURES_LIST[] = {
+  0,
+  madoka::CPU_SSE42,
+  madoka::CPU_BMI2,
+  madoka::CPU_AVX2,
+  madoka::CPU_AVX512,
+  madoka::CPU_ALL_FEATURES
+};
+
+const madoka::UInt64 VALUE_SIZES[] = { 1, 2, 4, 8, 16 };
+
+madoka::UInt64 random_unit() {
+  madoka::UInt64 unit = 0;
+  for (int i = 0; i < 4; ++i) {
+    unit = (unit << 16) ^ static_cast<madoka::UInt64>(std::rand() & 0xFFFF);
+  }
+  return unit;
+}
+
+void hash_test() {
+  enum { NUM_KEYS = 1 << 10 };
+
+  std::vector<std::string> keys(NUM_KEYS);
+  std::vector<const void *> key_addrs(NUM_KEYS);
+  std::vector<std::size_t> key_sizes(NUM_KEYS);
+  for (std::size_t i = 0; i < NUM_KEYS; ++i) {
+    const std::size_t key_size = static_cast<std::size_t>(std::rand() % 101);
+    for (std::size_t j = 0; j < key_size; ++j) {
+      keys[i] += static_cast<char>(std::rand() & 0xFF);
+    }
+    key_addrs[i] = keys[i].c_str();
+    key_sizes[i] = keys[i].length();
+  }
+
+  std::vector<madoka::UInt64> hash_values(NUM_KEYS * 2);
+  madoka::UInt64 (* const batch_hash_values)[2] =
+      reinterpret_cast<madoka::UInt64 (*)[2]>(&hash_values[0]);
+  madoka::kernel().hash(&key_addrs[0], &key_sizes[0], NUM_KEYS, 12345,
+                        batch_hash_values);
+  for (std::size_t i = 0; i < NUM_KEYS; ++i) {
+    madoka::UInt64 scalar_hash_values[2];
+    madoka::Hash()(key_addrs[i], key_sizes[i], 12345, scalar_hash_values);
+    MADOKA_THROW_IF(batch_hash_values[i][0] != scalar_hash_values[0]);
+    MADOKA_THROW_IF(batch_hash_values[i][1] != scalar_hash_values[1]);
+  }
+}
+
+void saturated_add_test() {
+  enum { NUM_UNITS = 100 };
+
+  for (std::size_t i = 0; i < (sizeof(VALUE_SIZES) / sizeof(VALUE_SIZES[0]));
+       ++i) {
+    const madoka::UInt64 value_size = VALUE_SIZES[i];
+    const madoka::UInt64 value_mask = (1ULL << value_size) - 1;
+
+    std::vector<madoka::UInt64> lhs(NUM_UNITS);
+    std::vector<madoka::UInt64> rhs(NUM_UNITS);
+    for (std::size_t j = 0; j < NUM_UNITS; ++j) {
+      lhs[j] = random_unit();
+      rhs[j] = random_unit();
+    }
+    // Zero units must stay as they are.
+    lhs[0] = rhs[0] = 0;
+
+    std::vector<madoka::UInt64> sums(lhs);
+    madoka::kernel().saturated_add(&sums[0], &rhs[0], NUM_UNITS, value_size);
+    for (std::size_t j = 0; j < NUM_UNITS; ++j) {
+      for (madoka::UInt64 k = 0; k < 64; k += value_size) {
+        const madoka::UInt64 x = (lhs[j] >> k) & value_mask;
+        const madoka::UInt64 y = (rhs[j] >> k) & value_mask;
+        const madoka::UInt64 sum = (sums[j] >> k) & value_mask;
+        MADOKA_THROW_IF(sum != (((x + y) < value_mask) ?
+                                (x + y) : value_mask));
+      }
+    }
+  }
+}
+
+void select_merge_test(bool is_max) {
+  enum { NUM_UNITS = 101 };
+
+  std::vector<madoka::UInt64> value_sizes(VALUE_SIZES, VALUE_SIZES +
+      (sizeof(VALUE_SIZES) / sizeof(VALUE_SIZES[0])));
+  value_sizes.push_back(madoka::APPROX_SIZE);
+  for (std::size_t i = 0; i < value_sizes.size(); ++i) {
+    const madoka::UInt64 value_size = value_sizes[i];
+    const madoka::UInt64 value_mask = (1ULL << value_size) - 1;
+    const bool is_approx = (value_size == madoka::APPROX_SIZE);
+    const madoka::UInt64 num_values = is_approx ? 3 : (64 / value_size);
+
+    std::vector<madoka::UInt64> lhs(NUM_UNITS);
+    std::vector<madoka::UInt64> rhs(NUM_UNITS);
+    for (std::size_t j = 0; j < NUM_UNITS; ++j) {
+      lhs[j] = random_unit();
+      // Some values are equal and some differ only in their lower bits.
+      rhs[j] = (j & 1) ? random_unit() : (lhs[j] ^ (random_unit() &
+                                                    random_unit()));
+    }
+
+    std::vector<madoka::UInt64> results(lhs);
+    if (is_max) {
+      madoka::kernel().max_merge(&results[0], &rhs[0], NUM_UNITS, value_size);
+    } else {
+      madoka::kernel().min_merge(&results[0], &rhs[0], NUM_UNITS, value_size);
+    }
+    for (std::size_t j = 0; j < NUM_UNITS; ++j) {
+      madoka::UInt64 expected = lhs[j];
+      for (madoka::UInt64 k = 0; k < num_values; ++k) {
+        const madoka::UInt64 shift = k * value_size;
+        const madoka::UInt64 x = (lhs[j] >> shift) & value_mask;
+        const madoka::UInt64 y = (rhs[j] >> shift) & value_mask;
+        if (is_max ? (y > x) : (y < x)) {
+          madoka::UInt64 mask = value_mask << shift;
+          if (is_approx) {
+            mask |= 3ULL << ((madoka::APPROX_SIZE * 3) + (2 * k));
+          }
+          expected = (expected & ~mask) | (rhs[j] & mask);
+        }
+      }
+      MADOKA_THROW_IF(results[j] != expected);
+    }
+  }
+}
+
+void filter_test() {
+  enum { NUM_UNITS = 101 };
+
+  for (madoka::UInt64 value_size = 8; value_size <= 16; value_size *= 2) {
+    const madoka::UInt64 value_mask = (1ULL << value_size) - 1;
+    for (int i = 0; i < 16; ++i) {
+      const madoka::UInt64 threshold = random_unit() % ((1 << 16) + 1);
+      const madoka::UInt64 multiplier = random_unit() % ((1 << 16) + 1);
+      const madoka::UInt64 shift = random_unit() % 33;
+      const madoka::UInt64 max_value = random_unit() & value_mask;
+
+      std::vector<madoka::UInt64> units(NUM_UNITS);
+      for (std::size_t j = 0; j < NUM_UNITS; ++j) {
+        units[j] = random_unit();
+      }
+      std::vector<madoka::UInt64> results(units);
+      madoka::kernel().filter(&results[0], NUM_UNITS, value_size, threshold,
+                              multiplier, shift, max_value);
+      for (std::size_t j = 0; j < NUM_UNITS; ++j) {
+        for (madoka::UInt64 k = 0; k < 64; k += value_size) {
+          const madoka::UInt64 value = (units[j] >> k) & value_mask;
+          madoka::UInt64 expected =
+              (value < threshold) ? 0 : ((value * multiplier) >> shift);
+          expected = (expected < max_value) ? expected : max_value;
+          MADOKA_THROW_IF(((results[j] >> k) & value_mask) != expected);
+        }
+      }
+    }
+  }
+}
+
+void exact_decode_test() {
+  enum { NUM_UNITS = 64 };
+
+  std::vector<madoka::UInt64> units(NUM_UNITS);
+  for (std::size_t i = 0; i < NUM_UNITS; ++i) {
+    units[i] = random_unit();
+  }
+
+  for (std::size_t i = 0; i < (sizeof(VALUE_SIZES) / sizeof(VALUE_SIZES[0]));
+       ++i) {
+    const madoka::UInt64 value_size = VALUE_SIZES[i];
+    const madoka::UInt64 value_mask = (1ULL << value_size) - 1;
+    const madoka::UInt64 num_cells = (NUM_UNITS * 64) / value_size;
+
+    for (int j = 0; j < 100; ++j) {
+      const madoka::UInt64 cell_id = static_cast<madoka::UInt64>(
+          std::rand() % static_cast<int>(num_cells));
+      const madoka::UInt64 num_values = static_cast<madoka::UInt64>(
+          std::rand() % static_cast<int>(num_cells - cell_id));
+      std::vector<madoka::UInt64> values(num_values + 1);
+      madoka::kernel().exact_decode(&units[0], cell_id, num_values,
+                                    value_size, &values[0]);
+      for (madoka::UInt64 k = 0; k < num_values; ++k) {
+        const madoka::UInt64 bit_id = (cell_id + k) * value_size;
+        MADOKA_THROW_IF(values[k] !=
+                        ((units[bit_id / 64] >> (bit_id % 64)) & value_mask));
+      }
+    }
+  }
+}
+
+void approx_encode_test() {
+  enum { NUM_VALUES = 1003 };
+
+  std::vector<madoka::UInt64> values(NUM_VALUES);
+  for (std::size_t i = 0; i < NUM_VALUES; ++i) {
+    values[i] = random_unit() >> (i % 64);
+  }
+  const madoka::UInt64 EDGES[] = {
+    0, 1, (1ULL << 14) - 1, 1ULL << 14, (1ULL << 15) - 1, 1ULL << 15,
+    madoka::APPROX_MAX_VALUE, madoka::APPROX_MAX_VALUE + 1, ~0ULL
+  };
+  for (std::size_t i = 0; i < (sizeof(EDGES) / sizeof(EDGES[0])); ++i) {
+    values[i] = EDGES[i];
+  }
+
+  std::vector<madoka::UInt64> approxes(NUM_VALUES);
+  madoka::kernel().approx_encode(&values[0], NUM_VALUES, &approxes[0]);
+  for (std::size_t i = 0; i < NUM_VALUES; ++i) {
+    MADOKA_THROW_IF(approxes[i] != madoka::Approx::encode(values[i]));
+  }
+
+  madoka::kernel().approx_encode(&values[0], NUM_VALUES, &values[0]);
+  MADOKA_THROW_IF(values != approxes);
+}
+
+void approx_decode_test() {
+  enum { NUM_UNITS = 1000 };
+
+  std::vector<madoka::UInt64> units(NUM_UNITS);
+  for (std::size_t i = 0; i < NUM_UNITS; ++i) {
+    units[i] = random_unit();
+  }
+  units[0] = 0;
+
+  std::vector<madoka::UInt64> values(NUM_UNITS);
+  std::vector<madoka::UInt64> masks(NUM_UNITS);
+  for (madoka::UInt64 table_id = 0; table_id < 3; ++table_id) {
+    madoka::kernel().approx_decode(&units[0], NUM_UNITS, table_id,
+                                   &values[0], &masks[0]);
+    for (std::size_t i = 0; i < NUM_UNITS; ++i) {
+      const madoka::UInt64 approx =
+          (units[i] >> (madoka::APPROX_SIZE * table_id)) &
+          madoka::APPROX_MASK;
+      MADOKA_THROW_IF(values[i] != madoka::Approx::decode(approx));
+      MADOKA_THROW_IF(madoka::Approx::encode(values[i] | masks[i]) !=
+                      approx);
+      MADOKA_THROW_IF((values[i] & masks[i]) != 0);
+    }
+
+    std::vector<madoka::UInt64> lower_bounds(NUM_UNITS);
+    madoka::kernel().approx_decode(&units[0], NUM_UNITS, table_id,
+                                   &lower_bounds[0], NULL);
+    MADOKA_THROW_IF(lower_bounds != values);
+  }
+}
+
+void inner_product_test() {
+  enum { NUM_VALUES = 1001 };
+
+  std::vector<madoka::UInt64> lhs(NUM_VALUES);
+  std::vector<madoka::UInt64> rhs(NUM_VALUES);
+  for (std::size_t i = 0; i < NUM_VALUES; ++i) {
+    lhs[i] = random_unit() & madoka::APPROX_MAX_VALUE;
+    rhs[i] = random_unit() & 0xFFFF;
+  }
+
+  double expected_sums[3] = { 0.0, 0.0, 0.0 };
+  for (std::size_t i = 0; i < NUM_VALUES; ++i) {
+    const double lhs_value = static_cast<double>(lhs[i]);
+    const double rhs_value = static_cast<double>(rhs[i]);
+    expected_sums[0] += lhs_value * rhs_value;
+    expected_sums[1] += lhs_value * lhs_value;
+    expected_sums[2] += rhs_value * rhs_value;
+  }
+
+  double sums[3] = { 1.0, 2.0, 3.0 };
+  madoka::kernel().inner_product(&lhs[0], &rhs[0], NUM_VALUES, sums);
+  for (int i = 0; i < 3; ++i) {
+    const double expected_sum = expected_sums[i] + (i + 1);
+    MADOKA_THROW_IF(std::fabs(sums[i] - expected_sum) >
+                    (expected_sum * 1E-12));
+  }
+}
+
+void exact_inner_product_test() {
+  enum { NUM_UNITS = 1001 };
+
+  const madoka::UInt64 VALUE_SIZES[] = { 1, 2, 4, 8, 16 };
+  for (std::size_t i = 0;
+       i < (sizeof(VALUE_SIZES) / sizeof(VALUE_SIZES[0])); ++i) {
+    const madoka::UInt64 value_size = VALUE_SIZES[i];
+    const madoka::UInt64 mask = (1ULL << value_size) - 1;
+
+    std::vector<madoka::UInt64> lhs(NUM_UNITS);
+    std::vector<madoka::UInt64> rhs(NUM_UNITS);
+    for (std::size_t j = 0; j < NUM_UNITS; ++j) {
+      lhs[j] = random_unit();
+      rhs[j] = random_unit();
+    }
+    lhs[0] = rhs[0] = ~0ULL;
+
+    madoka::UInt64 expected_sums[3] = { 1, 2, 3 };
+    for (std::size_t j = 0; j < NUM_UNITS; ++j) {
+      for (madoka::UInt64 shift = 0; shift < 64; shift += value_size) {
+        const madoka::UInt64 x = (lhs[j] >> shift) & mask;
+        const madoka::UInt64 y = (rhs[j] >> shift) & mask;
+        expected_sums[0] += x * y;
+        expected_sums[1] += x * x;
+        expected_sums[2] += y * y;
+      }
+    }
+
+    madoka::UInt64 sums[3] = { 1, 2, 3 };
+    madoka::kernel().exact_inner_product(&lhs[0], &rhs[0], NUM_UNITS,
+                                         value_size, sums);
+    for (int j = 0; j < 3; ++j) {
+      MADOKA_THROW_IF(sums[j] != expected_sums[j]);
+    }
+  }
+}
+
+}  // namespace
+
+int main() try {
+  std::srand(static_cast<unsigned int>(std::time(NULL)));
+
+  const int detected_features = madoka::cpu_features();
+  for (std::size_t i = 0;
+       i < (sizeof(FEATURES_LIST) / sizeof(FEATURES_LIST[0])); ++i) {
+    madoka::set_cpu_features(FEATURES_LIST[i]);
+    MADOKA_THROW_IF(madoka::cpu_features() !=
+                    (FEATURES_LIST[i] & detected_features));
+
+    hash_test();
+    saturated_add_test();
+    select_merge_test(true);
+    select_merge_test(false);
+    filter_test();
+    exact_decode_test();
+    approx_encode_test();
+    approx_decode_test();
+    inner_product_test();
+    exact_inner_product_test();
+  }
+  madoka::set_cpu_features(madoka::CPU_ALL_FEATURES);
+  MADOKA_THROW_IF(madoka::cpu_features() != detected_features);
+
+  return 0;
+} catch (const madoka::Exception &ex) {
+  std::cerr << "error: " << ex.what() << std::endl;
+  return 1;
+}
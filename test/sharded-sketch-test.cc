@@ -0,0 +1,168 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <madoka/sharded-sketch.h>
+
+namespace {
+
+const std::size_t NUM_KEYS = 1 << 12;
+const std::size_t NUM_SHARDS = 4;
+
+void generate_keys(std::vector<std::string> *keys,
+                   std::vector<madoka::UInt64> *freqs,
+                   std::vector<std::size_t> *ids) {
+  std::mt19937 random_engine(1);
+  for (std::size_t i = 0; i < NUM_KEYS; ++i) {
+    keys->push_back(std::to_string(i));
+    const std::size_t freq = NUM_KEYS / (i + 1);
+    freqs->push_back(freq);
+    for (std::size_t j = 0; j < freq; ++j) {
+      ids->push_back(i);
+    }
+  }
+  std::shuffle(ids->begin(), ids->end(), random_engine);
+}
+
+void test_sharded_sketch(madoka::UInt64 max_value, int flags,
+                         const std::vector<std::string> &keys,
+                         const std::vector<madoka::UInt64> &freqs,
+                         const std::vector<std::size_t> &ids) {
+  const char PATH[] = "sharded-sketch-test.temp";
+
+  std::remove(PATH);
+
+  madoka::ShardedSketch sketch;
+  sketch.create(NUM_SHARDS, NUM_KEYS, max_value, PATH, flags, 123);
+  MADOKA_THROW_IF(sketch.num_shards() != NUM_SHARDS);
+  for (std::size_t i = 0; i < NUM_SHARDS; ++i) {
+    MADOKA_THROW_IF(sketch.shard(i).width() != sketch.master().width());
+    MADOKA_THROW_IF(sketch.shard(i).max_value() !=
+                    sketch.master().max_value());
+    MADOKA_THROW_IF(sketch.shard(i).seed() != 123);
+    MADOKA_THROW_IF((sketch.shard(i).flags() & madoka::SKETCH_HEADER_FLAGS) !=
+                    (flags & (madoka::SKETCH_BLOCKED_LAYOUT |
+                              madoka::SKETCH_FAST_RANGE)));
+  }
+
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    const std::string &key = keys[ids[i]];
+    sketch.shard(i % NUM_SHARDS).inc(key.c_str(), key.length());
+  }
+
+  const bool is_exact = sketch.master().mode() == madoka::SKETCH_EXACT_MODE;
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const madoka::UInt64 freq = std::min(freqs[i], sketch.master().max_value());
+    MADOKA_THROW_IF(sketch.get(keys[i].c_str(), keys[i].length()) != 0);
+    if (is_exact) {
+      MADOKA_THROW_IF(sketch.get_live(keys[i].c_str(), keys[i].length()) <
+                      freq);
+    }
+  }
+
+  sketch.sync(0);
+  MADOKA_THROW_IF(sketch.shard(0).get(keys[0].c_str(), keys[0].length()) !=
+                  0);
+  sketch.sync();
+
+  madoka::UInt64 diff = 0;
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const madoka::UInt64 freq = std::min(freqs[i], sketch.master().max_value());
+    const madoka::UInt64 value = sketch.get(keys[i].c_str(), keys[i].length());
+    if (is_exact) {
+      MADOKA_THROW_IF(value < freq);
+    }
+    MADOKA_THROW_IF(sketch.get_live(keys[i].c_str(), keys[i].length()) !=
+                    value);
+    diff += (value > freq) ? (value - freq) : (freq - value);
+  }
+  std::cout << "info: error = "
+            << (100.0 * diff / ids.size()) << '%' << std::endl;
+
+  bool is_thrown = false;
+  try {
+    sketch.sync(NUM_SHARDS);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+
+  const madoka::UInt64 value = sketch.get(keys[0].c_str(), keys[0].length());
+  sketch.close();
+  MADOKA_THROW_IF(sketch.num_shards() != 0);
+
+  sketch.open(2, PATH);
+  MADOKA_THROW_IF(sketch.num_shards() != 2);
+  MADOKA_THROW_IF(sketch.get(keys[0].c_str(), keys[0].length()) != value);
+  sketch.shard(1).add(keys[0].c_str(), keys[0].length(), 1);
+  sketch.sync();
+  MADOKA_THROW_IF(sketch.get(keys[0].c_str(), keys[0].length()) < value);
+  sketch.close();
+
+  MADOKA_THROW_IF(std::remove(PATH) == -1);
+}
+
+}  // namespace
+
+int main() try {
+  std::vector<std::string> keys;
+  std::vector<madoka::UInt64> freqs;
+  std::vector<std::size_t> ids;
+  generate_keys(&keys, &freqs, &ids);
+
+#define TEST_SHARDED_SKETCH(max_value, flags) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "test_sharded_sketch(" #max_value ", " #flags ")" \
+              << std::endl), \
+   test_sharded_sketch(max_value, flags, keys, freqs, ids))
+
+  TEST_SHARDED_SKETCH(3, 0);
+  TEST_SHARDED_SKETCH(255, 0);
+  TEST_SHARDED_SKETCH(65535, madoka::SKETCH_BLOCKED_LAYOUT);
+  TEST_SHARDED_SKETCH(0, 0);
+  TEST_SHARDED_SKETCH(0, madoka::SKETCH_FAST_RANGE);
+  TEST_SHARDED_SKETCH(65535, madoka::SKETCH_HOT_TIER);
+
+#undef TEST_SHARDED_SKETCH
+
+  bool is_thrown = false;
+  try {
+    madoka::ShardedSketch sketch;
+    sketch.create(0);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+
+  return 0;
+} catch (const madoka::Exception &ex) {
+  std::cerr << "error: " << ex.what() << std::endl;
+  return 1;
+}
@@ -0,0 +1,192 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <madoka/sketch-group.h>
+
+namespace {
+
+const std::size_t NUM_KEYS = 1 << 12;
+const std::size_t NUM_OPS  = 1 << 16;
+const madoka::UInt64 SEED = 123456789;
+
+void generate_keys(std::vector<std::string> *keys) {
+  std::mt19937 random_engine(1);
+  for (std::size_t i = 0; i < NUM_KEYS; ++i) {
+    std::string key(1 + (random_engine() % 16), '\0');
+    for (std::size_t j = 0; j < key.length(); ++j) {
+      key[j] = 'A' + (random_engine() % 26);
+    }
+    keys->push_back(key);
+  }
+}
+
+void test_key_hash(const std::vector<std::string> &keys) {
+  madoka::Sketch sketch;
+  sketch.create(1000, 255, NULL, 0, SEED);
+
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const madoka::KeyHash key_hash =
+        sketch.hash(keys[i].c_str(), keys[i].length());
+    MADOKA_THROW_IF(key_hash.seed() != SEED);
+
+    madoka::UInt64 hash_values[2];
+    madoka::Hash()(keys[i].c_str(), keys[i].length(), SEED, hash_values);
+    MADOKA_THROW_IF(key_hash.values()[0] != hash_values[0]);
+    MADOKA_THROW_IF(key_hash.values()[1] != hash_values[1]);
+
+    const madoka::UInt64 value = sketch.inc(key_hash);
+    MADOKA_THROW_IF(sketch.get(keys[i].c_str(), keys[i].length()) != value);
+    MADOKA_THROW_IF(sketch.get(key_hash) != value);
+    MADOKA_THROW_IF(sketch.add(key_hash, 2) != std::min(value + 2,
+                                                        sketch.max_value()));
+    sketch.set(key_hash, 1);
+    MADOKA_THROW_IF(sketch.get(keys[i].c_str(), keys[i].length()) < 1);
+  }
+}
+
+void test_sketch_group(const std::vector<std::string> &keys) {
+  const madoka::UInt64 WIDTHS[] = { 1000, 1 << 10, 777, 4096, 3000 };
+  const madoka::UInt64 MAX_VALUES[] = { 1, 15, 65535, 0, 0 };
+  const int FLAGS[] = {
+    0, madoka::SKETCH_BLOCKED_LAYOUT, madoka::SKETCH_FAST_RANGE, 0,
+    madoka::SKETCH_BLOCKED_LAYOUT | madoka::SKETCH_FAST_RANGE
+  };
+  const std::size_t NUM_SKETCHES = sizeof(WIDTHS) / sizeof(WIDTHS[0]);
+
+  madoka::Sketch sketches[NUM_SKETCHES];
+  madoka::Sketch expected_sketches[NUM_SKETCHES];
+  madoka::SketchGroup group;
+  MADOKA_THROW_IF(!group.empty());
+  for (std::size_t i = 0; i < NUM_SKETCHES; ++i) {
+    sketches[i].create(WIDTHS[i], MAX_VALUES[i], NULL, FLAGS[i], SEED);
+    expected_sketches[i].create(WIDTHS[i], MAX_VALUES[i], NULL, FLAGS[i],
+                                SEED);
+    group.insert(&sketches[i]);
+  }
+  MADOKA_THROW_IF(group.size() != NUM_SKETCHES);
+  MADOKA_THROW_IF(group.seed() != SEED);
+  MADOKA_THROW_IF(&group[1] != &sketches[1]);
+
+  madoka::Sketch other_sketch;
+  other_sketch.create(1000, 0, NULL, 0, SEED + 1);
+  bool is_thrown = false;
+  try {
+    group.insert(&other_sketch);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+  MADOKA_THROW_IF(group.size() != NUM_SKETCHES);
+
+  madoka::Sketch top_k_sketch;
+  top_k_sketch.create(1000, 0, NULL, madoka::SKETCH_TOP_K, SEED);
+  is_thrown = false;
+  try {
+    group.insert(&top_k_sketch);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+  MADOKA_THROW_IF(group.size() != NUM_SKETCHES);
+
+  std::mt19937 random_engine(2);
+  madoka::UInt64 values[NUM_SKETCHES];
+  for (std::size_t i = 0; i < NUM_OPS; ++i) {
+    const std::string &key = keys[random_engine() % keys.size()];
+    switch (random_engine() % 4) {
+      case 0: {
+        group.inc(key.c_str(), key.length(), values);
+        for (std::size_t j = 0; j < NUM_SKETCHES; ++j) {
+          MADOKA_THROW_IF(values[j] !=
+                          expected_sketches[j].inc(key.c_str(), key.length()));
+        }
+        break;
+      }
+      case 1: {
+        const madoka::UInt64 value = random_engine() % 100;
+        group.add(group.hash(key.c_str(), key.length()), value, values);
+        for (std::size_t j = 0; j < NUM_SKETCHES; ++j) {
+          MADOKA_THROW_IF(values[j] != expected_sketches[j].add(
+              key.c_str(), key.length(), value));
+        }
+        break;
+      }
+      case 2: {
+        const madoka::UInt64 value = random_engine() % 100;
+        group.set(key.c_str(), key.length(), value);
+        for (std::size_t j = 0; j < NUM_SKETCHES; ++j) {
+          expected_sketches[j].set(key.c_str(), key.length(), value);
+        }
+        break;
+      }
+      default: {
+        group.get(key.c_str(), key.length(), values);
+        for (std::size_t j = 0; j < NUM_SKETCHES; ++j) {
+          MADOKA_THROW_IF(values[j] !=
+                          expected_sketches[j].get(key.c_str(), key.length()));
+        }
+        break;
+      }
+    }
+  }
+
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    for (std::size_t j = 0; j < NUM_SKETCHES; ++j) {
+      MADOKA_THROW_IF(sketches[j].get(keys[i].c_str(), keys[i].length()) !=
+          expected_sketches[j].get(keys[i].c_str(), keys[i].length()));
+    }
+  }
+
+  group.clear();
+  MADOKA_THROW_IF(!group.empty());
+  group.insert(&other_sketch);
+  MADOKA_THROW_IF(group.seed() != (SEED + 1));
+}
+
+}  // namespace
+
+int main() try {
+  std::vector<std::string> keys;
+  generate_keys(&keys);
+
+  std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": "
+            << "test_key_hash()" << std::endl;
+  test_key_hash(keys);
+
+  std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": "
+            << "test_sketch_group()" << std::endl;
+  test_sketch_group(keys);
+
+  return 0;
+} catch (const madoka::Exception &ex) {
+  std::cerr << "error: " << ex.what() << std::endl;
+  return 1;
+}
@@ -0,0 +1,202 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <madoka/sketch-merge.h>
+
+namespace {
+
+const std::size_t NUM_SOURCES = 9;
+const std::size_t NUM_KEYS = 1 << 10;
+const std::size_t NUM_UPDATES = 1 << 12;
+const madoka::UInt64 WIDTH = 1 << 12;
+const madoka::UInt64 SEED = 7;
+
+const char PATH[] = "sketch-merge-test.temp";
+
+std::string get_src_path(std::size_t src_id) {
+  return std::string(PATH) + '.' + std::to_string(src_id);
+}
+
+// run_in_reverse() is an executor that runs tasks in reverse order.
+void run_in_reverse(madoka::SketchTask task, void *arg,
+                    madoka::UInt64 num_tasks) {
+  for (madoka::UInt64 task_id = num_tasks; task_id > 0; --task_id) {
+    task(arg, task_id - 1);
+  }
+}
+
+void test_merge_sketch_files(madoka::UInt64 max_value, int flags,
+                             madoka::SketchMergeMode mode) {
+  std::mt19937 random_engine(1);
+  std::vector<std::string> keys;
+  for (std::size_t i = 0; i < NUM_KEYS; ++i) {
+    keys.push_back(std::to_string(i));
+  }
+
+  std::vector<std::string> src_paths;
+  for (std::size_t i = 0; i < NUM_SOURCES; ++i) {
+    src_paths.push_back(get_src_path(i));
+    madoka::Sketch sketch;
+    sketch.create(WIDTH, max_value, src_paths[i].c_str(),
+                  madoka::FILE_TRUNCATE | flags, SEED);
+    for (std::size_t j = 0; j < NUM_UPDATES; ++j) {
+      const std::size_t id = random_engine() % NUM_KEYS;
+      sketch.inc(keys[id].c_str(), keys[id].length());
+    }
+  }
+  std::vector<const char *> src_path_ptrs;
+  for (std::size_t i = 0; i < NUM_SOURCES; ++i) {
+    src_path_ptrs.push_back(src_paths[i].c_str());
+  }
+
+  // `expected' merges the sources one by one.
+  madoka::Sketch expected;
+  for (std::size_t i = 0; i < NUM_SOURCES; ++i) {
+    madoka::Sketch src;
+    src.open(src_paths[i].c_str(), madoka::FILE_PRIVATE);
+    if (i == 0) {
+      expected.copy(src);
+    } else {
+      expected.merge(src, mode);
+    }
+  }
+  const bool is_exact = expected.mode() == madoka::SKETCH_EXACT_MODE;
+
+  const std::size_t MAX_NUM_FILES_LIST[] = { 2, 4, 6, 64 };
+  for (std::size_t i = 0;
+       i < (sizeof(MAX_NUM_FILES_LIST) / sizeof(MAX_NUM_FILES_LIST[0]));
+       ++i) {
+    for (int j = 0; j < 2; ++j) {
+      madoka::merge_sketch_files(PATH, &src_path_ptrs[0], NUM_SOURCES, mode,
+                                 madoka::FILE_TRUNCATE,
+                                 MAX_NUM_FILES_LIST[i],
+                                 (j == 0) ? NULL : run_in_reverse);
+
+      madoka::Sketch sketch;
+      sketch.open(PATH, madoka::FILE_READONLY | madoka::SKETCH_DECODE_LOWER);
+      MADOKA_THROW_IF(sketch.width() != expected.width());
+      MADOKA_THROW_IF(sketch.max_value() != expected.max_value());
+      MADOKA_THROW_IF(sketch.seed() != SEED);
+      MADOKA_THROW_IF(sketch.flags() & ~flags &
+                      madoka::SKETCH_HEADER_FLAGS);
+
+      // Merges of exact values and max or min merges of approx values are
+      // associative, so the tree must give the same values. Approx sums are
+      // rounded at random, so only their total is compared.
+      double total = 0.0;
+      double expected_total = 0.0;
+      for (std::size_t k = 0; k < NUM_KEYS; ++k) {
+        const madoka::UInt64 value = sketch.get(keys[k].c_str(),
+                                                keys[k].length());
+        const madoka::UInt64 expected_value = expected.get(
+            keys[k].c_str(), keys[k].length(), madoka::SKETCH_LOWER_DECODE);
+        if (is_exact || (mode != madoka::SKETCH_SUM_MERGE)) {
+          MADOKA_THROW_IF(value != expected_value);
+        }
+        total += static_cast<double>(value);
+        expected_total += static_cast<double>(expected_value);
+      }
+      MADOKA_THROW_IF(total < (expected_total * 0.9));
+      MADOKA_THROW_IF(total > (expected_total * 1.1));
+    }
+  }
+}
+
+void test_errors() {
+  std::vector<std::string> src_paths;
+  for (std::size_t i = 0; i < 2; ++i) {
+    src_paths.push_back(get_src_path(i));
+    madoka::Sketch sketch;
+    sketch.create(WIDTH, 255, src_paths[i].c_str(), madoka::FILE_TRUNCATE,
+                  SEED + i);
+  }
+  const char * const src_path_ptrs[] = {
+    src_paths[0].c_str(), src_paths[1].c_str()
+  };
+
+  // The seeds differ.
+  bool is_thrown = false;
+  try {
+    madoka::merge_sketch_files(PATH, src_path_ptrs, 2);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+
+  is_thrown = false;
+  try {
+    madoka::merge_sketch_files(PATH, src_path_ptrs, 1,
+                               madoka::SKETCH_SUM_MERGE, madoka::FILE_TRUNCATE,
+                               1);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+
+  madoka::merge_sketch_files(PATH, src_path_ptrs, 1,
+                             madoka::SKETCH_SUM_MERGE, madoka::FILE_TRUNCATE);
+  madoka::Sketch sketch;
+  sketch.open(PATH, madoka::FILE_READONLY);
+  MADOKA_THROW_IF(sketch.seed() != SEED);
+}
+
+}  // namespace
+
+int main() try {
+#define TEST_MERGE_SKETCH_FILES(max_value, flags, mode) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "test_merge_sketch_files(" #max_value ", " #flags ", " \
+              #mode ")" << std::endl), \
+   test_merge_sketch_files(max_value, flags, mode))
+
+  TEST_MERGE_SKETCH_FILES(255, 0, madoka::SKETCH_SUM_MERGE);
+  TEST_MERGE_SKETCH_FILES(15, madoka::SKETCH_BLOCKED_LAYOUT,
+                          madoka::SKETCH_SUM_MERGE);
+  TEST_MERGE_SKETCH_FILES(65535, madoka::SKETCH_TOP_K,
+                          madoka::SKETCH_MAX_MERGE);
+  TEST_MERGE_SKETCH_FILES(0, 0, madoka::SKETCH_SUM_MERGE);
+  TEST_MERGE_SKETCH_FILES(0, madoka::SKETCH_FAST_RANGE,
+                          madoka::SKETCH_MIN_MERGE);
+
+#undef TEST_MERGE_SKETCH_FILES
+
+  std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": "
+            << "test_errors()" << std::endl;
+  test_errors();
+
+  std::remove(PATH);
+  for (std::size_t i = 0; i < NUM_SOURCES; ++i) {
+    std::remove(get_src_path(i).c_str());
+  }
+  return 0;
+} catch (const madoka::Exception &ex) {
+  std::cerr << "error: " << ex.what() << std::endl;
+  return 1;
+}
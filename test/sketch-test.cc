@@ -26,6 +26,7 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <random>
@@ -70,7 +71,7 @@ void generate_keys(std::vector<std::string> *keys,
   std::shuffle(ids->begin(), ids->end(), random_engine);
 }
 
-void basic_test(madoka::UInt64 max_value,
+void basic_test(madoka::UInt64 max_value, int flags,
                 const std::vector<std::string> &keys,
                 const std::vector<madoka::UInt64> &original_freqs,
                 const std::vector<std::size_t> &ids) {
@@ -81,8 +82,14 @@ void basic_test(madoka::UInt64 max_value,
   madoka::Sketch sketch;
   std::vector<char> sketch_buf;
 
-  sketch.create(keys.size(), max_value, PATH);
-  MADOKA_THROW_IF(sketch.width() != keys.size());
+  sketch.create(keys.size(), max_value, PATH, flags);
+  MADOKA_THROW_IF(sketch.width() < keys.size());
+  MADOKA_THROW_IF(sketch.width() >= (keys.size() + sketch.block_width()));
+  MADOKA_THROW_IF((sketch.width() % sketch.block_width()) != 0);
+  MADOKA_THROW_IF((sketch.flags() & madoka::SKETCH_BLOCKED_LAYOUT) !=
+                  (flags & madoka::SKETCH_BLOCKED_LAYOUT));
+  MADOKA_THROW_IF((sketch.flags() & madoka::SKETCH_FAST_RANGE) !=
+                  (flags & madoka::SKETCH_FAST_RANGE));
   MADOKA_THROW_IF(sketch.depth() != madoka::SKETCH_DEPTH);
   MADOKA_THROW_IF(sketch.max_value() != max_value);
   MADOKA_THROW_IF(sketch.seed() != 0);
@@ -136,8 +143,8 @@ void basic_test(madoka::UInt64 max_value,
     MADOKA_THROW_IF(sketch.get(keys[i].c_str(), keys[i].length()) != 0);
   }
 
-  sketch.create(keys.size() + 13, max_value, NULL, 0, 123456789);
-  MADOKA_THROW_IF(sketch.width() != (keys.size() + 13));
+  sketch.create(keys.size() + 13, max_value, NULL, flags, 123456789);
+  MADOKA_THROW_IF(sketch.width() < (keys.size() + 13));
   MADOKA_THROW_IF(sketch.depth() != madoka::SKETCH_DEPTH);
   MADOKA_THROW_IF(sketch.seed() != 123456789);
 
@@ -196,7 +203,7 @@ void basic_test(madoka::UInt64 max_value,
   MADOKA_THROW_IF(std::remove(PATH) == -1);
 }
 
-void extra_test(madoka::UInt64 max_value,
+void extra_test(madoka::UInt64 max_value, int flags,
                 const std::vector<std::string> &keys,
                 const std::vector<madoka::UInt64> &original_freqs,
                 const std::vector<std::size_t> &) {
@@ -207,7 +214,11 @@ void extra_test(madoka::UInt64 max_value,
   std::remove(PATH_2);
 
   madoka::Sketch sketch;
-  sketch.create(keys.size(), max_value);
+  sketch.create(keys.size(), max_value, NULL, flags);
+  if (((sketch.width() / sketch.block_width()) % 2) != 0) {
+    sketch.create(sketch.width() + sketch.block_width(), max_value, NULL,
+                  flags);
+  }
 
   std::vector<madoka::UInt64> freqs;
   for (std::size_t i = 0; i < keys.size(); ++i) {
@@ -288,21 +299,28 @@ void extra_test(madoka::UInt64 max_value,
     }
   }
 
+  // A blocked sketch reshapes its blocks for a new max_value, and then a
+  // cell may also take the values of the neighbouring slots.
+  const bool is_blocked = (flags & madoka::SKETCH_BLOCKED_LAYOUT) != 0;
   sketch_2.shrink(sketch, 0, 15);
-  MADOKA_THROW_IF(sketch_2.width() != sketch.width());
+  MADOKA_THROW_IF(!is_blocked && (sketch_2.width() != sketch.width()));
   MADOKA_THROW_IF(sketch_2.max_value() != 15);
   for (std::size_t i = 0; i < keys.size(); ++i) {
-    MADOKA_THROW_IF(sketch_2.get(keys[i].c_str(), keys[i].length()) !=
-                    std::min(freqs[i], sketch_2.max_value()));
+    const madoka::UInt64 expected = std::min(freqs[i], sketch_2.max_value());
+    const madoka::UInt64 value =
+        sketch_2.get(keys[i].c_str(), keys[i].length());
+    MADOKA_THROW_IF(is_blocked ? (value < expected) : (value != expected));
   }
 
   sketch_2.shrink(sketch, 0, 1,
                   [](madoka::UInt64 x) -> madoka::UInt64 { return x > 10; });
-  MADOKA_THROW_IF(sketch_2.width() != sketch.width());
+  MADOKA_THROW_IF(!is_blocked && (sketch_2.width() != sketch.width()));
   MADOKA_THROW_IF(sketch_2.max_value() != 1);
   for (std::size_t i = 0; i < keys.size(); ++i) {
-    MADOKA_THROW_IF(sketch_2.get(keys[i].c_str(), keys[i].length()) !=
-                    (freqs[i] > 10));
+    const madoka::UInt64 expected = freqs[i] > 10;
+    const madoka::UInt64 value =
+        sketch_2.get(keys[i].c_str(), keys[i].length());
+    MADOKA_THROW_IF(is_blocked ? (value < expected) : (value != expected));
   }
 
   sketch_2.copy(sketch, PATH_2, madoka::FILE_TRUNCATE);
@@ -339,6 +357,856 @@ void extra_test(madoka::UInt64 max_value,
   MADOKA_THROW_IF(std::remove(PATH_2) == -1);
 }
 
+// count_filter() is an identity filter that counts its calls.
+madoka::UInt64 num_filter_calls = 0;
+madoka::UInt64 count_filter(madoka::UInt64 value) {
+  ++num_filter_calls;
+  return value;
+}
+
+void filter_test(madoka::UInt64 max_value, int flags,
+                 const std::vector<std::string> &keys,
+                 const std::vector<madoka::UInt64> &original_freqs,
+                 const std::vector<std::size_t> &) {
+  struct FilterCase {
+    madoka::SketchFilterOp op;
+    madoka::UInt64 param;
+  };
+  const FilterCase CASES[] = {
+    { madoka::SKETCH_THRESHOLD_FILTER, 3 },
+    { madoka::SKETCH_THRESHOLD_FILTER, 1ULL << 20 },
+    { madoka::SKETCH_SHIFT_FILTER, 1 },
+    { madoka::SKETCH_SHIFT_FILTER, 5 },
+    { madoka::SKETCH_SHIFT_FILTER, 64 },
+    { madoka::SKETCH_SCALE_FILTER, 3 },
+    { madoka::SKETCH_SCALE_FILTER, 1ULL << 40 },
+    { madoka::SKETCH_CLAMP_FILTER, 100 },
+    { madoka::SKETCH_DECAY_FILTER, madoka::SKETCH_DECAY_FILTER_ONE * 9 / 10 },
+    { madoka::SKETCH_DECAY_FILTER, madoka::SKETCH_DECAY_FILTER_ONE }
+  };
+  const std::size_t NUM_CASES = sizeof(CASES) / sizeof(CASES[0]);
+
+  madoka::Sketch sketch;
+  sketch.create(keys.size() / 4, max_value, NULL, flags);
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    sketch.add(keys[i].c_str(), keys[i].length(), original_freqs[i]);
+  }
+  const bool is_exact = sketch.mode() == madoka::SKETCH_EXACT_MODE;
+
+  for (std::size_t i = 0; i < NUM_CASES; ++i) {
+    const madoka::UInt64 param = CASES[i].param;
+    // `expected' is the reference implementation of the built-in filter.
+    const madoka::UInt64 limit = sketch.max_value();
+    auto expected = [&](madoka::UInt64 value) -> madoka::UInt64 {
+      long double result = static_cast<long double>(value);
+      switch (CASES[i].op) {
+        case madoka::SKETCH_THRESHOLD_FILTER: {
+          result = (value < param) ? 0 : value;
+          break;
+        }
+        case madoka::SKETCH_SHIFT_FILTER: {
+          result = (param < 64) ? (value >> param) : 0;
+          break;
+        }
+        case madoka::SKETCH_SCALE_FILTER: {
+          result *= static_cast<long double>(param);
+          break;
+        }
+        case madoka::SKETCH_CLAMP_FILTER: {
+          result = (value < param) ? value : param;
+          break;
+        }
+        case madoka::SKETCH_DECAY_FILTER: {
+          result = std::floor(result * param / 65536);
+          break;
+        }
+      }
+      return (result < limit) ? static_cast<madoka::UInt64>(result) : limit;
+    };
+
+    madoka::Sketch builtin_sketch;
+    builtin_sketch.copy(sketch);
+    builtin_sketch.filter(CASES[i].op, param);
+    madoka::Sketch functor_sketch;
+    functor_sketch.copy(sketch);
+    functor_sketch.filter(expected);
+
+    for (std::size_t j = 0; j < keys.size(); ++j) {
+      const std::string &key = keys[j];
+      const madoka::UInt64 value =
+          builtin_sketch.get(key.c_str(), key.length());
+      if (is_exact) {
+        MADOKA_THROW_IF(value !=
+                        functor_sketch.get(key.c_str(), key.length()));
+        // A hot key gets its pending count back in the cells on filter().
+        if (sketch.num_hot_keys() == 0) {
+          MADOKA_THROW_IF(value !=
+                          expected(sketch.get(key.c_str(), key.length())));
+        }
+      } else if (((CASES[i].op == madoka::SKETCH_THRESHOLD_FILTER) &&
+                  (param > limit)) ||
+                 ((CASES[i].op == madoka::SKETCH_SHIFT_FILTER) &&
+                  (param >= 64))) {
+        MADOKA_THROW_IF(value != 0);
+      } else if (CASES[i].op == madoka::SKETCH_CLAMP_FILTER) {
+        MADOKA_THROW_IF(value > (param * 2));
+      }
+    }
+  }
+
+  // A function pointer is called once per cell.
+  num_filter_calls = 0;
+  sketch.filter(count_filter);
+  MADOKA_THROW_IF(num_filter_calls != (sketch.width() * madoka::SKETCH_DEPTH));
+
+  bool is_thrown = false;
+  try {
+    sketch.filter(madoka::SKETCH_DECAY_FILTER,
+                  madoka::SKETCH_DECAY_FILTER_ONE + 1);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+
+  is_thrown = false;
+  try {
+    sketch.filter(static_cast<madoka::SketchFilterOp>(-1), 0);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+}
+
+void merge_test(madoka::UInt64 max_value, int flags,
+                const std::vector<std::string> &keys,
+                const std::vector<madoka::UInt64> &original_freqs,
+                const std::vector<std::size_t> &) {
+  const madoka::SketchMergeMode MODES[] = {
+    madoka::SKETCH_SUM_MERGE,
+    madoka::SKETCH_MAX_MERGE,
+    madoka::SKETCH_MIN_MERGE
+  };
+  const std::size_t NUM_MODES = sizeof(MODES) / sizeof(MODES[0]);
+
+  madoka::Sketch lhs;
+  lhs.create(keys.size() / 4, max_value, NULL, flags, 1);
+  madoka::Sketch rhs;
+  rhs.create(keys.size() / 4, max_value, NULL, flags, 1);
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    lhs.add(keys[i].c_str(), keys[i].length(), original_freqs[i]);
+    rhs.add(keys[i].c_str(), keys[i].length(),
+            original_freqs[keys.size() - 1 - i]);
+  }
+  const bool is_exact = lhs.mode() == madoka::SKETCH_EXACT_MODE;
+  const bool has_hot_keys =
+      (lhs.num_hot_keys() != 0) || (rhs.num_hot_keys() != 0);
+
+  for (std::size_t i = 0; i < NUM_MODES; ++i) {
+    const madoka::SketchMergeMode mode = MODES[i];
+
+    // An identity filter makes merge() go through the scalar path.
+    madoka::Sketch sketch;
+    sketch.copy(lhs);
+    sketch.merge(rhs, mode);
+    madoka::Sketch scalar_sketch;
+    scalar_sketch.copy(lhs);
+    scalar_sketch.merge(rhs, mode,
+                        [](madoka::UInt64 x) { return x; }, NULL);
+
+    for (std::size_t j = 0; j < keys.size(); ++j) {
+      const std::string &key = keys[j];
+      madoka::UInt64 value = sketch.get(key.c_str(), key.length());
+      madoka::UInt64 scalar_value =
+          scalar_sketch.get(key.c_str(), key.length());
+      madoka::UInt64 lhs_value = lhs.get(key.c_str(), key.length());
+      madoka::UInt64 rhs_value = rhs.get(key.c_str(), key.length());
+      if (!is_exact) {
+        value = madoka::Approx::encode(value);
+        scalar_value = madoka::Approx::encode(scalar_value);
+        lhs_value = madoka::Approx::encode(lhs_value);
+        rhs_value = madoka::Approx::encode(rhs_value);
+      }
+      if (is_exact || (mode != madoka::SKETCH_SUM_MERGE)) {
+        MADOKA_THROW_IF(value != scalar_value);
+      }
+      if (has_hot_keys) {
+        continue;
+      }
+      // Each cell of a max merge is not less than the cells of both inputs,
+      // and each cell of a min merge is not greater.
+      if (mode == madoka::SKETCH_MAX_MERGE) {
+        MADOKA_THROW_IF(value < std::max(lhs_value, rhs_value));
+      } else if (mode == madoka::SKETCH_MIN_MERGE) {
+        MADOKA_THROW_IF(value > std::min(lhs_value, rhs_value));
+      }
+    }
+  }
+
+  bool is_thrown = false;
+  try {
+    lhs.merge(rhs, static_cast<madoka::SketchMergeMode>(-1));
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+}
+
+void inner_products_test(madoka::UInt64 max_value, int flags,
+                         const std::vector<std::string> &keys,
+                         const std::vector<madoka::UInt64> &original_freqs,
+                         const std::vector<std::size_t> &) {
+  // More than SKETCH_MAX_TILE_SKETCHES sketches make more than one tile.
+  const std::size_t NUM_SKETCHES = madoka::SKETCH_MAX_TILE_SKETCHES + 6;
+  const madoka::UInt64 WIDTH = 1 << 10;
+
+  std::vector<madoka::Sketch> sketches(NUM_SKETCHES);
+  std::vector<const madoka::Sketch *> sketch_ptrs(NUM_SKETCHES);
+  for (std::size_t i = 0; i < NUM_SKETCHES; ++i) {
+    sketches[i].create(WIDTH, max_value, NULL, flags, 1);
+    for (std::size_t j = i % 7; j < keys.size(); j += 1 + (i % 5)) {
+      sketches[i].add(keys[j].c_str(), keys[j].length(), original_freqs[j]);
+    }
+    sketch_ptrs[i] = &sketches[i];
+  }
+  const bool is_exact = sketches[0].mode() == madoka::SKETCH_EXACT_MODE;
+
+  std::vector<double> inner_products(NUM_SKETCHES * NUM_SKETCHES);
+  std::vector<double> square_lengths(NUM_SKETCHES * NUM_SKETCHES);
+  madoka::Sketch::inner_products(&sketch_ptrs[0], NUM_SKETCHES,
+                                 &inner_products[0], &square_lengths[0]);
+  for (std::size_t i = 0; i < NUM_SKETCHES; ++i) {
+    for (std::size_t j = 0; j < NUM_SKETCHES; ++j) {
+      const std::size_t pair_id = (i * NUM_SKETCHES) + j;
+      const std::size_t rev_pair_id = (j * NUM_SKETCHES) + i;
+      MADOKA_THROW_IF(inner_products[pair_id] !=
+                      inner_products[rev_pair_id]);
+      if (is_exact) {
+        double lhs_square_length;
+        double rhs_square_length;
+        const double inner_product = sketches[i].inner_product(
+            sketches[j], &lhs_square_length, &rhs_square_length);
+        MADOKA_THROW_IF(inner_products[pair_id] != inner_product);
+        MADOKA_THROW_IF(square_lengths[pair_id] != lhs_square_length);
+        MADOKA_THROW_IF(square_lengths[rev_pair_id] != rhs_square_length);
+      } else {
+        const double cosine = inner_products[pair_id] /
+            std::sqrt(square_lengths[pair_id]) /
+            std::sqrt(square_lengths[rev_pair_id]);
+        MADOKA_THROW_IF(cosine < 0.0);
+        MADOKA_THROW_IF(cosine > (1.0 + 1e-9));
+      }
+    }
+  }
+
+  // square_lengths is optional.
+  std::vector<double> inner_products_2(NUM_SKETCHES * NUM_SKETCHES);
+  madoka::Sketch::inner_products(&sketch_ptrs[0], NUM_SKETCHES,
+                                 &inner_products_2[0]);
+  if (is_exact) {
+    MADOKA_THROW_IF(inner_products_2 != inner_products);
+  }
+
+  madoka::Sketch other;
+  other.create(WIDTH * 2, max_value, NULL, flags, 1);
+  sketch_ptrs.push_back(&other);
+  inner_products.resize(sketch_ptrs.size() * sketch_ptrs.size());
+  bool is_thrown = false;
+  try {
+    madoka::Sketch::inner_products(&sketch_ptrs[0], sketch_ptrs.size(),
+                                   &inner_products[0]);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+}
+
+void format_test(const std::vector<std::string> &keys,
+                 const std::vector<madoka::UInt64> &original_freqs) {
+  madoka::Sketch sketch;
+  sketch.create(keys.size() / 4, 255, NULL, 0, 1);
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    sketch.add(keys[i].c_str(), keys[i].length(), original_freqs[i]);
+  }
+  MADOKA_THROW_IF(sketch.version() != madoka::SKETCH_FORMAT_VERSION);
+  MADOKA_THROW_IF((sketch.file_size() - sketch.table_size()) !=
+                  madoka::SKETCH_PAGE_SIZE);
+
+  madoka::Sketch huge_sketch;
+  huge_sketch.create(keys.size() / 4, 255, NULL,
+                     madoka::SKETCH_HUGE_PAGE_ALIGNED |
+                     madoka::SKETCH_TOP_K, 1);
+  MADOKA_THROW_IF(!(huge_sketch.flags() & madoka::SKETCH_HUGE_PAGE_ALIGNED));
+  MADOKA_THROW_IF((huge_sketch.file_size() - huge_sketch.table_size()) !=
+                  madoka::SKETCH_HUGE_PAGE_SIZE);
+
+  // A sketch of format version 0 has no magic number, and its table follows
+  // the header and the generator directly.
+  const std::size_t table_size =
+      static_cast<std::size_t>(sketch.table_size());
+  const std::size_t legacy_offset =
+      sizeof(madoka::Header) + sizeof(madoka::Random);
+  std::vector<char> buf(static_cast<std::size_t>(sketch.file_size()));
+  sketch.serialize(&buf[0], buf.size());
+  std::vector<char> legacy_buf(legacy_offset + table_size);
+  std::memcpy(&legacy_buf[0], &buf[0], legacy_offset);
+  std::memcpy(&legacy_buf[legacy_offset], &buf[buf.size() - table_size],
+              table_size);
+  madoka::Header * const header =
+      reinterpret_cast<madoka::Header *>(&legacy_buf[0]);
+  header->set_version(0);
+  header->set_magic(0);
+  header->set_file_size(legacy_buf.size());
+
+  madoka::Sketch legacy_sketch;
+  legacy_sketch.deserialize(&legacy_buf[0], legacy_buf.size());
+  MADOKA_THROW_IF(legacy_sketch.version() != 0);
+  MADOKA_THROW_IF(legacy_sketch.file_size() != legacy_buf.size());
+
+  // copy() writes the current format.
+  madoka::Sketch upgraded_sketch;
+  upgraded_sketch.copy(legacy_sketch);
+  MADOKA_THROW_IF(upgraded_sketch.version() != madoka::SKETCH_FORMAT_VERSION);
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const madoka::UInt64 value = sketch.get(keys[i].c_str(), keys[i].length());
+    MADOKA_THROW_IF(legacy_sketch.get(keys[i].c_str(), keys[i].length()) !=
+                    value);
+    MADOKA_THROW_IF(upgraded_sketch.get(keys[i].c_str(), keys[i].length()) !=
+                    value);
+  }
+
+  // A magic number needs a version, and an unknown version is rejected.
+  const madoka::UInt64 VERSIONS[] = { 0, madoka::SKETCH_FORMAT_VERSION + 1 };
+  for (std::size_t i = 0; i < (sizeof(VERSIONS) / sizeof(VERSIONS[0])); ++i) {
+    madoka::Header * const new_header =
+        reinterpret_cast<madoka::Header *>(&buf[0]);
+    new_header->set_version(VERSIONS[i]);
+    bool is_thrown = false;
+    try {
+      legacy_sketch.deserialize(&buf[0], buf.size());
+    } catch (const madoka::Exception &) {
+      is_thrown = true;
+    }
+    MADOKA_THROW_IF(!is_thrown);
+  }
+}
+
+void blocked_shrink_test(int flags, const std::vector<std::string> &keys,
+                         const std::vector<madoka::UInt64> &original_freqs) {
+  const madoka::UInt64 MAX_VALUES[] = {
+    1, 15, 255, 65535, madoka::SKETCH_MAX_MAX_VALUE
+  };
+  const madoka::UInt64 WIDTHS[] = { 0, 1 << 11, 1000, 1 };
+
+  madoka::Sketch sketch;
+  sketch.create(1 << 12, 255, NULL, flags, 1);
+  MADOKA_THROW_IF(sketch.block_width() == 1);
+  const madoka::UInt64 num_blocks = sketch.width() / sketch.block_width();
+  std::vector<madoka::UInt64> freqs(keys.size());
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    freqs[i] = sketch.add(keys[i].c_str(), keys[i].length(),
+                          original_freqs[i]);
+  }
+
+  for (std::size_t i = 0; i < (sizeof(MAX_VALUES) / sizeof(MAX_VALUES[0]));
+       ++i) {
+    for (std::size_t j = 0; j < (sizeof(WIDTHS) / sizeof(WIDTHS[0])); ++j) {
+      madoka::Sketch shrunk_sketch;
+      shrunk_sketch.shrink(sketch, WIDTHS[j], MAX_VALUES[i]);
+      MADOKA_THROW_IF(shrunk_sketch.block_width() == 1);
+      MADOKA_THROW_IF(shrunk_sketch.max_value() != MAX_VALUES[i]);
+      const madoka::UInt64 num_shrunk_blocks =
+          shrunk_sketch.width() / shrunk_sketch.block_width();
+      MADOKA_THROW_IF((num_blocks % num_shrunk_blocks) != 0);
+      MADOKA_THROW_IF((num_shrunk_blocks < num_blocks) &&
+                      (shrunk_sketch.width() < WIDTHS[j]));
+
+      for (std::size_t k = 0; k < keys.size(); ++k) {
+        const madoka::UInt64 expected =
+            std::min(freqs[k], shrunk_sketch.max_value());
+        const madoka::UInt64 value =
+            shrunk_sketch.get(keys[k].c_str(), keys[k].length());
+        if (shrunk_sketch.mode() == madoka::SKETCH_EXACT_MODE) {
+          MADOKA_THROW_IF(value < expected);
+        } else {
+          MADOKA_THROW_IF(madoka::Approx::encode(value) <
+                          madoka::Approx::encode(expected));
+        }
+      }
+    }
+  }
+}
+
+// layout_flags_test() checks that copy() and shrink() keep the layout of
+// the source whatever flags they are given.
+void layout_flags_test(const std::vector<std::string> &keys,
+                       const std::vector<madoka::UInt64> &original_freqs) {
+  const int LAYOUT_FLAGS =
+      madoka::SKETCH_BLOCKED_LAYOUT | madoka::SKETCH_FAST_RANGE;
+
+  madoka::Sketch sketch;
+  sketch.create(1 << 12, 255, NULL, 0, 1);
+  std::vector<madoka::UInt64> freqs(keys.size());
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    freqs[i] = sketch.add(keys[i].c_str(), keys[i].length(),
+                          original_freqs[i]);
+  }
+
+  madoka::Sketch copied_sketch;
+  copied_sketch.copy(sketch, NULL, LAYOUT_FLAGS);
+  MADOKA_THROW_IF(copied_sketch.flags() & LAYOUT_FLAGS);
+  MADOKA_THROW_IF(copied_sketch.width() != sketch.width());
+  MADOKA_THROW_IF(copied_sketch.table_size() != sketch.table_size());
+
+  madoka::Sketch shrunk_sketch;
+  shrunk_sketch.shrink(sketch, 1 << 11, 0, NULL, NULL, LAYOUT_FLAGS);
+  MADOKA_THROW_IF(shrunk_sketch.flags() & LAYOUT_FLAGS);
+  MADOKA_THROW_IF(shrunk_sketch.width() != (1 << 11));
+
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const char * const key = keys[i].c_str();
+    const std::size_t key_size = keys[i].length();
+    MADOKA_THROW_IF(copied_sketch.get(key, key_size) !=
+                    sketch.get(key, key_size));
+    MADOKA_THROW_IF(shrunk_sketch.get(key, key_size) < freqs[i]);
+  }
+
+  // A fast range sketch keeps its mapping without the flag, and a modulo
+  // mapped sketch rejects a merge with it.
+  madoka::Sketch fast_sketch;
+  fast_sketch.create(1 << 12, 255, NULL, madoka::SKETCH_FAST_RANGE, 1);
+  copied_sketch.copy(fast_sketch);
+  MADOKA_THROW_IF(!(copied_sketch.flags() & madoka::SKETCH_FAST_RANGE));
+  shrunk_sketch.shrink(fast_sketch, 1 << 11);
+  MADOKA_THROW_IF(!(shrunk_sketch.flags() & madoka::SKETCH_FAST_RANGE));
+
+  bool is_thrown = false;
+  try {
+    copied_sketch.merge(sketch);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+}
+
+void batch_test(madoka::UInt64 max_value, int flags,
+                const std::vector<std::string> &keys,
+                const std::vector<madoka::UInt64> &,
+                const std::vector<std::size_t> &ids) {
+  const std::size_t CHUNK_SIZES[] = { 1, 3, 16, 17, 1000 };
+  const std::size_t NUM_CHUNK_SIZES =
+      sizeof(CHUNK_SIZES) / sizeof(CHUNK_SIZES[0]);
+
+  madoka::Sketch sketch;
+  sketch.create(keys.size() / 4, max_value, NULL, flags);
+  madoka::Sketch batch_sketch;
+  batch_sketch.copy(sketch);
+
+  std::vector<const void *> key_addrs;
+  std::vector<std::size_t> key_sizes;
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    key_addrs.push_back(keys[ids[i]].c_str());
+    key_sizes.push_back(keys[ids[i]].length());
+  }
+
+  std::vector<madoka::UInt64> values(ids.size());
+  std::vector<madoka::UInt64> batch_values(ids.size());
+
+  madoka::Sketch::reset_thread_counter();
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    values[i] = sketch.inc(key_addrs[i], key_sizes[i]);
+  }
+  madoka::Sketch::reset_thread_counter();
+  for (std::size_t i = 0, j = 0; i < ids.size(); ++j) {
+    const std::size_t num_keys =
+        std::min(CHUNK_SIZES[j % NUM_CHUNK_SIZES], ids.size() - i);
+    batch_sketch.inc_batch(&key_addrs[i], &key_sizes[i], num_keys,
+                           &batch_values[i]);
+    i += num_keys;
+  }
+  MADOKA_THROW_IF(values != batch_values);
+
+  madoka::Sketch::reset_thread_counter();
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    values[i] = i % 7;
+    sketch.add(key_addrs[i], key_sizes[i], values[i]);
+  }
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    sketch.set(key_addrs[i], key_sizes[i], values[i] * 3);
+  }
+  batch_values = values;
+  madoka::Sketch::reset_thread_counter();
+  batch_sketch.add_batch(key_addrs.data(), key_sizes.data(), ids.size(),
+                         batch_values.data(), batch_values.data());
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    batch_values[i] = values[i] * 3;
+  }
+  batch_sketch.set_batch(key_addrs.data(), key_sizes.data(), ids.size(),
+                         batch_values.data());
+
+  madoka::Sketch::reset_thread_counter();
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    values[i] = sketch.get(key_addrs[i], key_sizes[i]);
+  }
+  madoka::Sketch::reset_thread_counter();
+  for (std::size_t i = 0, j = 0; i < ids.size(); ++j) {
+    const std::size_t num_keys =
+        std::min(CHUNK_SIZES[j % NUM_CHUNK_SIZES], ids.size() - i);
+    batch_sketch.get_batch(&key_addrs[i], &key_sizes[i], num_keys,
+                           &batch_values[i]);
+    i += num_keys;
+  }
+  MADOKA_THROW_IF(values != batch_values);
+}
+
+void decode_test(int flags, const std::vector<std::string> &keys,
+                 const std::vector<madoka::UInt64> &,
+                 const std::vector<std::size_t> &ids) {
+  const char PATH[] = "sketch-test.temp.1";
+
+  std::remove(PATH);
+
+  madoka::Sketch sketch;
+  sketch.create(keys.size() / 4, madoka::SKETCH_MAX_MAX_VALUE, PATH, flags);
+  MADOKA_THROW_IF(sketch.decode() != madoka::SKETCH_RANDOM_DECODE);
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    sketch.inc(keys[ids[i]].c_str(), keys[ids[i]].length());
+  }
+
+  std::vector<madoka::UInt64> lower_values(keys.size());
+  std::vector<madoka::UInt64> midpoint_values(keys.size());
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const madoka::UInt64 value = sketch.get(keys[i].c_str(),
+                                            keys[i].length());
+    lower_values[i] = sketch.get(keys[i].c_str(), keys[i].length(),
+                                 madoka::SKETCH_LOWER_DECODE);
+    midpoint_values[i] = sketch.get(sketch.hash(keys[i].c_str(),
+                                                keys[i].length()),
+                                    madoka::SKETCH_MIDPOINT_DECODE);
+    MADOKA_THROW_IF(lower_values[i] > midpoint_values[i]);
+    MADOKA_THROW_IF(lower_values[i] > value);
+    MADOKA_THROW_IF(madoka::Approx::encode(lower_values[i]) !=
+                    madoka::Approx::encode(value));
+    MADOKA_THROW_IF(madoka::Approx::encode(midpoint_values[i]) !=
+                    madoka::Approx::encode(value));
+  }
+  sketch.close();
+
+  // A read-only mapping makes any write to the sketch fatal.
+  sketch.open(PATH, madoka::FILE_READONLY | madoka::SKETCH_DECODE_LOWER);
+  MADOKA_THROW_IF(sketch.decode() != madoka::SKETCH_LOWER_DECODE);
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    MADOKA_THROW_IF(sketch.get(keys[i].c_str(), keys[i].length()) !=
+                    lower_values[i]);
+  }
+
+  sketch.open(PATH, madoka::FILE_READONLY | madoka::SKETCH_DECODE_MIDPOINT);
+  MADOKA_THROW_IF(sketch.decode() != madoka::SKETCH_MIDPOINT_DECODE);
+  std::vector<const void *> key_addrs(keys.size());
+  std::vector<std::size_t> key_sizes(keys.size());
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    key_addrs[i] = keys[i].c_str();
+    key_sizes[i] = keys[i].length();
+  }
+  std::vector<madoka::UInt64> values(keys.size());
+  sketch.get_batch(key_addrs.data(), key_sizes.data(), keys.size(),
+                   values.data());
+  MADOKA_THROW_IF(values != midpoint_values);
+
+  bool thrown = false;
+  try {
+    sketch.open(PATH, madoka::SKETCH_DECODE_LOWER |
+                madoka::SKETCH_DECODE_MIDPOINT);
+  } catch (const madoka::Exception &) {
+    thrown = true;
+  }
+  MADOKA_THROW_IF(!thrown);
+
+  sketch.close();
+  MADOKA_THROW_IF(std::remove(PATH) == -1);
+}
+
+void geometric_add_test(int flags) {
+  const madoka::UInt64 NUM_KEYS = 16;
+  const madoka::UInt64 COUNT = 1ULL << 20;
+
+  madoka::Sketch sketch;
+  sketch.create(1 << 10, madoka::SKETCH_MAX_MAX_VALUE, NULL, flags);
+  MADOKA_THROW_IF(!(sketch.flags() & madoka::SKETCH_GEOMETRIC_ADD));
+
+  // Each key gets COUNT in runs of a different length, from 1 to 2^15.
+  for (madoka::UInt64 key = 0; key < NUM_KEYS; ++key) {
+    const madoka::UInt64 run = 1ULL << key;
+    madoka::UInt64 value = 0;
+    for (madoka::UInt64 i = 0; i < COUNT; i += run) {
+      value = sketch.add(&key, sizeof(key), run);
+    }
+    MADOKA_THROW_IF(madoka::Approx::encode(value) !=
+                    madoka::Approx::encode(sketch.get(&key, sizeof(key))));
+  }
+  for (madoka::UInt64 key = 0; key < NUM_KEYS; ++key) {
+    const madoka::UInt64 value = sketch.get(&key, sizeof(key));
+    MADOKA_THROW_IF(value < (COUNT * 0.975));
+    MADOKA_THROW_IF(value > (COUNT * 1.025));
+  }
+
+  sketch.set("query", 5, madoka::SKETCH_MAX_MAX_VALUE - 1);
+  MADOKA_THROW_IF(sketch.add("query", 5, 1 << 20) <
+                  (madoka::SKETCH_MAX_MAX_VALUE * 0.975));
+}
+
+void hot_tier_test(madoka::UInt64 max_value, int flags,
+                   const std::vector<std::string> &keys,
+                   const std::vector<madoka::UInt64> &original_freqs,
+                   const std::vector<std::size_t> &ids) {
+  const char PATH[] = "sketch-test.temp.1";
+  const std::size_t NUM_HOT_KEYS = 8;
+
+  std::remove(PATH);
+
+  // A narrow sketch overestimates keys a lot, except for the hot keys.
+  madoka::Sketch sketch;
+  sketch.create(keys.size() / 64, max_value, PATH,
+                flags | madoka::SKETCH_HOT_TIER);
+  madoka::Sketch plain_sketch;
+  plain_sketch.create(keys.size() / 64, max_value, NULL, flags);
+  MADOKA_THROW_IF(!(sketch.flags() & madoka::SKETCH_HOT_TIER));
+  MADOKA_THROW_IF(sketch.num_hot_keys() != 0);
+  // The HotTier fits in the padding before the page-aligned table.
+  MADOKA_THROW_IF(sketch.file_size() < plain_sketch.file_size());
+
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    const std::string &key = keys[ids[i]];
+    sketch.inc(key.c_str(), key.length());
+    plain_sketch.inc(key.c_str(), key.length());
+  }
+  MADOKA_THROW_IF(sketch.num_hot_keys() != madoka::HOT_TIER_SIZE);
+
+  std::vector<madoka::UInt64> values(keys.size());
+  madoka::UInt64 diff = 0;
+  madoka::UInt64 plain_diff = 0;
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const madoka::UInt64 freq = std::min(original_freqs[i], max_value);
+    values[i] = sketch.get(keys[i].c_str(), keys[i].length());
+    const madoka::UInt64 plain_value =
+        plain_sketch.get(keys[i].c_str(), keys[i].length());
+    if (sketch.mode() == madoka::SKETCH_EXACT_MODE) {
+      MADOKA_THROW_IF(values[i] < freq);
+    }
+    if (i < NUM_HOT_KEYS) {
+      diff += (values[i] > freq) ? (values[i] - freq) : (freq - values[i]);
+      plain_diff += (plain_value > freq) ?
+          (plain_value - freq) : (freq - plain_value);
+    }
+  }
+  std::cout << "info: error of hot keys: " << diff << " (hot tier), "
+            << plain_diff << " (plain)" << std::endl;
+  if (sketch.mode() == madoka::SKETCH_EXACT_MODE) {
+    MADOKA_THROW_IF(diff > plain_diff);
+  }
+
+  // The hot tier is saved with the cells.
+  sketch.close();
+  sketch.open(PATH);
+  MADOKA_THROW_IF(sketch.num_hot_keys() != madoka::HOT_TIER_SIZE);
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    if (sketch.mode() == madoka::SKETCH_EXACT_MODE) {
+      MADOKA_THROW_IF(sketch.get(keys[i].c_str(), keys[i].length()) !=
+                      values[i]);
+    }
+  }
+
+  // merge(), shrink() and inner_product() take the hot keys of a sketch
+  // that they only read as if demoted.
+  madoka::Sketch demoted_sketch;
+  demoted_sketch.copy(sketch);
+  demoted_sketch.filter([](madoka::UInt64 x) { return x; });
+  MADOKA_THROW_IF(demoted_sketch.num_hot_keys() != 0);
+  madoka::Sketch merged_sketch;
+  merged_sketch.copy(plain_sketch);
+  merged_sketch.merge(sketch);
+  madoka::Sketch demoted_merged_sketch;
+  demoted_merged_sketch.copy(plain_sketch);
+  demoted_merged_sketch.merge(demoted_sketch);
+  const madoka::UInt64 shrunk_width =
+      ((sketch.width() % 2) == 0) ? (sketch.width() / 2) : 0;
+  madoka::Sketch shrunk_sketch;
+  shrunk_sketch.shrink(sketch, shrunk_width);
+  madoka::Sketch demoted_shrunk_sketch;
+  demoted_shrunk_sketch.shrink(demoted_sketch, shrunk_width);
+  MADOKA_THROW_IF(sketch.num_hot_keys() != madoka::HOT_TIER_SIZE);
+  if (sketch.mode() == madoka::SKETCH_EXACT_MODE) {
+    MADOKA_THROW_IF(sketch.inner_product(plain_sketch) !=
+                    demoted_sketch.inner_product(plain_sketch));
+    MADOKA_THROW_IF(sketch.inner_product(sketch) !=
+                    demoted_sketch.inner_product(demoted_sketch));
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      const char * const key = keys[i].c_str();
+      const std::size_t length = keys[i].length();
+      MADOKA_THROW_IF(merged_sketch.get(key, length) !=
+                      demoted_merged_sketch.get(key, length));
+      MADOKA_THROW_IF(shrunk_sketch.get(key, length) !=
+                      demoted_shrunk_sketch.get(key, length));
+    }
+  }
+
+  // merge() keeps the hot keys of this sketch and merges their counts.
+  merged_sketch.copy(sketch);
+  merged_sketch.merge(plain_sketch);
+  MADOKA_THROW_IF(merged_sketch.num_hot_keys() != madoka::HOT_TIER_SIZE);
+  if (sketch.mode() == madoka::SKETCH_EXACT_MODE) {
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      const madoka::UInt64 freq = std::min(original_freqs[i], max_value);
+      MADOKA_THROW_IF(merged_sketch.get(keys[i].c_str(), keys[i].length()) <
+                      std::min(freq * 2, max_value));
+    }
+  }
+
+  // filter() demotes the hot keys without losing their counts.
+  sketch.filter([](madoka::UInt64 x) { return x; });
+  MADOKA_THROW_IF(sketch.num_hot_keys() != 0);
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const madoka::UInt64 freq = std::min(original_freqs[i], max_value);
+    if (sketch.mode() == madoka::SKETCH_EXACT_MODE) {
+      MADOKA_THROW_IF(sketch.get(keys[i].c_str(), keys[i].length()) < freq);
+    }
+  }
+
+  sketch.clear();
+  MADOKA_THROW_IF(sketch.num_hot_keys() != 0);
+  sketch.close();
+
+  bool is_thrown = false;
+  try {
+    sketch.open(PATH, madoka::SKETCH_CONCURRENT);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+
+  MADOKA_THROW_IF(std::remove(PATH) == -1);
+}
+
+void top_k_test(madoka::UInt64 max_value, int flags,
+                const std::vector<std::string> &keys,
+                const std::vector<madoka::UInt64> &original_freqs,
+                const std::vector<std::size_t> &ids) {
+  const char PATH[] = "sketch-test.temp.1";
+  const std::size_t NUM_TOP_KEYS = 8;
+
+  std::remove(PATH);
+
+  madoka::Sketch sketch;
+  sketch.create(keys.size(), max_value, PATH, flags | madoka::SKETCH_TOP_K);
+  madoka::Sketch batch_sketch;
+  batch_sketch.create(keys.size(), max_value, NULL,
+                      flags | madoka::SKETCH_TOP_K);
+  MADOKA_THROW_IF(!(sketch.flags() & madoka::SKETCH_TOP_K));
+  MADOKA_THROW_IF(sketch.top_keys(NULL, 0) != 0);
+
+  std::vector<const void *> key_addrs;
+  std::vector<std::size_t> key_sizes;
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    key_addrs.push_back(keys[ids[i]].c_str());
+    key_sizes.push_back(keys[ids[i]].length());
+  }
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    sketch.inc(key_addrs[i], key_sizes[i]);
+  }
+  batch_sketch.inc_batch(&key_addrs[0], &key_sizes[0], ids.size(), NULL);
+
+  std::vector<madoka::TopKey> top_keys(madoka::TOP_K_SIZE);
+  const std::size_t num_top_keys =
+      sketch.top_keys(&top_keys[0], top_keys.size());
+  MADOKA_THROW_IF(num_top_keys != madoka::TOP_K_SIZE);
+  for (std::size_t i = 1; i < num_top_keys; ++i) {
+    MADOKA_THROW_IF(top_keys[i - 1].value < top_keys[i].value);
+  }
+  // Every tracked key is found again, so none of them is tracked twice.
+  std::set<std::string> distinct_keys;
+  for (std::size_t i = 0; i < num_top_keys; ++i) {
+    distinct_keys.insert(std::string(
+        static_cast<const char *>(top_keys[i].key_addr),
+        top_keys[i].key_size));
+  }
+  MADOKA_THROW_IF(distinct_keys.size() != num_top_keys);
+
+  // The most frequent keys come first and their values are not stale. A key
+  // out of them may get in only if collisions lift it over their values.
+  std::set<std::string> expected_keys(keys.begin(),
+                                      keys.begin() + NUM_TOP_KEYS);
+  for (std::size_t i = 0; i < NUM_TOP_KEYS; ++i) {
+    const std::string key(static_cast<const char *>(top_keys[i].key_addr),
+                          top_keys[i].key_size);
+    const std::size_t id = std::lower_bound(keys.begin(), keys.end(), key) -
+        keys.begin();
+    MADOKA_THROW_IF(id >= keys.size());
+    if (sketch.mode() == madoka::SKETCH_EXACT_MODE) {
+      MADOKA_THROW_IF(top_keys[i].value > sketch.get(key.c_str(),
+                                                     key.length()));
+      MADOKA_THROW_IF(top_keys[i].value <
+                      std::min(original_freqs[id], max_value));
+      MADOKA_THROW_IF((expected_keys.count(key) == 0) &&
+                      (top_keys[i].value < std::min(
+                           original_freqs[NUM_TOP_KEYS - 1], max_value)));
+    }
+  }
+
+  // inc_batch() tracks the same keys as inc().
+  std::vector<madoka::TopKey> batch_top_keys(madoka::TOP_K_SIZE);
+  MADOKA_THROW_IF(batch_sketch.top_keys(&batch_top_keys[0],
+                                        batch_top_keys.size()) !=
+                  num_top_keys);
+  if (sketch.mode() == madoka::SKETCH_EXACT_MODE) {
+    for (std::size_t i = 0; i < NUM_TOP_KEYS; ++i) {
+      MADOKA_THROW_IF(batch_top_keys[i].value != top_keys[i].value);
+    }
+  }
+
+  // The tracked keys are saved with the cells.
+  std::vector<std::string> saved_keys;
+  std::vector<madoka::UInt64> saved_values;
+  for (std::size_t i = 0; i < num_top_keys; ++i) {
+    saved_keys.push_back(std::string(
+        static_cast<const char *>(top_keys[i].key_addr),
+        top_keys[i].key_size));
+    saved_values.push_back(top_keys[i].value);
+  }
+  sketch.close();
+  sketch.open(PATH);
+  MADOKA_THROW_IF(sketch.top_keys(&top_keys[0], top_keys.size()) !=
+                  num_top_keys);
+  for (std::size_t i = 0; i < num_top_keys; ++i) {
+    MADOKA_THROW_IF(std::string(static_cast<const char *>(
+        top_keys[i].key_addr), top_keys[i].key_size) != saved_keys[i]);
+    MADOKA_THROW_IF(top_keys[i].value != saved_values[i]);
+  }
+
+  // filter() refreshes the tracked values.
+  sketch.filter([](madoka::UInt64 x) { return x / 2; });
+  MADOKA_THROW_IF(sketch.top_keys(&top_keys[0], top_keys.size()) !=
+                  num_top_keys);
+  if (sketch.mode() == madoka::SKETCH_EXACT_MODE) {
+    for (std::size_t i = 0; i < num_top_keys; ++i) {
+      MADOKA_THROW_IF(top_keys[i].value != sketch.get(top_keys[i].key_addr,
+                                                      top_keys[i].key_size));
+    }
+  }
+
+  sketch.clear();
+  MADOKA_THROW_IF(sketch.top_keys(&top_keys[0], top_keys.size()) != 0);
+  sketch.close();
+
+  bool is_thrown = false;
+  try {
+    sketch.open(PATH, madoka::SKETCH_CONCURRENT);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+
+  MADOKA_THROW_IF(std::remove(PATH) == -1);
+}
+
 void benchmark_sketch(const std::vector<std::string> &keys,
                       const std::vector<madoka::UInt64> &freqs,
                       const std::vector<std::size_t> &ids) {
@@ -427,34 +1295,221 @@ int main() try {
   MADOKA_THROW_IF(keys.size() != NUM_KEYS);
   MADOKA_THROW_IF(freqs.size() != NUM_KEYS);
 
-#define BASIC_TEST(max_value) \
+#define BASIC_TEST(max_value, flags) \
   ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
-              << "basic_test(" #max_value ")" << std::endl), \
-   basic_test(max_value, keys, freqs, ids))
+              << "basic_test(" #max_value ", " #flags ")" << std::endl), \
+   basic_test(max_value, flags, keys, freqs, ids))
+
+  BASIC_TEST(1, 0);
+  BASIC_TEST(3, 0);
+  BASIC_TEST(15, 0);
+  BASIC_TEST(255, 0);
+  BASIC_TEST(65535, 0);
+  BASIC_TEST(madoka::SKETCH_MAX_MAX_VALUE, 0);
+
+  BASIC_TEST(1, madoka::SKETCH_BLOCKED_LAYOUT);
+  BASIC_TEST(3, madoka::SKETCH_BLOCKED_LAYOUT);
+  BASIC_TEST(15, madoka::SKETCH_BLOCKED_LAYOUT);
+  BASIC_TEST(255, madoka::SKETCH_BLOCKED_LAYOUT);
+  BASIC_TEST(65535, madoka::SKETCH_BLOCKED_LAYOUT);
+  BASIC_TEST(madoka::SKETCH_MAX_MAX_VALUE, madoka::SKETCH_BLOCKED_LAYOUT);
+
+  BASIC_TEST(1, madoka::SKETCH_FAST_RANGE);
+  BASIC_TEST(15, madoka::SKETCH_FAST_RANGE);
+  BASIC_TEST(65535, madoka::SKETCH_FAST_RANGE);
+  BASIC_TEST(madoka::SKETCH_MAX_MAX_VALUE, madoka::SKETCH_FAST_RANGE);
 
-  BASIC_TEST(1);
-  BASIC_TEST(3);
-  BASIC_TEST(15);
-  BASIC_TEST(255);
-  BASIC_TEST(65535);
-  BASIC_TEST(madoka::SKETCH_MAX_MAX_VALUE);
+  BASIC_TEST(3, madoka::SKETCH_BLOCKED_LAYOUT | madoka::SKETCH_FAST_RANGE);
+  BASIC_TEST(255, madoka::SKETCH_BLOCKED_LAYOUT | madoka::SKETCH_FAST_RANGE);
+
+  BASIC_TEST(madoka::SKETCH_MAX_MAX_VALUE, madoka::SKETCH_COUNTER_RANDOM);
+  BASIC_TEST(madoka::SKETCH_MAX_MAX_VALUE,
+          madoka::SKETCH_BLOCKED_LAYOUT | madoka::SKETCH_COUNTER_RANDOM);
+  BASIC_TEST(madoka::SKETCH_MAX_MAX_VALUE, madoka::SKETCH_GEOMETRIC_ADD);
+
+  BASIC_TEST(15, madoka::SKETCH_HOT_TIER);
+  BASIC_TEST(255, madoka::SKETCH_BLOCKED_LAYOUT | madoka::SKETCH_HOT_TIER);
+  BASIC_TEST(madoka::SKETCH_MAX_MAX_VALUE, madoka::SKETCH_HOT_TIER);
 
 #undef BASIC_TEST
 
-#define EXTRA_TEST(max_value) \
+#define EXTRA_TEST(max_value, flags) \
   ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
-              << "extra_test(" #max_value ")" << std::endl), \
-   extra_test(max_value, keys, freqs, ids))
+              << "extra_test(" #max_value ", " #flags ")" << std::endl), \
+   extra_test(max_value, flags, keys, freqs, ids))
+
+  EXTRA_TEST(1, 0);
+  EXTRA_TEST(3, 0);
+  EXTRA_TEST(15, 0);
+  EXTRA_TEST(255, 0);
+  EXTRA_TEST(65535, 0);
+  EXTRA_TEST(madoka::SKETCH_MAX_MAX_VALUE, 0);
+
+  EXTRA_TEST(1, madoka::SKETCH_BLOCKED_LAYOUT);
+  EXTRA_TEST(3, madoka::SKETCH_BLOCKED_LAYOUT);
+  EXTRA_TEST(15, madoka::SKETCH_BLOCKED_LAYOUT);
+  EXTRA_TEST(255, madoka::SKETCH_BLOCKED_LAYOUT);
+  EXTRA_TEST(65535, madoka::SKETCH_BLOCKED_LAYOUT);
+  EXTRA_TEST(madoka::SKETCH_MAX_MAX_VALUE, madoka::SKETCH_BLOCKED_LAYOUT);
 
-  EXTRA_TEST(1);
-  EXTRA_TEST(3);
-  EXTRA_TEST(15);
-  EXTRA_TEST(255);
-  EXTRA_TEST(65535);
-  EXTRA_TEST(madoka::SKETCH_MAX_MAX_VALUE);
+  EXTRA_TEST(1, madoka::SKETCH_FAST_RANGE);
+  EXTRA_TEST(15, madoka::SKETCH_FAST_RANGE);
+  EXTRA_TEST(65535, madoka::SKETCH_FAST_RANGE);
+  EXTRA_TEST(madoka::SKETCH_MAX_MAX_VALUE, madoka::SKETCH_FAST_RANGE);
+
+  EXTRA_TEST(3, madoka::SKETCH_BLOCKED_LAYOUT | madoka::SKETCH_FAST_RANGE);
+  EXTRA_TEST(255, madoka::SKETCH_BLOCKED_LAYOUT | madoka::SKETCH_FAST_RANGE);
+
+  EXTRA_TEST(madoka::SKETCH_MAX_MAX_VALUE, madoka::SKETCH_COUNTER_RANDOM);
+  EXTRA_TEST(madoka::SKETCH_MAX_MAX_VALUE,
+          madoka::SKETCH_BLOCKED_LAYOUT | madoka::SKETCH_COUNTER_RANDOM);
+  EXTRA_TEST(madoka::SKETCH_MAX_MAX_VALUE, madoka::SKETCH_GEOMETRIC_ADD);
+
+  EXTRA_TEST(65535, madoka::SKETCH_HOT_TIER);
+  EXTRA_TEST(madoka::SKETCH_MAX_MAX_VALUE, madoka::SKETCH_HOT_TIER);
 
 #undef EXTRA_TEST
 
+#define DECODE_TEST(flags) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "decode_test(" #flags ")" << std::endl), \
+   decode_test(flags, keys, freqs, ids))
+
+  DECODE_TEST(0);
+  DECODE_TEST(madoka::SKETCH_BLOCKED_LAYOUT);
+  DECODE_TEST(madoka::SKETCH_CONCURRENT);
+  DECODE_TEST(madoka::SKETCH_COUNTER_RANDOM);
+
+#undef DECODE_TEST
+
+#define GEOMETRIC_ADD_TEST(flags) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "geometric_add_test(" #flags ")" << std::endl), \
+   geometric_add_test(flags))
+
+  GEOMETRIC_ADD_TEST(madoka::SKETCH_GEOMETRIC_ADD);
+  GEOMETRIC_ADD_TEST(madoka::SKETCH_GEOMETRIC_ADD |
+                     madoka::SKETCH_CONCURRENT);
+  GEOMETRIC_ADD_TEST(madoka::SKETCH_GEOMETRIC_ADD |
+                     madoka::SKETCH_COUNTER_RANDOM);
+
+#undef GEOMETRIC_ADD_TEST
+
+#define HOT_TIER_TEST(max_value, flags) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "hot_tier_test(" #max_value ", " #flags ")" << std::endl), \
+   hot_tier_test(max_value, flags, keys, freqs, ids))
+
+  HOT_TIER_TEST(65535, 0);
+  HOT_TIER_TEST(65535, madoka::SKETCH_BLOCKED_LAYOUT);
+  HOT_TIER_TEST(madoka::SKETCH_MAX_MAX_VALUE, 0);
+
+#undef HOT_TIER_TEST
+
+#define TOP_K_TEST(max_value, flags) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "top_k_test(" #max_value ", " #flags ")" << std::endl), \
+   top_k_test(max_value, flags, keys, freqs, ids))
+
+  TOP_K_TEST(65535, 0);
+  TOP_K_TEST(65535, madoka::SKETCH_BLOCKED_LAYOUT);
+  TOP_K_TEST(madoka::SKETCH_MAX_MAX_VALUE, madoka::SKETCH_HOT_TIER);
+
+#undef TOP_K_TEST
+
+#define FILTER_TEST(max_value, flags) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "filter_test(" #max_value ", " #flags ")" << std::endl), \
+   filter_test(max_value, flags, keys, freqs, ids))
+
+  FILTER_TEST(1, 0);
+  FILTER_TEST(3, 0);
+  FILTER_TEST(15, 0);
+  FILTER_TEST(255, 0);
+  FILTER_TEST(65535, 0);
+  FILTER_TEST(madoka::SKETCH_MAX_MAX_VALUE, 0);
+  FILTER_TEST(15, madoka::SKETCH_BLOCKED_LAYOUT);
+  FILTER_TEST(255, madoka::SKETCH_BLOCKED_LAYOUT);
+  FILTER_TEST(65535, madoka::SKETCH_HOT_TIER);
+
+#undef FILTER_TEST
+
+#define MERGE_TEST(max_value, flags) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "merge_test(" #max_value ", " #flags ")" << std::endl), \
+   merge_test(max_value, flags, keys, freqs, ids))
+
+  MERGE_TEST(1, 0);
+  MERGE_TEST(3, 0);
+  MERGE_TEST(15, 0);
+  MERGE_TEST(255, 0);
+  MERGE_TEST(65535, 0);
+  MERGE_TEST(madoka::SKETCH_MAX_MAX_VALUE, 0);
+  MERGE_TEST(15, madoka::SKETCH_BLOCKED_LAYOUT);
+  MERGE_TEST(65535, madoka::SKETCH_BLOCKED_LAYOUT);
+  MERGE_TEST(65535, madoka::SKETCH_HOT_TIER);
+
+#undef MERGE_TEST
+
+#define INNER_PRODUCTS_TEST(max_value, flags) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "inner_products_test(" #max_value ", " #flags ")" \
+              << std::endl), \
+   inner_products_test(max_value, flags, keys, freqs, ids))
+
+  INNER_PRODUCTS_TEST(1, 0);
+  INNER_PRODUCTS_TEST(15, 0);
+  INNER_PRODUCTS_TEST(65535, 0);
+  INNER_PRODUCTS_TEST(madoka::SKETCH_MAX_MAX_VALUE, 0);
+  INNER_PRODUCTS_TEST(255, madoka::SKETCH_BLOCKED_LAYOUT);
+  INNER_PRODUCTS_TEST(65535, madoka::SKETCH_HOT_TIER);
+
+#undef INNER_PRODUCTS_TEST
+
+  std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": "
+            << "format_test()" << std::endl;
+  format_test(keys, freqs);
+
+#define BLOCKED_SHRINK_TEST(flags) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "blocked_shrink_test(" #flags ")" << std::endl), \
+   blocked_shrink_test(flags, keys, freqs))
+
+  BLOCKED_SHRINK_TEST(madoka::SKETCH_BLOCKED_LAYOUT);
+  BLOCKED_SHRINK_TEST(madoka::SKETCH_BLOCKED_LAYOUT |
+                      madoka::SKETCH_FAST_RANGE);
+
+#undef BLOCKED_SHRINK_TEST
+
+  std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": "
+            << "layout_flags_test()" << std::endl;
+  layout_flags_test(keys, freqs);
+
+#define BATCH_TEST(max_value, flags) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "batch_test(" #max_value ", " #flags ")" << std::endl), \
+   batch_test(max_value, flags, keys, freqs, ids))
+
+  BATCH_TEST(1, 0);
+  BATCH_TEST(15, 0);
+  BATCH_TEST(65535, 0);
+  BATCH_TEST(madoka::SKETCH_MAX_MAX_VALUE, 0);
+
+  BATCH_TEST(3, madoka::SKETCH_BLOCKED_LAYOUT);
+  BATCH_TEST(255, madoka::SKETCH_BLOCKED_LAYOUT);
+  BATCH_TEST(madoka::SKETCH_MAX_MAX_VALUE, madoka::SKETCH_BLOCKED_LAYOUT);
+
+  BATCH_TEST(15, madoka::SKETCH_FAST_RANGE);
+  BATCH_TEST(255, madoka::SKETCH_BLOCKED_LAYOUT | madoka::SKETCH_FAST_RANGE);
+
+  BATCH_TEST(madoka::SKETCH_MAX_MAX_VALUE, madoka::SKETCH_COUNTER_RANDOM);
+
+  BATCH_TEST(255, madoka::SKETCH_HOT_TIER);
+  BATCH_TEST(madoka::SKETCH_MAX_MAX_VALUE,
+             madoka::SKETCH_BLOCKED_LAYOUT | madoka::SKETCH_HOT_TIER);
+
+#undef BATCH_TEST
+
   benchmark_sketch(keys, freqs, ids);
   benchmark_shrink(keys, freqs, ids);
 
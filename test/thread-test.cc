@@ -23,9 +23,12 @@
 // THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <random>
@@ -35,6 +38,7 @@
 #include <vector>
 
 #include <madoka/random.h>
+#include <madoka/sharded-sketch.h>
 #include <madoka/sketch.h>
 
 namespace {
@@ -137,7 +141,7 @@ void test_sketch() {
     std::cout << "info: " << std::setw(6) << width << ':' << std::flush;
     for (int num_threads = 1; num_threads <= 8; ++num_threads) {
       madoka::Sketch sketch;
-      sketch.create(width);
+      sketch.create(width, 0, NULL, madoka::SKETCH_CONCURRENT);
 
       std::vector<std::thread> threads;
       for (int i = 0; i < num_threads; ++i) {
@@ -164,6 +168,63 @@ void test_sketch() {
   }
 }
 
+void test_concurrent() {
+  std::vector<std::string> keys;
+  std::vector<madoka::UInt64> freqs;
+  std::vector<std::size_t> ids;
+  generate_keys(&keys, &freqs, &ids);
+
+  MADOKA_THROW_IF(keys.size() != NUM_KEYS);
+  MADOKA_THROW_IF(freqs.size() != NUM_KEYS);
+
+  std::cout << "info: Sketch (concurrent): Zipf distribution: "
+            << "#keys = " << keys.size()
+            << ", #queries = " << ids.size() << std::endl;
+
+  std::cout.setf(std::ios::fixed);
+
+  const madoka::UInt64 MAX_VALUES[] = { 15, 255, 65535, 0 };
+  for (std::size_t i = 0; i < (sizeof(MAX_VALUES) / sizeof(MAX_VALUES[0]));
+       ++i) {
+    std::cout << "info: " << std::setw(6) << MAX_VALUES[i] << ':'
+              << std::flush;
+    for (int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+      madoka::Sketch sketch;
+      sketch.create(keys.size(), MAX_VALUES[i], NULL,
+                    madoka::SKETCH_CONCURRENT);
+      MADOKA_THROW_IF(!(sketch.flags() & madoka::SKETCH_CONCURRENT));
+
+      const auto start = std::chrono::steady_clock::now();
+      std::vector<std::thread> threads;
+      for (int j = 0; j < num_threads; ++j) {
+        const auto begin = ids.begin() + (ids.size() / num_threads) * j;
+        const auto end = (j == (num_threads - 1)) ? ids.end() :
+            (ids.begin() + (ids.size() / num_threads) * (j + 1));
+        threads.push_back(std::thread(do_sketch_count, std::cref(keys),
+                                      begin, end, &sketch));
+      }
+      for (int j = 0; j < num_threads; ++j) {
+        threads[j].join();
+      }
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+
+      // Increments must not be lost in exact mode.
+      if (sketch.mode() == madoka::SKETCH_EXACT_MODE) {
+        for (std::size_t j = 0; j < keys.size(); ++j) {
+          const madoka::UInt64 freq =
+              sketch.get(keys[j].c_str(), keys[j].length());
+          MADOKA_THROW_IF(freq < std::min(freqs[j], sketch.max_value()));
+        }
+      }
+      std::cout << ' ' << std::setw(6) << std::setprecision(1)
+                << (ids.size() / elapsed.count() / 1000000.0) << "M/s"
+                << std::flush;
+    }
+    std::cout << std::endl;
+  }
+}
+
 void test_merge() {
   std::vector<std::string> keys;
   std::vector<madoka::UInt64> freqs;
@@ -183,48 +244,301 @@ void test_merge() {
        width <= keys.size() * 4; width *= 2) {
     std::cout << "info: " << std::setw(6) << width << ':' << std::flush;
     for (int num_threads = 1; num_threads <= 8; ++num_threads) {
-      madoka::Sketch * const sketches = new madoka::Sketch[num_threads];
-      for (int i = 0; i < num_threads; ++i) {
-        sketches[i].create(width);
-      }
+      madoka::ShardedSketch sketch;
+      sketch.create(num_threads, width);
 
       std::vector<std::thread> threads;
       for (int i = 0; i < num_threads; ++i) {
         const auto begin = ids.begin() + (ids.size() / num_threads) * i;
         const auto end = ids.begin() + (ids.size() / num_threads) * (i + 1);
         threads.push_back(std::thread(do_sketch_count, keys, begin, end,
-                                      &sketches[i]));
+                                      &sketch.shard(i)));
       }
 
       for (int i = 0; i < num_threads; ++i) {
         threads[i].join();
       }
 
-      for (int i = 1; i < num_threads; ++i) {
-        sketches[0].merge(sketches[i]);
-      }
+      sketch.sync();
 
       madoka::UInt64 diff = 0;
       for (std::size_t i = 0; i < keys.size(); ++i) {
         const madoka::UInt64 freq =
-            sketches[0].get(keys[i].c_str(), keys[i].length());
+            sketch.get(keys[i].c_str(), keys[i].length());
         diff += std::llabs(freq - freqs[i]);
       }
       std::cout << ' ' << std::setw(6) << std::setprecision(3)
                 << (100.0 * diff / ids.size()) << '%' << std::flush;
-
-      delete [] sketches;
     }
     std::cout << std::endl;
   }
 }
 
+void do_counter_random_count(const std::vector<std::string> &keys,
+                             const std::vector<std::size_t> &ids,
+                             std::vector<madoka::UInt64> *freqs) {
+  madoka::Sketch sketch;
+  sketch.create(keys.size() / 4, madoka::SKETCH_MAX_MAX_VALUE, NULL,
+                madoka::SKETCH_COUNTER_RANDOM);
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    sketch.inc(keys[ids[i]].c_str(), keys[ids[i]].length());
+  }
+  freqs->resize(keys.size());
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    (*freqs)[i] = sketch.get(keys[i].c_str(), keys[i].length());
+  }
+}
+
+void test_counter_random() {
+  std::vector<std::string> keys;
+  std::vector<madoka::UInt64> freqs;
+  std::vector<std::size_t> ids;
+  generate_keys(&keys, &freqs, &ids);
+
+  std::cout << "info: Sketch (counter random): Zipf distribution: "
+            << "#keys = " << keys.size()
+            << ", #queries = " << ids.size() << std::endl;
+
+  // Fresh threads start with the same counter, so the same sequence of
+  // operations must yield the same sketch.
+  std::vector<madoka::UInt64> results[2];
+  for (int i = 0; i < 2; ++i) {
+    std::thread thread(do_counter_random_count, std::cref(keys),
+                       std::cref(ids), &results[i]);
+    thread.join();
+  }
+  MADOKA_THROW_IF(results[0] != results[1]);
+
+  madoka::UInt64 diff = 0;
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    diff += std::llabs(results[0][i] - freqs[i]);
+  }
+  std::cout << "info: error: " << std::setprecision(3)
+            << (100.0 * diff / ids.size()) << '%' << std::endl;
+}
+
+// do_stream_count() increments each key `num_incs' times in turns.
+void do_stream_count(const std::vector<std::string> &keys,
+                     madoka::UInt64 num_incs, madoka::UInt64 stream_id,
+                     madoka::Sketch *sketch) {
+  madoka::Sketch::reset_thread_counter(0, stream_id);
+  for (madoka::UInt64 i = 0; i < num_incs; ++i) {
+    for (std::size_t j = 0; j < keys.size(); ++j) {
+      sketch->inc(keys[j].c_str(), keys[j].length());
+    }
+  }
+}
+
+void test_counter_random_streams() {
+  const std::size_t NUM_STREAM_KEYS = 256;
+  const madoka::UInt64 NUM_INCS = 1 << 14;
+  const int NUM_THREADS = 4;
+  std::vector<std::string> keys;
+  for (std::size_t i = 0; i < NUM_STREAM_KEYS; ++i) {
+    keys.push_back("key" + std::to_string(i));
+  }
+
+  // Threads of the same stream ID draw the same numbers for a key at the
+  // same counter. Whether a draw bumps a cell depends on its current value,
+  // so the estimates stay accurate either way, but distinct stream IDs keep
+  // the draws independent.
+  double deviations[2];
+  for (int i = 0; i < 2; ++i) {
+    madoka::Sketch sketch;
+    sketch.create(1 << 16, madoka::SKETCH_MAX_MAX_VALUE, NULL,
+                  madoka::SKETCH_CONCURRENT | madoka::SKETCH_COUNTER_RANDOM);
+    std::vector<std::thread> threads;
+    for (int j = 0; j < NUM_THREADS; ++j) {
+      threads.push_back(std::thread(do_stream_count, std::cref(keys),
+                                    NUM_INCS, (i == 0) ? 0 : j, &sketch));
+    }
+    for (int j = 0; j < NUM_THREADS; ++j) {
+      threads[j].join();
+    }
+    const double expected = static_cast<double>(NUM_INCS * NUM_THREADS);
+    double sum = 0.0;
+    for (std::size_t j = 0; j < keys.size(); ++j) {
+      const double ratio = static_cast<double>(
+          sketch.get(keys[j].c_str(), keys[j].length())) / expected;
+      sum += (ratio - 1.0) * (ratio - 1.0);
+    }
+    deviations[i] = std::sqrt(sum / keys.size());
+    std::cout << "info: counter random (" << ((i == 0) ? "same" : "distinct")
+              << " streams): deviation = " << std::setprecision(3)
+              << (100.0 * deviations[i]) << '%' << std::endl;
+    MADOKA_THROW_IF(deviations[i] > 0.02);
+  }
+}
+
+std::atomic<int> num_executor_calls(0);
+
+// run_on_threads() is an executor that runs tasks on 4 threads.
+void run_on_threads(madoka::SketchTask task, void *arg,
+                    madoka::UInt64 num_tasks) {
+  ++num_executor_calls;
+  std::atomic<madoka::UInt64> next_task_id(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.push_back(std::thread([&]() {
+      for (madoka::UInt64 task_id = next_task_id++; task_id < num_tasks;
+           task_id = next_task_id++) {
+        task(arg, task_id);
+      }
+    }));
+  }
+  for (std::size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+}
+
+std::vector<char> serialize_sketch(const madoka::Sketch &sketch) {
+  std::vector<char> buf(static_cast<std::size_t>(sketch.file_size()));
+  sketch.serialize(&buf[0], sketch.file_size());
+  return buf;
+}
+
+void test_executor() {
+  std::vector<std::string> keys;
+  std::vector<madoka::UInt64> freqs;
+  std::vector<std::size_t> ids;
+  generate_keys(&keys, &freqs, &ids);
+
+  std::cout << "info: Sketch (executor): Zipf distribution: "
+            << "#keys = " << keys.size()
+            << ", #queries = " << ids.size() << std::endl;
+
+  const madoka::UInt64 MAX_VALUES[] = { 1, 15, 255, 65535, 0 };
+  const int FLAGS[] = { 0, madoka::SKETCH_BLOCKED_LAYOUT };
+  for (std::size_t i = 0; i < (sizeof(MAX_VALUES) / sizeof(MAX_VALUES[0]));
+       ++i) {
+    for (std::size_t j = 0; j < (sizeof(FLAGS) / sizeof(FLAGS[0])); ++j) {
+      madoka::Sketch lhs;
+      lhs.create(keys.size(), MAX_VALUES[i], NULL, FLAGS[j]);
+      madoka::Sketch rhs;
+      rhs.create(keys.size(), MAX_VALUES[i], NULL, FLAGS[j]);
+      for (std::size_t k = 0; k < ids.size(); ++k) {
+        madoka::Sketch &sketch = (k & 1) ? lhs : rhs;
+        sketch.inc(keys[ids[k]].c_str(), keys[ids[k]].length());
+      }
+
+      // sketches[0] runs on the calling thread and sketches[1] runs with
+      // the executor, and they must give the same results.
+      madoka::Sketch sketches[2];
+      sketches[1].set_executor(run_on_threads);
+      MADOKA_THROW_IF(sketches[1].executor() != run_on_threads);
+      double inner_products[2];
+      std::vector<double> all_pairs[2];
+      std::vector<char> results[2][8];
+      for (int k = 0; k < 2; ++k) {
+        // Approx sketches draw random numbers on get(), so each run reads
+        // its own copies of the inputs.
+        madoka::Sketch src;
+        src.copy(lhs);
+        madoka::Sketch other;
+        other.copy(rhs);
+        madoka::Sketch &sketch = sketches[k];
+        sketch.copy(lhs);
+        sketch.merge(other);
+        results[k][0] = serialize_sketch(sketch);
+        sketch.merge(other, madoka::SKETCH_MAX_MERGE);
+        results[k][1] = serialize_sketch(sketch);
+        sketch.merge(other, madoka::SKETCH_MIN_MERGE,
+                     [](madoka::UInt64 x) { return x / 2; }, NULL);
+        results[k][2] = serialize_sketch(sketch);
+        sketch.filter(madoka::SKETCH_SHIFT_FILTER, 1);
+        results[k][3] = serialize_sketch(sketch);
+        sketch.filter([](madoka::UInt64 x) { return x * 3; });
+        results[k][4] = serialize_sketch(sketch);
+        inner_products[k] = sketch.inner_product(other);
+        src.set_executor(sketch.executor());
+        const madoka::Sketch *all_pairs_srcs[] = { &src, &other, &sketch };
+        all_pairs[k].resize(9);
+        madoka::Sketch::inner_products(all_pairs_srcs, 3, &all_pairs[k][0]);
+        sketch.shrink(src, ((src.width() % (src.block_width() * 4)) == 0) ?
+                      (src.width() / 4) : src.width());
+        results[k][5] = serialize_sketch(sketch);
+        sketch.shrink(src, 0, 0, [](madoka::UInt64 x) { return x / 3; });
+        results[k][6] = serialize_sketch(sketch);
+        sketch.clear();
+        results[k][7] = serialize_sketch(sketch);
+      }
+      MADOKA_THROW_IF(sketches[1].executor() != run_on_threads);
+      MADOKA_THROW_IF(inner_products[0] != inner_products[1]);
+      MADOKA_THROW_IF(all_pairs[0] != all_pairs[1]);
+      for (int k = 0; k < 8; ++k) {
+        MADOKA_THROW_IF(results[0][k] != results[1][k]);
+      }
+    }
+  }
+  MADOKA_THROW_IF(num_executor_calls == 0);
+
+  std::cout.setf(std::ios::fixed);
+
+  // An executor pays off for large tables.
+  madoka::Sketch lhs;
+  lhs.create(1 << 23, madoka::SKETCH_MAX_MAX_VALUE);
+  madoka::Sketch rhs;
+  rhs.create(1 << 23, madoka::SKETCH_MAX_MAX_VALUE);
+  for (int i = 0; i < 2; ++i) {
+    lhs.set_executor((i == 0) ? NULL : run_on_threads);
+    const auto start = std::chrono::steady_clock::now();
+    for (int j = 0; j < 10; ++j) {
+      lhs.merge(rhs, madoka::SKETCH_MAX_MERGE);
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "info: merge (" << ((i == 0) ? "serial" : "executor")
+              << "): " << std::setw(6) << std::setprecision(1)
+              << (10 * lhs.table_size() / elapsed.count() / (1 << 30))
+              << "GB/s" << std::endl;
+  }
+
+  // A sum of approx sketches decodes values with a generator per task.
+  for (int i = 0; i < 2; ++i) {
+    lhs.set_executor((i == 0) ? NULL : run_on_threads);
+    const auto start = std::chrono::steady_clock::now();
+    lhs.merge(rhs);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "info: sum merge (" << ((i == 0) ? "serial" : "executor")
+              << "): " << std::setw(6) << std::setprecision(1)
+              << (lhs.table_size() / elapsed.count() / (1 << 30))
+              << "GB/s" << std::endl;
+  }
+
+  // Exact sketches go through the kernel without decoding values.
+  madoka::Sketch exact_lhs;
+  exact_lhs.create(1 << 23, 65535);
+  madoka::Sketch exact_rhs;
+  exact_rhs.create(1 << 23, 65535);
+  double inner_products[2];
+  for (int i = 0; i < 2; ++i) {
+    exact_lhs.set_executor((i == 0) ? NULL : run_on_threads);
+    const auto start = std::chrono::steady_clock::now();
+    for (int j = 0; j < 10; ++j) {
+      inner_products[i] = exact_lhs.inner_product(exact_rhs);
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "info: inner_product ("
+              << ((i == 0) ? "serial" : "executor") << "): "
+              << std::setw(6) << std::setprecision(1)
+              << (20 * exact_lhs.table_size() / elapsed.count() / (1 << 30))
+              << "GB/s" << std::endl;
+  }
+  MADOKA_THROW_IF(inner_products[0] != inner_products[1]);
+}
+
 }  // namespace
 
 int main() try {
   test_approx();
   test_sketch();
+  test_concurrent();
   test_merge();
+  test_counter_random();
+  test_counter_random_streams();
+  test_executor();
 
   return 0;
 } catch (const madoka::Exception &ex) {
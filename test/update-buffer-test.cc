@@ -0,0 +1,162 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <madoka/update-buffer.h>
+
+namespace {
+
+const std::size_t NUM_KEYS = 1 << 12;
+
+void generate_keys(std::vector<std::string> *keys,
+                   std::vector<madoka::UInt64> *freqs,
+                   std::vector<std::size_t> *ids) {
+  std::mt19937 random_engine(1);
+  for (std::size_t i = 0; i < NUM_KEYS; ++i) {
+    keys->push_back(std::to_string(i));
+    const std::size_t freq = NUM_KEYS / (i + 1);
+    freqs->push_back(freq);
+    for (std::size_t j = 0; j < freq; ++j) {
+      ids->push_back(i);
+    }
+  }
+  std::shuffle(ids->begin(), ids->end(), random_engine);
+}
+
+void test_update_buffer(madoka::UInt64 max_value, madoka::UInt64 capacity,
+                        madoka::UInt64 max_updates,
+                        const std::vector<std::string> &keys,
+                        const std::vector<madoka::UInt64> &freqs,
+                        const std::vector<std::size_t> &ids) {
+  madoka::Sketch sketch;
+  sketch.create(NUM_KEYS, max_value);
+
+  madoka::UpdateBuffer buffer;
+  buffer.open(&sketch, capacity, max_updates);
+  MADOKA_THROW_IF(buffer.sketch() != &sketch);
+  MADOKA_THROW_IF(buffer.capacity() <
+                  std::max(capacity, madoka::UPDATE_BUFFER_MIN_CAPACITY));
+  MADOKA_THROW_IF(buffer.capacity() & (buffer.capacity() - 1));
+  MADOKA_THROW_IF(buffer.size() != 0);
+
+  const bool is_exact = sketch.mode() == madoka::SKETCH_EXACT_MODE;
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    const std::string &key = keys[ids[i]];
+    if (i % 2) {
+      buffer.inc(key.c_str(), key.length());
+    } else {
+      buffer.add(buffer.hash(key.c_str(), key.length()), 1);
+    }
+    MADOKA_THROW_IF(buffer.size() >= buffer.capacity());
+    MADOKA_THROW_IF(buffer.num_updates() >= buffer.max_updates());
+  }
+
+  // get() of a buffer includes pending counts.
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const madoka::UInt64 freq = std::min(freqs[i], max_value);
+    const madoka::UInt64 value = buffer.get(keys[i].c_str(), keys[i].length());
+    if (is_exact) {
+      MADOKA_THROW_IF(value < freq);
+    }
+  }
+
+  buffer.flush();
+  MADOKA_THROW_IF(buffer.size() != 0);
+  MADOKA_THROW_IF(buffer.num_updates() != 0);
+
+  madoka::UInt64 diff = 0;
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const madoka::UInt64 freq = std::min(freqs[i], sketch.max_value());
+    const madoka::UInt64 value = sketch.get(keys[i].c_str(), keys[i].length());
+    if (is_exact) {
+      MADOKA_THROW_IF(value < freq);
+    }
+    MADOKA_THROW_IF(buffer.get(keys[i].c_str(), keys[i].length()) != value);
+    diff += (value > freq) ? (value - freq) : (freq - value);
+  }
+  std::cout << "info: error = "
+            << (100.0 * diff / ids.size()) << '%' << std::endl;
+
+  // close() flushes pending counts.
+  const madoka::UInt64 value = sketch.get(keys[0].c_str(), keys[0].length());
+  buffer.add(keys[0].c_str(), keys[0].length(), 2);
+  MADOKA_THROW_IF(sketch.get(keys[0].c_str(), keys[0].length()) != value);
+  buffer.close();
+  MADOKA_THROW_IF(buffer.sketch() != NULL);
+  MADOKA_THROW_IF(sketch.get(keys[0].c_str(), keys[0].length()) <
+                  std::min(value + 2, sketch.max_value()));
+}
+
+}  // namespace
+
+int main() try {
+  std::vector<std::string> keys;
+  std::vector<madoka::UInt64> freqs;
+  std::vector<std::size_t> ids;
+  generate_keys(&keys, &freqs, &ids);
+
+#define TEST_UPDATE_BUFFER(max_value, capacity, max_updates) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "test_update_buffer(" #max_value ", " #capacity ", " \
+              << #max_updates ")" << std::endl), \
+   test_update_buffer(max_value, capacity, max_updates, keys, freqs, ids))
+
+  TEST_UPDATE_BUFFER(3, 0, 0);
+  TEST_UPDATE_BUFFER(255, 1, 0);
+  TEST_UPDATE_BUFFER(65535, 100, 0);
+  TEST_UPDATE_BUFFER(65535, 1 << 14, 1000);
+  TEST_UPDATE_BUFFER(madoka::SKETCH_MAX_MAX_VALUE, 0, 0);
+
+#undef TEST_UPDATE_BUFFER
+
+  bool is_thrown = false;
+  try {
+    madoka::UpdateBuffer buffer;
+    buffer.open(NULL);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+
+  is_thrown = false;
+  try {
+    madoka::Sketch sketch;
+    sketch.create(1000, 0, NULL, madoka::SKETCH_TOP_K);
+    madoka::UpdateBuffer buffer;
+    buffer.open(&sketch);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+
+  return 0;
+} catch (const madoka::Exception &ex) {
+  std::cerr << "error: " << ex.what() << std::endl;
+  return 1;
+}
@@ -26,6 +26,7 @@
 #include <iostream>
 
 #include <madoka/exception.h>
+#include <madoka/range.h>
 
 int main() try {
   int x = 100;
@@ -38,6 +39,44 @@ int main() try {
   MADOKA_THROW_IF(madoka::util::bit_scan_reverse(12) != 3);
   MADOKA_THROW_IF(madoka::util::bit_scan_reverse(0x1000) != 12);
   MADOKA_THROW_IF(madoka::util::bit_scan_reverse(-1) != 63);
+#ifndef _MSC_VER
+  static_assert(madoka::util::bit_scan_reverse(0x1000) == 12,
+                "bit_scan_reverse() must be a constant expression");
+#endif  // _MSC_VER
+
+  MADOKA_THROW_IF(madoka::util::mul_high(1ULL << 32, 1ULL << 32) != 1);
+  MADOKA_THROW_IF(madoka::util::mul_high(~0ULL, ~0ULL) != ~1ULL);
+  MADOKA_THROW_IF(madoka::util::mul_high(~0ULL, 12345) != 12344);
+  MADOKA_THROW_IF(madoka::util::mul_high(0x123456789ABCDEFULL, 100) != 0);
+
+  MADOKA_THROW_IF(madoka::util::pop_count(0) != 0);
+  MADOKA_THROW_IF(madoka::util::pop_count(12) != 2);
+  MADOKA_THROW_IF(madoka::util::pop_count(0x8000000000000001ULL) != 2);
+  MADOKA_THROW_IF(madoka::util::pop_count(~0ULL) != 64);
+
+  const madoka::UInt64 max_id = (1ULL << 48) - 1;
+  const madoka::UInt64 sizes[] = { 1, 3, 7, 64, 1000, 1ULL << 20, 999999937 };
+  madoka::UInt64 id = 0x9E3779B97F4A7C15ULL;
+  for (std::size_t i = 0; i < (sizeof(sizes) / sizeof(sizes[0])); ++i) {
+    madoka::Range range;
+    range.reset(sizes[i], 48, false);
+    MADOKA_THROW_IF(range.fast());
+    madoka::Range fast_range;
+    fast_range.reset(sizes[i], 48, true);
+    MADOKA_THROW_IF(!fast_range.fast());
+
+    MADOKA_THROW_IF(range(max_id) != (max_id % sizes[i]));
+    MADOKA_THROW_IF(fast_range(max_id) != (sizes[i] - 1));
+    MADOKA_THROW_IF(fast_range(0) != 0);
+    for (int j = 0; j < 1000; ++j) {
+      id ^= id << 13;
+      id ^= id >> 7;
+      id ^= id << 17;
+      const madoka::UInt64 x = id & max_id;
+      MADOKA_THROW_IF(range(x) != (x % sizes[i]));
+      MADOKA_THROW_IF(fast_range(x) >= sizes[i]);
+    }
+  }
 
   return 0;
 } catch (const madoka::Exception &ex) {
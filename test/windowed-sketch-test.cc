@@ -0,0 +1,192 @@
+// Copyright (c) 2012-2015, Susumu Yata
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+// THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <madoka/windowed-sketch.h>
+
+namespace {
+
+const std::size_t NUM_KEYS = 1 << 10;
+const std::size_t NUM_SLOTS = 4;
+const std::size_t NUM_UPDATES_PER_SLOT = 1 << 12;
+
+void test_windowed_sketch(madoka::UInt64 width, madoka::UInt64 max_value,
+                          int flags) {
+  madoka::WindowedSketch sketch;
+  sketch.create(NUM_SLOTS, width, max_value, flags, 123);
+  MADOKA_THROW_IF(sketch.num_slots() != NUM_SLOTS);
+  MADOKA_THROW_IF(sketch.time() != 0);
+  for (std::size_t i = 0; i < NUM_SLOTS; ++i) {
+    MADOKA_THROW_IF(sketch.slot(i).width() != sketch.width());
+    MADOKA_THROW_IF(sketch.slot(i).max_value() != sketch.max_value());
+    MADOKA_THROW_IF(sketch.slot(i).seed() != 123);
+  }
+
+  std::mt19937 random_engine(1);
+  std::vector<std::string> keys;
+  for (std::size_t i = 0; i < NUM_KEYS; ++i) {
+    keys.push_back(std::to_string(i));
+  }
+
+  // freqs[t][i] is the true count of the i-th key at time t.
+  const std::size_t NUM_TIMES = NUM_SLOTS * 3;
+  std::vector<std::vector<madoka::UInt64> > freqs(
+      NUM_TIMES, std::vector<madoka::UInt64>(NUM_KEYS, 0));
+  const bool is_exact = sketch.slot(0).mode() == madoka::SKETCH_EXACT_MODE;
+  for (std::size_t t = 0; t < NUM_TIMES; ++t) {
+    sketch.advance(t);
+    MADOKA_THROW_IF(sketch.time() != t);
+    for (std::size_t j = 0; j < NUM_UPDATES_PER_SLOT; ++j) {
+      const std::size_t id = std::min(random_engine() % NUM_KEYS,
+                                      random_engine() % NUM_KEYS);
+      sketch.inc(keys[id].c_str(), keys[id].length());
+      ++freqs[t][id];
+    }
+    MADOKA_THROW_IF(sketch.num_slot_updates() != NUM_UPDATES_PER_SLOT);
+
+    madoka::UInt64 diff = 0;
+    for (std::size_t i = 0; i < NUM_KEYS; ++i) {
+      madoka::UInt64 freq = 0;
+      for (std::size_t age = 0; (age < NUM_SLOTS) && (age <= t); ++age) {
+        freq += freqs[t - age][i];
+      }
+      freq = std::min(freq, sketch.max_value());
+      const madoka::UInt64 value = sketch.get(keys[i].c_str(),
+                                              keys[i].length());
+      if (is_exact) {
+        MADOKA_THROW_IF(value < freq);
+      }
+      diff += (value > freq) ? (value - freq) : (freq - value);
+    }
+    if (t == (NUM_TIMES - 1)) {
+      std::cout << "info: error = "
+                << (100.0 * diff / (NUM_UPDATES_PER_SLOT * NUM_SLOTS)) << '%'
+                << std::endl;
+    }
+  }
+
+  // flatten() merges the live slots into one sketch.
+  madoka::Sketch flat_sketch;
+  sketch.flatten(&flat_sketch);
+  MADOKA_THROW_IF(flat_sketch.width() != sketch.width());
+  MADOKA_THROW_IF(flat_sketch.seed() != sketch.seed());
+  if (is_exact) {
+    for (std::size_t i = 0; i < NUM_KEYS; ++i) {
+      MADOKA_THROW_IF(flat_sketch.get(keys[i].c_str(), keys[i].length()) <
+                      sketch.get(keys[i].c_str(), keys[i].length()));
+    }
+  }
+
+  // A rotation drops the oldest slot and starts with a clean slot.
+  const madoka::KeyHash key_hash = sketch.hash("key", 3);
+  madoka::UInt64 time = sketch.time();
+  for (std::size_t i = 0; i < NUM_SLOTS; ++i) {
+    sketch.rotate();
+    MADOKA_THROW_IF(sketch.time() != ++time);
+    MADOKA_THROW_IF(sketch.num_slot_updates() != 0);
+    sketch.add(key_hash, 1);
+  }
+  if (is_exact) {
+    MADOKA_THROW_IF(sketch.get(key_hash) != NUM_SLOTS);
+    for (std::size_t i = 0; i < NUM_KEYS; ++i) {
+      MADOKA_THROW_IF(sketch.get(keys[i].c_str(), keys[i].length()) != 0);
+    }
+  }
+  sketch.rotate();
+  if (is_exact) {
+    MADOKA_THROW_IF(sketch.get(key_hash) != (NUM_SLOTS - 1));
+  }
+
+  // advance() ignores the past and clears the window after a long gap.
+  sketch.advance(sketch.time() - 1);
+  MADOKA_THROW_IF(sketch.time() != time + 1);
+  sketch.advance(sketch.time() + NUM_SLOTS);
+  MADOKA_THROW_IF(sketch.time() != time + 1 + NUM_SLOTS);
+  MADOKA_THROW_IF(sketch.get(key_hash) != 0);
+
+  // A slot ends after max_slot_updates() updates.
+  sketch.set_max_slot_updates(3);
+  time = sketch.time();
+  for (std::size_t i = 0; i < 7; ++i) {
+    sketch.inc(key_hash);
+  }
+  MADOKA_THROW_IF(sketch.time() != time + 2);
+  MADOKA_THROW_IF(sketch.num_slot_updates() != 1);
+  if (is_exact) {
+    MADOKA_THROW_IF(sketch.slot(0).get(key_hash) != 1);
+    MADOKA_THROW_IF(sketch.get(key_hash) != std::min<madoka::UInt64>(
+        7, sketch.max_value()));
+  }
+
+  sketch.clear();
+  MADOKA_THROW_IF(sketch.get(key_hash) != 0);
+
+  sketch.close();
+  MADOKA_THROW_IF(sketch.num_slots() != 0);
+}
+
+}  // namespace
+
+int main() try {
+#define TEST_WINDOWED_SKETCH(width, max_value, flags) \
+  ((std::cout << "log: " << __FILE__ << ':' << __LINE__ << ": " \
+              << "test_windowed_sketch(" #width ", " #max_value ", " \
+              #flags ")" << std::endl), \
+   test_windowed_sketch(width, max_value, flags))
+
+  TEST_WINDOWED_SKETCH(NUM_KEYS, 255, 0);
+  TEST_WINDOWED_SKETCH(NUM_KEYS, 65535, madoka::SKETCH_BLOCKED_LAYOUT);
+  TEST_WINDOWED_SKETCH(NUM_KEYS, 0, madoka::SKETCH_HOT_TIER);
+  TEST_WINDOWED_SKETCH(1 << 20, 65535, 0);
+
+#undef TEST_WINDOWED_SKETCH
+
+  bool is_thrown = false;
+  try {
+    madoka::WindowedSketch sketch;
+    sketch.create(0);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+
+  is_thrown = false;
+  try {
+    madoka::WindowedSketch sketch;
+    sketch.create(2, 1000, 0, madoka::SKETCH_TOP_K);
+  } catch (const madoka::Exception &) {
+    is_thrown = true;
+  }
+  MADOKA_THROW_IF(!is_thrown);
+
+  return 0;
+} catch (const madoka::Exception &ex) {
+  std::cerr << "error: " << ex.what() << std::endl;
+  return 1;
+}